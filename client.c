@@ -16,6 +16,8 @@ struct client_options client_options = {
     .copt_interactive = 0,
     .copt_host = HOST,
     .copt_loaddir = LOADDIR,
+    .copt_serverload = 0,
+    .copt_script = 0,
 };
 
 const char *short_options = "h";
@@ -26,6 +28,8 @@ const struct option long_options[] = {
     {"host", required_argument, NULL, 0},
     {"loaddir", required_argument,  NULL, 0},
     {"interactive", no_argument, &client_options.copt_interactive, 1},
+    {"serverload", no_argument, &client_options.copt_serverload, 1},
+    {"script", no_argument, &client_options.copt_script, 1},
     {NULL, 0, NULL, 0}
 };
 
@@ -59,6 +63,9 @@ parse_options(int argc, char **argv)
             printf("--host H         [default=%s]\n", HOST);
             printf("--loaddir dir    [default=%s]\n", LOADDIR);
             printf("--interactive\n");
+            printf("--serverload     have the server open load files itself\n");
+            printf("--script         send all of stdin at once, so that the server\n"
+                   "                 can run independent queries at the same time\n");
             return 1;
         }
     }
@@ -5,19 +5,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <db/common/dberror.h>
+#include <db/common/threadpool.h>
 #include <db/common/try.h>
 #include <db/server/server.h>
 
 #define PORT 5000
 #define BACKLOG 16
 #define NTHREADS 16
+#define IODEPTH 32
 #define DBDIR "db"
+#define AFFINITY TP_AFFINITY_NONE
+
+// names of the --affinity choices, by enum threadpool_affinity
+const char *affinity_names[] = { "none", "node", "core" };
 
 struct server_options server_options = {
     .sopt_port = PORT,
     .sopt_backlog = BACKLOG,
     .sopt_nthreads = NTHREADS,
+    .sopt_iodepth = IODEPTH,
+    .sopt_affinity = AFFINITY,
     .sopt_dbdir = DBDIR,
+    .sopt_loaddir = "",
 };
 
 const char *short_options = "h";
@@ -27,7 +36,10 @@ const struct option long_options[] = {
     {"port", required_argument, &server_options.sopt_port, 0},
     {"backlog", required_argument, &server_options.sopt_backlog, 0},
     {"nthreads", required_argument,  &server_options.sopt_nthreads, 0},
+    {"iodepth", required_argument,  &server_options.sopt_iodepth, 0},
     {"dbdir", required_argument, NULL, 0},
+    {"affinity", required_argument, NULL, 0},
+    {"loaddir", required_argument, NULL, 0},
     {NULL, 0, NULL, 0}
 };
 
@@ -47,6 +59,22 @@ parse_options(int argc, char **argv)
             if (optarg) {
                 if (strcmp(long_options[option_index].name, "dbdir") == 0) {
                     strcpy(server_options.sopt_dbdir, optarg);
+                } else if (strcmp(long_options[option_index].name, "loaddir") == 0) {
+                    if (strlen(optarg) >= sizeof(server_options.sopt_loaddir)) {
+                        printf("load directory %s is too long\n", optarg);
+                        return 1;
+                    }
+                    strcpy(server_options.sopt_loaddir, optarg);
+                } else if (strcmp(long_options[option_index].name, "affinity") == 0) {
+                    int a = TP_AFFINITY_CORE;
+                    while (a >= 0 && strcmp(affinity_names[a], optarg) != 0) {
+                        a--;
+                    }
+                    if (a < 0) {
+                        printf("unknown affinity %s\n", optarg);
+                        return 1;
+                    }
+                    server_options.sopt_affinity = a;
                 } else {
                     *(long_options[option_index].flag) = atoi(optarg);
                 }
@@ -58,13 +86,21 @@ parse_options(int argc, char **argv)
             printf("--port P         [default=%d]\n", PORT);
             printf("--backlog B      [default=%d]\n", BACKLOG);
             printf("--nthreads T     [default=%d]\n", NTHREADS);
+            printf("--iodepth D      [default=%d]\n", IODEPTH);
             printf("--dbdir dir      [default=%s]\n", DBDIR);
+            printf("--affinity A     none, node or core [default=%s]\n",
+                   affinity_names[AFFINITY]);
+            printf("--loaddir dir    let clients load files under dir from the server's\n"
+                   "                 filesystem [default=none]\n");
             return 1;
         }
     }
-    printf("port: %d, backlog: %d, nthreads: %d, dbdir: %s\n",
+    printf("port: %d, backlog: %d, nthreads: %d, iodepth: %d, affinity: %s, dbdir: %s, "
+           "loaddir: %s\n",
             server_options.sopt_port, server_options.sopt_backlog,
-            server_options.sopt_nthreads, server_options.sopt_dbdir);
+            server_options.sopt_nthreads, server_options.sopt_iodepth,
+            affinity_names[server_options.sopt_affinity], server_options.sopt_dbdir,
+            server_options.sopt_loaddir[0] ? server_options.sopt_loaddir : "none");
     return 0;
 }
 
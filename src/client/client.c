@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,11 +24,29 @@
 #include <db/common/operators.h>
 #include <db/common/parser.h>
 #include <db/common/io.h>
+#include <db/common/wire.h>
 #include <db/client/client.h>
 
+// Most messages we have in flight at once
+#define CLIENT_MAX_FRAMES 64
+
+// A message of ops we sent: how many of them are still unanswered, and
+// its size
+struct client_frame {
+    unsigned cf_nops;
+    size_t cf_len;
+};
+
 struct client {
     struct client_options c_opt;
     int c_sockfd;
+    unsigned c_inflight; // ops sent that have not been answered yet
+    // ring of the messages in flight, oldest first
+    struct client_frame c_frames[CLIENT_MAX_FRAMES];
+    unsigned c_firstframe;
+    unsigned c_nframes;
+    size_t c_inflight_len; // bytes of the messages in flight
+    unsigned c_line; // lines of stdin read so far, for parse errors
 //    volatile bool c_keep_running;
 };
 
@@ -41,6 +60,17 @@ sigint_handler(int sig)
 
 #define BUFSIZE 4096
 
+// Most ops we send in one message
+#define CLIENT_MAX_OPS 256
+
+// Most bytes of ops we send before waiting for replies. The server reads a
+// message before it replies to it, so as long as what we have sent fits in
+// the socket buffers, neither side can block the other with a full socket.
+#define CLIENT_WINDOW (64 << 10)
+
+// How much of stdin we read at once in batch mode
+#define CLIENT_READSIZE (64 << 10)
+
 static
 int
 client_handle_fetch(int sockfd, struct rpc_header *msg)
@@ -127,6 +157,24 @@ client_handle_tuple(int sockfd, struct rpc_header *msg)
     return result;
 }
 
+// An op we sent has been answered
+static
+void
+client_op_done(struct client *c)
+{
+    if (c->c_inflight == 0) {
+        return;
+    }
+    c->c_inflight--;
+    assert(c->c_nframes > 0);
+    struct client_frame *frame = &c->c_frames[c->c_firstframe];
+    if (--frame->cf_nops == 0) {
+        c->c_inflight_len -= frame->cf_len;
+        c->c_firstframe = (c->c_firstframe + 1) % CLIENT_MAX_FRAMES;
+        c->c_nframes--;
+    }
+}
+
 static
 int
 parse_sockfd(struct client *c)
@@ -141,9 +189,11 @@ parse_sockfd(struct client *c)
         TRY(result, rpc_read_header(sockfd, &msg), done);
         switch (msg.rpc_type) {
         case RPC_OK:
+            client_op_done(c);
             result = 0;
             goto done;
         case RPC_ERROR:
+            client_op_done(c);
             result = client_handle_error(sockfd, &msg);
             goto done;
         case RPC_TERMINATE:
@@ -180,28 +230,111 @@ parse_sockfd(struct client *c)
     return result;
 }
 
+// Sends ops [first, first + n) in one message, once there is room in the
+// window. Replies that arrive while we wait are handled as usual.
 static
 int
-parse_stdin_string(struct client *c, char *s)
+client_send_ops(struct client *c, struct oparray *ops, unsigned first, unsigned n)
 {
     int result;
-    struct oparray *ops;
-    int sockfd = c->c_sockfd;
-    TRYNULL(result, DBEPARSE, ops, parse_query(s), done);
+    size_t len = 0;
+    for (unsigned i = first; i < first + n; i++) {
+        len += wire_op_size(oparray_get(ops, i));
+    }
+    while (c->c_inflight > 0 && (c->c_nframes == CLIENT_MAX_FRAMES
+                                 || c->c_inflight_len + len > CLIENT_WINDOW)) {
+        TRY(result, parse_sockfd(c), done);
+    }
+    if (c->c_opt.copt_script) {
+        TRY(result, rpc_write_script(c->c_sockfd, ops, first, n), done);
+    } else {
+        TRY(result, rpc_write_ops(c->c_sockfd, ops, first, n), done);
+    }
+    unsigned last = (c->c_firstframe + c->c_nframes) % CLIENT_MAX_FRAMES;
+    c->c_frames[last].cf_nops = n;
+    c->c_frames[last].cf_len = len;
+    c->c_nframes++;
+    c->c_inflight += n;
+    c->c_inflight_len += len;
+
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
 
+// Sends the ops to the server without waiting for their replies, in as few
+// messages as we can. A script is only split at loads.
+static
+int
+client_send(struct client *c, struct oparray *ops)
+{
+    int result;
+    int sockfd = c->c_sockfd;
+    unsigned maxops = c->c_opt.copt_script ? UINT_MAX : CLIENT_MAX_OPS;
+    unsigned first = 0;
     for (unsigned i = 0; i < oparray_num(ops); i++) {
         struct op *op = oparray_get(ops, i);
-        TRY(result, rpc_write_query(sockfd, op), cleanup_ops);
+        bool last = (i + 1 == oparray_num(ops));
         if (op->op_type == OP_LOAD) {
+            // A load goes in a message of its own, because its file has to
+            // follow it. Everything before it must have been answered, or
+            // the server could be stuck writing replies that we would not
+            // read while we write the file.
+            if (i > first) {
+                TRY(result, client_send_ops(c, ops, first, i - first), done);
+            }
+            while (c->c_inflight > 0) {
+                TRY(result, parse_sockfd(c), done);
+            }
+            TRY(result, client_send_ops(c, ops, i, 1), done);
+            first = i + 1;
             char loadfilebuf[128];
             sprintf(loadfilebuf, "%s/%s", c->c_opt.copt_loaddir,
                     op->op_load.op_load_file);
+            if (c->c_opt.copt_serverload) {
+                // the server shares our filesystem, so it only needs to
+                // know where the file is
+                char pathbuf[PATH_MAX];
+                char *path = realpath(loadfilebuf, pathbuf);
+                TRY(result, rpc_write_file_path(sockfd, path ? path : loadfilebuf),
+                    done);
+                continue;
+            }
             strcpy(op->op_load.op_load_file, loadfilebuf);
-            TRY(result, rpc_write_file(sockfd, op), cleanup_ops);
+            TRY(result, rpc_write_file(sockfd, op), done);
+            continue;
+        }
+        if (last || i + 1 - first == maxops) {
+            TRY(result, client_send_ops(c, ops, first, i + 1 - first), done);
+            first = i + 1;
         }
     }
     // success
     result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+static
+int
+parse_stdin_string(struct client *c, char *s)
+{
+    int result;
+    struct oparray *ops;
+    struct parse_error err = { 0, 0, "out of memory" };
+    ops = parse_query_err(s, &err);
+    if (ops == NULL) {
+        fprintf(stderr, "parse error at line %u, column %u: %s\n",
+                err.pe_line + 1, err.pe_pos + 1, err.pe_msg);
+        result = DBEPARSE;
+        goto done;
+    }
+    TRY(result, client_send(c, ops), cleanup_ops);
+
+    // success
+    result = 0;
   cleanup_ops:
     parse_cleanup_ops(ops);
   done:
@@ -253,7 +386,10 @@ client_interactive(struct client *c)
                 goto done;
             }
         }
-        TRY(result, parse_sockfd(c), done);
+        // every op we sent gets an OK or an ERROR
+        while (c->c_inflight > 0) {
+            TRY(result, parse_sockfd(c), done);
+        }
     }
     result = 0;
     goto done;
@@ -261,37 +397,54 @@ client_interactive(struct client *c)
     return result;
 }
 
+// Parses the complete lines in buf[0, len) and sends them. A line that
+// does not parse is reported and skipped. Returns how much of buf was used,
+// which leaves out a partial last line unless eof is set.
 static
 int
-parse_stdin_batch(struct client *c)
+parse_stdin_lines(struct client *c, char *buf, size_t len, bool eof, size_t *retused)
 {
     int result;
-    char buf[TUPLELEN];
-    bzero(buf, TUPLELEN);
-    result = 0;
-    unsigned ix = 0;
-    while (1) {
-        result = read(STDIN_FILENO, buf + ix, 1);
-        if (result == -1 || result == 0) {
-            result = DBEIOCHECKERRNO;
-            goto done;
-        }
-        ix++;
-        if (buf[ix-1] == '\n' || buf[ix-1] == '\0') {
+    struct oparray *ops;
+    TRYNULL(result, DBENOMEM, ops, oparray_create(), done);
+    size_t start = 0;
+    while (start < len) {
+        char *nl = memchr(buf + start, '\n', len - start);
+        if (nl == NULL && !eof) {
             break;
         }
+        size_t end = (nl == NULL) ? len : (size_t) (nl - buf);
+        buf[end] = '\0';
+        struct parse_error err = { 0, 0, "out of memory" };
+        struct op *op = parse_line_err(buf + start, &err);
+        start = end + 1;
+        c->c_line++;
+        if (op == NULL) {
+            fprintf(stderr, "parse error at line %u, column %u: %s\n",
+                    c->c_line, err.pe_pos + 1, err.pe_msg);
+            continue;
+        }
+        result = oparray_add(ops, op, NULL);
+        if (result) {
+            free(op);
+            goto cleanup_ops;
+        }
     }
-    TRY(result, parse_stdin_string(c, buf), done);
+    TRY(result, client_send(c, ops), cleanup_ops);
 
+    // success
     result = 0;
-    goto done;
+    *retused = (start < len) ? start : len;
+    goto cleanup_ops;
+  cleanup_ops:
+    parse_cleanup_ops(ops);
   done:
-    if (!dberror_client_is_fatal(result)) {
-        result = DBSUCCESS;
-    }
     return result;
 }
 
+// Reads stdin a block at a time and sends every line in it, without
+// waiting for the replies to earlier lines. Replies are read in between,
+// and come back in the order we sent the ops, so they are printed in order.
 static
 int
 client_batch(struct client *c)
@@ -300,6 +453,11 @@ client_batch(struct client *c)
     int sockfd = c->c_sockfd;
     bool read_stdin = true;
     bool read_socket = true;
+    char *buf;
+    size_t bufmax = CLIENT_READSIZE;
+    // one more byte to end the last line
+    TRYNULL(result, DBENOMEM, buf, malloc(bufmax + 1), done);
+    size_t buflen = 0;
     while (errno != EINTR && (read_stdin || read_socket)) {
         fd_set readfds;
         FD_ZERO(&readfds);
@@ -313,30 +471,94 @@ client_batch(struct client *c)
         if (result == -1) {
             result = DBESELECT;
             DBLOG(result);
-            goto done;
+            goto cleanup_buf;
+        }
+
+        // if we get something from the socket, parse it and write it to
+        // stdout. This comes first, because sending lines below may read
+        // replies while it waits for room in the window, after which the
+        // socket need not be readable any more.
+        if (read_socket && FD_ISSET(sockfd, &readfds)) {
+            result = parse_sockfd(c);
+            if (result) {
+                read_socket = false;
+            }
         }
 
         // if we get something from stdin, parse it and write it to the socket
         if (read_stdin && FD_ISSET(STDIN_FILENO, &readfds)) {
-            result = parse_stdin_batch(c);
-            if (result) {
+            ssize_t n = read(STDIN_FILENO, buf + buflen, bufmax - buflen);
+            bool eof = (n <= 0);
+            buflen += (n > 0) ? n : 0;
+            size_t used = 0;
+            result = parse_stdin_lines(c, buf, buflen, eof, &used);
+            if (result == 0 && used == 0 && buflen == bufmax) {
+                // a line longer than the buffer, which has to grow to hold
+                // the rest of it
+                char *newbuf;
+                TRYNULL(result, DBENOMEM, newbuf, realloc(buf, 2 * bufmax + 1),
+                        cleanup_buf);
+                buf = newbuf;
+                bufmax *= 2;
+            }
+            memmove(buf, buf + used, buflen - used);
+            buflen -= used;
+            if (eof || (result && dberror_client_is_fatal(result))) {
                 // if stdin is done, send a connection termination message
                 // to the server
                 read_stdin = false;
                 (void) rpc_write_terminate(sockfd);
             }
         }
+    }
+    result = 0;
+    goto cleanup_buf;
+  cleanup_buf:
+    free(buf);
+  done:
+    return result;
+}
 
-        // if we get something from the socket, parse it and write it to stdout
-        if (read_socket && FD_ISSET(sockfd, &readfds)) {
-            result = parse_sockfd(c);
-            if (result) {
-                read_socket = false;
-            }
+// Reads all of stdin and sends it as one script, then prints the replies
+static
+int
+client_script(struct client *c)
+{
+    int result;
+    size_t max = CLIENT_READSIZE;
+    size_t len = 0;
+    char *buf;
+    TRYNULL(result, DBENOMEM, buf, malloc(max + 1), done);
+    while (1) {
+        if (len == max) {
+            char *newbuf;
+            TRYNULL(result, DBENOMEM, newbuf, realloc(buf, 2 * max + 1), cleanup_buf);
+            buf = newbuf;
+            max *= 2;
         }
+        ssize_t n = read(STDIN_FILENO, buf + len, max - len);
+        if (n == -1) {
+            result = DBEIOCHECKERRNO;
+            DBLOG(result);
+            goto cleanup_buf;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    size_t used;
+    TRY(result, parse_stdin_lines(c, buf, len, true, &used), cleanup_buf);
+    (void) rpc_write_terminate(c->c_sockfd);
+    while (parse_sockfd(c) == 0) {
+        continue;
     }
+
+    // success
     result = 0;
-    goto done;
+    goto cleanup_buf;
+  cleanup_buf:
+    free(buf);
   done:
     return result;
 }
@@ -350,6 +572,11 @@ client_create(struct client_options *options)
     struct client *c = NULL;
     TRYNULL(result, DBENOMEM, c, malloc(sizeof(struct client)), done);
     memcpy(&c->c_opt, options, sizeof(struct client_options));
+    c->c_inflight = 0;
+    c->c_firstframe = 0;
+    c->c_nframes = 0;
+    c->c_inflight_len = 0;
+    c->c_line = 0;
 
     int sockfd;
     struct addrinfo hints, *servinfo;
@@ -417,6 +644,8 @@ client_start(struct client *c)
     int result;
     if (c->c_opt.copt_interactive) {
         result = client_interactive(c);
+    } else if (c->c_opt.copt_script) {
+        result = client_script(c);
     } else {
         result = client_batch(c);
     }
@@ -6,6 +6,8 @@ struct client_options {
     char copt_host[128];
     char copt_loaddir[128];
     int copt_interactive;
+    int copt_serverload; // send load paths instead of file contents
+    int copt_script; // send all of stdin at once, for the server to schedule
 };
 
 struct client;
@@ -32,6 +32,7 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
@@ -58,6 +59,24 @@ struct bitmap {
     WORD_TYPE *v;
 };
 
+/* Mark any leftover bits at the end in use */
+static
+void
+bitmap_mark_padding(struct bitmap *b) {
+    unsigned words = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+    if (words > b->nbits / BITS_PER_WORD) {
+        unsigned j, ix = words - 1;
+        unsigned overbits = b->nbits - ix * BITS_PER_WORD;
+
+        assert(b->nbits / BITS_PER_WORD == words - 1);
+        assert(overbits > 0 && overbits < BITS_PER_WORD);
+
+        for (j = overbits; j < BITS_PER_WORD; j++) {
+            b->v[ix] |= ((WORD_TYPE) 1 << j);
+        }
+    }
+}
+
 struct bitmap *
 bitmap_create(unsigned nbits) {
     struct bitmap *b;
@@ -77,18 +96,7 @@ bitmap_create(unsigned nbits) {
     bzero(b->v, words * sizeof(WORD_TYPE));
     b->nbits = nbits;
 
-    /* Mark any leftover bits at the end in use */
-    if (words > nbits / BITS_PER_WORD) {
-        unsigned j, ix = words - 1;
-        unsigned overbits = nbits - ix * BITS_PER_WORD;
-
-        assert(nbits / BITS_PER_WORD == words - 1);
-        assert(overbits > 0 && overbits < BITS_PER_WORD);
-
-        for (j = overbits; j < BITS_PER_WORD; j++) {
-            b->v[ix] |= ((WORD_TYPE) 1 << j);
-        }
-    }
+    bitmap_mark_padding(b);
 
     return b;
 }
@@ -187,3 +195,127 @@ void bitmap_destroy(struct bitmap *b) {
     free(b->v);
     free(b);
 }
+
+/*
+ * The bulk operations below work on 64-bit chunks of the byte array.
+ * Bit j of byte i is bit (8*i + j) of the chunk, which is the natural
+ * layout on little-endian machines; swap the bytes on big-endian ones.
+ * Bits at or past nbits are masked off, since bitmap_create marks the
+ * leftover bits in the last byte as in use.
+ */
+#define CHUNK_BITS 64
+
+static
+inline
+uint64_t bitmap_chunk(struct bitmap *b, unsigned chunk) {
+    unsigned nbytes = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+    unsigned offset = chunk * (CHUNK_BITS / BITS_PER_WORD);
+    uint64_t bits = 0;
+
+    assert(offset < nbytes);
+    if (nbytes - offset >= sizeof(uint64_t)) {
+        memcpy(&bits, &b->v[offset], sizeof(uint64_t));
+    } else {
+        memcpy(&bits, &b->v[offset], nbytes - offset);
+    }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = __builtin_bswap64(bits);
+#endif
+    unsigned validbits = b->nbits - chunk * CHUNK_BITS;
+    if (validbits < CHUNK_BITS) {
+        bits &= (((uint64_t) 1) << validbits) - 1;
+    }
+    return bits;
+}
+
+unsigned
+bitmap_count(struct bitmap *b) {
+    unsigned nchunks = DIVROUNDUP(b->nbits, CHUNK_BITS);
+    unsigned count = 0;
+    for (unsigned chunk = 0; chunk < nchunks; chunk++) {
+        count += __builtin_popcountll(bitmap_chunk(b, chunk));
+    }
+    return count;
+}
+
+bool
+bitmap_next_set(struct bitmap *b, unsigned start, unsigned *index) {
+    unsigned nchunks = DIVROUNDUP(b->nbits, CHUNK_BITS);
+    for (unsigned chunk = start / CHUNK_BITS; chunk < nchunks; chunk++) {
+        uint64_t bits = bitmap_chunk(b, chunk);
+        if (chunk == start / CHUNK_BITS) {
+            bits &= ~((uint64_t) 0) << (start % CHUNK_BITS);
+        }
+        if (bits != 0) {
+            *index = chunk * CHUNK_BITS + __builtin_ctzll(bits);
+            return true;
+        }
+    }
+    *index = b->nbits;
+    return false;
+}
+
+unsigned
+bitmap_extract(struct bitmap *b, unsigned *start, unsigned *buf, unsigned n) {
+    unsigned nchunks = DIVROUNDUP(b->nbits, CHUNK_BITS);
+    unsigned count = 0;
+    unsigned pos = *start;
+    while (count < n && pos < b->nbits) {
+        unsigned chunk = pos / CHUNK_BITS;
+        uint64_t bits = bitmap_chunk(b, chunk);
+        bits &= ~((uint64_t) 0) << (pos % CHUNK_BITS);
+        while (bits != 0 && count < n) {
+            buf[count++] = chunk * CHUNK_BITS + __builtin_ctzll(bits);
+            bits &= bits - 1; // clear the lowest set bit
+        }
+        if (bits != 0) {
+            // buf is full, resume from the next set bit next time
+            pos = chunk * CHUNK_BITS + __builtin_ctzll(bits);
+            break;
+        }
+        pos = (chunk + 1 < nchunks) ? (chunk + 1) * CHUNK_BITS : b->nbits;
+    }
+    *start = pos;
+    return count;
+}
+
+struct bitmap *
+bitmap_copy(struct bitmap *b) {
+    struct bitmap *copy = bitmap_create(b->nbits);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy->v, b->v, DIVROUNDUP(b->nbits, BITS_PER_WORD));
+    return copy;
+}
+
+/*
+ * In-place set operations on bitmaps of the same size. The loops are
+ * simple enough for the compiler to vectorize.
+ */
+void
+bitmap_and(struct bitmap *dst, struct bitmap *src) {
+    assert(dst->nbits == src->nbits);
+    unsigned words = DIVROUNDUP(dst->nbits, BITS_PER_WORD);
+    for (unsigned i = 0; i < words; i++) {
+        dst->v[i] &= src->v[i];
+    }
+}
+
+void
+bitmap_or(struct bitmap *dst, struct bitmap *src) {
+    assert(dst->nbits == src->nbits);
+    unsigned words = DIVROUNDUP(dst->nbits, BITS_PER_WORD);
+    for (unsigned i = 0; i < words; i++) {
+        dst->v[i] |= src->v[i];
+    }
+}
+
+void
+bitmap_invert(struct bitmap *b) {
+    unsigned words = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+    for (unsigned i = 0; i < words; i++) {
+        b->v[i] = ~b->v[i];
+    }
+    bitmap_mark_padding(b);
+}
@@ -1,105 +1,437 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <db/common/csv.h>
-#include <db/common/array.h>
 #include <db/common/dberror.h>
 #include <db/common/try.h>
 
-DEFARRAY_BYTYPE(intarray, int, /* no inline */);
+// Files are split between at most CSV_MAX_THREADS threads, each getting
+// at least CSV_MIN_CHUNK bytes.
+#define CSV_MAX_THREADS 8
+#define CSV_MIN_CHUNK (1 << 20)
 
-DEFARRAY(csv_result, /* no inline */);
+// A range of whole lines parsed by one thread
+struct csv_chunk {
+    const char *ch_start;
+    const char *ch_end;
+    uint64_t ch_nrows; // number of rows in the chunk
+    uint64_t ch_firstrow; // index of the first row of the chunk
+    struct csv_table *ch_table;
+};
 
-#define BUFSIZE 1024
-#define DELIMITERS ",\n"
+void
+csv_destroy(struct csv_table *table)
+{
+    assert(table != NULL);
+    for (unsigned i = 0; i < table->csv_ncols; i++) {
+        free(table->csv_cols[i].csv_vals);
+    }
+    free(table->csv_cols);
+    free(table);
+}
+
+// Returns the end of the line that starts at p, either a newline or end
+static inline
+const char *
+csv_line_end(const char *p, const char *end)
+{
+    const char *eol = memchr(p, '\n', end - p);
+    return (eol == NULL) ? end : eol;
+}
+
+static inline
+bool
+csv_line_blank(const char *p, const char *eol)
+{
+    while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p == eol;
+}
+
+// Parses an integer at p like atoi, and returns the first character after
+// it. On little endian machines the digits are converted eight at a time
+// without branching on each one.
+static inline
+const char *
+csv_parse_int(const char *p, const char *end, int *retval)
+{
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    uint32_t val = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (end - p >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, p, sizeof(uint64_t));
+        // a byte is a digit if its high nibble is 3 and its low nibble is
+        // at most 9, so the first non-zero byte here is the first non-digit
+        uint64_t nondigit =
+                ((chunk & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL)
+                | (((chunk & 0x0F0F0F0F0F0F0F0FULL) + 0x0606060606060606ULL)
+                   & 0x1010101010101010ULL);
+        unsigned ndigits = (nondigit == 0) ? 8 : __builtin_ctzll(nondigit) / 8;
+        if (ndigits > 0) {
+            // Shift the digits to the top so the missing ones become
+            // leading zeros, then combine pairs, quads and octets.
+            uint64_t digits = (chunk & 0x0F0F0F0F0F0F0F0FULL) << (8 * (8 - ndigits));
+            digits = (digits * 10 + (digits >> 8)) & 0x00FF00FF00FF00FFULL;
+            digits = (digits * 100 + (digits >> 16)) & 0x0000FFFF0000FFFFULL;
+            digits = (digits * 10000 + (digits >> 32)) & 0x00000000FFFFFFFFULL;
+            val = (uint32_t) digits;
+            p += ndigits;
+        }
+        if (ndigits < 8) {
+            goto done;
+        }
+    }
+#endif
+    while (p < end && (unsigned) (*p - '0') < 10) {
+        val = val * 10 + (*p - '0');
+        p++;
+    }
+    goto done;
+  done:
+    *retval = neg ? (int) (0u - val) : (int) val;
+    return p;
+}
+
+static
+void *
+csv_count_routine(void *arg)
+{
+    struct csv_chunk *chunk = (struct csv_chunk *) arg;
+    uint64_t nrows = 0;
+    const char *p = chunk->ch_start;
+    while (p < chunk->ch_end) {
+        const char *eol = csv_line_end(p, chunk->ch_end);
+        nrows += !csv_line_blank(p, eol);
+        p = eol + 1;
+    }
+    chunk->ch_nrows = nrows;
+    return NULL;
+}
+
+static
+void *
+csv_parse_routine(void *arg)
+{
+    struct csv_chunk *chunk = (struct csv_chunk *) arg;
+    struct csv_table *table = chunk->ch_table;
+    uint64_t row = chunk->ch_firstrow;
+    const char *p = chunk->ch_start;
+    while (p < chunk->ch_end) {
+        const char *eol = csv_line_end(p, chunk->ch_end);
+        if (csv_line_blank(p, eol)) {
+            p = eol + 1;
+            continue;
+        }
+        for (unsigned col = 0; col < table->csv_ncols; col++) {
+            int val = 0;
+            if (p < eol) {
+                p = csv_parse_int(p, eol, &val);
+                while (p < eol && *p != ',') {
+                    p++;
+                }
+                p += (p < eol);
+            }
+            table->csv_cols[col].csv_vals[row] = val;
+        }
+        row++;
+        p = eol + 1;
+    }
+    assert(row == chunk->ch_firstrow + chunk->ch_nrows);
+    return NULL;
+}
 
+// Runs routine on every chunk, one thread per chunk. The calling thread
+// takes the first chunk, and any chunk we fail to start a thread for.
+static
 void
-csv_destroy(struct csv_resultarray *results)
+csv_run(struct csv_chunk *chunks, unsigned nchunks, void *(*routine)(void *))
 {
-    assert(results != NULL);
-    while (csv_resultarray_num(results) > 0) {
-        struct csv_result *header = csv_resultarray_get(results, 0);
-        header->csv_vals->arr.num = 0;
-        intarray_destroy(header->csv_vals);
-        free(header);
-        csv_resultarray_remove(results, 0);
-    }
-    csv_resultarray_destroy(results);
+    pthread_t threads[CSV_MAX_THREADS];
+    bool started[CSV_MAX_THREADS];
+    for (unsigned i = 1; i < nchunks; i++) {
+        started[i] = (pthread_create(&threads[i], NULL, routine, &chunks[i]) == 0);
+        if (!started[i]) {
+            routine(&chunks[i]);
+        }
+    }
+    routine(&chunks[0]);
+    for (unsigned i = 1; i < nchunks; i++) {
+        if (started[i]) {
+            assert(pthread_join(threads[i], NULL) == 0);
+        }
+    }
 }
 
-struct csv_resultarray *
-csv_parse(int fd)
+// Reads the column names from the header line [p, eol)
+static
+int
+csv_parse_header(struct csv_table *table, const char *p, const char *eol)
 {
     int result;
-    struct csv_resultarray *results = NULL;
-    result = lseek(fd, 0, SEEK_SET);
-    if (result) {
-        result = DBELSEEK;
-        DBLOG(result);
-        goto done;
-    }
-    FILE *file;
-    TRYNULL(result, DBEIONOFILE, file, fdopen(fd, "r"), done);
-    TRYNULL(result, DBENOMEM, results, csv_resultarray_create(), cleanup_file);
-
-    char buf[BUFSIZE];
-    bzero(buf, BUFSIZE);
-    char c;
-    unsigned ix = 0;
-    while ((c = fgetc(file)) != EOF) {
-        if (c == '\n' || c == ',') {
-            buf[ix] = '\0';
-            struct csv_result *header;
-            TRYNULL(result, DBENOMEM, header, malloc(sizeof(struct csv_result)), free_csv_resultarray);
-            TRYNULL(result, DBENOMEM, header->csv_vals, intarray_create(), free_csv_resultarray);
-            TRY(result, csv_resultarray_add(results, header, NULL), free_csv_resultarray);
-            strcpy(header->csv_colname, buf);
-            ix = 0;
-            bzero(buf, BUFSIZE);
-            if (c == '\n') {
-                break;
-            }
+    unsigned ncols = 1;
+    for (const char *c = p; c < eol; c++) {
+        ncols += (*c == ',');
+    }
+    TRYNULL(result, DBENOMEM, table->csv_cols,
+            calloc(ncols, sizeof(struct csv_column)), done);
+    table->csv_ncols = ncols;
+    for (unsigned i = 0; i < ncols; i++) {
+        const char *name = p;
+        while (p < eol && *p != ',') {
+            p++;
+        }
+        size_t len = p - name;
+        if (len > 0 && name[len - 1] == '\r') {
+            len--;
+        }
+        if (len >= sizeof(table->csv_cols[i].csv_colname)) {
+            result = DBECSV;
+            DBLOG(result);
+            goto done;
+        }
+        memcpy(table->csv_cols[i].csv_colname, name, len);
+        table->csv_cols[i].csv_colname[len] = '\0';
+        p++;
+    }
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Parses the rows in [body, end), which must be whole lines, into table,
+// replacing the rows it held before.
+static
+int
+csv_parse_rows(struct csv_table *table, const char *body, const char *end)
+{
+    int result;
+    // Split the rows into chunks of whole lines
+    size_t bodysize = end - body;
+    unsigned nchunks = bodysize / CSV_MIN_CHUNK;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus > 0 && nchunks > (unsigned) ncpus) {
+        nchunks = ncpus;
+    }
+    if (nchunks > CSV_MAX_THREADS) {
+        nchunks = CSV_MAX_THREADS;
+    }
+    if (nchunks == 0) {
+        nchunks = 1;
+    }
+    struct csv_chunk chunks[CSV_MAX_THREADS];
+    const char *start = body;
+    for (unsigned i = 0; i < nchunks; i++) {
+        chunks[i].ch_start = start;
+        if (i == nchunks - 1) {
+            chunks[i].ch_end = end;
         } else {
-            buf[ix++] = c;
+            const char *split = body + (bodysize / nchunks) * (i + 1);
+            split = (split < start) ? start : split;
+            const char *nl = csv_line_end(split, end);
+            chunks[i].ch_end = (nl == end) ? end : nl + 1;
         }
+        chunks[i].ch_table = table;
+        start = chunks[i].ch_end;
     }
-    if (c == EOF) {
+
+    // Count the rows of every chunk so each thread knows where its rows
+    // go, then parse them in place.
+    csv_run(chunks, nchunks, csv_count_routine);
+    uint64_t nrows = 0;
+    for (unsigned i = 0; i < nchunks; i++) {
+        chunks[i].ch_firstrow = nrows;
+        nrows += chunks[i].ch_nrows;
+    }
+    table->csv_nrows = 0;
+    if (nrows > table->csv_maxrows) {
+        for (unsigned i = 0; i < table->csv_ncols; i++) {
+            int *vals;
+            TRYNULL(result, DBENOMEM, vals,
+                    realloc(table->csv_cols[i].csv_vals, sizeof(int) * nrows), done);
+            table->csv_cols[i].csv_vals = vals;
+        }
+        table->csv_maxrows = nrows;
+    }
+    csv_run(chunks, nchunks, csv_parse_routine);
+    table->csv_nrows = nrows;
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+struct csv_table *
+csv_parse(int fd)
+{
+    int result;
+    struct csv_table *table = NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        result = DBEIONOFILE;
+        DBLOG(result);
+        goto cleanup_fd;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        result = DBEIOEARLYEOF;
+        DBLOG(result);
+        goto cleanup_fd;
+    }
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        result = DBEIOCHECKERRNO;
+        DBLOG(result);
+        goto cleanup_fd;
+    }
+    (void) madvise((void *) map, size, MADV_SEQUENTIAL);
+    const char *end = map + size;
+
+    TRYNULL(result, DBENOMEM, table, calloc(1, sizeof(struct csv_table)), cleanup_map);
+    const char *eol = csv_line_end(map, end);
+    if (eol == end) {
         result = DBEIOEARLYEOF;
         DBLOG(result);
-        goto free_csv_resultarray;
-    }
-
-    // loop until we have no more rows
-    ix = 0;
-    unsigned colnum = 0;
-    while ((c = fgetc(file)) != EOF) {
-        if (c == '\n' || c == ',') {
-            buf[ix] = '\0';
-            int val = atoi(buf);
-            struct csv_result *header = csv_resultarray_get(results, colnum);
-            TRY(result, intarray_add(header->csv_vals, (void *) val, NULL), free_csv_resultarray);
-            ix = 0;
-            bzero(buf, BUFSIZE);
-            if (c == '\n') {
-                colnum = 0;
-            } else {
-                colnum++;
+        goto cleanup_table;
+    }
+    TRY(result, csv_parse_header(table, map, eol), cleanup_table);
+    TRY(result, csv_parse_rows(table, eol + 1, end), cleanup_table);
+
+    // success
+    result = 0;
+    goto cleanup_map;
+
+  cleanup_table:
+    csv_destroy(table);
+    table = NULL;
+  cleanup_map:
+    assert(munmap((void *) map, size) == 0);
+  cleanup_fd:
+    assert(close(fd) == 0);
+    return table;
+}
+
+struct csv_stream {
+    char *cs_buf;
+    size_t cs_size; // size of cs_buf
+    size_t cs_len; // bytes of cs_buf that hold data
+    bool cs_header; // whether we have parsed the header line yet
+    struct csv_table *cs_table;
+};
+
+struct csv_stream *
+csv_stream_create(size_t bufsize)
+{
+    assert(bufsize > 0);
+    int result;
+    struct csv_stream *stream;
+    TRYNULL(result, DBENOMEM, stream, calloc(1, sizeof(struct csv_stream)), done);
+    TRYNULL(result, DBENOMEM, stream->cs_buf, malloc(bufsize), cleanup_stream);
+    TRYNULL(result, DBENOMEM, stream->cs_table,
+            calloc(1, sizeof(struct csv_table)), cleanup_buf);
+    stream->cs_size = bufsize;
+    goto done;
+
+  cleanup_buf:
+    free(stream->cs_buf);
+  cleanup_stream:
+    free(stream);
+    stream = NULL;
+  done:
+    return stream;
+}
+
+void
+csv_stream_destroy(struct csv_stream *stream)
+{
+    assert(stream != NULL);
+    csv_destroy(stream->cs_table);
+    free(stream->cs_buf);
+    free(stream);
+}
+
+char *
+csv_stream_buf(struct csv_stream *stream, size_t *retlen)
+{
+    assert(stream != NULL);
+    assert(retlen != NULL);
+    // only a line longer than the buffer can fill it up
+    if (stream->cs_len == stream->cs_size) {
+        char *buf = realloc(stream->cs_buf, stream->cs_size * 2);
+        if (buf == NULL) {
+            return NULL;
+        }
+        stream->cs_buf = buf;
+        stream->cs_size *= 2;
+    }
+    *retlen = stream->cs_size - stream->cs_len;
+    return stream->cs_buf + stream->cs_len;
+}
+
+int
+csv_stream_parse(struct csv_stream *stream, size_t len, bool eof,
+                 struct csv_table **rettable)
+{
+    assert(stream != NULL);
+    assert(rettable != NULL);
+    assert(stream->cs_len + len <= stream->cs_size);
+
+    int result;
+    struct csv_table *table = NULL;
+    stream->cs_len += len;
+    const char *p = stream->cs_buf;
+    const char *end = stream->cs_buf + stream->cs_len;
+    if (!stream->cs_header) {
+        const char *eol = csv_line_end(p, end);
+        if (eol == end) {
+            if (eof) {
+                result = DBEIOEARLYEOF;
+                DBLOG(result);
+                goto done;
             }
-        } else {
-            buf[ix++] = c;
+            // wait for the rest of the header
+            result = 0;
+            goto done;
         }
+        TRY(result, csv_parse_header(stream->cs_table, p, eol), done);
+        stream->cs_header = true;
+        p = eol + 1;
     }
-    // success
-    goto cleanup_file;
 
-  free_csv_resultarray:
-    csv_destroy(results);
-    results = NULL;
-  cleanup_file:
-    assert(fclose(file) == 0);
+    // Parse up to the last complete line, and keep the rest for later
+    const char *stop = end;
+    if (!eof) {
+        while (stop > p && stop[-1] != '\n') {
+            stop--;
+        }
+    }
+    TRY(result, csv_parse_rows(stream->cs_table, p, stop), done);
+    stream->cs_len = end - stop;
+    memmove(stream->cs_buf, stop, stream->cs_len);
+    table = stream->cs_table;
+
+    // success
+    result = 0;
+    goto done;
   done:
-    return results;
+    *rettable = table;
+    return result;
 }
@@ -42,6 +42,9 @@ dberror_string(enum dberror result)
     case DBENOTREE: return "no btree on join input tree column";
     case DBEUNSUPPORTED: return "unsupported operation on this column";
     case DBEDUPCOL: return "duplicate column";
+    case DBEDELETED: return "position refers to a deleted tuple";
+    case DBEWIRE: return "malformed op in message";
+    case DBELOADPATH: return "load file is not under the server's load directory";
     default:
         assert(0);
         return NULL;
@@ -0,0 +1,933 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <db/common/dberror.h>
+#include <db/common/try.h>
+#include <db/common/idset.h>
+
+#define CHUNK_BITS 16
+#define CHUNK_SIZE (1U << CHUNK_BITS) // ids per container
+#define CHUNK_WORDS (CHUNK_SIZE / 64) // words in a bitmap container
+#define ARRAY_MAX 4096 // past this, a bitmap container is smaller
+#define KEY(id) ((id) >> CHUNK_BITS)
+#define LOW(id) ((id) & (CHUNK_SIZE - 1))
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+
+enum container_type {
+    CONTAINER_ARRAY,
+    CONTAINER_BITMAP,
+    CONTAINER_RUN,
+};
+
+// inclusive run of ids [r_start, r_last]
+struct run {
+    uint16_t r_start;
+    uint16_t r_last;
+};
+
+struct container {
+    enum container_type c_type;
+    unsigned c_key; // high bits shared by every id in this container
+    unsigned c_card; // number of ids in the container
+    unsigned c_n; // number of array values or runs
+    unsigned c_cap; // allocated array values or runs
+    union {
+        uint16_t *c_array;
+        uint64_t *c_words;
+        struct run *c_runs;
+    };
+};
+
+struct idset {
+    unsigned is_nbits; // every id is less than this
+    unsigned is_n; // number of containers
+    unsigned is_cap; // allocated containers
+    struct container *is_containers; // sorted by key
+};
+
+enum idset_op {
+    IDSET_AND,
+    IDSET_OR,
+    IDSET_ANDNOT,
+};
+
+/*
+ * Helpers on the 1024 word representation of a container. Every container
+ * can be expanded into words, so conversions and the slow paths of the
+ * set operations all go through it.
+ */
+
+static
+void
+words_set_range(uint64_t *words, unsigned start, unsigned last)
+{
+    unsigned sw = start / 64;
+    unsigned lw = last / 64;
+    uint64_t smask = ~((uint64_t) 0) << (start % 64);
+    uint64_t lmask = ~((uint64_t) 0) >> (63 - (last % 64));
+    if (sw == lw) {
+        words[sw] |= smask & lmask;
+        return;
+    }
+    words[sw] |= smask;
+    for (unsigned w = sw + 1; w < lw; w++) {
+        words[w] = ~((uint64_t) 0);
+    }
+    words[lw] |= lmask;
+}
+
+static
+unsigned
+words_count(uint64_t *words)
+{
+    unsigned count = 0;
+    for (unsigned w = 0; w < CHUNK_WORDS; w++) {
+        count += __builtin_popcountll(words[w]);
+    }
+    return count;
+}
+
+static
+unsigned
+words_nruns(uint64_t *words)
+{
+    // a run starts at every set bit whose lower neighbour is clear
+    unsigned nruns = 0;
+    uint64_t carry = 0;
+    for (unsigned w = 0; w < CHUNK_WORDS; w++) {
+        nruns += __builtin_popcountll(words[w] & ~((words[w] << 1) | carry));
+        carry = words[w] >> 63;
+    }
+    return nruns;
+}
+
+// Returns the first position at or after pos whose bit equals set,
+// or CHUNK_SIZE if there is none.
+static
+unsigned
+words_next(uint64_t *words, unsigned pos, bool set)
+{
+    while (pos < CHUNK_SIZE) {
+        uint64_t w = set ? words[pos / 64] : ~words[pos / 64];
+        w &= ~((uint64_t) 0) << (pos % 64);
+        if (w != 0) {
+            return (pos & ~63U) + __builtin_ctzll(w);
+        }
+        pos = (pos & ~63U) + 64;
+    }
+    return CHUNK_SIZE;
+}
+
+/*
+ * Containers
+ */
+
+// first index in the array whose value is >= v
+static
+unsigned
+array_lower_bound(uint16_t *array, unsigned n, unsigned v)
+{
+    unsigned l = 0;
+    unsigned r = n;
+    while (l < r) {
+        unsigned m = l + (r - l) / 2;
+        if (array[m] < v) {
+            l = m + 1;
+        } else {
+            r = m;
+        }
+    }
+    return l;
+}
+
+// first run whose last value is >= v
+static
+unsigned
+runs_lower_bound(struct run *runs, unsigned n, unsigned v)
+{
+    unsigned l = 0;
+    unsigned r = n;
+    while (l < r) {
+        unsigned m = l + (r - l) / 2;
+        if (runs[m].r_last < v) {
+            l = m + 1;
+        } else {
+            r = m;
+        }
+    }
+    return l;
+}
+
+static
+void
+container_cleanup(struct container *c)
+{
+    // every member of the union is a malloc'd pointer
+    free(c->c_array);
+    c->c_array = NULL;
+}
+
+static
+void
+container_to_words(struct container *c, uint64_t *words)
+{
+    switch (c->c_type) {
+    case CONTAINER_ARRAY:
+        memset(words, 0, CHUNK_WORDS * sizeof(uint64_t));
+        for (unsigned i = 0; i < c->c_n; i++) {
+            words[c->c_array[i] / 64] |= ((uint64_t) 1) << (c->c_array[i] % 64);
+        }
+        break;
+    case CONTAINER_BITMAP:
+        memcpy(words, c->c_words, CHUNK_WORDS * sizeof(uint64_t));
+        break;
+    case CONTAINER_RUN:
+        memset(words, 0, CHUNK_WORDS * sizeof(uint64_t));
+        for (unsigned i = 0; i < c->c_n; i++) {
+            words_set_range(words, c->c_runs[i].r_start, c->c_runs[i].r_last);
+        }
+        break;
+    default: assert(0); break;
+    }
+}
+
+// Builds a container of the given type holding the bits in words.
+// Only the storage and counts of c are written.
+static
+int
+container_from_words(struct container *c, uint64_t *words,
+                     enum container_type type)
+{
+    int result;
+    unsigned card = words_count(words);
+    c->c_type = type;
+    c->c_card = card;
+    switch (type) {
+    case CONTAINER_ARRAY:
+        assert(card <= ARRAY_MAX);
+        c->c_n = card;
+        c->c_cap = MAX(card, 1);
+        TRYNULL(result, DBENOMEM, c->c_array,
+                malloc(sizeof(uint16_t) * c->c_cap), done);
+        unsigned n = 0;
+        for (unsigned w = 0; w < CHUNK_WORDS; w++) {
+            uint64_t bits = words[w];
+            while (bits != 0) {
+                c->c_array[n++] = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+            }
+        }
+        assert(n == card);
+        break;
+    case CONTAINER_BITMAP:
+        c->c_n = 0;
+        c->c_cap = 0;
+        TRYNULL(result, DBENOMEM, c->c_words,
+                malloc(sizeof(uint64_t) * CHUNK_WORDS), done);
+        memcpy(c->c_words, words, sizeof(uint64_t) * CHUNK_WORDS);
+        break;
+    case CONTAINER_RUN:
+        c->c_n = words_nruns(words);
+        c->c_cap = MAX(c->c_n, 1);
+        TRYNULL(result, DBENOMEM, c->c_runs,
+                malloc(sizeof(struct run) * c->c_cap), done);
+        unsigned nruns = 0;
+        unsigned pos = words_next(words, 0, true);
+        while (pos < CHUNK_SIZE) {
+            unsigned end = words_next(words, pos, false);
+            c->c_runs[nruns].r_start = pos;
+            c->c_runs[nruns].r_last = end - 1;
+            nruns++;
+            pos = (end < CHUNK_SIZE) ? words_next(words, end, true) : CHUNK_SIZE;
+        }
+        assert(nruns == c->c_n);
+        break;
+    default: assert(0); break;
+    }
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+static
+int
+container_convert(struct container *c, enum container_type type)
+{
+    if (c->c_type == type) {
+        return 0;
+    }
+    int result;
+    uint64_t words[CHUNK_WORDS];
+    struct container converted = { .c_key = c->c_key };
+    container_to_words(c, words);
+    TRY(result, container_from_words(&converted, words, type), done);
+    container_cleanup(c);
+    *c = converted;
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// The smallest representation for a container with these stats
+static
+enum container_type
+container_best_type(unsigned card, unsigned nruns)
+{
+    size_t arraysize = sizeof(uint16_t) * card;
+    size_t bitmapsize = sizeof(uint64_t) * CHUNK_WORDS;
+    size_t runsize = sizeof(struct run) * nruns;
+    if (runsize < MIN(arraysize, bitmapsize)) {
+        return CONTAINER_RUN;
+    }
+    return (card <= ARRAY_MAX) ? CONTAINER_ARRAY : CONTAINER_BITMAP;
+}
+
+static
+unsigned
+container_nruns(struct container *c)
+{
+    switch (c->c_type) {
+    case CONTAINER_ARRAY: {
+        unsigned nruns = (c->c_n > 0) ? 1 : 0;
+        for (unsigned i = 1; i < c->c_n; i++) {
+            if (c->c_array[i] != c->c_array[i - 1] + 1) {
+                nruns++;
+            }
+        }
+        return nruns;
+    }
+    case CONTAINER_BITMAP: return words_nruns(c->c_words);
+    case CONTAINER_RUN: return c->c_n;
+    default: assert(0); return 0;
+    }
+}
+
+static
+bool
+container_contains(struct container *c, unsigned low)
+{
+    unsigned i;
+    switch (c->c_type) {
+    case CONTAINER_ARRAY:
+        i = array_lower_bound(c->c_array, c->c_n, low);
+        return (i < c->c_n) && (c->c_array[i] == low);
+    case CONTAINER_BITMAP:
+        return (c->c_words[low / 64] >> (low % 64)) & 1;
+    case CONTAINER_RUN:
+        i = runs_lower_bound(c->c_runs, c->c_n, low);
+        return (i < c->c_n) && (c->c_runs[i].r_start <= low);
+    default: assert(0); return false;
+    }
+}
+
+static
+int
+container_add(struct container *c, unsigned low)
+{
+    int result;
+    switch (c->c_type) {
+    case CONTAINER_ARRAY: {
+        unsigned pos;
+        if (c->c_n == 0 || c->c_array[c->c_n - 1] < low) {
+            pos = c->c_n; // appending in order is the common case
+        } else {
+            pos = array_lower_bound(c->c_array, c->c_n, low);
+            if (c->c_array[pos] == low) {
+                return 0;
+            }
+        }
+        if (c->c_n == ARRAY_MAX) {
+            TRY(result, container_convert(c, CONTAINER_BITMAP), done);
+            return container_add(c, low);
+        }
+        if (c->c_n == c->c_cap) {
+            unsigned newcap = MIN(MAX(c->c_cap * 2, 4), ARRAY_MAX);
+            uint16_t *newarray;
+            TRYNULL(result, DBENOMEM, newarray,
+                    realloc(c->c_array, sizeof(uint16_t) * newcap), done);
+            c->c_array = newarray;
+            c->c_cap = newcap;
+        }
+        memmove(&c->c_array[pos + 1], &c->c_array[pos],
+                sizeof(uint16_t) * (c->c_n - pos));
+        c->c_array[pos] = low;
+        c->c_n++;
+        c->c_card++;
+        break;
+    }
+    case CONTAINER_BITMAP: {
+        uint64_t mask = ((uint64_t) 1) << (low % 64);
+        if ((c->c_words[low / 64] & mask) == 0) {
+            c->c_words[low / 64] |= mask;
+            c->c_card++;
+        }
+        break;
+    }
+    case CONTAINER_RUN:
+        if (container_contains(c, low)) {
+            return 0;
+        }
+        // extending the last run is cheap, anything else goes to a bitmap
+        if (c->c_n > 0 && c->c_runs[c->c_n - 1].r_last + 1 == low) {
+            c->c_runs[c->c_n - 1].r_last = low;
+            c->c_card++;
+            break;
+        }
+        TRY(result, container_convert(c, CONTAINER_BITMAP), done);
+        return container_add(c, low);
+    default: assert(0); break;
+    }
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Copies up to n ids at or past low into buf, offset by base.
+// *retnext is where to resume, or CHUNK_SIZE once the container is done.
+static
+unsigned
+container_extract(struct container *c, unsigned low, unsigned base,
+                  unsigned *buf, unsigned n, unsigned *retnext)
+{
+    unsigned count = 0;
+    switch (c->c_type) {
+    case CONTAINER_ARRAY: {
+        unsigned i = array_lower_bound(c->c_array, c->c_n, low);
+        while (i < c->c_n && count < n) {
+            buf[count++] = base + c->c_array[i++];
+        }
+        *retnext = (i < c->c_n) ? c->c_array[i] : CHUNK_SIZE;
+        return count;
+    }
+    case CONTAINER_BITMAP: {
+        unsigned pos = low;
+        while (pos < CHUNK_SIZE) {
+            unsigned w = pos / 64;
+            uint64_t bits = c->c_words[w] & (~((uint64_t) 0) << (pos % 64));
+            while (bits != 0 && count < n) {
+                buf[count++] = base + w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+            }
+            if (bits != 0) {
+                *retnext = w * 64 + __builtin_ctzll(bits);
+                return count;
+            }
+            pos = (w + 1) * 64;
+        }
+        *retnext = CHUNK_SIZE;
+        return count;
+    }
+    case CONTAINER_RUN: {
+        unsigned r = runs_lower_bound(c->c_runs, c->c_n, low);
+        unsigned v = low;
+        for (/* none */; r < c->c_n; r++) {
+            v = MAX(v, c->c_runs[r].r_start);
+            while (v <= c->c_runs[r].r_last && count < n) {
+                buf[count++] = base + v++;
+            }
+            if (v <= c->c_runs[r].r_last) {
+                *retnext = v;
+                return count;
+            }
+        }
+        *retnext = CHUNK_SIZE;
+        return count;
+    }
+    default: assert(0); return 0;
+    }
+}
+
+static
+int
+container_copy(struct container *c, struct container *copy)
+{
+    int result;
+    size_t size;
+    switch (c->c_type) {
+    case CONTAINER_ARRAY: size = sizeof(uint16_t) * MAX(c->c_n, 1); break;
+    case CONTAINER_BITMAP: size = sizeof(uint64_t) * CHUNK_WORDS; break;
+    case CONTAINER_RUN: size = sizeof(struct run) * MAX(c->c_n, 1); break;
+    default: assert(0); size = 0; break;
+    }
+    *copy = *c;
+    copy->c_cap = (c->c_type == CONTAINER_BITMAP) ? 0 : MAX(c->c_n, 1);
+    TRYNULL(result, DBENOMEM, copy->c_array, malloc(size), done);
+    memcpy(copy->c_array, c->c_array, size);
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Keeps the values of the array container a that are (or, for ANDNOT,
+// are not) in b.
+static
+int
+container_filter(struct container *a, struct container *b, bool keep,
+                 struct container *out)
+{
+    assert(a->c_type == CONTAINER_ARRAY);
+    int result;
+    out->c_type = CONTAINER_ARRAY;
+    out->c_cap = MAX(a->c_n, 1);
+    TRYNULL(result, DBENOMEM, out->c_array,
+            malloc(sizeof(uint16_t) * out->c_cap), done);
+    unsigned n = 0;
+    for (unsigned i = 0; i < a->c_n; i++) {
+        if (container_contains(b, a->c_array[i]) == keep) {
+            out->c_array[n++] = a->c_array[i];
+        }
+    }
+    out->c_n = n;
+    out->c_card = n;
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Union of two array containers, when it still fits in an array
+static
+int
+container_merge(struct container *a, struct container *b, struct container *out)
+{
+    assert(a->c_type == CONTAINER_ARRAY);
+    assert(b->c_type == CONTAINER_ARRAY);
+    int result;
+    out->c_type = CONTAINER_ARRAY;
+    out->c_cap = MAX(a->c_n + b->c_n, 1);
+    TRYNULL(result, DBENOMEM, out->c_array,
+            malloc(sizeof(uint16_t) * out->c_cap), done);
+    unsigned i = 0, j = 0, n = 0;
+    while (i < a->c_n && j < b->c_n) {
+        if (a->c_array[i] < b->c_array[j]) {
+            out->c_array[n++] = a->c_array[i++];
+        } else if (b->c_array[j] < a->c_array[i]) {
+            out->c_array[n++] = b->c_array[j++];
+        } else {
+            out->c_array[n++] = a->c_array[i++];
+            j++;
+        }
+    }
+    while (i < a->c_n) {
+        out->c_array[n++] = a->c_array[i++];
+    }
+    while (j < b->c_n) {
+        out->c_array[n++] = b->c_array[j++];
+    }
+    out->c_n = n;
+    out->c_card = n;
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Combines two containers with the same key into out. Sparse inputs are
+// handled directly on the arrays; everything else is done a word at a time.
+static
+int
+container_combine(enum idset_op op, struct container *a, struct container *b,
+                  struct container *out)
+{
+    assert(a->c_key == b->c_key);
+    out->c_key = a->c_key;
+    switch (op) {
+    case IDSET_AND:
+        if (a->c_type == CONTAINER_ARRAY) {
+            return container_filter(a, b, true, out);
+        }
+        if (b->c_type == CONTAINER_ARRAY) {
+            return container_filter(b, a, true, out);
+        }
+        break;
+    case IDSET_OR:
+        if (a->c_type == CONTAINER_ARRAY && b->c_type == CONTAINER_ARRAY
+                && a->c_n + b->c_n <= ARRAY_MAX) {
+            return container_merge(a, b, out);
+        }
+        break;
+    case IDSET_ANDNOT:
+        if (a->c_type == CONTAINER_ARRAY) {
+            return container_filter(a, b, false, out);
+        }
+        break;
+    default: assert(0); break;
+    }
+
+    uint64_t wa[CHUNK_WORDS];
+    uint64_t wb[CHUNK_WORDS];
+    container_to_words(a, wa);
+    container_to_words(b, wb);
+    for (unsigned w = 0; w < CHUNK_WORDS; w++) {
+        switch (op) {
+        case IDSET_AND: wa[w] &= wb[w]; break;
+        case IDSET_OR: wa[w] |= wb[w]; break;
+        case IDSET_ANDNOT: wa[w] &= ~wb[w]; break;
+        default: assert(0); break;
+        }
+    }
+    return container_from_words(out, wa,
+            container_best_type(words_count(wa), words_nruns(wa)));
+}
+
+/*
+ * The set itself
+ */
+
+// first container whose key is >= key
+static
+unsigned
+idset_lower_bound(struct idset *set, unsigned key)
+{
+    unsigned l = 0;
+    unsigned r = set->is_n;
+    while (l < r) {
+        unsigned m = l + (r - l) / 2;
+        if (set->is_containers[m].c_key < key) {
+            l = m + 1;
+        } else {
+            r = m;
+        }
+    }
+    return l;
+}
+
+static
+int
+idset_insert_container(struct idset *set, unsigned pos, struct container *c)
+{
+    int result;
+    if (set->is_n == set->is_cap) {
+        unsigned newcap = MAX(set->is_cap * 2, 4);
+        struct container *newcontainers;
+        TRYNULL(result, DBENOMEM, newcontainers,
+                realloc(set->is_containers, sizeof(struct container) * newcap),
+                done);
+        set->is_containers = newcontainers;
+        set->is_cap = newcap;
+    }
+    memmove(&set->is_containers[pos + 1], &set->is_containers[pos],
+            sizeof(struct container) * (set->is_n - pos));
+    set->is_containers[pos] = *c;
+    set->is_n++;
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Takes ownership of c, dropping it if it is empty
+static
+int
+idset_append_container(struct idset *set, struct container *c)
+{
+    assert(set->is_n == 0 || set->is_containers[set->is_n - 1].c_key < c->c_key);
+    if (c->c_card == 0) {
+        container_cleanup(c);
+        return 0;
+    }
+    int result = idset_insert_container(set, set->is_n, c);
+    if (result) {
+        container_cleanup(c);
+    }
+    return result;
+}
+
+static
+int
+idset_get_container(struct idset *set, unsigned key, struct container **retc)
+{
+    int result;
+    unsigned pos;
+    // ids tend to arrive in order, so check the last container first
+    if (set->is_n > 0 && set->is_containers[set->is_n - 1].c_key <= key) {
+        pos = (set->is_containers[set->is_n - 1].c_key == key)
+                ? set->is_n - 1 : set->is_n;
+    } else {
+        pos = idset_lower_bound(set, key);
+    }
+    if (pos == set->is_n || set->is_containers[pos].c_key != key) {
+        struct container c = {
+            .c_type = CONTAINER_ARRAY,
+            .c_key = key,
+        };
+        TRY(result, idset_insert_container(set, pos, &c), done);
+    }
+    *retc = &set->is_containers[pos];
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+struct idset *
+idset_create(unsigned nbits)
+{
+    struct idset *set = malloc(sizeof(struct idset));
+    if (set == NULL) {
+        return NULL;
+    }
+    set->is_nbits = nbits;
+    set->is_n = 0;
+    set->is_cap = 0;
+    set->is_containers = NULL;
+    return set;
+}
+
+void
+idset_destroy(struct idset *set)
+{
+    assert(set != NULL);
+    for (unsigned i = 0; i < set->is_n; i++) {
+        container_cleanup(&set->is_containers[i]);
+    }
+    free(set->is_containers);
+    free(set);
+}
+
+unsigned
+idset_nbits(struct idset *set)
+{
+    assert(set != NULL);
+    return set->is_nbits;
+}
+
+int
+idset_add(struct idset *set, unsigned id)
+{
+    assert(set != NULL);
+    assert(id < set->is_nbits);
+    int result;
+    struct container *c;
+    TRY(result, idset_get_container(set, KEY(id), &c), done);
+    TRY(result, container_add(c, LOW(id)), done);
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+int
+idset_add_range(struct idset *set, unsigned start, unsigned end)
+{
+    assert(set != NULL);
+    assert(start <= end);
+    assert(end <= set->is_nbits);
+    int result;
+    if (start == end) {
+        return 0;
+    }
+    for (unsigned key = KEY(start); key <= KEY(end - 1); key++) {
+        unsigned low = (key == KEY(start)) ? LOW(start) : 0;
+        unsigned last = (key == KEY(end - 1)) ? LOW(end - 1) : CHUNK_SIZE - 1;
+        struct container *c;
+        TRY(result, idset_get_container(set, key, &c), done);
+        if (c->c_card == 0) {
+            // fresh container, a single run covers it. The run is
+            // allocated first, so a failure leaves the container as it was.
+            struct run *runs;
+            TRYNULL(result, DBENOMEM, runs, malloc(sizeof(struct run)), done);
+            container_cleanup(c);
+            c->c_type = CONTAINER_RUN;
+            c->c_runs = runs;
+            c->c_n = 1;
+            c->c_cap = 1;
+            c->c_card = last - low + 1;
+            c->c_runs[0].r_start = low;
+            c->c_runs[0].r_last = last;
+        } else {
+            TRY(result, container_convert(c, CONTAINER_BITMAP), done);
+            words_set_range(c->c_words, low, last);
+            c->c_card = words_count(c->c_words);
+        }
+    }
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+bool
+idset_contains(struct idset *set, unsigned id)
+{
+    assert(set != NULL);
+    unsigned pos = idset_lower_bound(set, KEY(id));
+    return (pos < set->is_n) && (set->is_containers[pos].c_key == KEY(id))
+            && container_contains(&set->is_containers[pos], LOW(id));
+}
+
+unsigned
+idset_count(struct idset *set)
+{
+    assert(set != NULL);
+    unsigned count = 0;
+    for (unsigned i = 0; i < set->is_n; i++) {
+        count += set->is_containers[i].c_card;
+    }
+    return count;
+}
+
+int
+idset_optimize(struct idset *set)
+{
+    assert(set != NULL);
+    int result;
+    for (unsigned i = 0; i < set->is_n; i++) {
+        struct container *c = &set->is_containers[i];
+        enum container_type best = container_best_type(c->c_card, container_nruns(c));
+        TRY(result, container_convert(c, best), done);
+    }
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+unsigned
+idset_extract(struct idset *set, unsigned *start, unsigned *buf, unsigned n)
+{
+    assert(set != NULL);
+    assert(start != NULL);
+    unsigned count = 0;
+    unsigned pos = *start;
+    unsigned ci = idset_lower_bound(set, KEY(pos));
+    while (count < n && ci < set->is_n) {
+        struct container *c = &set->is_containers[ci];
+        unsigned base = c->c_key << CHUNK_BITS;
+        unsigned low = (pos > base) ? pos - base : 0;
+        unsigned next;
+        count += container_extract(c, low, base, buf + count, n - count, &next);
+        if (next < CHUNK_SIZE) {
+            // buf is full, resume from here next time
+            pos = base + next;
+            break;
+        }
+        ci++;
+        if (ci < set->is_n) {
+            pos = set->is_containers[ci].c_key << CHUNK_BITS;
+        }
+    }
+    if (ci >= set->is_n) {
+        pos = set->is_nbits;
+    }
+    *start = pos;
+    return count;
+}
+
+bool
+idset_next_set(struct idset *set, unsigned start, unsigned *index)
+{
+    unsigned id;
+    if (idset_extract(set, &start, &id, 1) == 1) {
+        *index = id;
+        return true;
+    }
+    *index = set->is_nbits;
+    return false;
+}
+
+// Walks the containers of both sets in key order, combining containers
+// present in both and copying those that the operation keeps from one side.
+static
+int
+idset_combine(enum idset_op op, struct idset *a, struct idset *b,
+              struct idset **retset)
+{
+    assert(a != NULL);
+    assert(b != NULL);
+    assert(retset != NULL);
+    int result;
+    struct idset *set;
+    unsigned nbits;
+    switch (op) {
+    case IDSET_AND: nbits = MIN(a->is_nbits, b->is_nbits); break;
+    case IDSET_OR: nbits = MAX(a->is_nbits, b->is_nbits); break;
+    case IDSET_ANDNOT: nbits = a->is_nbits; break;
+    default: assert(0); nbits = 0; break;
+    }
+    TRYNULL(result, DBENOMEM, set, idset_create(nbits), done);
+
+    unsigned i = 0, j = 0;
+    while (i < a->is_n || j < b->is_n) {
+        struct container *ca = (i < a->is_n) ? &a->is_containers[i] : NULL;
+        struct container *cb = (j < b->is_n) ? &b->is_containers[j] : NULL;
+        struct container c;
+        if (ca != NULL && cb != NULL && ca->c_key == cb->c_key) {
+            TRY(result, container_combine(op, ca, cb, &c), cleanup_set);
+            i++;
+            j++;
+        } else if (cb == NULL || (ca != NULL && ca->c_key < cb->c_key)) {
+            // only in a
+            i++;
+            if (op == IDSET_AND) {
+                continue;
+            }
+            TRY(result, container_copy(ca, &c), cleanup_set);
+        } else {
+            // only in b
+            j++;
+            if (op != IDSET_OR) {
+                continue;
+            }
+            TRY(result, container_copy(cb, &c), cleanup_set);
+        }
+        TRY(result, idset_append_container(set, &c), cleanup_set);
+    }
+
+    // success
+    result = 0;
+    *retset = set;
+    goto done;
+  cleanup_set:
+    idset_destroy(set);
+  done:
+    return result;
+}
+
+int
+idset_and(struct idset *a, struct idset *b, struct idset **retset)
+{
+    return idset_combine(IDSET_AND, a, b, retset);
+}
+
+int
+idset_or(struct idset *a, struct idset *b, struct idset **retset)
+{
+    return idset_combine(IDSET_OR, a, b, retset);
+}
+
+int
+idset_andnot(struct idset *a, struct idset *b, struct idset **retset)
+{
+    return idset_combine(IDSET_ANDNOT, a, b, retset);
+}
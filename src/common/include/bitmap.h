@@ -42,8 +42,21 @@
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
  *     bitmap_destroy - destroy bitmap.
+ *     bitmap_count   - return the number of set bits.
+ *     bitmap_next_set - locate the first set bit at or after an index.
+ *     bitmap_extract - copy out the indices of up to N set bits, starting
+ *                      at *start, and advance *start past them.
+ *     bitmap_copy    - allocate a copy of a bitmap.
+ *     bitmap_and     - intersect a bitmap of the same size into another.
+ *     bitmap_or      - union a bitmap of the same size into another.
+ *     bitmap_invert  - flip every bit.
+ *
+ * bitmap_count, bitmap_next_set, and bitmap_extract scan 64 bits at a
+ * time, so they are cheap on sparse bitmaps.
  */
 
+#include <stdbool.h>
+
 
 struct bitmap;  /* Opaque. */
 
@@ -58,6 +71,14 @@ void           bitmap_destroy(struct bitmap *);
 // so that bitmap_destroy may safely be called
 struct bitmap *bitmap_init(unsigned nbits, unsigned char *bytes);
 unsigned       bitmap_nbits(struct bitmap *);
+unsigned       bitmap_count(struct bitmap *);
+bool           bitmap_next_set(struct bitmap *, unsigned start, unsigned *index);
+unsigned       bitmap_extract(struct bitmap *, unsigned *start,
+                              unsigned *buf, unsigned n);
+struct bitmap *bitmap_copy(struct bitmap *);
+void           bitmap_and(struct bitmap *dst, struct bitmap *src);
+void           bitmap_or(struct bitmap *dst, struct bitmap *src);
+void           bitmap_invert(struct bitmap *);
 
 
 #endif /* _BITMAP_H_ */
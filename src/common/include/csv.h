@@ -1,19 +1,50 @@
 #ifndef _CSV_H_
 #define _CSV_H_
 
-#include <stdio.h>
-#include <db/common/array.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-DECLARRAY_BYTYPE(intarray, int);
-
-struct csv_result {
+// A CSV file with a header line of column names followed by rows of
+// integers. Every column gets csv_nrows values.
+struct csv_column {
     char csv_colname[128];
-    struct intarray *csv_vals;
+    int *csv_vals;
+};
+
+struct csv_table {
+    unsigned csv_ncols;
+    uint64_t csv_nrows;
+    uint64_t csv_maxrows; // room in each csv_vals
+    struct csv_column *csv_cols;
 };
 
-DECLARRAY(csv_result);
+// Parses the whole file and closes fd. The file is mapped into memory and
+// split at line boundaries between several threads, which parse their rows
+// straight into the column buffers.
+//
+// Fields are read like atoi: leading blanks and a sign are allowed and
+// anything after the digits is ignored. Missing fields are 0, extra fields
+// and blank lines are skipped.
+struct csv_table *csv_parse(int fd);
+void csv_destroy(struct csv_table *table);
+
+// Incremental parser, for CSV data that arrives in pieces. Read data into
+// the space returned by csv_stream_buf, then call csv_stream_parse with
+// the number of bytes read. That parses every complete line so far into
+// *rettable, which stays valid until the next call, and keeps the partial
+// last line for later. *rettable is NULL until the header has arrived.
+// Pass eof with the last piece to parse the final line.
+//
+// Memory use is bounded by the buffer size, which only grows to fit a
+// single line longer than the buffer.
+struct csv_stream;
 
-struct csv_resultarray *csv_parse(int fd);
-void csv_destroy(struct csv_resultarray *results);
+struct csv_stream *csv_stream_create(size_t bufsize);
+void csv_stream_destroy(struct csv_stream *stream);
+// returns NULL if we are out of memory
+char *csv_stream_buf(struct csv_stream *stream, size_t *retlen);
+int csv_stream_parse(struct csv_stream *stream, size_t len, bool eof,
+                     struct csv_table **rettable);
 
 #endif
@@ -38,6 +38,9 @@ enum dberror {
     DBENOTREE,
     DBEUNSUPPORTED,
     DBEDUPCOL,
+    DBEDELETED,
+    DBEWIRE,
+    DBELOADPATH,
 };
 
 const char *dberror_string(enum dberror result);
@@ -0,0 +1,43 @@
+#ifndef _IDSET_H_
+#define _IDSET_H_
+
+#include <stdbool.h>
+
+// Compressed set of ids in [0, nbits), in the style of Roaring bitmaps.
+//
+// The id space is split into chunks of 64K ids. Each non-empty chunk is
+// stored in one container, using whichever of these is smallest:
+//   array  - sorted 16-bit offsets, for sparse chunks (<= 4096 ids)
+//   bitmap - 65536 bits, for dense chunks
+//   run    - sorted [start, last] runs, for clustered chunks
+//
+// Ids may be added in any order, but adding them in increasing order is
+// the fast path. Containers grow as arrays and turn into bitmaps when they
+// fill up; call idset_optimize once the set is built to pick the final
+// representation of every container.
+
+struct idset; // Opaque.
+
+struct idset *idset_create(unsigned nbits);
+void idset_destroy(struct idset *set);
+unsigned idset_nbits(struct idset *set);
+
+// Adding an id that is already in the set is a no-op.
+int idset_add(struct idset *set, unsigned id);
+// Adds every id in [start, end).
+int idset_add_range(struct idset *set, unsigned start, unsigned end);
+bool idset_contains(struct idset *set, unsigned id);
+unsigned idset_count(struct idset *set);
+int idset_optimize(struct idset *set);
+
+// Same contract as bitmap_next_set and bitmap_extract.
+bool idset_next_set(struct idset *set, unsigned start, unsigned *index);
+unsigned idset_extract(struct idset *set, unsigned *start,
+                       unsigned *buf, unsigned n);
+
+// Set algebra. The result is a new set that must be destroyed by the caller.
+int idset_and(struct idset *a, struct idset *b, struct idset **retset);
+int idset_or(struct idset *a, struct idset *b, struct idset **retset);
+int idset_andnot(struct idset *a, struct idset *b, struct idset **retset);
+
+#endif
@@ -2,10 +2,14 @@
 #define _IO_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 int io_read(int fd, void *buf, int nbytes);
 int io_write(int fd, void *buf, int nbytes);
 int io_copy(int readfd, int writefd, uint64_t expected_bytes);
 uint64_t io_size(int fd);
+// While a socket is corked, small writes are held back and sent together
+// in full packets. Uncorking sends whatever is left.
+void io_cork(int fd, bool cork);
 
 #endif
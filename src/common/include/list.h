@@ -13,6 +13,8 @@ void *list_gethead(struct list *lst);
 void *list_gettail(struct list *lst);
 void *list_remhead(struct list *lst);
 void *list_remtail(struct list *lst);
+// removes the node the iterator is at, which can't be used after
+void *list_remove(struct list *lst, struct listnode *lnode);
 
 // returns NULL if there are no more items left
 struct listnode *list_iterhead(struct list *lst);
@@ -46,6 +48,7 @@ void *list_getentry(struct listnode *lnode);
     T *LIST##_gettail(struct LIST *lst); \
     T *LIST##_remhead(struct LIST *lst); \
     T *LIST##_remtail(struct LIST *lst); \
+    T *LIST##_remove(struct LIST *lst, struct LIST##node *lnode); \
     struct LIST##node *LIST##_iterhead(struct LIST *lst); \
     struct LIST##node *LIST##_itertail(struct LIST *lst); \
     struct LIST##node *LIST##_next(struct LIST##node *lnode); \
@@ -98,6 +101,9 @@ void *list_getentry(struct listnode *lnode);
     T *LIST##_remtail(struct LIST *lst) { \
         return list_remtail(lst->lst); \
     } \
+    T *LIST##_remove(struct LIST *lst, struct LIST##node *lnode) { \
+        return list_remove(lst->lst, (struct listnode *) lnode); \
+    } \
     struct LIST##node *LIST##_iterhead(struct LIST *lst) { \
         return (struct LIST##node *) list_iterhead(lst->lst); \
     }\
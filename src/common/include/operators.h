@@ -2,6 +2,7 @@
 #define _OPERATORS_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #define COLUMNLEN 256
 #define TUPLELEN 16384
@@ -25,6 +26,9 @@ enum op_type {
     OP_MATH,
     OP_PRINT,
     OP_JOIN,
+    OP_SET,
+    OP_BATCH_QUERIES,
+    OP_BATCH_EXECUTE,
 };
 
 enum storage_type {
@@ -48,11 +52,18 @@ enum math_type {
     MATH_DIV,
 };
 
+enum set_type {
+    SET_AND,
+    SET_OR,
+    SET_NOT,
+};
+
 enum join_type {
     JOIN_LOOP,
     JOIN_SORT,
     JOIN_TREE,
     JOIN_HASH,
+    JOIN_AUTO, // let the server pick one of the above
 };
 
 struct op_tuple {
@@ -61,9 +72,12 @@ struct op_tuple {
 
 // struct for all the select queries
 // depending on the select operator, some fields will not be used
+// if op_sel_pos is set on a range select, only the positions in that
+// intermediate are scanned, e.g. s2=select(s1,col,low,high)
 struct op_select {
     char op_sel_var[COLUMNLEN];
     char op_sel_col[COLUMNLEN];
+    char op_sel_pos[COLUMNLEN];
     union {
         struct {
             unsigned op_sel_low;
@@ -104,13 +118,19 @@ struct op_update {
     int op_update_val;
 };
 
+// if op_agg_math is set, this aggregates the result of
+// op_agg_mtype(op_agg_col, op_agg_col2), e.g. sum(add(a,b))
 struct op_agg {
     enum agg_type op_agg_atype;
     bool op_agg_assign;
+    bool op_agg_math;
+    enum math_type op_agg_mtype;
     char op_agg_var[COLUMNLEN];
     char op_agg_col[COLUMNLEN];
+    char op_agg_col2[COLUMNLEN];
 };
 
+// either of op_math_col1 or op_math_col2 may be an integer constant
 struct op_math {
     enum math_type op_math_mtype;
     bool op_math_assign;
@@ -131,6 +151,16 @@ struct op_join {
     char op_join_varR[COLUMNLEN];
 };
 
+// combines position intermediates, e.g. s3=and(s1,s2) or s2=not(s1)
+// op_set_ids2 is unused for SET_NOT
+struct op_set {
+    enum set_type op_set_stype;
+    bool op_set_assign;
+    char op_set_var[COLUMNLEN];
+    char op_set_ids1[COLUMNLEN];
+    char op_set_ids2[COLUMNLEN];
+};
+
 struct op {
     enum op_type op_type;
     union {
@@ -146,6 +176,7 @@ struct op {
         struct op_math op_math;
         struct op_print op_print;
         struct op_join op_join;
+        struct op_set op_set;
     };
 };
 
@@ -154,9 +185,15 @@ char *storage_type_string(enum storage_type stype);
 char *math_type_string(enum math_type mtype);
 char *agg_type_string(enum agg_type atype);
 char *join_type_string(enum join_type jtype);
+char *set_type_string(enum set_type stype);
+bool math_type_from_string(char *s, enum math_type *retmtype);
+bool agg_type_from_string(char *s, enum agg_type *retatype);
 
 // This string must be destroyed by the caller
 char *op_string(struct op *op);
+// The bytes at the start of op that its operator uses. An op may be
+// allocated with only this many.
+size_t op_size(struct op *op);
 
 // TODO
 // support var=operator(...) in general
@@ -6,9 +6,21 @@
 
 DECLARRAY(op);
 
+// Where and why a query failed to parse
+struct parse_error {
+    unsigned pe_line; // line of the query
+    unsigned pe_pos; // offset into the line
+    const char *pe_msg;
+};
+
+// Returns NULL if the line is not a valid operator. The op is only as
+// large as its operator needs, see op_size.
 struct op *parse_line(char *line);
+// Like parse_line, but also says what was wrong in reterr
+struct op *parse_line_err(char *line, struct parse_error *reterr);
 void parse_cleanup_op(struct op *op);
 struct oparray *parse_query(char *query);
+struct oparray *parse_query_err(char *query, struct parse_error *reterr);
 void parse_cleanup_ops(struct oparray *ops);
 
 #endif
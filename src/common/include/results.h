@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <db/common/bitmap.h>
+#include <db/common/idset.h>
 #include <db/common/array.h>
 #include <db/common/operators.h>
 
@@ -12,6 +13,7 @@ DECLARRAY_BYTYPE(idarray, unsigned);
 enum column_ids_type {
     CID_BITMAP,
     CID_ARRAY,
+    CID_IDSET, // compressed, for sparse selections
 };
 
 struct column_ids {
@@ -19,9 +21,21 @@ struct column_ids {
     union {
         struct bitmap *cid_bitmap;
         struct idarray *cid_array;
+        struct idset *cid_idset;
     };
+    // column whose positions these are, or empty if not known
+    char cid_col[COLUMNLEN];
+    // For a bitmap or idset from a range select on an indexed column, that
+    // column and range, so that a fetch of the column may read the values
+    // from its index. Empty otherwise.
+    char cid_index_col[COLUMNLEN];
+    unsigned cid_index_low;
+    unsigned cid_index_high;
 };
 
+// number of ids callers typically pull out of an iterator at once
+#define CID_BATCH 1024
+
 struct cid_iterator {
     struct column_ids *ciditer_ids;
     unsigned ciditer_i;
@@ -30,6 +44,9 @@ struct cid_iterator {
 void cid_iter_init(struct cid_iterator *iter, struct column_ids *cids);
 bool cid_iter_has_next(struct cid_iterator *iter);
 uint64_t cid_iter_get(struct cid_iterator *iter);
+// Copies up to n of the remaining ids into buf and returns how many were
+// copied. Returns 0 once the iterator is exhausted.
+unsigned cid_iter_next_batch(struct cid_iterator *iter, unsigned *buf, unsigned n);
 void cid_iter_cleanup(struct cid_iterator *iter);
 
 struct column_vals {
@@ -39,6 +56,23 @@ struct column_vals {
     char cval_col[COLUMNLEN]; // column that this was fetched from
 };
 
+// Creates an empty bitmap or idset over nbits ids
+struct column_ids *column_ids_create(enum column_ids_type type, unsigned nbits);
+// Adds ids to a bitmap or idset
+int column_ids_add(struct column_ids *cids, unsigned id);
+int column_ids_add_range(struct column_ids *cids, unsigned start, unsigned end);
+// Whether a bitmap or idset holds id, which must be less than its nbits
+bool column_ids_contains(struct column_ids *cids, unsigned id);
+// Number of ids a bitmap or idset ranges over
+unsigned column_ids_nbits(struct column_ids *cids);
+unsigned column_ids_count(struct column_ids *cids);
+// Combines ids with and/or/not into a new set. Arrays are treated as
+// sets, so their order and duplicates are lost. SET_NOT needs a bitmap or
+// idset to know the full range of ids, and takes the complement within b,
+// the live positions of the column over the same range, or within the
+// whole range if b is NULL.
+int column_ids_combine(enum set_type stype, struct column_ids *a,
+                       struct column_ids *b, struct column_ids **retids);
 void column_ids_destroy(struct column_ids *cids);
 void column_vals_destroy(struct column_vals *vals);
 
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <db/common/operators.h>
 #include <db/common/results.h>
+#include <db/common/parser.h>
 
 #define RPC_HEADER_MAGIC 0xDEADBEEF
 
@@ -22,6 +23,9 @@ enum rpc_type {
     RPC_SELECT_RESULT,
     RPC_FETCH_RESULT,
     RPC_TUPLE_RESULT,
+    RPC_FILE_PATH,
+    RPC_OPS,
+    RPC_SCRIPT,
 };
 
 struct rpc_header {
@@ -37,10 +41,26 @@ int rpc_write_query(int fd, struct op *op);
 // the retop must be freed
 int rpc_read_query(int fd, struct rpc_header *msg, struct op **retop);
 
+// Sends ops [first, first + n) of ops in one message, in the compact
+// encoding of wire.h, each after its length as a varint. The server
+// replies to each op in order, as if it had been sent on its own.
+int rpc_write_ops(int fd, struct oparray *ops, unsigned first, unsigned n);
+// Like rpc_write_ops, but the server may run ops that do not depend on
+// each other at the same time. Replies still come in order.
+int rpc_write_script(int fd, struct oparray *ops, unsigned first, unsigned n);
+// Reads either kind of message. The retops must be cleaned up with
+// parse_cleanup_ops.
+int rpc_read_ops(int fd, struct rpc_header *msg, struct oparray **retops);
+
 int rpc_write_file(int fd, struct op *op);
 // the retfd must be closed
 int rpc_read_file(int fd, struct rpc_header *msg, char *filename, int *retfd);
 
+// Sends only the path of a load file, for a server that can open it itself
+int rpc_write_file_path(int fd, char *path);
+// the retpath must be freed
+int rpc_read_file_path(int fd, struct rpc_header *msg, char **retpath);
+
 int rpc_write_fetch_result(int fd, struct column_vals *vals);
 // the retvals must be freed
 int rpc_read_fetch_result(int fd, struct rpc_header *msg, int **retvals, unsigned *retn);
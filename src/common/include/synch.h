@@ -31,4 +31,20 @@ void rwlock_acquire_read(struct rwlock *rwlk);
 void rwlock_acquire_write(struct rwlock *rwlk);
 void rwlock_release(struct rwlock *rwlk);
 
+// Version latch, for data that readers go through without locking. A
+// writer makes the version odd while it changes the data. A reader takes
+// the version before it reads, and reads again unless the version is the
+// same afterwards. Readers never hold it, so it can be embedded and needs
+// no destroy.
+struct vlatch {
+    unsigned vl_version;
+};
+void vlatch_init(struct vlatch *vl);
+// Waits out a writer that holds it, and returns the version to validate
+unsigned vlatch_read_begin(struct vlatch *vl);
+// True if nothing was written since version was taken
+bool vlatch_read_validate(struct vlatch *vl, unsigned version);
+void vlatch_write_acquire(struct vlatch *vl);
+void vlatch_write_release(struct vlatch *vl);
+
 #endif
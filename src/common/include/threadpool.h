@@ -1,8 +1,43 @@
 #ifndef _THREADPOOL_H_
 #define _THREADPOOL_H_
 
+#include <stdbool.h>
+
+// A pool of worker threads, which runs two kinds of work.
+//
+// Jobs are long running, like a client connection. A job keeps the worker
+// that takes it until it returns, and jobs are taken in the order they
+// were added.
+//
+// Tasks are small pieces of a bigger piece of work, like a morsel of a
+// scan, and belong to a task group. Each worker keeps the tasks it spawns
+// in a deque of its own and runs the newest first, and a worker with
+// nothing to do steals the oldest task of another. A thread that waits on a
+// group runs tasks of the group until it is done, so a task may spawn
+// subtasks and wait for them, and tasks spawned by a job are run even when
+// every worker has a job. It runs no tasks of other groups, which could
+// need locks it holds.
+//
+// Routines are passed the number of the worker that runs them, or the
+// number of workers for a thread outside the pool.
+//
+// Workers may be pinned to the CPUs of a memory node, and are then spread
+// evenly over the nodes we may run on. A worker looks for tasks on its own
+// node before it steals from another, and the memory it touches first is
+// placed on its node.
+
 struct threadpool;
 
+enum threadpool_affinity {
+    TP_AFFINITY_NONE, // workers run anywhere, as one node
+    TP_AFFINITY_NODE, // each worker runs on any CPU of its node
+    TP_AFFINITY_CORE, // each worker runs on one CPU of its node, shared only
+                      // when there are more workers than CPUs
+};
+
+// For the pools created after. Ignored where we can't pin threads.
+void threadpool_set_affinity(enum threadpool_affinity affinity);
+
 struct job {
     void *j_arg;
     void (*j_routine)(void *arg, unsigned threadnum);
@@ -10,9 +45,37 @@ struct job {
 
 struct threadpool *threadpool_create(unsigned nthreads);
 void threadpool_destroy(struct threadpool *tpool);
+// Nodes the workers are spread over, at least 1
+unsigned threadpool_nnodes(struct threadpool *tpool);
 
 // return 0 on success, otherwise error.
 // the threadpool will create its own copy of job
 int threadpool_add_job(struct threadpool *tpool, struct job *job);
 
+struct task_group;
+
+// Runs tasks of group on the calling thread until done returns true, for a
+// thread that waits for some of the tasks rather than all of them.
+// Whatever makes done true has to call threadpool_notify after.
+void task_group_wait_until(struct task_group *group, bool (*done)(void *arg), void *arg);
+void threadpool_notify(struct threadpool *tpool);
+
+struct task_group *task_group_create(struct threadpool *tpool);
+// The group must have been waited on since its last task was spawned
+void task_group_destroy(struct task_group *group);
+
+// Queues routine to run on arg. A group is spawned into by the thread that
+// waits on it, or by its tasks, and by nobody else. Returns 0 on success,
+// otherwise error.
+int task_group_spawn(struct task_group *group,
+                     void (*routine)(void *arg, unsigned threadnum), void *arg);
+
+// Like task_group_spawn, but the task is run on a worker of node, mod the
+// number of nodes, unless all of them are busy and another is not
+int task_group_spawn_node(struct task_group *group, unsigned node,
+                          void (*routine)(void *arg, unsigned threadnum), void *arg);
+
+// Runs tasks until every task spawned into the group is done
+void task_group_wait(struct task_group *group);
+
 #endif
@@ -0,0 +1,32 @@
+#ifndef _WIRE_H_
+#define _WIRE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <db/common/operators.h>
+
+// Compact binary encoding of ops, so that a client which has already
+// parsed a query does not send it as text for the server to parse again.
+//
+// An op is its type followed by its fields in a fixed order: enums and
+// bools as one byte, numbers as four bytes in network order, and names as
+// a varint length followed by the characters. Only the names take space
+// in proportion to what was written, so a select is a few dozen bytes.
+
+// The number of bytes op_encode will write for op
+size_t wire_op_size(struct op *op);
+// Writes op to buf, which must have room for wire_op_size(op) bytes.
+// Returns the number of bytes written.
+size_t wire_op_encode(struct op *op, char *buf);
+// Reads an op from the len bytes of buf. Returns 0 and the op, which is
+// allocated with op_size bytes and must be freed, or DBEWIRE if the bytes
+// are not an op.
+int wire_op_decode(const char *buf, size_t len, struct op **retop);
+
+// Varints for the lengths of names and of ops in a message
+size_t wire_varint_size(uint64_t val);
+size_t wire_varint_encode(uint64_t val, char *buf);
+// Returns the bytes read, or 0 if buf does not hold a whole varint
+size_t wire_varint_decode(const char *buf, size_t len, uint64_t *retval);
+
+#endif
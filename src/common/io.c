@@ -1,9 +1,16 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <db/common/dberror.h>
 #include <db/common/io.h>
 
@@ -54,22 +61,119 @@ io_write(int fd, void *buf, int nbytes)
     return io_readwrite(fd, buf, nbytes, IO_WRITE);
 }
 
+// Largest piece we hand to sendfile or splice at once
+#define IO_CHUNK (1 << 30)
+
+// The result of a zero-copy attempt: done, not possible for these fds, or
+// stopped early after some bytes were already moved
+enum io_zerocopy {
+    IO_ZC_DONE,
+    IO_ZC_UNSUPPORTED,
+    IO_ZC_EOF,
+    IO_ZC_ERROR,
+};
+
+// Copies with sendfile, which works when readfd can be mapped, so from a
+// regular file to anything.
+static
+enum io_zerocopy
+io_copy_sendfile(int readfd, int writefd, uint64_t *total, uint64_t expected_bytes)
+{
+    while (*total < expected_bytes) {
+        ssize_t n = sendfile(writefd, readfd, NULL, MIN(IO_CHUNK, expected_bytes - *total));
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && *total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            return IO_ZC_UNSUPPORTED;
+        }
+        if (n <= 0) {
+            return (n == 0) ? IO_ZC_EOF : IO_ZC_ERROR;
+        }
+        *total += n;
+    }
+    return IO_ZC_DONE;
+}
+
+// Copies with splice through a pipe, which works when either end is a
+// socket or a pipe, such as a socket into a file.
+static
+enum io_zerocopy
+io_copy_splice(int readfd, int writefd, uint64_t *total, uint64_t expected_bytes)
+{
+    int pipefds[2];
+    if (pipe(pipefds) == -1) {
+        return IO_ZC_UNSUPPORTED;
+    }
+    enum io_zerocopy result = IO_ZC_DONE;
+    while (*total < expected_bytes) {
+        ssize_t nin = splice(readfd, NULL, pipefds[1], NULL,
+                             MIN(IO_CHUNK, expected_bytes - *total), SPLICE_F_MOVE);
+        if (nin == -1 && errno == EINTR) {
+            continue;
+        }
+        if (nin == -1 && *total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            result = IO_ZC_UNSUPPORTED;
+            break;
+        }
+        if (nin <= 0) {
+            result = (nin == 0) ? IO_ZC_EOF : IO_ZC_ERROR;
+            break;
+        }
+        // drain the pipe before reading more
+        while (nin > 0) {
+            ssize_t nout = splice(pipefds[0], NULL, writefd, NULL, nin, SPLICE_F_MOVE);
+            if (nout == -1 && errno == EINTR) {
+                continue;
+            }
+            if (nout <= 0) {
+                result = IO_ZC_ERROR;
+                goto done;
+            }
+            nin -= nout;
+            *total += nout;
+        }
+    }
+  done:
+    assert(close(pipefds[0]) == 0);
+    assert(close(pipefds[1]) == 0);
+    return result;
+}
+
 int
 io_copy(int readfd, int writefd, uint64_t expected_bytes)
 {
+    // Move the data inside the kernel when we can, and fall back to a
+    // buffer otherwise
     uint64_t total = 0;
-    int nr, nw;
-    char buf[BUFSIZE];
-    bzero(buf, BUFSIZE);
-    while ((nr = read(readfd, buf, MIN(BUFSIZE, expected_bytes - total))) > 0) {
-        nw = write(writefd, buf, nr);
-        assert(nw == nr);
-        total += nr;
+    enum io_zerocopy zc = io_copy_sendfile(readfd, writefd, &total, expected_bytes);
+    if (zc == IO_ZC_UNSUPPORTED) {
+        zc = io_copy_splice(readfd, writefd, &total, expected_bytes);
+    }
+    if (zc == IO_ZC_DONE) {
+        return 0;
     }
-    if (nr == -1) {
+    if (zc == IO_ZC_EOF) {
+        return DBEIOEARLYEOF;
+    }
+    if (zc == IO_ZC_ERROR) {
         return DBEIOCHECKERRNO;
     }
-    if (nr == 0 && (total != expected_bytes)) {
+
+    int nr;
+    char buf[BUFSIZE];
+    while (total < expected_bytes
+           && (nr = read(readfd, buf, MIN(BUFSIZE, expected_bytes - total))) != 0) {
+        if (nr == -1) {
+            return DBEIOCHECKERRNO;
+        }
+        int result = io_write(writefd, buf, nr);
+        if (result) {
+            return result;
+        }
+        total += nr;
+    }
+    if (total != expected_bytes) {
         return DBEIOEARLYEOF;
     }
     return 0;
@@ -83,3 +187,11 @@ io_size(int fd)
     assert(result == 0);
     return buf.st_size;
 }
+
+void
+io_cork(int fd, bool cork)
+{
+    // Only TCP sockets can be corked; anything else just sends as it goes
+    int val = cork;
+    (void) setsockopt(fd, IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+}
@@ -145,6 +145,21 @@ list_remtail(struct list *lst)
     return item;
 }
 
+void *
+list_remove(struct list *lst, struct listnode *lnode)
+{
+    assert(lst != NULL);
+    assert(lst->lst_size > 0);
+    assert(lnode != NULL);
+    assert(lnode != &lst->lst_head && lnode != &lst->lst_tail);
+    void *item = lnode->ln_item;
+    lnode->ln_next->ln_prev = lnode->ln_prev;
+    lnode->ln_prev->ln_next = lnode->ln_next;
+    free(lnode);
+    lst->lst_size--;
+    return item;
+}
+
 // returns NULL if there are no more items left
 struct listnode *
 list_iterhead(struct list *lst)
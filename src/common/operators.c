@@ -21,6 +21,15 @@ char *op_string(struct op *op) {
                 op->op_select.op_sel_col);
         break;
     case OP_SELECT_RANGE_ASSIGN:
+        if (op->op_select.op_sel_pos[0] != '\0') {
+            sprintf(buf, "%s=select(%s,%s,%u,%u)",
+                    op->op_select.op_sel_var,
+                    op->op_select.op_sel_pos,
+                    op->op_select.op_sel_col,
+                    op->op_select.op_sel_low,
+                    op->op_select.op_sel_high);
+            break;
+        }
         sprintf(buf, "%s=select(%s,%u,%u)",
                 op->op_select.op_sel_var,
                 op->op_select.op_sel_col,
@@ -38,6 +47,14 @@ char *op_string(struct op *op) {
                 op->op_select.op_sel_col);
         break;
     case OP_SELECT_RANGE:
+        if (op->op_select.op_sel_pos[0] != '\0') {
+            sprintf(buf, "select(%s,%s,%u,%u)",
+                    op->op_select.op_sel_pos,
+                    op->op_select.op_sel_col,
+                    op->op_select.op_sel_low,
+                    op->op_select.op_sel_high);
+            break;
+        }
         sprintf(buf, "select(%s,%u,%u)",
                 op->op_select.op_sel_col,
                 op->op_select.op_sel_low,
@@ -89,7 +106,20 @@ char *op_string(struct op *op) {
                 op->op_tuple.op_tuple_vars);
         break;
     case OP_AGG:
-        if (op->op_agg.op_agg_assign) {
+        if (op->op_agg.op_agg_math && op->op_agg.op_agg_assign) {
+            sprintf(buf, "%s=%s(%s(%s,%s))",
+                    op->op_agg.op_agg_var,
+                    agg_type_string(op->op_agg.op_agg_atype),
+                    math_type_string(op->op_agg.op_agg_mtype),
+                    op->op_agg.op_agg_col,
+                    op->op_agg.op_agg_col2);
+        } else if (op->op_agg.op_agg_math) {
+            sprintf(buf, "%s(%s(%s,%s))",
+                    agg_type_string(op->op_agg.op_agg_atype),
+                    math_type_string(op->op_agg.op_agg_mtype),
+                    op->op_agg.op_agg_col,
+                    op->op_agg.op_agg_col2);
+        } else if (op->op_agg.op_agg_assign) {
             sprintf(buf, "%s=%s(%s)",
                     op->op_agg.op_agg_var,
                     agg_type_string(op->op_agg.op_agg_atype),
@@ -125,6 +155,27 @@ char *op_string(struct op *op) {
                 op->op_join.op_join_inputL,
                 op->op_join.op_join_inputR);
         break;
+    case OP_SET:
+        if (op->op_set.op_set_assign) {
+            sprintf(buf, "%s=", op->op_set.op_set_var);
+        }
+        if (op->op_set.op_set_stype == SET_NOT) {
+            sprintf(buf + strlen(buf), "%s(%s)",
+                    set_type_string(op->op_set.op_set_stype),
+                    op->op_set.op_set_ids1);
+        } else {
+            sprintf(buf + strlen(buf), "%s(%s,%s)",
+                    set_type_string(op->op_set.op_set_stype),
+                    op->op_set.op_set_ids1,
+                    op->op_set.op_set_ids2);
+        }
+        break;
+    case OP_BATCH_QUERIES:
+        sprintf(buf, "batch_queries()");
+        break;
+    case OP_BATCH_EXECUTE:
+        sprintf(buf, "batch_execute()");
+        break;
     default: assert(0); return NULL;
     }
 
@@ -132,6 +183,51 @@ char *op_string(struct op *op) {
     return buf;
 }
 
+size_t op_size(struct op *op) {
+    size_t size = offsetof(struct op, op_select);
+    switch (op->op_type) {
+    case OP_SELECT_ALL_ASSIGN:
+    case OP_SELECT_RANGE_ASSIGN:
+    case OP_SELECT_VALUE_ASSIGN:
+    case OP_SELECT_ALL:
+    case OP_SELECT_RANGE:
+    case OP_SELECT_VALUE:
+        return size + sizeof(struct op_select);
+    case OP_FETCH:
+    case OP_FETCH_ASSIGN:
+        return size + sizeof(struct op_fetch);
+    case OP_CREATE:
+        return size + sizeof(struct op_create);
+    case OP_LOAD:
+        return size + sizeof(struct op_load);
+    case OP_INSERT:
+        // only as much of the list as there is
+        return offsetof(struct op, op_insert.op_insert_cols)
+               + strlen(op->op_insert.op_insert_cols) + 1;
+    case OP_DELETE:
+        return size + sizeof(struct op_delete);
+    case OP_UPDATE:
+        return size + sizeof(struct op_update);
+    case OP_TUPLE:
+        return offsetof(struct op, op_tuple.op_tuple_vars)
+               + strlen(op->op_tuple.op_tuple_vars) + 1;
+    case OP_AGG:
+        return size + sizeof(struct op_agg);
+    case OP_MATH:
+        return size + sizeof(struct op_math);
+    case OP_PRINT:
+        return size + sizeof(struct op_print);
+    case OP_JOIN:
+        return size + sizeof(struct op_join);
+    case OP_SET:
+        return size + sizeof(struct op_set);
+    case OP_BATCH_QUERIES:
+    case OP_BATCH_EXECUTE:
+        return size;
+    default: assert(0); return sizeof(struct op);
+    }
+}
+
 enum storage_type storage_type_from_string(char *s) {
     if (strcmp(s, "unsorted") == 0) {
         return STORAGE_UNSORTED;
@@ -165,6 +261,28 @@ char *math_type_string(enum math_type mtype) {
     }
 }
 
+bool math_type_from_string(char *s, enum math_type *retmtype) {
+    enum math_type mtypes[] = { MATH_ADD, MATH_SUB, MATH_MUL, MATH_DIV };
+    for (unsigned i = 0; i < sizeof(mtypes) / sizeof(enum math_type); i++) {
+        if (strcmp(s, math_type_string(mtypes[i])) == 0) {
+            *retmtype = mtypes[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool agg_type_from_string(char *s, enum agg_type *retatype) {
+    enum agg_type atypes[] = { AGG_MIN, AGG_MAX, AGG_SUM, AGG_AVG, AGG_COUNT };
+    for (unsigned i = 0; i < sizeof(atypes) / sizeof(enum agg_type); i++) {
+        if (strcmp(s, agg_type_string(atypes[i])) == 0) {
+            *retatype = atypes[i];
+            return true;
+        }
+    }
+    return false;
+}
+
 char *agg_type_string(enum agg_type atype) {
     switch (atype) {
     case AGG_MIN: return "min";
@@ -182,6 +300,16 @@ char *join_type_string(enum join_type jtype) {
     case JOIN_SORT: return "sortjoin";
     case JOIN_TREE: return "treejoin";
     case JOIN_HASH: return "hashjoin";
+    case JOIN_AUTO: return "join";
+    default: assert(0); return NULL;
+    }
+}
+
+char *set_type_string(enum set_type stype) {
+    switch (stype) {
+    case SET_AND: return "and";
+    case SET_OR: return "or";
+    case SET_NOT: return "not";
     default: assert(0); return NULL;
     }
 }
@@ -5,7 +5,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
-#include <regex.h>
+#include <limits.h>
 #include <db/common/array.h>
 #include <db/common/try.h>
 #include <db/common/operators.h>
@@ -71,341 +71,598 @@ parse_split_lines(char *query)
     return vec;
 }
 
+// Characters that end a name or a number
+#define PARSE_DELIMS "=,()\""
+
+// Most arguments any operator takes
+#define PARSE_MAXARGS 4
+
+enum token_type {
+    TOK_WORD,
+    TOK_EQUALS,
+    TOK_COMMA,
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_QUOTE,
+    TOK_END,
+};
+
+struct token {
+    enum token_type tok_type;
+    const char *tok_start;
+    unsigned tok_len;
+};
+
+// A line is parsed in one pass from left to right. p_tok is the token we
+// are looking at, and p_next is where the one after it starts.
+struct parser {
+    const char *p_line;
+    const char *p_next;
+    struct token p_tok;
+    struct parse_error *p_err;
+    // the names being assigned to, e.g. r and s in r,s=join(a,b)
+    unsigned p_nvars;
+    struct token p_vars[2];
+};
+
+static
+void
+parser_lex(struct parser *p)
+{
+    struct token *tok = &p->p_tok;
+    const char *s = p->p_next;
+    tok->tok_start = s;
+    tok->tok_len = 1;
+    switch (*s) {
+    case '\0': tok->tok_type = TOK_END; tok->tok_len = 0; break;
+    case '=': tok->tok_type = TOK_EQUALS; break;
+    case ',': tok->tok_type = TOK_COMMA; break;
+    case '(': tok->tok_type = TOK_LPAREN; break;
+    case ')': tok->tok_type = TOK_RPAREN; break;
+    case '"': tok->tok_type = TOK_QUOTE; break;
+    default:
+        tok->tok_type = TOK_WORD;
+        tok->tok_len = strcspn(s, PARSE_DELIMS);
+        break;
+    }
+    p->p_next = s + tok->tok_len;
+}
+
+// Records why the line is bad at tok. Always returns false.
+static
+bool
+parser_fail(struct parser *p, const struct token *tok, const char *msg)
+{
+    if (p->p_err != NULL) {
+        p->p_err->pe_pos = tok->tok_start - p->p_line;
+        p->p_err->pe_msg = msg;
+    }
+    return false;
+}
+
+static
+bool
+parser_expect(struct parser *p, enum token_type type, const char *msg)
+{
+    if (p->p_tok.tok_type != type) {
+        return parser_fail(p, &p->p_tok, msg);
+    }
+    parser_lex(p);
+    return true;
+}
+
+// Copies a word into buf, which holds size bytes with the '\0'
+static
+bool
+token_copy(struct parser *p, const struct token *tok, char *buf, size_t size)
+{
+    if (tok->tok_len >= size) {
+        return parser_fail(p, tok, "name too long");
+    }
+    memcpy(buf, tok->tok_start, tok->tok_len);
+    buf[tok->tok_len] = '\0';
+    return true;
+}
+
+// Reads a number. Only the canonical form is accepted, so a number
+// always prints back the way it was written.
+static
+bool
+token_number(struct parser *p, const struct token *tok, bool issigned,
+             long long *retval)
+{
+    const char *s = tok->tok_start;
+    unsigned len = tok->tok_len;
+    bool neg = false;
+    if (issigned && len > 1 && s[0] == '-') {
+        neg = true;
+        s++;
+        len--;
+    }
+    if (tok->tok_type != TOK_WORD || len == 0 || len > 10
+        || (s[0] == '0' && (len > 1 || neg))) {
+        return parser_fail(p, tok, "expected a number");
+    }
+    long long val = 0;
+    for (unsigned i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return parser_fail(p, tok, "expected a number");
+        }
+        val = val * 10 + (s[i] - '0');
+    }
+    val = neg ? -val : val;
+    if (issigned ? (val < INT_MIN || val > INT_MAX) : (val > UINT_MAX)) {
+        return parser_fail(p, tok, "number out of range");
+    }
+    *retval = val;
+    return true;
+}
+
+static
+bool
+token_unsigned(struct parser *p, const struct token *tok, unsigned *retval)
+{
+    long long val;
+    if (!token_number(p, tok, false, &val)) {
+        return false;
+    }
+    *retval = (unsigned) val;
+    return true;
+}
+
+static
+bool
+token_int(struct parser *p, const struct token *tok, int *retval)
+{
+    long long val;
+    if (!token_number(p, tok, true, &val)) {
+        return false;
+    }
+    *retval = (int) val;
+    return true;
+}
+
+// Collects between min and max comma separated words, up to the ')'
+static
+bool
+parser_args(struct parser *p, struct token *args, unsigned min, unsigned max,
+            unsigned *retn)
+{
+    unsigned n = 0;
+    while (1) {
+        if (p->p_tok.tok_type != TOK_WORD) {
+            return parser_fail(p, &p->p_tok, "expected a name or a number");
+        }
+        if (n == max) {
+            return parser_fail(p, &p->p_tok, "too many arguments");
+        }
+        args[n++] = p->p_tok;
+        parser_lex(p);
+        if (p->p_tok.tok_type != TOK_COMMA) {
+            break;
+        }
+        parser_lex(p);
+    }
+    if (n < min) {
+        return parser_fail(p, &p->p_tok, "too few arguments");
+    }
+    if (retn != NULL) {
+        *retn = n;
+    }
+    return true;
+}
+
+// Copies the text from the current token up to the first of stops, which
+// may hold delimiters, e.g. the a,1,b,2 in insert(a,1,b,2)
+static
+bool
+parser_raw(struct parser *p, const char *stops, char *buf, size_t size)
+{
+    struct token raw = p->p_tok;
+    raw.tok_type = TOK_WORD;
+    raw.tok_len = strcspn(raw.tok_start, stops);
+    if (raw.tok_len == 0) {
+        return parser_fail(p, &raw, "expected a value");
+    }
+    if (!token_copy(p, &raw, buf, size)) {
+        return false;
+    }
+    p->p_next = raw.tok_start + raw.tok_len;
+    parser_lex(p);
+    return true;
+}
+
+// The variable an operator assigns to, if any
+static
+bool
+parser_var(struct parser *p, unsigned i, char *buf, size_t size)
+{
+    if (i >= p->p_nvars) {
+        buf[0] = '\0';
+        return true;
+    }
+    return token_copy(p, &p->p_vars[i], buf, size);
+}
+
+static
+bool
+parse_select(struct parser *p, struct op *op, int subtype)
+{
+    (void) subtype;
+    struct op_select *sel = &op->op_select;
+    bzero(sel, sizeof(struct op_select));
+    bool assign = (p->p_nvars > 0);
+    struct token args[PARSE_MAXARGS];
+    unsigned nargs;
+    if (!parser_var(p, 0, sel->op_sel_var, COLUMNLEN)
+        || !parser_args(p, args, 1, 4, &nargs)) {
+        return false;
+    }
+    // select(col), select(col,value), select(col,low,high) or
+    // select(pos,col,low,high)
+    switch (nargs) {
+    case 1:
+        op->op_type = assign ? OP_SELECT_ALL_ASSIGN : OP_SELECT_ALL;
+        return token_copy(p, &args[0], sel->op_sel_col, COLUMNLEN);
+    case 2:
+        op->op_type = assign ? OP_SELECT_VALUE_ASSIGN : OP_SELECT_VALUE;
+        return token_copy(p, &args[0], sel->op_sel_col, COLUMNLEN)
+               && token_unsigned(p, &args[1], &sel->op_sel_value);
+    case 3:
+        op->op_type = assign ? OP_SELECT_RANGE_ASSIGN : OP_SELECT_RANGE;
+        return token_copy(p, &args[0], sel->op_sel_col, COLUMNLEN)
+               && token_unsigned(p, &args[1], &sel->op_sel_low)
+               && token_unsigned(p, &args[2], &sel->op_sel_high);
+    default:
+        op->op_type = assign ? OP_SELECT_RANGE_ASSIGN : OP_SELECT_RANGE;
+        return token_copy(p, &args[0], sel->op_sel_pos, COLUMNLEN)
+               && token_copy(p, &args[1], sel->op_sel_col, COLUMNLEN)
+               && token_unsigned(p, &args[2], &sel->op_sel_low)
+               && token_unsigned(p, &args[3], &sel->op_sel_high);
+    }
+}
+
+static
+bool
+parse_fetch(struct parser *p, struct op *op, int subtype)
+{
+    (void) subtype;
+    struct op_fetch *fetch = &op->op_fetch;
+    bzero(fetch, sizeof(struct op_fetch));
+    op->op_type = (p->p_nvars > 0) ? OP_FETCH_ASSIGN : OP_FETCH;
+    struct token args[2];
+    return parser_var(p, 0, fetch->op_fetch_var, COLUMNLEN / 2)
+           && parser_args(p, args, 2, 2, NULL)
+           && token_copy(p, &args[0], fetch->op_fetch_col, COLUMNLEN)
+           && token_copy(p, &args[1], fetch->op_fetch_pos, COLUMNLEN / 2);
+}
+
+static
+bool
+parse_create(struct parser *p, struct op *op, int subtype)
+{
+    (void) subtype;
+    struct op_create *create = &op->op_create;
+    bzero(create, sizeof(struct op_create));
+    op->op_type = OP_CREATE;
+    char stype[16];
+    struct token stypetok;
+    if (p->p_tok.tok_type != TOK_WORD
+        || !token_copy(p, &p->p_tok, create->op_create_col, COLUMNLEN)) {
+        return parser_fail(p, &p->p_tok, "expected a column");
+    }
+    parser_lex(p);
+    if (!parser_expect(p, TOK_COMMA, "expected ','")
+        || !parser_expect(p, TOK_QUOTE, "expected '\"'")) {
+        return false;
+    }
+    stypetok = p->p_tok;
+    if (!parser_raw(p, "\")", stype, sizeof(stype))
+        || !parser_expect(p, TOK_QUOTE, "expected '\"'")) {
+        return false;
+    }
+    for (enum storage_type t = STORAGE_SORTED; t <= STORAGE_BTREE; t++) {
+        if (strcmp(stype, storage_type_string(t)) == 0) {
+            create->op_create_stype = t;
+            return true;
+        }
+    }
+    return parser_fail(p, &stypetok, "unknown storage type");
+}
+
+static
+bool
+parse_load(struct parser *p, struct op *op, int subtype)
+{
+    (void) subtype;
+    bzero(&op->op_load, sizeof(struct op_load));
+    op->op_type = OP_LOAD;
+    return parser_expect(p, TOK_QUOTE, "expected '\"'")
+           && parser_raw(p, "\")", op->op_load.op_load_file, COLUMNLEN)
+           && parser_expect(p, TOK_QUOTE, "expected '\"'");
+}
+
+// insert and tuple keep their whole argument list as it is
+static
+bool
+parse_insert(struct parser *p, struct op *op, int subtype)
+{
+    op->op_type = subtype;
+    if (subtype == OP_INSERT) {
+        return parser_raw(p, ")", op->op_insert.op_insert_cols, TUPLELEN);
+    }
+    return parser_raw(p, ")", op->op_tuple.op_tuple_vars, TUPLELEN);
+}
+
+static
+bool
+parse_delete(struct parser *p, struct op *op, int subtype)
+{
+    (void) subtype;
+    struct op_delete *del = &op->op_delete;
+    bzero(del, sizeof(struct op_delete));
+    op->op_type = OP_DELETE;
+    if (p->p_tok.tok_type != TOK_WORD
+        || !token_copy(p, &p->p_tok, del->op_delete_var, COLUMNLEN)) {
+        return parser_fail(p, &p->p_tok, "expected a name");
+    }
+    parser_lex(p);
+    return parser_expect(p, TOK_COMMA, "expected ','")
+           && parser_raw(p, ")", del->op_delete_cols, COLUMNLEN);
+}
+
+static
+bool
+parse_update(struct parser *p, struct op *op, int subtype)
+{
+    (void) subtype;
+    struct op_update *update = &op->op_update;
+    bzero(update, sizeof(struct op_update));
+    op->op_type = OP_UPDATE;
+    struct token args[3];
+    return parser_args(p, args, 3, 3, NULL)
+           && token_copy(p, &args[0], update->op_update_var, COLUMNLEN)
+           && token_copy(p, &args[1], update->op_update_col, COLUMNLEN)
+           && token_int(p, &args[2], &update->op_update_val);
+}
+
+// Operands may be integer constants, e.g. add(a,-5), which the server
+// tells apart from names
+static
+bool
+parse_math(struct parser *p, struct op *op, int subtype)
+{
+    struct op_math *math = &op->op_math;
+    bzero(math, sizeof(struct op_math));
+    op->op_type = OP_MATH;
+    math->op_math_mtype = subtype;
+    math->op_math_assign = (p->p_nvars > 0);
+    struct token args[2];
+    return parser_var(p, 0, math->op_math_var, COLUMNLEN)
+           && parser_args(p, args, 2, 2, NULL)
+           && token_copy(p, &args[0], math->op_math_col1, COLUMNLEN)
+           && token_copy(p, &args[1], math->op_math_col2, COLUMNLEN);
+}
+
+// An aggregate of a column, or of a math operator, e.g. x=sum(mul(a,b))
+static
+bool
+parse_agg(struct parser *p, struct op *op, int subtype)
+{
+    struct op_agg *agg = &op->op_agg;
+    bzero(agg, sizeof(struct op_agg));
+    op->op_type = OP_AGG;
+    agg->op_agg_atype = subtype;
+    agg->op_agg_assign = (p->p_nvars > 0);
+    if (!parser_var(p, 0, agg->op_agg_var, COLUMNLEN)) {
+        return false;
+    }
+    struct token args[2];
+    if (p->p_tok.tok_type != TOK_WORD || *p->p_next != '(') {
+        return parser_args(p, args, 1, 1, NULL)
+               && token_copy(p, &args[0], agg->op_agg_col, COLUMNLEN);
+    }
+    struct token mathtok = p->p_tok;
+    char mathname[16];
+    if (mathtok.tok_len >= sizeof(mathname)) {
+        return parser_fail(p, &mathtok, "unknown math operator");
+    }
+    memcpy(mathname, mathtok.tok_start, mathtok.tok_len);
+    mathname[mathtok.tok_len] = '\0';
+    if (!math_type_from_string(mathname, &agg->op_agg_mtype)) {
+        return parser_fail(p, &mathtok, "unknown math operator");
+    }
+    agg->op_agg_math = true;
+    parser_lex(p);
+    return parser_expect(p, TOK_LPAREN, "expected '('")
+           && parser_args(p, args, 2, 2, NULL)
+           && token_copy(p, &args[0], agg->op_agg_col, COLUMNLEN)
+           && token_copy(p, &args[1], agg->op_agg_col2, COLUMNLEN)
+           && parser_expect(p, TOK_RPAREN, "expected ')'");
+}
+
+static
+bool
+parse_print(struct parser *p, struct op *op, int subtype)
+{
+    (void) subtype;
+    bzero(&op->op_print, sizeof(struct op_print));
+    op->op_type = OP_PRINT;
+    struct token args[1];
+    return parser_args(p, args, 1, 1, NULL)
+           && token_copy(p, &args[0], op->op_print.op_print_var, COLUMNLEN);
+}
+
+static
+bool
+parse_join(struct parser *p, struct op *op, int subtype)
+{
+    struct op_join *join = &op->op_join;
+    bzero(join, sizeof(struct op_join));
+    op->op_type = OP_JOIN;
+    join->op_join_jtype = subtype;
+    struct token args[2];
+    return parser_var(p, 0, join->op_join_varL, COLUMNLEN)
+           && parser_var(p, 1, join->op_join_varR, COLUMNLEN)
+           && parser_args(p, args, 2, 2, NULL)
+           && token_copy(p, &args[0], join->op_join_inputL, COLUMNLEN)
+           && token_copy(p, &args[1], join->op_join_inputR, COLUMNLEN);
+}
+
+static
+bool
+parse_set(struct parser *p, struct op *op, int subtype)
+{
+    struct op_set *set = &op->op_set;
+    bzero(set, sizeof(struct op_set));
+    op->op_type = OP_SET;
+    set->op_set_stype = subtype;
+    set->op_set_assign = (p->p_nvars > 0);
+    unsigned nargs = (subtype == SET_NOT) ? 1 : 2;
+    struct token args[2];
+    if (!parser_var(p, 0, set->op_set_var, COLUMNLEN)
+        || !parser_args(p, args, nargs, nargs, NULL)
+        || !token_copy(p, &args[0], set->op_set_ids1, COLUMNLEN)) {
+        return false;
+    }
+    return (nargs == 1) || token_copy(p, &args[1], set->op_set_ids2, COLUMNLEN);
+}
+
+// batch_queries() and batch_execute(), which take no arguments
+static
+bool
+parse_batch(struct parser *p, struct op *op, int subtype)
+{
+    (void) p;
+    op->op_type = subtype;
+    return true;
+}
+
+// How to parse the arguments of each operator, and how many names it may
+// assign to
+struct parse_rule {
+    const char *pr_name;
+    bool (*pr_parse)(struct parser *p, struct op *op, int subtype);
+    int pr_subtype;
+    unsigned pr_minvars;
+    unsigned pr_maxvars;
+};
+
+static const struct parse_rule parse_rules[] = {
+    { "select", parse_select, 0, 0, 1 },
+    { "fetch", parse_fetch, 0, 0, 1 },
+    { "create", parse_create, 0, 0, 0 },
+    { "load", parse_load, 0, 0, 0 },
+    { "insert", parse_insert, OP_INSERT, 0, 0 },
+    { "tuple", parse_insert, OP_TUPLE, 0, 0 },
+    { "delete", parse_delete, 0, 0, 0 },
+    { "update", parse_update, 0, 0, 0 },
+    { "add", parse_math, MATH_ADD, 0, 1 },
+    { "sub", parse_math, MATH_SUB, 0, 1 },
+    { "mul", parse_math, MATH_MUL, 0, 1 },
+    { "div", parse_math, MATH_DIV, 0, 1 },
+    { "min", parse_agg, AGG_MIN, 0, 1 },
+    { "max", parse_agg, AGG_MAX, 0, 1 },
+    { "sum", parse_agg, AGG_SUM, 0, 1 },
+    { "avg", parse_agg, AGG_AVG, 0, 1 },
+    { "count", parse_agg, AGG_COUNT, 0, 1 },
+    { "print", parse_print, 0, 0, 0 },
+    { "loopjoin", parse_join, JOIN_LOOP, 2, 2 },
+    { "sortjoin", parse_join, JOIN_SORT, 2, 2 },
+    { "treejoin", parse_join, JOIN_TREE, 2, 2 },
+    { "hashjoin", parse_join, JOIN_HASH, 2, 2 },
+    { "join", parse_join, JOIN_AUTO, 2, 2 },
+    { "and", parse_set, SET_AND, 0, 1 },
+    { "or", parse_set, SET_OR, 0, 1 },
+    { "not", parse_set, SET_NOT, 0, 1 },
+    { "batch_queries", parse_batch, OP_BATCH_QUERIES, 0, 0 },
+    { "batch_execute", parse_batch, OP_BATCH_EXECUTE, 0, 0 },
+};
+
+// Parses [var[,var]=]operator(args) into op
+static
+bool
+parse_statement(struct parser *p, struct op *op)
+{
+    // names followed by '=' are assigned to
+    if (p->p_tok.tok_type == TOK_WORD && (*p->p_next == '=' || *p->p_next == ',')) {
+        while (1) {
+            if (p->p_tok.tok_type != TOK_WORD) {
+                return parser_fail(p, &p->p_tok, "expected a name");
+            }
+            if (p->p_nvars == 2) {
+                return parser_fail(p, &p->p_tok, "too many names");
+            }
+            p->p_vars[p->p_nvars++] = p->p_tok;
+            parser_lex(p);
+            if (p->p_tok.tok_type != TOK_COMMA) {
+                break;
+            }
+            parser_lex(p);
+        }
+        if (!parser_expect(p, TOK_EQUALS, "expected '='")) {
+            return false;
+        }
+    }
+
+    struct token optok = p->p_tok;
+    const struct parse_rule *rule = NULL;
+    for (unsigned i = 0; i < sizeof(parse_rules) / sizeof(parse_rules[0]); i++) {
+        if (optok.tok_type == TOK_WORD
+            && strlen(parse_rules[i].pr_name) == optok.tok_len
+            && strncmp(parse_rules[i].pr_name, optok.tok_start, optok.tok_len) == 0) {
+            rule = &parse_rules[i];
+            break;
+        }
+    }
+    if (rule == NULL) {
+        return parser_fail(p, &optok, "unknown operator");
+    }
+    if (p->p_nvars < rule->pr_minvars || p->p_nvars > rule->pr_maxvars) {
+        return parser_fail(p, &optok, (rule->pr_maxvars == 0)
+                           ? "operator cannot be assigned"
+                           : "wrong number of names assigned");
+    }
+    parser_lex(p);
+    return parser_expect(p, TOK_LPAREN, "expected '('")
+           && rule->pr_parse(p, op, rule->pr_subtype)
+           && parser_expect(p, TOK_RPAREN, "expected ')'")
+           && parser_expect(p, TOK_END, "unexpected text after ')'");
+}
+
 struct op *
-parse_line(char *line)
+parse_line_err(char *line, struct parse_error *reterr)
 {
+    assert(line != NULL);
     int result;
-    struct op *op;
-    char *s;
-    TRYNULL(result, DBENOMEM, op, malloc(sizeof(struct op)), done);
-    char stype_buf[16];
-
-    // Because scanf is greedy, we need to put the select
-    // in decreasing number of arguments.
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=select(%[^,],%u,%u)",
-        (char *) &op->op_select.op_sel_var,
-        (char *) &op->op_select.op_sel_col,
-        &op->op_select.op_sel_low,
-        &op->op_select.op_sel_high) == 4) {
-        op->op_type = OP_SELECT_RANGE_ASSIGN;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=select(%[^,],%u)",
-        (char *) &op->op_select.op_sel_var,
-        (char *) &op->op_select.op_sel_col,
-        &op->op_select.op_sel_value) == 3) {
-        op->op_type = OP_SELECT_VALUE_ASSIGN;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=select(%[^,)])",
-        (char *) &op->op_select.op_sel_var,
-        (char *) &op->op_select.op_sel_col) == 2) {
-        op->op_type = OP_SELECT_ALL_ASSIGN;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "select(%[^,],%u,%u)",
-        (char *) &op->op_select.op_sel_col,
-        &op->op_select.op_sel_low,
-        &op->op_select.op_sel_high) == 3) {
-        op->op_type = OP_SELECT_RANGE;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "select(%[^,],%u)",
-        (char *) &op->op_select.op_sel_col,
-        &op->op_select.op_sel_value) == 2) {
-        op->op_type = OP_SELECT_VALUE;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "select(%[^,)])",
-        (char *) &op->op_select.op_sel_col) == 1) {
-        op->op_type = OP_SELECT_ALL;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=fetch(%[^,],%[^)])",
-        (char *) &op->op_fetch.op_fetch_var,
-        (char *) &op->op_fetch.op_fetch_col,
-        (char *) &op->op_fetch.op_fetch_pos) == 3) {
-        op->op_type = OP_FETCH_ASSIGN;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "fetch(%[^,],%[^)])",
-        (char *) &op->op_fetch.op_fetch_col,
-        (char *) &op->op_fetch.op_fetch_pos) == 2) {
-        op->op_type = OP_FETCH;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "create(%[^,],\"%[^)\"])",
-        (char *) &op->op_create.op_create_col,
-        (char *) stype_buf) == 2) {
-        op->op_type = OP_CREATE;
-        op->op_create.op_create_stype = storage_type_from_string(stype_buf);
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "load(\"%[^)\"])",
-        (char *) &op->op_load.op_load_file) == 1) {
-        op->op_type = OP_LOAD;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "insert(%[^)])",
-        (char *) &op->op_insert.op_insert_cols) == 1) {
-        op->op_type = OP_INSERT;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "delete(%[^,],%[^)])",
-        (char *) &op->op_delete.op_delete_var,
-        (char *) &op->op_delete.op_delete_cols) == 2) {
-        op->op_type = OP_DELETE;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "update(%[^,],%[^,],%d)",
-        (char *) &op->op_update.op_update_var,
-        (char *) &op->op_update.op_update_col,
-        &op->op_update.op_update_val) == 3) {
-        op->op_type = OP_UPDATE;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "tuple(%[^)])",
-        (char *) &op->op_tuple.op_tuple_vars) == 1) {
-        op->op_type = OP_TUPLE;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=add(%[^,],%[^)])",
-        (char *) &op->op_math.op_math_var,
-        (char *) &op->op_math.op_math_col1,
-        (char *) &op->op_math.op_math_col2) == 3) {
-        op->op_type = OP_MATH;
-        op->op_math.op_math_mtype = MATH_ADD;
-        op->op_math.op_math_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "add(%[^,],%[^)])",
-        (char *) &op->op_math.op_math_col1,
-        (char *) &op->op_math.op_math_col2) == 2) {
-        op->op_type = OP_MATH;
-        op->op_math.op_math_mtype = MATH_ADD;
-        op->op_math.op_math_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=sub(%[^,],%[^)])",
-        (char *) &op->op_math.op_math_var,
-        (char *) &op->op_math.op_math_col1,
-        (char *) &op->op_math.op_math_col2) == 3) {
-        op->op_type = OP_MATH;
-        op->op_math.op_math_mtype = MATH_SUB;
-        op->op_math.op_math_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "sub(%[^,],%[^)])",
-        (char *) &op->op_math.op_math_col1,
-        (char *) &op->op_math.op_math_col2) == 2) {
-        op->op_type = OP_MATH;
-        op->op_math.op_math_mtype = MATH_SUB;
-        op->op_math.op_math_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=mul(%[^,],%[^)])",
-        (char *) &op->op_math.op_math_var,
-        (char *) &op->op_math.op_math_col1,
-        (char *) &op->op_math.op_math_col2) == 3) {
-        op->op_type = OP_MATH;
-        op->op_math.op_math_mtype = MATH_MUL;
-        op->op_math.op_math_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "mul(%[^,],%[^)])",
-        (char *) &op->op_math.op_math_col1,
-        (char *) &op->op_math.op_math_col2) == 2) {
-        op->op_type = OP_MATH;
-        op->op_math.op_math_mtype = MATH_MUL;
-        op->op_math.op_math_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=div(%[^,],%[^)])",
-        (char *) &op->op_math.op_math_var,
-        (char *) &op->op_math.op_math_col1,
-        (char *) &op->op_math.op_math_col2) == 3) {
-        op->op_type = OP_MATH;
-        op->op_math.op_math_mtype = MATH_DIV;
-        op->op_math.op_math_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "div(%[^,],%[^)])",
-        (char *) &op->op_math.op_math_col1,
-        (char *) &op->op_math.op_math_col2) == 2) {
-        op->op_type = OP_MATH;
-        op->op_math.op_math_mtype = MATH_DIV;
-        op->op_math.op_math_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=min(%[^,)])",
-        (char *) &op->op_agg.op_agg_var,
-        (char *) &op->op_agg.op_agg_col) == 2) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_MIN;
-        op->op_agg.op_agg_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "min(%[^,)])",
-        (char *) &op->op_agg.op_agg_col) == 1) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_MIN;
-        op->op_agg.op_agg_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=max(%[^,)])",
-        (char *) &op->op_agg.op_agg_var,
-        (char *) &op->op_agg.op_agg_col) == 2) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_MAX;
-        op->op_agg.op_agg_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "max(%[^,)])",
-        (char *) &op->op_agg.op_agg_col) == 1) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_MAX;
-        op->op_agg.op_agg_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=avg(%[^,)])",
-        (char *) &op->op_agg.op_agg_var,
-        (char *) &op->op_agg.op_agg_col) == 2) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_AVG;
-        op->op_agg.op_agg_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "avg(%[^,)])",
-        (char *) &op->op_agg.op_agg_col) == 1) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_AVG;
-        op->op_agg.op_agg_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=sum(%[^,)])",
-        (char *) &op->op_agg.op_agg_var,
-        (char *) &op->op_agg.op_agg_col) == 2) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_SUM;
-        op->op_agg.op_agg_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "sum(%[^,)])",
-        (char *) &op->op_agg.op_agg_col) == 1) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_SUM;
-        op->op_agg.op_agg_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=]=count(%[^,)])",
-        (char *) &op->op_agg.op_agg_var,
-        (char *) &op->op_agg.op_agg_col) == 2) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_COUNT;
-        op->op_agg.op_agg_assign = true;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "count(%[^,)])",
-        (char *) &op->op_agg.op_agg_col) == 1) {
-        op->op_type = OP_AGG;
-        op->op_agg.op_agg_atype = AGG_COUNT;
-        op->op_agg.op_agg_assign = false;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "print(%[^,)])",
-        (char *) &op->op_print.op_print_var) == 1) {
-        op->op_type = OP_PRINT;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=,],%[^=,]=loopjoin(%[^,],%[^)])",
-        (char *) &op->op_join.op_join_varL,
-        (char *) &op->op_join.op_join_varR,
-        (char *) &op->op_join.op_join_inputL,
-        (char *) &op->op_join.op_join_inputR) == 4) {
-        op->op_type = OP_JOIN;
-        op->op_join.op_join_jtype = JOIN_LOOP;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=,],%[^=,]=sortjoin(%[^,],%[^)])",
-        (char *) &op->op_join.op_join_varL,
-        (char *) &op->op_join.op_join_varR,
-        (char *) &op->op_join.op_join_inputL,
-        (char *) &op->op_join.op_join_inputR) == 4) {
-        op->op_type = OP_JOIN;
-        op->op_join.op_join_jtype = JOIN_SORT;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=,],%[^=,]=treejoin(%[^,],%[^)])",
-        (char *) &op->op_join.op_join_varL,
-        (char *) &op->op_join.op_join_varR,
-        (char *) &op->op_join.op_join_inputL,
-        (char *) &op->op_join.op_join_inputR) == 4) {
-        op->op_type = OP_JOIN;
-        op->op_join.op_join_jtype = JOIN_TREE;
-        goto check_extra_args;
-    }
-    bzero(op, sizeof(struct op));
-    if (sscanf(line, "%[^=,],%[^=,]=hashjoin(%[^,],%[^)])",
-        (char *) &op->op_join.op_join_varL,
-        (char *) &op->op_join.op_join_varR,
-        (char *) &op->op_join.op_join_inputL,
-        (char *) &op->op_join.op_join_inputR) == 4) {
-        op->op_type = OP_JOIN;
-        op->op_join.op_join_jtype = JOIN_HASH;
-        goto check_extra_args;
-    }
-    goto cleanup_op;
-
-  check_extra_args:
-    s = op_string(op);
-    result = strcmp(s, line);
-    free(s);
-    if (result == 0) {
+    struct op *op = NULL;
+    struct parser p;
+    p.p_line = line;
+    p.p_next = line;
+    p.p_err = reterr;
+    p.p_nvars = 0;
+    parser_lex(&p);
+
+    // Parse into a full op on the stack, but only allocate as much of it as
+    // the operator uses, which for most is a small part of op_insert
+    struct op parsed;
+    if (!parse_statement(&p, &parsed)) {
         goto done;
     }
-  cleanup_op:
-    free(op);
-    op = NULL;
+    size_t size = op_size(&parsed);
+    TRYNULL(result, DBENOMEM, op, malloc(size), done);
+    memcpy(op, &parsed, size);
   done:
+    (void) result;
     return op;
 }
 
+struct op *
+parse_line(char *line)
+{
+    return parse_line_err(line, NULL);
+}
+
 void
 parse_cleanup(struct op *op)
 {
@@ -417,16 +674,17 @@ void
 parse_cleanup_ops(struct oparray *ops)
 {
     assert(ops != NULL);
+    // from the end, so that nothing has to be moved down
     while (oparray_num(ops) != 0) {
-        struct op *op = oparray_get(ops, 0);
-        oparray_remove(ops, 0);
-        free(op);
+        unsigned last = oparray_num(ops) - 1;
+        free(oparray_get(ops, last));
+        oparray_remove(ops, last);
     }
     oparray_destroy(ops);
 }
 
 struct oparray *
-parse_query(char *query)
+parse_query_err(char *query, struct parse_error *reterr)
 {
     int result;
     struct oparray *ops = NULL;
@@ -436,8 +694,11 @@ parse_query(char *query)
     TRYNULL(result, DBENOMEM, ops, oparray_create(), cleanup_lines);
     for (unsigned i = 0; i < stringarray_num(lines); i++) {
         struct op *op;
+        if (reterr != NULL) {
+            reterr->pe_line = i;
+        }
         TRYNULL(result, DBEPARSE, op,
-                parse_line(stringarray_get(lines, i)), cleanup_oparray);
+                parse_line_err(stringarray_get(lines, i), reterr), cleanup_oparray);
         TRY(result, oparray_add(ops, op, NULL), cleanup_oparray);
     }
     goto cleanup_lines;
@@ -455,3 +716,9 @@ parse_query(char *query)
   done:
     return ops;
 }
+
+struct oparray *
+parse_query(char *query)
+{
+    return parse_query_err(query, NULL);
+}
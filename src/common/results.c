@@ -3,7 +3,11 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <db/common/bitmap.h>
+#include <db/common/idset.h>
+#include <db/common/dberror.h>
+#include <db/common/try.h>
 #include <db/common/results.h>
 #include <db/common/array.h>
 
@@ -21,9 +25,254 @@ column_ids_destroy(struct column_ids *cids)
         cids->cid_array->arr.num = 0;
         idarray_destroy(cids->cid_array);
         break;
+    case CID_IDSET:
+        idset_destroy(cids->cid_idset);
+        break;
+    default: assert(0); break;
+    }
+    free(cids);
+}
+
+struct column_ids *
+column_ids_create(enum column_ids_type type, unsigned nbits)
+{
+    struct column_ids *cids = malloc(sizeof(struct column_ids));
+    if (cids == NULL) {
+        return NULL;
+    }
+    bool created = false;
+    cids->cid_type = type;
+    cids->cid_col[0] = '\0';
+    cids->cid_index_col[0] = '\0';
+    switch (type) {
+    case CID_BITMAP:
+        cids->cid_bitmap = bitmap_create(nbits);
+        created = (cids->cid_bitmap != NULL);
+        break;
+    case CID_IDSET:
+        cids->cid_idset = idset_create(nbits);
+        created = (cids->cid_idset != NULL);
+        break;
+    default: assert(0); break;
+    }
+    if (!created) {
+        free(cids);
+        return NULL;
+    }
+    return cids;
+}
+
+int
+column_ids_add(struct column_ids *cids, unsigned id)
+{
+    assert(cids != NULL);
+    switch (cids->cid_type) {
+    case CID_BITMAP:
+        bitmap_mark(cids->cid_bitmap, id);
+        return 0;
+    case CID_IDSET:
+        return idset_add(cids->cid_idset, id);
+    default: assert(0); return DBEUNSUPPORTED;
+    }
+}
+
+int
+column_ids_add_range(struct column_ids *cids, unsigned start, unsigned end)
+{
+    assert(cids != NULL);
+    switch (cids->cid_type) {
+    case CID_BITMAP:
+        for (unsigned id = start; id < end; id++) {
+            bitmap_mark(cids->cid_bitmap, id);
+        }
+        return 0;
+    case CID_IDSET:
+        return idset_add_range(cids->cid_idset, start, end);
+    default: assert(0); return DBEUNSUPPORTED;
+    }
+}
+
+bool
+column_ids_contains(struct column_ids *cids, unsigned id)
+{
+    assert(cids != NULL);
+    switch (cids->cid_type) {
+    case CID_BITMAP: return bitmap_isset(cids->cid_bitmap, id);
+    case CID_IDSET: return idset_contains(cids->cid_idset, id);
+    default: assert(0); return false;
+    }
+}
+
+unsigned
+column_ids_nbits(struct column_ids *cids)
+{
+    assert(cids != NULL);
+    switch (cids->cid_type) {
+    case CID_BITMAP: return bitmap_nbits(cids->cid_bitmap);
+    case CID_IDSET: return idset_nbits(cids->cid_idset);
+    default: assert(0); return 0;
+    }
+}
+
+unsigned
+column_ids_count(struct column_ids *cids)
+{
+    assert(cids != NULL);
+    switch (cids->cid_type) {
+    case CID_BITMAP: return bitmap_count(cids->cid_bitmap);
+    case CID_ARRAY: return idarray_num(cids->cid_array);
+    case CID_IDSET: return idset_count(cids->cid_idset);
+    default: assert(0); return 0;
+    }
+}
+
+// Returns the ids as an idset. Unless they already are one, the set is
+// built here and *retowned tells the caller to destroy it.
+static
+int
+column_ids_to_idset(struct column_ids *cids, struct idset **retset,
+                    bool *retowned)
+{
+    int result;
+    struct idset *set = NULL;
+    unsigned nbits = 0;
+    switch (cids->cid_type) {
+    case CID_IDSET:
+        *retset = cids->cid_idset;
+        *retowned = false;
+        return 0;
+    case CID_BITMAP:
+        nbits = bitmap_nbits(cids->cid_bitmap);
+        break;
+    case CID_ARRAY:
+        for (unsigned i = 0; i < idarray_num(cids->cid_array); i++) {
+            unsigned id = (unsigned) idarray_get(cids->cid_array, i);
+            if (id >= nbits) {
+                nbits = id + 1;
+            }
+        }
+        break;
+    default: assert(0); break;
+    }
+
+    TRYNULL(result, DBENOMEM, set, idset_create(nbits), done);
+    struct cid_iterator iter;
+    cid_iter_init(&iter, cids);
+    unsigned idbuf[CID_BATCH];
+    unsigned nids;
+    while ((nids = cid_iter_next_batch(&iter, idbuf, CID_BATCH)) > 0) {
+        for (unsigned i = 0; i < nids; i++) {
+            TRY(result, idset_add(set, idbuf[i]), cleanup_set);
+        }
+    }
+    cid_iter_cleanup(&iter);
+
+    // success
+    result = 0;
+    *retset = set;
+    *retowned = true;
+    goto done;
+  cleanup_set:
+    cid_iter_cleanup(&iter);
+    idset_destroy(set);
+  done:
+    return result;
+}
+
+int
+column_ids_combine(enum set_type stype, struct column_ids *a,
+                   struct column_ids *b, struct column_ids **retids)
+{
+    assert(a != NULL);
+    assert(stype == SET_NOT || b != NULL);
+    assert(retids != NULL);
+
+    int result;
+    struct column_ids *cids;
+    struct idset *seta = NULL, *setb = NULL;
+    bool ownseta = false, ownsetb = false;
+    TRYNULL(result, DBENOMEM, cids, malloc(sizeof(struct column_ids)), done);
+    strcpy(cids->cid_col, a->cid_col);
+    if (cids->cid_col[0] == '\0' && b != NULL) {
+        strcpy(cids->cid_col, b->cid_col);
+    }
+    cids->cid_index_col[0] = '\0';
+
+    // The live positions of not(a) have to cover the same range as a
+    if (stype == SET_NOT && b != NULL && a->cid_type != CID_ARRAY
+            && (b->cid_type == CID_ARRAY
+                || column_ids_nbits(a) != column_ids_nbits(b))) {
+        result = DBECOLDIFFLEN;
+        DBLOG(result);
+        goto cleanup_malloc;
+    }
+
+    // Two bitmaps over the same ids are combined a word at a time
+    if (a->cid_type == CID_BITMAP
+            && ((stype == SET_NOT && b == NULL) || (b->cid_type == CID_BITMAP
+                && bitmap_nbits(a->cid_bitmap) == bitmap_nbits(b->cid_bitmap)))) {
+        cids->cid_type = CID_BITMAP;
+        TRYNULL(result, DBENOMEM, cids->cid_bitmap,
+                bitmap_copy(a->cid_bitmap), cleanup_malloc);
+        switch (stype) {
+        case SET_AND: bitmap_and(cids->cid_bitmap, b->cid_bitmap); break;
+        case SET_OR: bitmap_or(cids->cid_bitmap, b->cid_bitmap); break;
+        case SET_NOT:
+            bitmap_invert(cids->cid_bitmap);
+            if (b != NULL) {
+                bitmap_and(cids->cid_bitmap, b->cid_bitmap);
+            }
+            break;
+        default: assert(0); break;
+        }
+        goto success;
+    }
+
+    // Otherwise work on idsets
+    if (stype == SET_NOT && a->cid_type == CID_ARRAY) {
+        result = DBEVARTYPE;
+        DBLOG(result);
+        goto cleanup_malloc;
+    }
+    cids->cid_type = CID_IDSET;
+    TRY(result, column_ids_to_idset(a, &seta, &ownseta), cleanup_malloc);
+    if (stype == SET_NOT && b == NULL) {
+        // not(a) is everything but a
+        TRYNULL(result, DBENOMEM, setb, idset_create(idset_nbits(seta)), cleanup_sets);
+        ownsetb = true;
+        TRY(result, idset_add_range(setb, 0, idset_nbits(seta)), cleanup_sets);
+    } else {
+        TRY(result, column_ids_to_idset(b, &setb, &ownsetb), cleanup_sets);
+    }
+    switch (stype) {
+    case SET_AND:
+        TRY(result, idset_and(seta, setb, &cids->cid_idset), cleanup_sets);
+        break;
+    case SET_OR:
+        TRY(result, idset_or(seta, setb, &cids->cid_idset), cleanup_sets);
+        break;
+    case SET_NOT:
+        TRY(result, idset_andnot(setb, seta, &cids->cid_idset), cleanup_sets);
+        break;
     default: assert(0); break;
     }
+    goto success;
+
+  success:
+    result = 0;
+    *retids = cids;
+    cids = NULL; // the caller owns it now
+  cleanup_sets:
+    if (ownseta) {
+        idset_destroy(seta);
+    }
+    if (ownsetb) {
+        idset_destroy(setb);
+    }
+  cleanup_malloc:
     free(cids);
+  done:
+    return result;
 }
 
 void
@@ -50,17 +299,15 @@ cid_iter_has_next(struct cid_iterator *iter)
     assert(iter != NULL);
     switch (iter->ciditer_ids->cid_type) {
     case CID_BITMAP:
-        // Keep iterating until we find a bit that is set
-        while (iter->ciditer_i < bitmap_nbits(iter->ciditer_ids->cid_bitmap)) {
-            if (bitmap_isset(iter->ciditer_ids->cid_bitmap, iter->ciditer_i)) {
-                return true;
-            }
-            iter->ciditer_i++;
-        }
-        return false;
+        // Skip ahead to the next bit that is set
+        return bitmap_next_set(iter->ciditer_ids->cid_bitmap, iter->ciditer_i,
+                               &iter->ciditer_i);
     case CID_ARRAY:
         // We still have a next element as long as we're less than the bound
         return (iter->ciditer_i < idarray_num(iter->ciditer_ids->cid_array));
+    case CID_IDSET:
+        return idset_next_set(iter->ciditer_ids->cid_idset, iter->ciditer_i,
+                              &iter->ciditer_i);
     default: assert(0); return false;
     }
 }
@@ -72,6 +319,7 @@ cid_iter_get(struct cid_iterator *iter)
     uint64_t id;
     switch (iter->ciditer_ids->cid_type) {
     case CID_BITMAP:
+    case CID_IDSET:
         id = iter->ciditer_i;
         break;
     case CID_ARRAY:
@@ -84,6 +332,34 @@ cid_iter_get(struct cid_iterator *iter)
     return id;
 }
 
+unsigned
+cid_iter_next_batch(struct cid_iterator *iter, unsigned *buf, unsigned n)
+{
+    assert(iter != NULL);
+    assert(buf != NULL);
+    unsigned count = 0;
+    switch (iter->ciditer_ids->cid_type) {
+    case CID_BITMAP:
+        count = bitmap_extract(iter->ciditer_ids->cid_bitmap, &iter->ciditer_i,
+                               buf, n);
+        break;
+    case CID_ARRAY: {
+        struct idarray *ids = iter->ciditer_ids->cid_array;
+        unsigned len = idarray_num(ids);
+        while (count < n && iter->ciditer_i < len) {
+            buf[count++] = (unsigned) idarray_get(ids, iter->ciditer_i++);
+        }
+        break;
+    }
+    case CID_IDSET:
+        count = idset_extract(iter->ciditer_ids->cid_idset, &iter->ciditer_i,
+                              buf, n);
+        break;
+    default: assert(0); break;
+    }
+    return count;
+}
+
 void
 cid_iter_cleanup(struct cid_iterator *iter)
 {
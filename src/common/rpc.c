@@ -17,6 +17,7 @@
 #include <db/common/dberror.h>
 #include <db/common/array.h>
 #include <db/common/results.h>
+#include <db/common/wire.h>
 
 static
 uint64_t
@@ -46,6 +47,33 @@ hton64(const uint64_t input)
     return rval;
 }
 
+// Result values are converted and written this many at a time
+#define RPC_BATCH 4096
+
+static
+void
+rpc_header_encode(struct rpc_header *message, struct rpc_header *networkmsg)
+{
+    networkmsg->rpc_type = htonl(message->rpc_type);
+    networkmsg->rpc_magic = htonl(message->rpc_magic);
+    networkmsg->rpc_len = hton64(message->rpc_len);
+}
+
+// Reads n ints and puts them in host order
+static
+int
+rpc_read_ints(int fd, uint32_t *vals, unsigned n)
+{
+    int result;
+    TRY(result, io_read(fd, vals, n * sizeof(uint32_t)), done);
+    for (unsigned i = 0; i < n; i++) {
+        vals[i] = ntohl(vals[i]);
+    }
+    result = 0;
+  done:
+    return result;
+}
+
 int
 rpc_write_header(int fd, struct rpc_header *message)
 {
@@ -54,9 +82,7 @@ rpc_write_header(int fd, struct rpc_header *message)
 
     int result;
     struct rpc_header networkmsg;
-    networkmsg.rpc_type = htonl(message->rpc_type);
-    networkmsg.rpc_magic = htonl(message->rpc_magic);
-    networkmsg.rpc_len = hton64(message->rpc_len);
+    rpc_header_encode(message, &networkmsg);
     TRY(result, io_write(fd, (void *) &networkmsg, sizeof(struct rpc_header)), done);
     result = 0;
   done:
@@ -135,7 +161,13 @@ rpc_read_query(int fd, struct rpc_header *msg, struct op **retop)
     // includes null byte
     TRYNULL(result, DBENOMEM, payload, malloc(sizeof(char) * msg->rpc_len), done);
     TRY(result, io_read(fd, payload, msg->rpc_len), cleanup_payload);
-    TRYNULL(result, DBENOMEM, op, parse_line(payload), cleanup_payload);
+    struct parse_error err = { 0, 0, "out of memory" };
+    op = parse_line_err(payload, &err);
+    if (op == NULL) {
+        fprintf(stderr, "bad query [%s] at %u: %s\n", payload, err.pe_pos, err.pe_msg);
+        result = DBEPARSE;
+        goto cleanup_payload;
+    }
 
     // success
     printf("got query: [%s]\n", payload);
@@ -147,6 +179,102 @@ rpc_read_query(int fd, struct rpc_header *msg, struct op **retop)
     return result;
 }
 
+static
+int
+rpc_write_oplist(int fd, enum rpc_type type, struct oparray *ops,
+                 unsigned first, unsigned n)
+{
+    assert(ops != NULL);
+    assert(first + n <= oparray_num(ops));
+
+    int result;
+    size_t len = 0;
+    for (unsigned i = first; i < first + n; i++) {
+        size_t oplen = wire_op_size(oparray_get(ops, i));
+        len += wire_varint_size(oplen) + oplen;
+    }
+    char *payload;
+    TRYNULL(result, DBENOMEM, payload, malloc(len), done);
+    size_t pos = 0;
+    for (unsigned i = first; i < first + n; i++) {
+        struct op *op = oparray_get(ops, i);
+        pos += wire_varint_encode(wire_op_size(op), payload + pos);
+        pos += wire_op_encode(op, payload + pos);
+    }
+    assert(pos == len);
+
+    struct rpc_header msg;
+    msg.rpc_type = type;
+    msg.rpc_magic = RPC_HEADER_MAGIC;
+    msg.rpc_len = len;
+    TRY(result, rpc_write_header(fd, &msg), cleanup_payload);
+    TRY(result, io_write(fd, payload, len), cleanup_payload);
+    result = 0;
+    goto cleanup_payload;
+
+  cleanup_payload:
+    free(payload);
+  done:
+    return result;
+}
+
+int
+rpc_write_ops(int fd, struct oparray *ops, unsigned first, unsigned n)
+{
+    return rpc_write_oplist(fd, RPC_OPS, ops, first, n);
+}
+
+int
+rpc_write_script(int fd, struct oparray *ops, unsigned first, unsigned n)
+{
+    return rpc_write_oplist(fd, RPC_SCRIPT, ops, first, n);
+}
+
+int
+rpc_read_ops(int fd, struct rpc_header *msg, struct oparray **retops)
+{
+    assert(msg != NULL);
+    assert(retops != NULL);
+    assert(msg->rpc_type == RPC_OPS || msg->rpc_type == RPC_SCRIPT);
+
+    int result;
+    char *payload;
+    struct oparray *ops;
+    TRYNULL(result, DBENOMEM, payload, malloc(msg->rpc_len), done);
+    TRY(result, io_read(fd, payload, msg->rpc_len), cleanup_payload);
+    TRYNULL(result, DBENOMEM, ops, oparray_create(), cleanup_payload);
+    size_t pos = 0;
+    while (pos < msg->rpc_len) {
+        uint64_t oplen;
+        size_t n = wire_varint_decode(payload + pos, msg->rpc_len - pos, &oplen);
+        if (n == 0 || oplen > msg->rpc_len - pos - n) {
+            result = DBEWIRE;
+            DBLOG(result);
+            goto cleanup_ops;
+        }
+        pos += n;
+        struct op *op;
+        TRY(result, wire_op_decode(payload + pos, oplen, &op), cleanup_ops);
+        result = oparray_add(ops, op, NULL);
+        if (result) {
+            free(op);
+            goto cleanup_ops;
+        }
+        pos += oplen;
+    }
+
+    // success
+    *retops = ops;
+    result = 0;
+    goto cleanup_payload;
+  cleanup_ops:
+    parse_cleanup_ops(ops);
+  cleanup_payload:
+    free(payload);
+  done:
+    return result;
+}
+
 int
 rpc_read_file(int fd, struct rpc_header *msg, char *filename, int *retfd)
 {
@@ -181,7 +309,7 @@ int
 rpc_write_file(int fd, struct op *op)
 {
     assert(op != NULL);
-    assert(op->op_type = OP_LOAD);
+    assert(op->op_type == OP_LOAD);
 
     int result;
     struct rpc_header msg;
@@ -205,6 +333,46 @@ rpc_write_file(int fd, struct op *op)
     return result;
 }
 
+int
+rpc_write_file_path(int fd, char *path)
+{
+    assert(path != NULL);
+
+    int result;
+    struct rpc_header msg;
+    msg.rpc_type = RPC_FILE_PATH;
+    msg.rpc_magic = RPC_HEADER_MAGIC;
+    msg.rpc_len = strlen(path) + 1; // +1 for the null byte
+    TRY(result, rpc_write_header(fd, &msg), done);
+    TRY(result, io_write(fd, path, msg.rpc_len), done);
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+int
+rpc_read_file_path(int fd, struct rpc_header *msg, char **retpath)
+{
+    assert(msg != NULL);
+    assert(retpath != NULL);
+    assert(msg->rpc_type == RPC_FILE_PATH);
+
+    int result;
+    char *path;
+    TRYNULL(result, DBENOMEM, path, malloc(msg->rpc_len + 1), done);
+    TRY(result, io_read(fd, path, msg->rpc_len), cleanup_path);
+    path[msg->rpc_len] = '\0';
+    // success
+    *retpath = path;
+    result = 0;
+    goto done;
+  cleanup_path:
+    free(path);
+  done:
+    return result;
+}
+
 int
 rpc_write_tuple_result(int fd, struct column_vals **tuples, unsigned len)
 {
@@ -220,16 +388,30 @@ rpc_write_tuple_result(int fd, struct column_vals **tuples, unsigned len)
     msg.rpc_magic = RPC_HEADER_MAGIC;
     msg.rpc_len = len * sizeof(int);
 
-    // Write a tuple at a time
-    for (uint64_t tuple = 0; tuple < ntuples; tuple++) {
-        TRY(result, rpc_write_header(fd, &msg), done);
-        for (unsigned i = 0; i < len; i++) {
-            uint32_t networkint = htonl(tuples[i]->cval_vals[tuple]);
-            TRY(result, io_write(fd, &networkint, sizeof(uint32_t)), done);
+    // Every tuple is its own message. Fill a buffer with as many of them
+    // as fit and write it at once.
+    size_t tuplelen = sizeof(struct rpc_header) + len * sizeof(uint32_t);
+    uint64_t batch = (RPC_BATCH * sizeof(uint32_t)) / tuplelen;
+    batch = (batch > 0) ? batch : 1;
+    char *buf;
+    TRYNULL(result, DBENOMEM, buf, malloc(batch * tuplelen), done);
+    for (uint64_t start = 0; start < ntuples; start += batch) {
+        uint64_t end = (start + batch < ntuples) ? start + batch : ntuples;
+        char *p = buf;
+        for (uint64_t tuple = start; tuple < end; tuple++) {
+            rpc_header_encode(&msg, (struct rpc_header *) p);
+            uint32_t *vals = (uint32_t *) (p + sizeof(struct rpc_header));
+            for (unsigned i = 0; i < len; i++) {
+                vals[i] = htonl(tuples[i]->cval_vals[tuple]);
+            }
+            p += tuplelen;
         }
+        TRY(result, io_write(fd, buf, p - buf), cleanup_buf);
     }
     result = 0;
-    goto done;
+    goto cleanup_buf;
+  cleanup_buf:
+    free(buf);
   done:
     return result;
 }
@@ -247,11 +429,7 @@ rpc_read_tuple_result(int fd, struct rpc_header *msg,
     unsigned nints = bytes / sizeof(int);
     int *tuple;
     TRYNULL(result, DBENOMEM, tuple, malloc(bytes), done);
-    for (unsigned i = 0; i < nints; i++) {
-        int networkint;
-        TRY(result, io_read(fd, &networkint, sizeof(int)), cleanup_malloc);
-        tuple[i] = ntohl(networkint);
-    }
+    TRY(result, rpc_read_ints(fd, (uint32_t *) tuple, nints), cleanup_malloc);
     result = 0;
     *rettuple = tuple;
     *retlen = nints;
@@ -272,9 +450,14 @@ rpc_write_fetch_result(int fd, struct column_vals *vals)
     msg.rpc_magic = RPC_HEADER_MAGIC;
     msg.rpc_len = vals->cval_len * sizeof(int);
     TRY(result, rpc_write_header(fd, &msg), done);
-    for (unsigned i = 0; i < vals->cval_len; i++) {
-        uint32_t networkint = htonl(vals->cval_vals[i]);
-        TRY(result, io_write(fd, &networkint, sizeof(uint32_t)), done);
+    uint32_t buf[RPC_BATCH];
+    for (unsigned start = 0; start < vals->cval_len; start += RPC_BATCH) {
+        unsigned n = vals->cval_len - start;
+        n = (n < RPC_BATCH) ? n : RPC_BATCH;
+        for (unsigned i = 0; i < n; i++) {
+            buf[i] = htonl(vals->cval_vals[start + i]);
+        }
+        TRY(result, io_write(fd, buf, n * sizeof(uint32_t)), done);
     }
     result = 0;
     goto done;
@@ -297,17 +480,15 @@ rpc_read_fetch_result(int fd, struct rpc_header *msg, int **retvals, unsigned *r
     int *vals;
     TRYNULL(result, DBENOMEM, vals, malloc(bytes), done);
     unsigned nvals = bytes / (sizeof(int));
-    for (unsigned i = 0; i < nvals; i++) {
-        int networkint;
-        TRY(result, io_read(fd, &networkint, sizeof(int)), done);
-        vals[i] = ntohl(networkint);
-    }
+    TRY(result, rpc_read_ints(fd, (uint32_t *) vals, nvals), cleanup_malloc);
 
     // success
     result = 0;
     *retvals = vals;
     *retn = nvals;
     goto done;
+  cleanup_malloc:
+    free(vals);
   done:
     return result;
 }
@@ -317,35 +498,25 @@ rpc_write_select_result(int fd, struct column_ids *cids)
 {
     assert(cids != NULL);
 
-    // materialize the ids
     int result;
-    unsigned len = 0;
-    switch (cids->cid_type) {
-    case CID_BITMAP:
-        for (unsigned i = 0; i < bitmap_nbits(cids->cid_bitmap); i++) {
-            if (bitmap_isset(cids->cid_bitmap, i)) {
-                len++;
-            }
-        }
-        break;
-    case CID_ARRAY:
-        len = idarray_num(cids->cid_array);
-        break;
-    }
+    unsigned len = column_ids_count(cids);
 
     struct cid_iterator iter;
     cid_iter_init(&iter, cids);
 
-    // Prepare the header and serialize the results
+    // Prepare the header and serialize the results a batch at a time
     struct rpc_header msg;
     msg.rpc_type = RPC_SELECT_RESULT;
     msg.rpc_magic = RPC_HEADER_MAGIC;
     msg.rpc_len = len * sizeof(unsigned);
     TRY(result, rpc_write_header(fd, &msg), done);
-    while (cid_iter_has_next(&iter)) {
-        uint32_t i = (uint32_t) cid_iter_get(&iter);
-        uint32_t networkint = htonl((uint32_t) i);
-        TRY(result, io_write(fd, &networkint, sizeof(uint32_t)), done);
+    unsigned idbuf[CID_BATCH];
+    unsigned nids;
+    while ((nids = cid_iter_next_batch(&iter, idbuf, CID_BATCH)) > 0) {
+        for (unsigned i = 0; i < nids; i++) {
+            idbuf[i] = htonl((uint32_t) idbuf[i]);
+        }
+        TRY(result, io_write(fd, idbuf, nids * sizeof(uint32_t)), done);
     }
 
     // success
@@ -372,17 +543,15 @@ rpc_read_select_result(int fd, struct rpc_header *msg,
     unsigned *vals;
     TRYNULL(result, DBENOMEM, vals, malloc(bytes), done);
     unsigned nvals = bytes / (sizeof(unsigned));
-    for (unsigned i = 0; i < nvals; i++) {
-        int networkint;
-        TRY(result, io_read(fd, &networkint, sizeof(unsigned)), done);
-        vals[i] = ntohl(networkint);
-    }
+    TRY(result, rpc_read_ints(fd, vals, nvals), cleanup_malloc);
 
     // success
     result = 0;
     *retids = vals;
     *retn = nvals;
     goto done;
+  cleanup_malloc:
+    free(vals);
   done:
     return result;
 }
@@ -4,7 +4,9 @@
 int
 int_compare(const void *a, const void *b)
 {
-    return (*((int *) a) - *((int *) b));
+    int x = *((int *) a);
+    int y = *((int *) b);
+    return (x > y) - (x < y);
 }
 
 unsigned
@@ -24,3 +26,22 @@ binary_search(void *x, void *vals, unsigned nvals, size_t size,
     }
     return l;
 }
+
+unsigned
+int_lower_bound(int x, const void *vals, unsigned nvals, size_t stride)
+{
+    if (nvals == 0) {
+        return 0;
+    }
+    // the lower bound is always within [base, base + n)
+    const char *base = vals;
+    unsigned n = nvals;
+    while (n > 1) {
+        unsigned half = n / 2;
+        const char *mid = base + half * stride;
+        base = (*(const int *) mid < x) ? mid : base;
+        n -= half;
+    }
+    unsigned ix = (base - (const char *) vals) / stride;
+    return ix + (*(const int *) base < x);
+}
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -227,3 +228,57 @@ rwlock_release(struct rwlock *rwlk)
     assert(rwlk != NULL);
     assert(pthread_rwlock_unlock(&rwlk->rwlk_lock) == 0);
 }
+
+void
+vlatch_init(struct vlatch *vl)
+{
+    assert(vl != NULL);
+    __atomic_store_n(&vl->vl_version, 0, __ATOMIC_RELEASE);
+}
+
+unsigned
+vlatch_read_begin(struct vlatch *vl)
+{
+    assert(vl != NULL);
+    unsigned version;
+    // the reads that follow may not move ahead of the version
+    while ((version = __atomic_load_n(&vl->vl_version, __ATOMIC_ACQUIRE)) & 1) {
+        sched_yield();
+    }
+    return version;
+}
+
+bool
+vlatch_read_validate(struct vlatch *vl, unsigned version)
+{
+    assert(vl != NULL);
+    // nor may the reads before move after it
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&vl->vl_version, __ATOMIC_RELAXED) == version;
+}
+
+void
+vlatch_write_acquire(struct vlatch *vl)
+{
+    assert(vl != NULL);
+    while (1) {
+        unsigned version = __atomic_load_n(&vl->vl_version, __ATOMIC_RELAXED);
+        if (!(version & 1)
+            && __atomic_compare_exchange_n(&vl->vl_version, &version, version + 1,
+                                           false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        sched_yield();
+    }
+    // the writes that follow may not move ahead of it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void
+vlatch_write_release(struct vlatch *vl)
+{
+    assert(vl != NULL);
+    assert(__atomic_load_n(&vl->vl_version, __ATOMIC_RELAXED) & 1);
+    // the writes before it become visible first
+    __atomic_fetch_add(&vl->vl_version, 1, __ATOMIC_RELEASE);
+}
@@ -1,8 +1,11 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <db/common/synch.h>
 #include <db/common/list.h>
@@ -10,23 +13,117 @@
 #include <db/common/try.h>
 #include <db/common/dberror.h>
 
+// Keeps what the owner of a deque writes apart from what thieves write
+#define TP_CACHELINE 64
+
+// Tasks a deque holds before it grows
+#define TASK_RING_SIZE 64
+
+// Memory nodes we look for, by number
+#define TP_MAX_NODES 64
+#define TP_NODE_PATH "/sys/devices/system/node/node%u/cpulist"
+
+// Workers are only pinned where there are CPU sets
+#if defined(__linux__) && defined(CPU_SETSIZE)
+#define TP_PIN
+#endif
+
+struct task {
+    void (*t_routine)(void *arg, unsigned threadnum);
+    void *t_arg;
+    struct task_group *t_group;
+};
+
+struct task_group {
+    struct threadpool *tg_pool;
+    unsigned tg_pending; // tasks spawned and not done
+};
+
 DECLLIST(job);
 DEFLIST(job);
+DECLLIST(task);
+DEFLIST(task);
+
+// A task in a deque, with its group, which a thief can look at before it
+// owns the task and while another thread may be running and freeing it
+struct task_slot {
+    struct task *ts_task;
+    struct task_group *ts_group;
+};
+
+// The tasks of a deque, by index mod the size. When it is full, the owner
+// copies it to one twice the size. A thief may still be reading the old
+// one, so it is kept until the pool is destroyed.
+struct task_ring {
+    unsigned long tr_mask;
+    struct task_ring *tr_prev; // the ring this one replaced
+    struct task_slot tr_slots[];
+};
+
+// A Chase-Lev deque. The owner pushes and takes at the bottom, and thieves
+// take from the top. Only the last task left is raced for, with a
+// compare-and-swap on the top. Indices only grow, and wrap around.
+struct task_deque {
+    unsigned long td_top __attribute__((aligned(TP_CACHELINE)));
+    unsigned long td_bottom __attribute__((aligned(TP_CACHELINE)));
+    struct task_ring *td_ring;
+};
+
+struct worker {
+    struct task_deque w_deque;
+    struct threadpool *w_pool;
+    unsigned w_num;
+    unsigned w_node;
+    unsigned w_seed; // picks the deque to steal from first
+    pthread_t w_thread;
+#ifdef TP_PIN
+    bool w_pinned;
+    cpu_set_t w_cpus;
+#endif
+};
+
+// A memory node, and the workers placed on it
+struct pool_node {
+    struct tasklist *pn_tasks; // spawned for it by threads not on it
+    unsigned pn_ntasks;
+    struct cv *pn_cv_work; // its workers sleep here when there is no work
+    unsigned pn_nidle;
+};
 
 struct threadpool {
     unsigned tp_nthreads;
-    pthread_t *tp_threads;
+    struct worker *tp_workers;
+    unsigned tp_nnodes;
+    struct pool_node *tp_nodes;
     struct joblist *tp_jobs;
+    unsigned tp_njobs;
+    struct tasklist *tp_tasks; // spawned by threads outside the pool
+    unsigned tp_ntasks;
     struct lock *tp_lock;
-    struct cv *tp_cv_job_queue;
-    volatile bool tp_shutdown;
+    // Workers with nothing to do sleep on the cv of their node, and threads
+    // that wait for something on tp_cv_done. Either goes back to looking
+    // for a task if tp_epoch moved since it last looked, and each counts
+    // itself in, so that a new task wakes them without taking the lock
+    // otherwise.
+    struct cv *tp_cv_done;
+    unsigned tp_epoch;
+    unsigned tp_nidle;
+    unsigned tp_nwaiting;
+    unsigned tp_nextnode; // to wake for work that may run anywhere
+    bool tp_shutdown;
     struct semaphore *tp_shutdown_sem;
 };
 
-struct thread_worker_args {
-    struct threadpool *tw_tpool;
-    unsigned int tw_tnum;
-};
+// The worker running on this thread, if any
+static __thread struct worker *threadpool_self;
+
+static enum threadpool_affinity threadpool_affinity = TP_AFFINITY_NONE;
+
+void
+threadpool_set_affinity(enum threadpool_affinity affinity)
+{
+    threadpool_affinity = affinity;
+}
 
 static
 struct job *
@@ -56,94 +153,581 @@ job_handle(struct job *job, unsigned threadnum) {
     assert(job != NULL);
     void *arg = job->j_arg;
     void (*routine)(void *, unsigned) = job->j_routine;
-    printf("[Thread %u] starting job...\n", threadnum);
     routine(arg, threadnum);
     job_destroy(job);
-    printf("[Thread %u] finished job.\n", threadnum);
 }
 
 static
-void *
-thread_worker(void *arg)
+int
+task_deque_init(struct task_deque *deque)
+{
+    int result;
+    struct task_ring *ring;
+    TRYNULL(result, DBENOMEM, ring,
+            malloc(sizeof(struct task_ring) + TASK_RING_SIZE * sizeof(struct task_slot)),
+            done);
+    ring->tr_mask = TASK_RING_SIZE - 1;
+    ring->tr_prev = NULL;
+    deque->td_top = 0;
+    deque->td_bottom = 0;
+    deque->td_ring = ring;
+    result = 0;
+  done:
+    return result;
+}
+
+static
+void
+task_deque_destroy(struct task_deque *deque)
+{
+    for (unsigned long i = deque->td_top; i != deque->td_bottom; i++) {
+        free(deque->td_ring->tr_slots[i & deque->td_ring->tr_mask].ts_task);
+    }
+    struct task_ring *ring = deque->td_ring;
+    while (ring != NULL) {
+        struct task_ring *prev = ring->tr_prev;
+        free(ring);
+        ring = prev;
+    }
+}
+
+static
+int
+task_deque_grow(struct task_deque *deque, unsigned long top, unsigned long bottom)
+{
+    int result;
+    struct task_ring *old = deque->td_ring;
+    unsigned long size = 2 * (old->tr_mask + 1);
+    struct task_ring *ring;
+    TRYNULL(result, DBENOMEM, ring,
+            malloc(sizeof(struct task_ring) + size * sizeof(struct task_slot)), done);
+    ring->tr_mask = size - 1;
+    ring->tr_prev = old;
+    for (unsigned long i = top; i != bottom; i++) {
+        struct task_slot *from = &old->tr_slots[i & old->tr_mask];
+        struct task_slot *to = &ring->tr_slots[i & ring->tr_mask];
+        to->ts_task = __atomic_load_n(&from->ts_task, __ATOMIC_RELAXED);
+        to->ts_group = __atomic_load_n(&from->ts_group, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&deque->td_ring, ring, __ATOMIC_RELEASE);
+    result = 0;
+  done:
+    return result;
+}
+
+// Only called by the owner
+static
+int
+task_deque_push(struct task_deque *deque, struct task *task)
+{
+    int result;
+    unsigned long bottom = __atomic_load_n(&deque->td_bottom, __ATOMIC_RELAXED);
+    unsigned long top = __atomic_load_n(&deque->td_top, __ATOMIC_ACQUIRE);
+    if (bottom - top > deque->td_ring->tr_mask) {
+        TRY(result, task_deque_grow(deque, top, bottom), done);
+    }
+    struct task_slot *slot = &deque->td_ring->tr_slots[bottom & deque->td_ring->tr_mask];
+    __atomic_store_n(&slot->ts_task, task, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->ts_group, task->t_group, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->td_bottom, bottom + 1, __ATOMIC_RELEASE);
+    result = 0;
+  done:
+    return result;
+}
+
+// Only called by the owner. Takes the newest task, or returns NULL. If group
+// isn't NULL, the newest task is only taken if it is one of group.
+static
+struct task *
+task_deque_take(struct task_deque *deque, struct task_group *group)
+{
+    unsigned long bottom = __atomic_load_n(&deque->td_bottom, __ATOMIC_RELAXED) - 1;
+    struct task_ring *ring = deque->td_ring;
+    // the bottom has to move before we look at the top, or a thief could
+    // take the same task
+    __atomic_store_n(&deque->td_bottom, bottom, __ATOMIC_SEQ_CST);
+    unsigned long top = __atomic_load_n(&deque->td_top, __ATOMIC_SEQ_CST);
+    long left = (long) (bottom - top);
+    if (left < 0) {
+        __atomic_store_n(&deque->td_bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct task_slot *slot = &ring->tr_slots[bottom & ring->tr_mask];
+    if (group != NULL && __atomic_load_n(&slot->ts_group, __ATOMIC_RELAXED) != group) {
+        // put it back, or leave it to the thief racing for the last one
+        __atomic_store_n(&deque->td_bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct task *task = __atomic_load_n(&slot->ts_task, __ATOMIC_RELAXED);
+    if (left > 0) {
+        return task;
+    }
+    // the last one, which a thief may be taking too
+    if (!__atomic_compare_exchange_n(&deque->td_top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        task = NULL;
+    }
+    __atomic_store_n(&deque->td_bottom, bottom + 1, __ATOMIC_RELAXED);
+    return task;
+}
+
+// Takes the oldest task, or returns NULL. If group isn't NULL, the oldest
+// task is only taken if it is one of group.
+static
+struct task *
+task_deque_steal(struct task_deque *deque, struct task_group *group)
 {
-    struct thread_worker_args *twargs = (struct thread_worker_args*) arg;
-    struct threadpool *tpool = twargs->tw_tpool;
-    unsigned int tnum = twargs->tw_tnum;
-    free(twargs);
-    printf("starting worker thread %d\n", tnum);
-
-    // The worker thread sleeps until
-    // (1) there is a job in the queue, OR
-    // (2) the main thread has initiated a shutdown. To handle a shutdown,
-    //     the main thread waits on a semaphore for all the worker
-    //     threads to exit. The main thread then cleans up any remaining
-    //     jobs on the queue.
     while (1) {
+        unsigned long top = __atomic_load_n(&deque->td_top, __ATOMIC_SEQ_CST);
+        unsigned long bottom = __atomic_load_n(&deque->td_bottom, __ATOMIC_SEQ_CST);
+        if ((long) (bottom - top) <= 0) {
+            return NULL;
+        }
+        struct task_ring *ring = __atomic_load_n(&deque->td_ring, __ATOMIC_ACQUIRE);
+        struct task_slot *slot = &ring->tr_slots[top & ring->tr_mask];
+        // the slot may be stale, but then the top has moved and we try again
+        struct task_group *taskgroup = __atomic_load_n(&slot->ts_group, __ATOMIC_RELAXED);
+        struct task *task = __atomic_load_n(&slot->ts_task, __ATOMIC_RELAXED);
+        if (group != NULL && taskgroup != group) {
+            if (__atomic_load_n(&deque->td_top, __ATOMIC_SEQ_CST) != top) {
+                continue;
+            }
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(&deque->td_top, &top, top + 1, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return task;
+        }
+        // somebody else took it, so try the next one
+    }
+}
+
+// Tells sleepers there is something new to run: one worker without work,
+// of node if it has one, and everyone who waits, since the task may be the
+// one they wait for
+static
+void
+threadpool_wake(struct threadpool *tpool, unsigned node)
+{
+    __atomic_fetch_add(&tpool->tp_epoch, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&tpool->tp_nidle, __ATOMIC_SEQ_CST) > 0
+        || __atomic_load_n(&tpool->tp_nwaiting, __ATOMIC_SEQ_CST) > 0) {
+        lock_acquire(tpool->tp_lock);
+        for (unsigned i = 0; i < tpool->tp_nnodes; i++) {
+            struct pool_node *pn = &tpool->tp_nodes[(node + i) % tpool->tp_nnodes];
+            if (pn->pn_nidle > 0) {
+                cv_signal(pn->pn_cv_work);
+                break;
+            }
+        }
+        if (tpool->tp_nwaiting > 0) {
+            cv_broadcast(tpool->tp_cv_done);
+        }
+        lock_release(tpool->tp_lock);
+    }
+}
+
+// Takes the oldest task of a shared list, or of group if it isn't NULL
+static
+struct task *
+threadpool_take_shared(struct threadpool *tpool, struct tasklist *tasks, unsigned *ntasks,
+                       struct task_group *group)
+{
+    struct task *task = NULL;
+    if (__atomic_load_n(ntasks, __ATOMIC_ACQUIRE) > 0) {
+        lock_acquire(tpool->tp_lock);
+        for (struct tasklistnode *lnode = tasklist_iterhead(tasks);
+             lnode != NULL; lnode = tasklist_next(lnode)) {
+            if (group == NULL || tasklist_getentry(lnode)->t_group == group) {
+                task = tasklist_remove(tasks, lnode);
+                __atomic_fetch_sub(ntasks, 1, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+        lock_release(tpool->tp_lock);
+    }
+    return task;
+}
+
+// Takes a task meant for node, or the oldest of one of its workers
+static
+struct task *
+threadpool_steal_node(struct threadpool *tpool, struct worker *self,
+                      unsigned start, unsigned node, struct task_group *group)
+{
+    struct pool_node *pn = &tpool->tp_nodes[node];
+    struct task *task = threadpool_take_shared(tpool, pn->pn_tasks, &pn->pn_ntasks, group);
+    for (unsigned i = 0; i < tpool->tp_nthreads && task == NULL; i++) {
+        struct worker *victim = &tpool->tp_workers[(start + i) % tpool->tp_nthreads];
+        if (victim != self && victim->w_node == node) {
+            task = task_deque_steal(&victim->w_deque, group);
+        }
+    }
+    return task;
+}
+
+// Finds a task for the calling thread: its own newest, one spawned outside
+// the pool, or one of its node, before one of another node. A thread that
+// waits on group only takes the tasks of group, since it may hold locks
+// that the tasks of others need.
+static
+struct task *
+threadpool_find_task(struct threadpool *tpool, struct task_group *group)
+{
+    struct worker *self = threadpool_self;
+    if (self != NULL && self->w_pool != tpool) {
+        self = NULL;
+    }
+    struct task *task = NULL;
+    if (self != NULL && (task = task_deque_take(&self->w_deque, group)) != NULL) {
+        goto done;
+    }
+    if ((task = threadpool_take_shared(tpool, tpool->tp_tasks, &tpool->tp_ntasks,
+                                       group)) != NULL) {
+        goto done;
+    }
+    unsigned start = 0;
+    unsigned node = 0;
+    if (self != NULL) {
+        // xorshift, so that thieves spread out over the workers
+        self->w_seed ^= self->w_seed << 13;
+        self->w_seed ^= self->w_seed >> 17;
+        self->w_seed ^= self->w_seed << 5;
+        start = self->w_seed;
+        node = self->w_node;
+    }
+    for (unsigned i = 0; i < tpool->tp_nnodes && task == NULL; i++) {
+        task = threadpool_steal_node(tpool, self, start, (node + i) % tpool->tp_nnodes, group);
+    }
+  done:
+    return task;
+}
+
+static
+void
+threadpool_run(struct threadpool *tpool, struct task *task)
+{
+    struct task_group *group = task->t_group;
+    struct worker *self = threadpool_self;
+    unsigned threadnum = (self != NULL && self->w_pool == tpool)
+        ? self->w_num : tpool->tp_nthreads;
+    task->t_routine(task->t_arg, threadnum);
+    free(task);
+    // the waiter may destroy the group as soon as this is zero
+    if (__atomic_sub_fetch(&group->tg_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        threadpool_notify(tpool);
+    }
+}
+
+void
+threadpool_notify(struct threadpool *tpool)
+{
+    assert(tpool != NULL);
+    // under the lock, so that a waiter either sees what changed before it
+    // sleeps or is counted here
+    lock_acquire(tpool->tp_lock);
+    if (tpool->tp_nwaiting > 0) {
+        cv_broadcast(tpool->tp_cv_done);
+    }
+    lock_release(tpool->tp_lock);
+}
+
+void
+task_group_wait_until(struct task_group *group, bool (*done)(void *arg), void *arg)
+{
+    assert(group != NULL);
+    assert(done != NULL);
+    struct threadpool *tpool = group->tg_pool;
+    while (!done(arg)) {
+        unsigned epoch = __atomic_load_n(&tpool->tp_epoch, __ATOMIC_SEQ_CST);
+        struct task *task = threadpool_find_task(tpool, group);
+        if (task != NULL) {
+            threadpool_run(tpool, task);
+            continue;
+        }
+        // Whatever we wait for is being run, or is a task that was spawned
+        // after we looked, which moved the epoch. Tasks of other groups
+        // move it too, and we only look again.
         lock_acquire(tpool->tp_lock);
-        while (joblist_size(tpool->tp_jobs) == 0 && !tpool->tp_shutdown) {
-            cv_wait(tpool->tp_cv_job_queue, tpool->tp_lock);
+        __atomic_fetch_add(&tpool->tp_nwaiting, 1, __ATOMIC_SEQ_CST);
+        if (!done(arg) && __atomic_load_n(&tpool->tp_epoch, __ATOMIC_SEQ_CST) == epoch) {
+            cv_wait(tpool->tp_cv_done, tpool->tp_lock);
+        }
+        __atomic_fetch_sub(&tpool->tp_nwaiting, 1, __ATOMIC_SEQ_CST);
+        lock_release(tpool->tp_lock);
+    }
+}
+
+static
+void *
+thread_worker(void *arg)
+{
+    struct worker *self = (struct worker *) arg;
+    struct threadpool *tpool = self->w_pool;
+    threadpool_self = self;
+#ifdef TP_PIN
+    // before the worker touches any memory of its own, so that the memory
+    // is placed on its node
+    if (self->w_pinned
+        && pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &self->w_cpus) != 0) {
+        printf("could not pin worker thread %d\n", self->w_num);
+    }
+#endif
+    printf("starting worker thread %d on node %u\n", self->w_num, self->w_node);
+
+    // The worker thread runs tasks while there are any, then starts a job.
+    // With neither, it sleeps until something is added, or the main thread
+    // has initiated a shutdown. To handle a shutdown, the main thread waits
+    // on a semaphore for all the worker threads to exit. The main thread
+    // then cleans up any remaining jobs and tasks.
+    while (!__atomic_load_n(&tpool->tp_shutdown, __ATOMIC_ACQUIRE)) {
+        unsigned epoch = __atomic_load_n(&tpool->tp_epoch, __ATOMIC_SEQ_CST);
+        struct task *task = threadpool_find_task(tpool, NULL);
+        if (task != NULL) {
+            threadpool_run(tpool, task);
+            continue;
         }
-        if (tpool->tp_shutdown) {
+        struct job *job = NULL;
+        if (__atomic_load_n(&tpool->tp_njobs, __ATOMIC_ACQUIRE) > 0) {
+            lock_acquire(tpool->tp_lock);
+            if (joblist_size(tpool->tp_jobs) > 0) {
+                job = joblist_remhead(tpool->tp_jobs);
+                __atomic_fetch_sub(&tpool->tp_njobs, 1, __ATOMIC_RELEASE);
+            }
             lock_release(tpool->tp_lock);
-            goto shutdown;
         }
-        assert(joblist_size(tpool->tp_jobs) != 0);
-        struct job *job = joblist_remhead(tpool->tp_jobs);
+        if (job != NULL) {
+            job_handle(job, self->w_num);
+            continue;
+        }
+        // Anything added after we took the epoch moved it, so we either
+        // see that here or are counted as idle when it wakes us
+        struct pool_node *pn = &tpool->tp_nodes[self->w_node];
+        lock_acquire(tpool->tp_lock);
+        __atomic_fetch_add(&tpool->tp_nidle, 1, __ATOMIC_SEQ_CST);
+        pn->pn_nidle++;
+        if (__atomic_load_n(&tpool->tp_epoch, __ATOMIC_SEQ_CST) == epoch
+            && !tpool->tp_shutdown) {
+            cv_wait(pn->pn_cv_work, tpool->tp_lock);
+        }
+        pn->pn_nidle--;
+        __atomic_fetch_sub(&tpool->tp_nidle, 1, __ATOMIC_SEQ_CST);
         lock_release(tpool->tp_lock);
-        job_handle(job, tnum);
     }
 
-  shutdown:
+    // the pool and this worker are freed once everyone has signalled
+    printf("shutting down worker thread %d\n", self->w_num);
     V(tpool->tp_shutdown_sem);
-    printf("shutting down worker thread %d\n", tnum);
     return NULL;
 }
 
+#ifdef TP_PIN
+// Reads the CPUs of memory node n that we may run on. Returns false if
+// there is no node n.
+static
+bool
+threadpool_node_cpus(unsigned n, cpu_set_t *allowed, cpu_set_t *cpus)
+{
+    char path[sizeof(TP_NODE_PATH) + 16];
+    snprintf(path, sizeof(path), TP_NODE_PATH, n);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    // ranges like 0-3,8-11
+    CPU_ZERO(cpus);
+    unsigned low, high;
+    while (fscanf(f, "%u", &low) == 1) {
+        high = low;
+        int c = fgetc(f);
+        if (c == '-' && fscanf(f, "%u", &high) == 1) {
+            c = fgetc(f);
+        }
+        for (unsigned cpu = low; cpu <= high && cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, allowed)) {
+                CPU_SET(cpu, cpus);
+            }
+        }
+        if (c != ',') {
+            break;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+// Finds the nodes with CPUs we may run on, or one node with all of them if
+// the kernel doesn't say. Returns 0 if we can't tell where we may run.
+static
+unsigned
+threadpool_find_nodes(cpu_set_t *nodecpus)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+        return 0;
+    }
+    unsigned nnodes = 0;
+    for (unsigned n = 0; n < TP_MAX_NODES; n++) {
+        if (threadpool_node_cpus(n, &allowed, &nodecpus[nnodes])
+            && CPU_COUNT(&nodecpus[nnodes]) > 0) {
+            nnodes++;
+        }
+    }
+    if (nnodes == 0) {
+        nodecpus[0] = allowed;
+        nnodes = 1;
+    }
+    return nnodes;
+}
+
+// Picks the CPUs the workers may run on. Workers go to the nodes in turn,
+// and with TP_AFFINITY_CORE to the CPUs of their node in turn.
+static
+void
+threadpool_place(struct threadpool *tpool)
+{
+    cpu_set_t nodecpus[TP_MAX_NODES];
+    unsigned nnodes = 0;
+    if (threadpool_affinity != TP_AFFINITY_NONE) {
+        nnodes = threadpool_find_nodes(nodecpus);
+    }
+    tpool->tp_nnodes = (nnodes == 0) ? 1 : nnodes;
+    for (unsigned i = 0; i < tpool->tp_nthreads; i++) {
+        struct worker *worker = &tpool->tp_workers[i];
+        worker->w_node = i % tpool->tp_nnodes;
+        worker->w_pinned = (nnodes > 0);
+        if (!worker->w_pinned) {
+            continue;
+        }
+        cpu_set_t *cpus = &nodecpus[worker->w_node];
+        if (threadpool_affinity == TP_AFFINITY_NODE) {
+            worker->w_cpus = *cpus;
+            continue;
+        }
+        unsigned k = (i / nnodes) % CPU_COUNT(cpus);
+        CPU_ZERO(&worker->w_cpus);
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, cpus) && k-- == 0) {
+                CPU_SET(cpu, &worker->w_cpus);
+                break;
+            }
+        }
+    }
+}
+#else
+static
+void
+threadpool_place(struct threadpool *tpool)
+{
+    tpool->tp_nnodes = 1;
+    for (unsigned i = 0; i < tpool->tp_nthreads; i++) {
+        tpool->tp_workers[i].w_node = 0;
+    }
+}
+#endif
+
+static
+void
+pool_nodes_destroy(struct pool_node *nodes, unsigned nnodes)
+{
+    for (unsigned i = 0; i < nnodes; i++) {
+        if (nodes[i].pn_tasks != NULL) {
+            while (tasklist_size(nodes[i].pn_tasks) > 0) {
+                free(tasklist_remhead(nodes[i].pn_tasks));
+            }
+            tasklist_destroy(nodes[i].pn_tasks);
+        }
+        if (nodes[i].pn_cv_work != NULL) {
+            cv_destroy(nodes[i].pn_cv_work);
+        }
+    }
+    free(nodes);
+}
+
+static
+int
+pool_nodes_create(unsigned nnodes, struct pool_node **retnodes)
+{
+    int result;
+    struct pool_node *nodes;
+    TRYNULL(result, DBENOMEM, nodes, calloc(nnodes, sizeof(struct pool_node)), done);
+    for (unsigned i = 0; i < nnodes; i++) {
+        TRYNULL(result, DBENOMEM, nodes[i].pn_tasks, tasklist_create(), cleanup_nodes);
+        TRYNULL(result, DBENOMEM, nodes[i].pn_cv_work, cv_create(), cleanup_nodes);
+    }
+    *retnodes = nodes;
+    result = 0;
+    goto done;
+  cleanup_nodes:
+    pool_nodes_destroy(nodes, nnodes);
+  done:
+    return result;
+}
+
 struct threadpool *
 threadpool_create(unsigned nthreads)
 {
     int result;
     struct threadpool *tpool = NULL;
+    unsigned ndeques = 0;
 
     TRYNULL(result, DBENOMEM, tpool, malloc(sizeof(struct threadpool)), done);
-    TRYNULL(result, DBENOMEM, tpool->tp_threads,
-            malloc(nthreads * sizeof(pthread_t)), cleanup_tpool);
-    TRYNULL(result, DBENOMEM, tpool->tp_jobs, joblist_create(), cleanup_threads);
-    TRYNULL(result, DBENOMEM, tpool->tp_lock, lock_create(), cleanup_joblist);
-    TRYNULL(result, DBENOMEM, tpool->tp_cv_job_queue, cv_create(), cleanup_lock);
-    TRYNULL(result, DBENOMEM, tpool->tp_shutdown_sem, semaphore_create(0), cleanup_cv);
+    if (posix_memalign((void **) &tpool->tp_workers, TP_CACHELINE,
+                       nthreads * sizeof(struct worker)) != 0) {
+        goto cleanup_tpool;
+    }
+    memset(tpool->tp_workers, 0, nthreads * sizeof(struct worker));
+    tpool->tp_nthreads = nthreads;
+    threadpool_place(tpool);
+    for (; ndeques < nthreads; ndeques++) {
+        TRY(result, task_deque_init(&tpool->tp_workers[ndeques].w_deque), cleanup_deques);
+    }
+    TRY(result, pool_nodes_create(tpool->tp_nnodes, &tpool->tp_nodes), cleanup_deques);
+    TRYNULL(result, DBENOMEM, tpool->tp_jobs, joblist_create(), cleanup_nodes);
+    TRYNULL(result, DBENOMEM, tpool->tp_tasks, tasklist_create(), cleanup_joblist);
+    TRYNULL(result, DBENOMEM, tpool->tp_lock, lock_create(), cleanup_tasklist);
+    TRYNULL(result, DBENOMEM, tpool->tp_cv_done, cv_create(), cleanup_lock);
+    TRYNULL(result, DBENOMEM, tpool->tp_shutdown_sem, semaphore_create(0), cleanup_cv_done);
 
     tpool->tp_shutdown = false;
-    tpool->tp_nthreads = nthreads;
+    tpool->tp_njobs = 0;
+    tpool->tp_ntasks = 0;
+    tpool->tp_epoch = 0;
+    tpool->tp_nidle = 0;
+    tpool->tp_nwaiting = 0;
+    tpool->tp_nextnode = 0;
 
     // start and detach all the threads
     for (unsigned i = 0; i < nthreads; i++) {
         // TODO: right now, we will crash if we can't spawn and detach
         // the threads. In the future, we should handle this more elegantly
+        struct worker *worker = &tpool->tp_workers[i];
+        worker->w_pool = tpool;
+        worker->w_num = i;
+        worker->w_seed = 2654435761u * (i + 1);
 
-        // the args struct will be freed by the worker
-        struct thread_worker_args *twargs =
-            malloc(sizeof(struct thread_worker_args));
-        assert(twargs != NULL);
-        twargs->tw_tnum = i;
-        twargs->tw_tpool = tpool;
-
-        result = pthread_create(&tpool->tp_threads[i], NULL,
-                                thread_worker, twargs);
+        result = pthread_create(&worker->w_thread, NULL, thread_worker, worker);
         assert(result == 0);
-        result = pthread_detach(tpool->tp_threads[i]);
+        result = pthread_detach(worker->w_thread);
         assert(result == 0);
     }
     goto done;
 
-  cleanup_cv:
-    cv_destroy(tpool->tp_cv_job_queue);
+  cleanup_cv_done:
+    cv_destroy(tpool->tp_cv_done);
   cleanup_lock:
     lock_destroy(tpool->tp_lock);
+  cleanup_tasklist:
+    tasklist_destroy(tpool->tp_tasks);
   cleanup_joblist:
     joblist_destroy(tpool->tp_jobs);
-  cleanup_threads:
-    free(tpool->tp_threads);
+  cleanup_nodes:
+    pool_nodes_destroy(tpool->tp_nodes, tpool->tp_nnodes);
+  cleanup_deques:
+    for (unsigned i = 0; i < ndeques; i++) {
+        task_deque_destroy(&tpool->tp_workers[i].w_deque);
+    }
+    free(tpool->tp_workers);
   cleanup_tpool:
     free(tpool);
     tpool = NULL;
@@ -159,27 +743,44 @@ threadpool_destroy(struct threadpool *tpool)
     // The main thread initiates a shutdown, and waits for all the
     // worker threads to exit.
     lock_acquire(tpool->tp_lock);
-    tpool->tp_shutdown = true;
-    cv_broadcast(tpool->tp_cv_job_queue);
+    __atomic_store_n(&tpool->tp_shutdown, true, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i < tpool->tp_nnodes; i++) {
+        cv_broadcast(tpool->tp_nodes[i].pn_cv_work);
+    }
     lock_release(tpool->tp_lock);
     for (unsigned i = 0; i < tpool->tp_nthreads; i++) {
         P(tpool->tp_shutdown_sem);
     }
 
-    // The main thread must then cleanup any remaining jobs on the queue
+    // The main thread must then cleanup any remaining jobs and tasks
     while (joblist_size(tpool->tp_jobs) > 0) {
         struct job *job = joblist_remhead(tpool->tp_jobs);
         job_destroy(job);
     }
+    while (tasklist_size(tpool->tp_tasks) > 0) {
+        free(tasklist_remhead(tpool->tp_tasks));
+    }
+    for (unsigned i = 0; i < tpool->tp_nthreads; i++) {
+        task_deque_destroy(&tpool->tp_workers[i].w_deque);
+    }
 
     semaphore_destroy(tpool->tp_shutdown_sem);
-    cv_destroy(tpool->tp_cv_job_queue);
+    cv_destroy(tpool->tp_cv_done);
     lock_destroy(tpool->tp_lock);
+    tasklist_destroy(tpool->tp_tasks);
     joblist_destroy(tpool->tp_jobs);
-    free(tpool->tp_threads);
+    pool_nodes_destroy(tpool->tp_nodes, tpool->tp_nnodes);
+    free(tpool->tp_workers);
     free(tpool);
 }
 
+unsigned
+threadpool_nnodes(struct threadpool *tpool)
+{
+    assert(tpool != NULL);
+    return tpool->tp_nnodes;
+}
+
 int
 threadpool_add_job(struct threadpool *tpool, struct job *job)
 {
@@ -191,15 +792,16 @@ threadpool_add_job(struct threadpool *tpool, struct job *job)
     struct job *jobinternal = NULL;
     TRYNULL(result, DBENOMEM, jobinternal, job_copy(job), done);
 
-    // Add a job to the queue and signal a thread to wake up to handle it
+    // Add a job to the queue and wake a thread up to handle it
     lock_acquire(tpool->tp_lock);
     result = joblist_addtail(tpool->tp_jobs, jobinternal);
     if (result) {
         lock_release(tpool->tp_lock);
         goto cleanup_job;
     }
-    cv_signal(tpool->tp_cv_job_queue);
+    __atomic_fetch_add(&tpool->tp_njobs, 1, __ATOMIC_RELEASE);
     lock_release(tpool->tp_lock);
+    threadpool_wake(tpool, __atomic_fetch_add(&tpool->tp_nextnode, 1, __ATOMIC_RELAXED));
     result = 0;
     goto done;
 
@@ -208,3 +810,111 @@ threadpool_add_job(struct threadpool *tpool, struct job *job)
   done:
     return result;
 }
+
+struct task_group *
+task_group_create(struct threadpool *tpool)
+{
+    assert(tpool != NULL);
+    struct task_group *group = malloc(sizeof(struct task_group));
+    if (group == NULL) {
+        goto done;
+    }
+    group->tg_pool = tpool;
+    group->tg_pending = 0;
+  done:
+    return group;
+}
+
+void
+task_group_destroy(struct task_group *group)
+{
+    assert(group != NULL);
+    assert(__atomic_load_n(&group->tg_pending, __ATOMIC_ACQUIRE) == 0);
+    free(group);
+}
+
+// Queues a task for node, or anywhere if node is -1
+static
+int
+task_group_push(struct task_group *group, int node,
+                void (*routine)(void *arg, unsigned threadnum), void *arg)
+{
+    int result;
+    struct threadpool *tpool = group->tg_pool;
+    struct task *task;
+    TRYNULL(result, DBENOMEM, task, malloc(sizeof(struct task)), done);
+    task->t_routine = routine;
+    task->t_arg = arg;
+    task->t_group = group;
+    __atomic_fetch_add(&group->tg_pending, 1, __ATOMIC_RELAXED);
+
+    // A worker keeps it to itself until somebody steals it, if it is on
+    // the right node. Otherwise it goes on the list of the node, or the
+    // shared list.
+    struct worker *self = threadpool_self;
+    if (self != NULL && self->w_pool == tpool && (node < 0 || (unsigned) node == self->w_node)) {
+        TRY(result, task_deque_push(&self->w_deque, task), cleanup_task);
+        node = self->w_node;
+    } else {
+        struct tasklist *tasks = tpool->tp_tasks;
+        unsigned *ntasks = &tpool->tp_ntasks;
+        if (node < 0) {
+            node = __atomic_fetch_add(&tpool->tp_nextnode, 1, __ATOMIC_RELAXED)
+                % tpool->tp_nnodes;
+        } else {
+            tasks = tpool->tp_nodes[node].pn_tasks;
+            ntasks = &tpool->tp_nodes[node].pn_ntasks;
+        }
+        lock_acquire(tpool->tp_lock);
+        result = tasklist_addtail(tasks, task);
+        if (result == 0) {
+            __atomic_fetch_add(ntasks, 1, __ATOMIC_RELEASE);
+        }
+        lock_release(tpool->tp_lock);
+        if (result) {
+            goto cleanup_task;
+        }
+    }
+    threadpool_wake(tpool, node);
+    result = 0;
+    goto done;
+
+  cleanup_task:
+    __atomic_fetch_sub(&group->tg_pending, 1, __ATOMIC_RELAXED);
+    free(task);
+  done:
+    return result;
+}
+
+int
+task_group_spawn(struct task_group *group,
+                 void (*routine)(void *arg, unsigned threadnum), void *arg)
+{
+    assert(group != NULL);
+    assert(routine != NULL);
+    return task_group_push(group, -1, routine, arg);
+}
+
+int
+task_group_spawn_node(struct task_group *group, unsigned node,
+                      void (*routine)(void *arg, unsigned threadnum), void *arg)
+{
+    assert(group != NULL);
+    assert(routine != NULL);
+    return task_group_push(group, node % group->tg_pool->tp_nnodes, routine, arg);
+}
+
+static
+bool
+task_group_done(void *arg)
+{
+    struct task_group *group = (struct task_group *) arg;
+    return __atomic_load_n(&group->tg_pending, __ATOMIC_ACQUIRE) == 0;
+}
+
+void
+task_group_wait(struct task_group *group)
+{
+    assert(group != NULL);
+    task_group_wait_until(group, task_group_done, group);
+}
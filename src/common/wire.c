@@ -0,0 +1,314 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <db/common/dberror.h>
+#include <db/common/try.h>
+#include <db/common/wire.h>
+
+// The fields of every op are listed once, in wire_op_fields, and the
+// codec decides whether that counts, writes or reads them.
+enum wire_mode {
+    WIRE_SIZE,
+    WIRE_ENCODE,
+    WIRE_DECODE,
+};
+
+struct wire_codec {
+    enum wire_mode wc_mode;
+    char *wc_out; // where to encode
+    const char *wc_in; // what to decode
+    size_t wc_len; // bytes of wc_in
+    size_t wc_pos; // bytes counted, written or read so far
+    bool wc_ok; // false once decoding finds something wrong
+};
+
+size_t
+wire_varint_size(uint64_t val)
+{
+    size_t size = 1;
+    while (val >= 0x80) {
+        val >>= 7;
+        size++;
+    }
+    return size;
+}
+
+size_t
+wire_varint_encode(uint64_t val, char *buf)
+{
+    size_t n = 0;
+    while (val >= 0x80) {
+        buf[n++] = (char) ((val & 0x7f) | 0x80);
+        val >>= 7;
+    }
+    buf[n++] = (char) val;
+    return n;
+}
+
+size_t
+wire_varint_decode(const char *buf, size_t len, uint64_t *retval)
+{
+    uint64_t val = 0;
+    for (size_t n = 0; n < len && n < 10; n++) {
+        uint8_t byte = (uint8_t) buf[n];
+        val |= (uint64_t) (byte & 0x7f) << (7 * n);
+        if ((byte & 0x80) == 0) {
+            *retval = val;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+// Makes sure there are n more bytes to decode
+static
+bool
+wire_have(struct wire_codec *wc, size_t n)
+{
+    if (wc->wc_ok && wc->wc_len - wc->wc_pos < n) {
+        wc->wc_ok = false;
+    }
+    return wc->wc_ok;
+}
+
+// Enums and bools, as a byte no larger than max
+static
+void
+wire_small(struct wire_codec *wc, unsigned *val, unsigned max)
+{
+    switch (wc->wc_mode) {
+    case WIRE_SIZE:
+        break;
+    case WIRE_ENCODE:
+        assert(*val <= max);
+        wc->wc_out[wc->wc_pos] = (char) *val;
+        break;
+    case WIRE_DECODE:
+        if (!wire_have(wc, 1)) {
+            return;
+        }
+        *val = (uint8_t) wc->wc_in[wc->wc_pos];
+        wc->wc_ok = (*val <= max);
+        break;
+    }
+    wc->wc_pos++;
+}
+
+#define WIRE_SMALL(wc, field, max) do { \
+        unsigned v = (field); \
+        wire_small((wc), &v, (max)); \
+        (field) = v; \
+    } while (0)
+
+static
+void
+wire_u32(struct wire_codec *wc, uint32_t *val)
+{
+    uint32_t networkint;
+    switch (wc->wc_mode) {
+    case WIRE_SIZE:
+        break;
+    case WIRE_ENCODE:
+        networkint = htonl(*val);
+        memcpy(wc->wc_out + wc->wc_pos, &networkint, sizeof(uint32_t));
+        break;
+    case WIRE_DECODE:
+        if (!wire_have(wc, sizeof(uint32_t))) {
+            return;
+        }
+        memcpy(&networkint, wc->wc_in + wc->wc_pos, sizeof(uint32_t));
+        *val = ntohl(networkint);
+        break;
+    }
+    wc->wc_pos += sizeof(uint32_t);
+}
+
+#define WIRE_U32(wc, field) do { \
+        uint32_t v = (uint32_t) (field); \
+        wire_u32((wc), &v); \
+        (field) = v; \
+    } while (0)
+
+// A name, into a buffer of size bytes
+static
+void
+wire_str(struct wire_codec *wc, char *s, size_t size)
+{
+    uint64_t len;
+    size_t n;
+    switch (wc->wc_mode) {
+    case WIRE_SIZE:
+        len = strlen(s);
+        wc->wc_pos += wire_varint_size(len) + len;
+        break;
+    case WIRE_ENCODE:
+        len = strlen(s);
+        wc->wc_pos += wire_varint_encode(len, wc->wc_out + wc->wc_pos);
+        memcpy(wc->wc_out + wc->wc_pos, s, len);
+        wc->wc_pos += len;
+        break;
+    case WIRE_DECODE:
+        if (!wc->wc_ok) {
+            return;
+        }
+        n = wire_varint_decode(wc->wc_in + wc->wc_pos, wc->wc_len - wc->wc_pos, &len);
+        if (n == 0 || len >= size) {
+            wc->wc_ok = false;
+            return;
+        }
+        wc->wc_pos += n;
+        if (!wire_have(wc, len)) {
+            return;
+        }
+        memcpy(s, wc->wc_in + wc->wc_pos, len);
+        s[len] = '\0';
+        // names can't hold a '\0'
+        wc->wc_ok = (strlen(s) == len);
+        wc->wc_pos += len;
+        break;
+    }
+}
+
+static
+void
+wire_op_fields(struct wire_codec *wc, struct op *op)
+{
+    WIRE_SMALL(wc, op->op_type, OP_BATCH_EXECUTE);
+    if (!wc->wc_ok) {
+        return;
+    }
+    switch (op->op_type) {
+    case OP_SELECT_ALL_ASSIGN:
+    case OP_SELECT_RANGE_ASSIGN:
+    case OP_SELECT_VALUE_ASSIGN:
+    case OP_SELECT_ALL:
+    case OP_SELECT_RANGE:
+    case OP_SELECT_VALUE:
+        wire_str(wc, op->op_select.op_sel_var, COLUMNLEN);
+        wire_str(wc, op->op_select.op_sel_col, COLUMNLEN);
+        wire_str(wc, op->op_select.op_sel_pos, COLUMNLEN);
+        // op_sel_value shares op_sel_low
+        WIRE_U32(wc, op->op_select.op_sel_low);
+        WIRE_U32(wc, op->op_select.op_sel_high);
+        break;
+    case OP_FETCH:
+    case OP_FETCH_ASSIGN:
+        wire_str(wc, op->op_fetch.op_fetch_col, COLUMNLEN);
+        wire_str(wc, op->op_fetch.op_fetch_pos, COLUMNLEN / 2);
+        wire_str(wc, op->op_fetch.op_fetch_var, COLUMNLEN / 2);
+        break;
+    case OP_CREATE:
+        wire_str(wc, op->op_create.op_create_col, COLUMNLEN);
+        WIRE_SMALL(wc, op->op_create.op_create_stype, STORAGE_BTREE);
+        break;
+    case OP_LOAD:
+        wire_str(wc, op->op_load.op_load_file, COLUMNLEN);
+        break;
+    case OP_INSERT:
+        wire_str(wc, op->op_insert.op_insert_cols, TUPLELEN);
+        break;
+    case OP_DELETE:
+        wire_str(wc, op->op_delete.op_delete_var, COLUMNLEN);
+        wire_str(wc, op->op_delete.op_delete_cols, COLUMNLEN);
+        break;
+    case OP_UPDATE:
+        wire_str(wc, op->op_update.op_update_var, COLUMNLEN);
+        wire_str(wc, op->op_update.op_update_col, COLUMNLEN);
+        WIRE_U32(wc, op->op_update.op_update_val);
+        break;
+    case OP_TUPLE:
+        wire_str(wc, op->op_tuple.op_tuple_vars, TUPLELEN);
+        break;
+    case OP_AGG:
+        WIRE_SMALL(wc, op->op_agg.op_agg_atype, AGG_COUNT);
+        WIRE_SMALL(wc, op->op_agg.op_agg_assign, 1);
+        WIRE_SMALL(wc, op->op_agg.op_agg_math, 1);
+        WIRE_SMALL(wc, op->op_agg.op_agg_mtype, MATH_DIV);
+        wire_str(wc, op->op_agg.op_agg_var, COLUMNLEN);
+        wire_str(wc, op->op_agg.op_agg_col, COLUMNLEN);
+        wire_str(wc, op->op_agg.op_agg_col2, COLUMNLEN);
+        break;
+    case OP_MATH:
+        WIRE_SMALL(wc, op->op_math.op_math_mtype, MATH_DIV);
+        WIRE_SMALL(wc, op->op_math.op_math_assign, 1);
+        wire_str(wc, op->op_math.op_math_var, COLUMNLEN);
+        wire_str(wc, op->op_math.op_math_col1, COLUMNLEN);
+        wire_str(wc, op->op_math.op_math_col2, COLUMNLEN);
+        break;
+    case OP_PRINT:
+        wire_str(wc, op->op_print.op_print_var, COLUMNLEN);
+        break;
+    case OP_JOIN:
+        WIRE_SMALL(wc, op->op_join.op_join_jtype, JOIN_AUTO);
+        wire_str(wc, op->op_join.op_join_inputL, COLUMNLEN);
+        wire_str(wc, op->op_join.op_join_inputR, COLUMNLEN);
+        wire_str(wc, op->op_join.op_join_varL, COLUMNLEN);
+        wire_str(wc, op->op_join.op_join_varR, COLUMNLEN);
+        break;
+    case OP_SET:
+        WIRE_SMALL(wc, op->op_set.op_set_stype, SET_NOT);
+        WIRE_SMALL(wc, op->op_set.op_set_assign, 1);
+        wire_str(wc, op->op_set.op_set_var, COLUMNLEN);
+        wire_str(wc, op->op_set.op_set_ids1, COLUMNLEN);
+        wire_str(wc, op->op_set.op_set_ids2, COLUMNLEN);
+        break;
+    case OP_BATCH_QUERIES:
+    case OP_BATCH_EXECUTE:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+size_t
+wire_op_size(struct op *op)
+{
+    assert(op != NULL);
+    struct wire_codec wc = { WIRE_SIZE, NULL, NULL, 0, 0, true };
+    wire_op_fields(&wc, op);
+    return wc.wc_pos;
+}
+
+size_t
+wire_op_encode(struct op *op, char *buf)
+{
+    assert(op != NULL);
+    assert(buf != NULL);
+    struct wire_codec wc = { WIRE_ENCODE, buf, NULL, 0, 0, true };
+    wire_op_fields(&wc, op);
+    return wc.wc_pos;
+}
+
+int
+wire_op_decode(const char *buf, size_t len, struct op **retop)
+{
+    assert(buf != NULL);
+    assert(retop != NULL);
+
+    int result;
+    struct op *op;
+    // decode into a whole op, and then keep only what it uses
+    struct op decoded;
+    bzero(&decoded, offsetof(struct op, op_select));
+    struct wire_codec wc = { WIRE_DECODE, NULL, buf, len, 0, true };
+    wire_op_fields(&wc, &decoded);
+    if (!wc.wc_ok || wc.wc_pos != len) {
+        result = DBEWIRE;
+        DBLOG(result);
+        goto done;
+    }
+    size_t size = op_size(&decoded);
+    TRYNULL(result, DBENOMEM, op, malloc(size), done);
+    memcpy(op, &decoded, size);
+
+    // success
+    *retop = op;
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
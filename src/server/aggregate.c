@@ -6,6 +6,8 @@
 #include <db/common/try.h>
 #include <db/server/aggregate.h>
 
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
 int
 column_agg(struct column_vals *vals,
            agg_func_t f,
@@ -39,38 +41,61 @@ column_agg(struct column_vals *vals,
     return result;
 }
 
+// The block kernels below take plain int arrays so that the
+// compiler can vectorize them, and so that they can be fed directly
+// from the math kernels without a materialized intermediate.
+static
 int
-agg_min(struct column_vals *vals)
+agg_min_block(int *vals, unsigned n, int min)
 {
-    int min = INT_MAX;
-    for (unsigned i = 0; i < vals->cval_len; i++) {
-        int val = vals->cval_vals[i];
+    for (unsigned i = 0; i < n; i++) {
+        int val = vals[i];
         min = (val < min) ? val : min;
     }
     return min;
 }
 
+static
 int
-agg_max(struct column_vals *vals)
+agg_max_block(int *vals, unsigned n, int max)
 {
-    int max = INT_MIN;
-    for (unsigned i = 0; i < vals->cval_len; i++) {
-        int val = vals->cval_vals[i];
+    for (unsigned i = 0; i < n; i++) {
+        int val = vals[i];
         max = (val > max) ? val : max;
     }
     return max;
 }
 
-int
-agg_sum(struct column_vals *vals)
+// Sums into 64 bits, so that a sum may go past an int on the way, and an
+// average of large values comes out right
+static
+int64_t
+agg_sum_block(int *vals, unsigned n, int64_t sum)
 {
-    int sum = 0;
-    for (unsigned i = 0; i < vals->cval_len; i++) {
-        sum += vals->cval_vals[i];
+    for (unsigned i = 0; i < n; i++) {
+        sum += vals[i];
     }
     return sum;
 }
 
+int
+agg_min(struct column_vals *vals)
+{
+    return agg_min_block(vals->cval_vals, vals->cval_len, INT_MAX);
+}
+
+int
+agg_max(struct column_vals *vals)
+{
+    return agg_max_block(vals->cval_vals, vals->cval_len, INT_MIN);
+}
+
+int
+agg_sum(struct column_vals *vals)
+{
+    return (int) agg_sum_block(vals->cval_vals, vals->cval_len, 0);
+}
+
 int
 agg_count(struct column_vals *vals)
 {
@@ -80,7 +105,7 @@ agg_count(struct column_vals *vals)
 int
 agg_avg(struct column_vals *vals)
 {
-    return agg_sum(vals) / agg_count(vals);
+    return (int) (agg_sum_block(vals->cval_vals, vals->cval_len, 0) / agg_count(vals));
 }
 
 agg_func_t
@@ -96,87 +121,223 @@ agg_func(enum agg_type atype)
     }
 }
 
-int
-column_math(struct column_vals *valsleft,
-            struct column_vals *valsright,
-            math_func_t f,
-            struct column_vals **retvals)
+// Number of values computed at a time when fusing math into an
+// aggregate. Small enough that the block stays in L1.
+#define MATH_BLOCK 1024
+
+// Define the column-column, column-scalar, and scalar-column kernels
+// for a math operator. Each kernel is a simple loop with no calls
+// or branches so that the compiler can inline and vectorize it.
+#define DEFMATH(NAME, OP) \
+    static void \
+    math_##NAME##_vv(int *out, int *left, int *right, unsigned n) \
+    { \
+        for (unsigned i = 0; i < n; i++) { \
+            out[i] = left[i] OP right[i]; \
+        } \
+    } \
+    static void \
+    math_##NAME##_vs(int *out, int *left, int right, unsigned n) \
+    { \
+        for (unsigned i = 0; i < n; i++) { \
+            out[i] = left[i] OP right; \
+        } \
+    } \
+    static void \
+    math_##NAME##_sv(int *out, int left, int *right, unsigned n) \
+    { \
+        for (unsigned i = 0; i < n; i++) { \
+            out[i] = left OP right[i]; \
+        } \
+    }
+
+DEFMATH(add, +)
+DEFMATH(sub, -)
+DEFMATH(mul, *)
+DEFMATH(div, /)
+
+#define MATH_DISPATCH(NAME, out, left, right, off, n) \
+    if (!(left)->mo_scalar && !(right)->mo_scalar) { \
+        math_##NAME##_vv(out, (left)->mo_vals->cval_vals + (off), \
+                         (right)->mo_vals->cval_vals + (off), n); \
+    } else if (!(left)->mo_scalar) { \
+        math_##NAME##_vs(out, (left)->mo_vals->cval_vals + (off), \
+                         (right)->mo_scalar_val, n); \
+    } else { \
+        math_##NAME##_sv(out, (left)->mo_scalar_val, \
+                         (right)->mo_vals->cval_vals + (off), n); \
+    }
+
+// Computes out[i] = left[off + i] op right[off + i] for i in [0, n)
+static
+void
+math_apply(enum math_type mtype,
+           struct math_operand *left,
+           struct math_operand *right,
+           int *out, unsigned off, unsigned n)
 {
-    assert(valsleft != NULL);
-    assert(valsright != NULL);
-    assert(retvals != NULL);
-    assert(f != NULL);
+    assert(!left->mo_scalar || !right->mo_scalar);
+    switch (mtype) {
+    case MATH_ADD: MATH_DISPATCH(add, out, left, right, off, n); break;
+    case MATH_SUB: MATH_DISPATCH(sub, out, left, right, off, n); break;
+    case MATH_MUL: MATH_DISPATCH(mul, out, left, right, off, n); break;
+    case MATH_DIV: MATH_DISPATCH(div, out, left, right, off, n); break;
+    default: assert(0); break;
+    }
+}
 
-    // Make sure the columns have the same length
+// Checks the operands and returns the length of the result.
+// For division, this does a separate pass over the divisor so that the
+// math kernels themselves don't need to check for zero.
+static
+int
+math_check_operands(enum math_type mtype,
+                    struct math_operand *left,
+                    struct math_operand *right,
+                    unsigned *retlen)
+{
     int result;
-    if (valsleft->cval_len != valsright->cval_len) {
+    if (left->mo_scalar && right->mo_scalar) {
+        result = DBEVARTYPE;
+        DBLOG(result);
+        goto done;
+    }
+    if (!left->mo_scalar && !right->mo_scalar
+        && left->mo_vals->cval_len != right->mo_vals->cval_len) {
         result = DBEINTERMDIFFLEN;
         DBLOG(result);
         goto done;
     }
-
-    // Now compute the math result
-    struct column_vals *mathvals;
-    TRYNULL(result, DBENOMEM, mathvals, malloc(sizeof(struct column_vals)), done);
-    bzero(mathvals, sizeof(struct column_vals));
-    TRYNULL(result, DBENOMEM, mathvals->cval_vals,
-            malloc(sizeof(int) * valsleft->cval_len), cleanup_vals);
-    mathvals->cval_len = valsleft->cval_len;
-    for (unsigned i = 0; i < mathvals->cval_len; i++) {
-        int left = valsleft->cval_vals[i];
-        int right = valsright->cval_vals[i];
-        if (f == math_div && right == 0) {
+    unsigned len = left->mo_scalar ? right->mo_vals->cval_len
+            : left->mo_vals->cval_len;
+    if (mtype == MATH_DIV) {
+        unsigned nzeros = 0;
+        if (right->mo_scalar) {
+            nzeros = (right->mo_scalar_val == 0);
+        } else {
+            int *divisors = right->mo_vals->cval_vals;
+            for (unsigned i = 0; i < len; i++) {
+                nzeros += (divisors[i] == 0);
+            }
+        }
+        if (nzeros != 0) {
             result = DBEDIVZERO; // handle division by zero
             DBLOG(result);
-            goto cleanup_mathvals;
+            goto done;
         }
-        mathvals->cval_vals[i] = f(left, right);
     }
 
     // success
     result = 0;
-    *retvals = mathvals;
+    *retlen = len;
     goto done;
-  cleanup_mathvals:
-    free(mathvals->cval_vals);
-  cleanup_vals:
-    free(mathvals);
   done:
     return result;
 }
 
 int
-math_add(int a, int b)
+column_math(enum math_type mtype,
+            struct math_operand *left,
+            struct math_operand *right,
+            struct column_vals *reuse,
+            struct column_vals **retvals)
 {
-    return a + b;
-}
+    assert(left != NULL);
+    assert(right != NULL);
+    assert(retvals != NULL);
 
-int
-math_sub(int a, int b)
-{
-    return a - b;
+    int result;
+    unsigned len;
+    TRY(result, math_check_operands(mtype, left, right, &len), done);
+
+    // Write into the reused intermediate if we can, otherwise
+    // allocate a new one. A math result has no ids.
+    struct column_vals *mathvals;
+    if (reuse != NULL && reuse->cval_len == len) {
+        mathvals = reuse;
+        free(mathvals->cval_ids);
+        mathvals->cval_ids = NULL;
+        bzero(mathvals->cval_col, COLUMNLEN);
+    } else {
+        TRYNULL(result, DBENOMEM, mathvals, malloc(sizeof(struct column_vals)), done);
+        bzero(mathvals, sizeof(struct column_vals));
+        TRYNULL(result, DBENOMEM, mathvals->cval_vals,
+                malloc(sizeof(int) * len), cleanup_vals);
+        mathvals->cval_len = len;
+    }
+    math_apply(mtype, left, right, mathvals->cval_vals, 0, len);
+
+    // success
+    result = 0;
+    *retvals = mathvals;
+    goto done;
+  cleanup_vals:
+    free(mathvals);
+  done:
+    return result;
 }
 
 int
-math_div(int a, int b)
+column_math_agg(enum agg_type atype,
+                enum math_type mtype,
+                struct math_operand *left,
+                struct math_operand *right,
+                struct column_vals **retvals)
 {
-    assert(b != 0); // caller is responsible for checking
-    return a / b;
-}
+    assert(left != NULL);
+    assert(right != NULL);
+    assert(retvals != NULL);
 
-int math_mul(int a, int b)
-{
-    return a * b;
-}
+    int result;
+    unsigned len;
+    TRY(result, math_check_operands(mtype, left, right, &len), done);
+    if (atype == AGG_AVG && len == 0) {
+        result = DBEDIVZERO; // handle division by zero
+        DBLOG(result);
+        goto done;
+    }
 
-math_func_t
-math_func(enum math_type mtype)
-{
-    switch (mtype) {
-    case MATH_ADD: return math_add;
-    case MATH_SUB: return math_sub;
-    case MATH_DIV: return math_div;
-    case MATH_MUL: return math_mul;
-    default: assert(0); return NULL;
+    // Compute the math one block at a time and fold each block
+    // into the aggregate while it is still in cache.
+    int agg;
+    int64_t sum = 0;
+    switch (atype) {
+    case AGG_MIN: agg = INT_MAX; break;
+    case AGG_MAX: agg = INT_MIN; break;
+    default: agg = 0; break;
+    }
+    int block[MATH_BLOCK];
+    for (unsigned off = 0; off < len && atype != AGG_COUNT; off += MATH_BLOCK) {
+        unsigned n = MIN(MATH_BLOCK, len - off);
+        math_apply(mtype, left, right, block, off, n);
+        switch (atype) {
+        case AGG_MIN: agg = agg_min_block(block, n, agg); break;
+        case AGG_MAX: agg = agg_max_block(block, n, agg); break;
+        case AGG_SUM:
+        case AGG_AVG: sum = agg_sum_block(block, n, sum); break;
+        default: assert(0); break;
+        }
+    }
+    switch (atype) {
+    case AGG_COUNT: agg = len; break;
+    case AGG_SUM: agg = (int) sum; break;
+    case AGG_AVG: agg = (int) (sum / len); break;
+    default: break;
     }
+
+    struct column_vals *aggval = NULL;
+    TRYNULL(result, DBENOMEM, aggval, malloc(sizeof(struct column_vals)), done);
+    bzero(aggval, sizeof(struct column_vals));
+    TRYNULL(result, DBENOMEM, aggval->cval_vals, malloc(sizeof(int) * 1), cleanup_val);
+    aggval->cval_len = 1;
+    aggval->cval_vals[0] = agg;
+
+    // success
+    result = 0;
+    *retvals = aggval;
+    goto done;
+  cleanup_val:
+    free(aggval);
+  done:
+    return result;
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -7,12 +8,27 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <db/common/dberror.h>
 #include <db/common/try.h>
 #include <db/common/io.h>
 #include <db/common/bitmap.h>
 #include <db/server/file.h>
 
+// io_uring is only used where the headers know about it. There is no
+// liburing, so we set up and drive the rings with the system calls.
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#if defined(IORING_OFF_SQ_RING) && defined(__NR_io_uring_setup)
+#define FILE_IO_URING
+#endif
+
 struct file {
     int f_fd;
     uint64_t f_size;
@@ -137,7 +153,9 @@ file_alloc_page(struct file *f, page_t *retpage)
         int result = ftruncate(f->f_fd, f->f_size + PAGESIZE);
         if (result == -1) {
             perror("ftruncate");
-            return result;
+            // the page is not in the file, so the next alloc tries again
+            bitmap_unmark(f->f_page_bitmap, page);
+            return DBEIOCHECKERRNO;
         }
         f->f_size += PAGESIZE;
         f->f_last_alloc_page = page;
@@ -190,6 +208,369 @@ file_read(struct file *f, page_t page, void *buf)
     return 0;
 }
 
+int
+file_read_pages(struct file *f, page_t page, page_t npages, void *buf)
+{
+    assert(f != NULL);
+    assert(buf != NULL);
+    assert(f->f_page_bitmap != NULL);
+    for (page_t i = 0; i < npages; i++) {
+        assert(bitmap_isset(f->f_page_bitmap, page + i));
+    }
+
+    size_t len = npages * PAGESIZE;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t result = pread(f->f_fd, (char *) buf + done, len - done,
+                               page * PAGESIZE + done);
+        if (result == -1 || result == 0) {
+            return DBEIOCHECKERRNO;
+        }
+        done += result;
+    }
+    return 0;
+}
+
+// Reads or writes the part of io from byte done on with pread or pwrite
+static
+int
+file_io_sync(struct file_io *io, size_t done)
+{
+    size_t len = io->fio_npages * PAGESIZE;
+    off_t off = io->fio_page * PAGESIZE;
+    char *buf = io->fio_buf;
+    while (done < len) {
+        ssize_t result = io->fio_write
+                ? pwrite(io->fio_file->f_fd, buf + done, len - done, off + done)
+                : pread(io->fio_file->f_fd, buf + done, len - done, off + done);
+        if (result == -1 || result == 0) {
+            return DBEIOCHECKERRNO;
+        }
+        done += result;
+    }
+    return 0;
+}
+
+static unsigned file_queue_depth = 0;
+
+void
+file_set_queue_depth(unsigned depth)
+{
+    file_queue_depth = depth;
+}
+
+#ifdef FILE_IO_URING
+
+// The io_uring of a thread, with its rings mapped in
+struct file_ring {
+    int fr_fd;
+    unsigned fr_depth;
+    unsigned fr_inflight;
+    unsigned *fr_sq_tail;
+    unsigned *fr_sq_mask;
+    unsigned *fr_sq_array;
+    struct io_uring_sqe *fr_sqes;
+    unsigned *fr_cq_head;
+    unsigned *fr_cq_tail;
+    unsigned *fr_cq_mask;
+    struct io_uring_cqe *fr_cqes;
+    void *fr_sq_map;
+    size_t fr_sq_size;
+    void *fr_cq_map;
+    size_t fr_cq_size;
+    size_t fr_sqes_size;
+};
+
+static pthread_key_t file_ring_key;
+static pthread_once_t file_ring_once = PTHREAD_ONCE_INIT;
+// marks a thread that could not set up a ring
+static struct file_ring file_ring_none;
+
+static
+void
+file_ring_destroy(void *arg)
+{
+    struct file_ring *ring = arg;
+    if (ring == &file_ring_none) {
+        return;
+    }
+    assert(ring->fr_inflight == 0);
+    munmap(ring->fr_sqes, ring->fr_sqes_size);
+    if (ring->fr_cq_map != ring->fr_sq_map) {
+        munmap(ring->fr_cq_map, ring->fr_cq_size);
+    }
+    munmap(ring->fr_sq_map, ring->fr_sq_size);
+    close(ring->fr_fd);
+    free(ring);
+}
+
+static
+void
+file_ring_init_key(void)
+{
+    int result = pthread_key_create(&file_ring_key, file_ring_destroy);
+    assert(result == 0);
+}
+
+static
+struct file_ring *
+file_ring_create(unsigned depth)
+{
+    struct file_ring *ring = malloc(sizeof(struct file_ring));
+    if (ring == NULL) {
+        goto done;
+    }
+    bzero(ring, sizeof(struct file_ring));
+    struct io_uring_params params;
+    bzero(&params, sizeof(params));
+    ring->fr_fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (ring->fr_fd < 0) {
+        goto cleanup_malloc;
+    }
+    ring->fr_depth = params.sq_entries;
+    ring->fr_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->fr_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->fr_cq_size > ring->fr_sq_size) {
+            ring->fr_sq_size = ring->fr_cq_size;
+        }
+        ring->fr_cq_size = ring->fr_sq_size;
+    }
+    ring->fr_sq_map = mmap(NULL, ring->fr_sq_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fr_fd, IORING_OFF_SQ_RING);
+    if (ring->fr_sq_map == MAP_FAILED) {
+        goto cleanup_fd;
+    }
+    ring->fr_cq_map = ring->fr_sq_map;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->fr_cq_map = mmap(NULL, ring->fr_cq_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, ring->fr_fd, IORING_OFF_CQ_RING);
+        if (ring->fr_cq_map == MAP_FAILED) {
+            goto cleanup_sq;
+        }
+    }
+    ring->fr_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->fr_sqes = mmap(NULL, ring->fr_sqes_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fr_fd, IORING_OFF_SQES);
+    if (ring->fr_sqes == MAP_FAILED) {
+        goto cleanup_cq;
+    }
+    char *sq = ring->fr_sq_map;
+    char *cq = ring->fr_cq_map;
+    ring->fr_sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->fr_sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->fr_sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->fr_cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->fr_cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->fr_cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->fr_cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    goto done;
+
+  cleanup_cq:
+    if (ring->fr_cq_map != ring->fr_sq_map) {
+        munmap(ring->fr_cq_map, ring->fr_cq_size);
+    }
+  cleanup_sq:
+    munmap(ring->fr_sq_map, ring->fr_sq_size);
+  cleanup_fd:
+    close(ring->fr_fd);
+  cleanup_malloc:
+    free(ring);
+    ring = NULL;
+  done:
+    return ring;
+}
+
+// Returns the ring of this thread, setting it up on first use, or NULL if
+// the thread reads and writes synchronously
+static
+struct file_ring *
+file_ring_get(void)
+{
+    if (file_queue_depth == 0) {
+        return NULL;
+    }
+    pthread_once(&file_ring_once, file_ring_init_key);
+    struct file_ring *ring = pthread_getspecific(file_ring_key);
+    if (ring == NULL) {
+        ring = file_ring_create(file_queue_depth);
+        pthread_setspecific(file_ring_key, (ring == NULL) ? &file_ring_none : ring);
+    }
+    return (ring == &file_ring_none) ? NULL : ring;
+}
+
+static
+int
+file_ring_enter(struct file_ring *ring, unsigned nsubmit, unsigned nwait)
+{
+    int result;
+    do {
+        result = syscall(__NR_io_uring_enter, ring->fr_fd, nsubmit, nwait,
+                         (nwait > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (result == -1 && errno == EINTR);
+    return result;
+}
+
+// Finishes every io that has completed, waiting for one if none has. An
+// io the kernel could not do, such as on kernels without IORING_OP_READ,
+// or only did part of, is done the rest of the way synchronously.
+static
+void
+file_ring_reap(struct file_ring *ring)
+{
+    unsigned head = *ring->fr_cq_head;
+    if (head == __atomic_load_n(ring->fr_cq_tail, __ATOMIC_ACQUIRE)) {
+        file_ring_enter(ring, 0, 1);
+    }
+    while (head != __atomic_load_n(ring->fr_cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ring->fr_cqes[head & *ring->fr_cq_mask];
+        struct file_io *io = (struct file_io *) (uintptr_t) cqe->user_data;
+        int res = cqe->res;
+        head++;
+        __atomic_store_n(ring->fr_cq_head, head, __ATOMIC_RELEASE);
+        io->fio_pending = false;
+        ring->fr_inflight--;
+        io->fio_result = file_io_sync(io, (res > 0) ? res : 0);
+    }
+}
+
+// Puts io on the ring, or returns false if it could not be submitted
+static
+bool
+file_ring_submit(struct file_ring *ring, struct file_io *io)
+{
+    while (ring->fr_inflight == ring->fr_depth) {
+        file_ring_reap(ring);
+    }
+    unsigned tail = *ring->fr_sq_tail;
+    unsigned ix = tail & *ring->fr_sq_mask;
+    struct io_uring_sqe *sqe = &ring->fr_sqes[ix];
+    bzero(sqe, sizeof(struct io_uring_sqe));
+    sqe->opcode = io->fio_write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = io->fio_file->f_fd;
+    sqe->off = io->fio_page * PAGESIZE;
+    sqe->addr = (uintptr_t) io->fio_buf;
+    sqe->len = io->fio_npages * PAGESIZE;
+    sqe->user_data = (uintptr_t) io;
+    ring->fr_sq_array[ix] = ix;
+    __atomic_store_n(ring->fr_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (file_ring_enter(ring, 1, 0) != 1) {
+        // take the entry back, the kernel did not consume it
+        __atomic_store_n(ring->fr_sq_tail, tail, __ATOMIC_RELEASE);
+        return false;
+    }
+    io->fio_pending = true;
+    ring->fr_inflight++;
+    return true;
+}
+
+#else
+
+static
+struct file_ring *
+file_ring_get(void)
+{
+    return NULL;
+}
+
+#endif
+
+static
+void
+file_io_start(struct file *f, page_t page, page_t npages, void *buf,
+              bool write, struct file_io *io)
+{
+    assert(f != NULL);
+    assert(buf != NULL);
+    assert(io != NULL);
+    for (page_t i = 0; i < npages; i++) {
+        assert(bitmap_isset(f->f_page_bitmap, page + i));
+    }
+    io->fio_file = f;
+    io->fio_page = page;
+    io->fio_npages = npages;
+    io->fio_buf = buf;
+    io->fio_write = write;
+    io->fio_pending = false;
+    io->fio_result = 0;
+    struct file_ring *ring = file_ring_get();
+#ifdef FILE_IO_URING
+    if (ring != NULL && file_ring_submit(ring, io)) {
+        return;
+    }
+#endif
+    (void) ring;
+    io->fio_result = file_io_sync(io, 0);
+}
+
+void
+file_read_start(struct file *f, page_t page, page_t npages, void *buf,
+                struct file_io *io)
+{
+    file_io_start(f, page, npages, buf, false, io);
+}
+
+void
+file_write_start(struct file *f, page_t page, page_t npages, void *buf,
+                 struct file_io *io)
+{
+    file_io_start(f, page, npages, buf, true, io);
+}
+
+int
+file_io_wait(struct file_io *io)
+{
+    assert(io != NULL);
+#ifdef FILE_IO_URING
+    if (io->fio_pending) {
+        struct file_ring *ring = file_ring_get();
+        assert(ring != NULL);
+        while (io->fio_pending) {
+            file_ring_reap(ring);
+        }
+    }
+#endif
+    return io->fio_result;
+}
+
+// A read that would wait for the disk fails with RWF_NOWAIT instead, and
+// the first byte of the page is enough to tell. Where there is no such
+// flag, pages are taken not to be cached.
+bool
+file_page_cached(struct file *f, page_t page)
+{
+    assert(f != NULL);
+#ifdef RWF_NOWAIT
+    char byte;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    return preadv2(f->f_fd, &iov, 1, page * PAGESIZE, RWF_NOWAIT) == 1;
+#else
+    return false;
+#endif
+}
+
+// Only a hint, so there is nothing to do if it fails
+void
+file_prefetch(struct file *f, page_t page, page_t npages)
+{
+    assert(f != NULL);
+    posix_fadvise(f->f_fd, page * PAGESIZE, npages * PAGESIZE, POSIX_FADV_WILLNEED);
+}
+
+void *
+file_buf_alloc(page_t npages)
+{
+    char *buf = malloc(npages * PAGESIZE);
+    if (buf == NULL) {
+        goto done;
+    }
+    for (size_t off = 0; off < npages * PAGESIZE; off += PAGESIZE) {
+        ((volatile char *) buf)[off] = 0;
+    }
+  done:
+    return buf;
+}
+
 int
 file_write(struct file *f, page_t page, void *buf) {
     assert(f != NULL);
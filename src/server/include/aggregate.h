@@ -1,6 +1,7 @@
 #ifndef _AGGREGATE_H_
 #define _AGGREGATE_H_
 
+#include <stdbool.h>
 #include <db/common/operators.h>
 #include <db/common/results.h>
 #include <db/server/storage.h>
@@ -19,18 +20,32 @@ int agg_avg(struct column_vals *vals);
 
 agg_func_t agg_func(enum agg_type atype);
 
-typedef int (*math_func_t)(int, int);
-
-int column_math(struct column_vals *valsleft,
-                struct column_vals *valsright,
-                math_func_t f,
+// An input to a math operator: either an intermediate column
+// or an integer constant that is broadcast across the column.
+struct math_operand {
+    bool mo_scalar;
+    union {
+        int mo_scalar_val;
+        struct column_vals *mo_vals;
+    };
+};
+
+// At least one of the operands must be a column. If reuse is not NULL
+// and has the same length as the result, the result is written into
+// reuse's buffer (reuse may alias one of the inputs) and returned,
+// otherwise a new intermediate is allocated.
+int column_math(enum math_type mtype,
+                struct math_operand *left,
+                struct math_operand *right,
+                struct column_vals *reuse,
                 struct column_vals **retvals);
 
-int math_add(int a, int b);
-int math_sub(int a, int b);
-int math_div(int a, int b);
-int math_mul(int a, int b);
-
-math_func_t math_func(enum math_type mtype);
+// Computes atype(mtype(left, right)) one cache-sized block at a time,
+// without materializing the math result.
+int column_math_agg(enum agg_type atype,
+                    enum math_type mtype,
+                    struct math_operand *left,
+                    struct math_operand *right,
+                    struct column_vals **retvals);
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef _BTREE_H_
 #define _BTREE_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <db/common/cassert.h>
 #include <db/server/file.h>
@@ -13,6 +14,10 @@
 
 #define BTREE_PAGE_NULL 0
 
+// Layout of the nodes, stamped on every node written. Files from before
+// the dense leaves have 0, and are rebuilt from the base file on open.
+#define BTREE_VERSION 1
+
 enum btree_node_type {
     BTREE_NODE_INTERNAL,
     BTREE_NODE_LEAF,
@@ -37,19 +42,57 @@ struct btree_header {
         page_t bth_left; // used for INTERNAL nodes
     };
     uint64_t bth_page; // page this node lives on
-    uint64_t bth_padding; // padding
+    uint32_t bth_version; // BTREE_VERSION of the layout it was written in
+    uint32_t bth_padding; // padding
 };
 
 CASSERT(sizeof(struct btree_header) % sizeof(struct btree_entry) == 0, btree);
 
 #define BTENTRY_PER_PAGE ((PAGESIZE - sizeof(struct btree_header)) / sizeof(struct btree_entry))
 
+// Leaves keep their keys and the ids of the tuples in two dense arrays, 8
+// bytes an entry rather than the 16 of a btree_entry, so a leaf holds
+// twice as many and its keys are searched without a stride. Ids are 32
+// bits, like the ones in column_ids.
+#define BTLEAF_PER_PAGE \
+    ((PAGESIZE - sizeof(struct btree_header)) / (sizeof(int) + sizeof(uint32_t)))
+
 // this will be the size of a page
 struct btree_node {
     struct btree_header bt_header;
-    struct btree_entry bt_entries[BTENTRY_PER_PAGE];
+    union {
+        struct btree_entry bt_entries[BTENTRY_PER_PAGE]; // INTERNAL nodes
+        struct { // LEAF nodes
+            int bt_keys[BTLEAF_PER_PAGE];
+            uint32_t bt_ids[BTLEAF_PER_PAGE];
+        };
+    };
 };
 
 CASSERT(PAGESIZE == sizeof(struct btree_node), btree);
+CASSERT(BTLEAF_PER_PAGE == 2 * BTENTRY_PER_PAGE, btree);
+
+// The internal levels of a B+tree are kept in memory while its column is
+// open, so that a search only reads the leaf it ends at. Each node holds
+// the keys of an internal node packed from the start of a cache line, and
+// one more child than keys: the left pointer, then the page of each entry.
+struct btree_inner {
+    unsigned bi_nkeys;
+    bool bi_leaves; // the children are leaf pages rather than inner nodes
+    int *bi_keys;
+    union {
+        page_t *bi_pages;
+        struct btree_inner **bi_children;
+    };
+    // a root that was replaced while searches may still be going through
+    // it, on the column's list of those
+    struct btree_inner *bi_retired;
+};
+
+#define BTREE_CACHELINE 64
+
+// Version latches for the pages of a B+tree, which a page shares with
+// every page equal to it modulo BTREE_NLATCHES
+#define BTREE_NLATCHES 1024
 
 #endif
@@ -24,6 +24,44 @@ bool file_page_isalloc(struct file *f, page_t page);
 // returns the total number of pages in the file, alloc'ed or freed
 page_t file_num_pages(struct file *f);
 int file_read(struct file *f, page_t page, void *buf);
+// reads npages consecutive pages starting at page into buf
+int file_read_pages(struct file *f, page_t page, page_t npages, void *buf);
 int file_write(struct file *f, page_t page, void *buf);
+// A read or write of consecutive pages that may still be in flight. With
+// a queue depth set, it goes through an io_uring of the thread that
+// started it, and otherwise it is done before it is started.
+struct file_io {
+    struct file *fio_file;
+    page_t fio_page;
+    page_t fio_npages;
+    void *fio_buf;
+    bool fio_write;
+    bool fio_pending; // on the io_uring of the thread
+    int fio_result;
+};
+
+// how many reads and writes each thread may have in flight, or 0 to read
+// and write with pread and pwrite. Threads that cannot set up an io_uring
+// use them too.
+void file_set_queue_depth(unsigned depth);
+// start reading or writing npages pages from page on into buf, which must
+// stay put until file_io_wait returns
+void file_read_start(struct file *f, page_t page, page_t npages, void *buf,
+                     struct file_io *io);
+void file_write_start(struct file *f, page_t page, page_t npages, void *buf,
+                      struct file_io *io);
+// waits for io, which must have been started on this thread, and returns
+// its result
+int file_io_wait(struct file_io *io);
+
+// whether the page can be read without waiting for the disk
+bool file_page_cached(struct file *f, page_t page);
+// hints that npages consecutive pages starting at page will be read soon,
+// so that the kernel reads them in meanwhile
+void file_prefetch(struct file *f, page_t page, page_t npages);
+// allocates a buffer of npages pages to read into, and touches each of
+// them, so that they are placed on the memory node of the calling thread
+// rather than wherever the kernel first writes them. Freed with free.
+void *file_buf_alloc(page_t npages);
 
 #endif
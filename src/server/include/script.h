@@ -0,0 +1,43 @@
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+#include <db/common/operators.h>
+#include <db/common/parser.h>
+
+// A script is a list of ops that a client sent at once, with the
+// dependencies between them worked out from the variables they read and
+// assign. An op depends on the last earlier op that assigned a variable it
+// reads or assigns, and on the earlier ops that read a variable it assigns
+// since that was last assigned. Ops with no path between them may run at
+// the same time without changing the result.
+
+enum script_kind {
+    // only reads and assigns variables, so it may run on any thread as
+    // soon as the ops it depends on are done
+    SCRIPT_PURE,
+    // sends a result to the client, so it has to run in script order
+    SCRIPT_OUTPUT,
+    // changes columns or the state of the session, so it runs after every
+    // earlier op and before every later one
+    SCRIPT_BARRIER,
+};
+
+struct script_node {
+    struct op *sn_op;
+    enum script_kind sn_kind;
+    unsigned sn_ndeps; // earlier ops this one waits for
+    unsigned *sn_next; // later ops that wait for this one
+    unsigned sn_nnext;
+    unsigned sn_maxnext;
+};
+
+struct script {
+    unsigned sc_nnodes;
+    struct script_node *sc_nodes;
+};
+
+// The script points into ops, which must outlive it
+int script_create(struct oparray *ops, struct script **retscript);
+void script_destroy(struct script *script);
+
+#endif
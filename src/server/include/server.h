@@ -5,7 +5,12 @@ struct server_options {
     int sopt_port;
     int sopt_backlog;
     int sopt_nthreads;
+    int sopt_iodepth; // reads and writes each thread has in flight, 0 for none
+    int sopt_affinity; // an enum threadpool_affinity
     char sopt_dbdir[128];
+    // where clients may have the server open load files itself, empty if
+    // they may not
+    char sopt_loaddir[128];
 };
 
 struct server;
@@ -0,0 +1,45 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+// Per-column statistics, used to choose access paths and join algorithms.
+//
+// The histogram has up to COLSTATS_NBUCKETS buckets. Bucket i holds the
+// values in [cs_bounds[i], cs_bounds[i + 1]) and the last bucket holds the
+// values in [cs_bounds[nbuckets - 1], cs_max]. The bounds are picked at
+// load time so that every bucket holds about the same number of values.
+// Inserts, updates and deletes only adjust the bucket counts (and widen
+// the outer bounds), so the histogram drifts away from equi-depth but its
+// counts stay exact until the column is loaded again.
+//
+// The number of distinct values is estimated with a small HyperLogLog
+// sketch, which can only grow. Deleting values does not lower it.
+//
+// This lives in struct column_on_disk, so it is persisted with the column.
+
+#define COLSTATS_NBUCKETS 16
+#define COLSTATS_NSKETCH 64
+
+struct column_stats {
+    uint32_t cs_nbuckets; // buckets in use, 0 if we have never seen a value
+    int cs_max; // largest value we have seen
+    int cs_bounds[COLSTATS_NBUCKETS]; // lower bound of each bucket
+    uint32_t cs_counts[COLSTATS_NBUCKETS]; // number of values in each bucket
+    uint8_t cs_sketch[COLSTATS_NSKETCH]; // HyperLogLog registers
+};
+
+// Rebuilds the statistics from scratch over the given values
+int column_stats_build(struct column_stats *stats, int *vals, uint64_t num);
+
+// Account for a value that was added to or removed from the column
+void column_stats_add(struct column_stats *stats, int val);
+void column_stats_remove(struct column_stats *stats, int val);
+
+uint64_t column_stats_rows(struct column_stats *stats);
+uint64_t column_stats_ndistinct(struct column_stats *stats);
+
+// Estimated number of values in [low, high]
+uint64_t column_stats_estimate(struct column_stats *stats, int low, int high);
+
+#endif
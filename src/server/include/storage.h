@@ -8,10 +8,16 @@
 #include <db/common/array.h>
 #include <db/common/cassert.h>
 #include <db/common/results.h>
+#include <db/common/synch.h>
 #include <db/server/file.h>
 #include <db/server/btree.h>
+#include <db/server/stats.h>
 
-#define COLUMN_TAKEN 0xCAFEBABE
+// The magic of a column record in use also tells the layout of the
+// metadata file. Records from before cd_stats were half the size, and the
+// metadata file is rewritten when it is opened.
+#define COLUMN_TAKEN 0xCAFED00D
+#define COLUMN_TAKEN_V1 0xCAFEBABE
 #define COLUMN_FREE 0x0
 
 // NOTE: we do not support deletions yet
@@ -27,12 +33,16 @@ struct column_on_disk {
     volatile page_t cd_btree_root; // location of btree root
     char cd_base_file[52]; // file where data is stored, does not include dbdir
     char cd_index_file[52]; // file where index is stored, does not include dbdir
+    struct column_stats cd_stats; // statistics on the values in this column
+    char cd_padding[56];
 };
 
 CASSERT(PAGESIZE % sizeof(struct column_on_disk) == 0, storage);
 
 #define COLUMNS_PER_PAGE (PAGESIZE / sizeof(struct column_on_disk))
 
+struct column_scan;
+
 // in memory representation
 struct column {
     struct storage *col_storage;
@@ -40,9 +50,23 @@ struct column {
     struct file *col_base_file;
     struct file *col_index_file;
     struct rwlock *col_rwlock;
+    // Taken before col_rwlock by everything that changes the column. An
+    // insert into a btree only holds col_rwlock to write while it adds to
+    // the base file, and goes on to add to the tree holding it to read, so
+    // that selects on the column run meanwhile.
+    struct lock *col_writer_lock;
+    struct column_scan *col_scan; // scan of the base file shared by selects
+    // internal levels of the btree in memory, NULL while the root is a leaf.
+    // Inserts replace them after a split, and may leave them older than the
+    // leaves, which searches make up for by moving right along the leaves.
+    struct btree_inner *col_btree_inner;
+    struct btree_inner *col_btree_retired; // freed under col_rwlock to write
+    bool col_btree_stale; // col_btree_inner has to be read again
+    struct vlatch col_btree_rootlatch; // covers cd_btree_root
+    struct vlatch *col_btree_latches; // BTREE_NLATCHES, covers the pages
     page_t col_page; // page in the storage file
     unsigned col_index; // index in the page in the storage file
-    volatile unsigned col_opencount; // ref count on number of times open
+    volatile unsigned col_opencount; // ref count on number of times open, protected by st_lock
     volatile bool col_dirty; // tells us whether we need to synch the buffer
 };
 
@@ -95,8 +119,44 @@ int column_update(struct column *col, struct column_ids *ids, int val);
 int column_delete(struct column *col, struct column_ids *ids);
 int column_load(struct column *col, int *vals, uint64_t num);
 
+// Loads a column in batches, so the caller never needs all of its values
+// in memory at once. The column stays locked from column_load_begin until
+// column_load_finish, which must be called even if an append fails. Once
+// an append fails, later ones do nothing, and column_load_finish returns
+// its error. A load that fails leaves the column empty again, so it may be
+// loaded again.
+// *retloader is NULL if the column already holds data, in which case the
+// load is skipped like in column_load.
+struct column_loader;
+int column_load_begin(struct column *col, struct column_loader **retloader);
+int column_load_append(struct column_loader *loader, int *vals, uint64_t num);
+int column_load_finish(struct column_loader *loader);
+
 // need reader/writer locks for select,fetch (read) and insert(write)
 struct column_ids *column_select(struct column *col, struct op *op);
+// Selects for each of ops at once, into retids[i] for ops[i]. The selects
+// that scan the base file share one pass over it, which evaluates each page
+// against all of them. None of them may be within an intermediate.
+int column_select_batch(struct column *col, struct op **ops, unsigned nops,
+                        struct column_ids **retids);
+// Like column_select, but only looks at the positions in within
+struct column_ids *column_select_within(struct column *col, struct op *op,
+                                        struct column_ids *within);
 struct column_vals *column_fetch(struct column *col, struct column_ids *ids);
+// Looks up each of the nkeys keys, which must be sorted, in the B+tree of
+// col, and adds (ids[i], right id) to the arrays of retidsL and retidsR
+// for every tuple equal to keys[i]. The right ids of a key come out in
+// increasing order. Each leaf is read once, since a probe resumes from
+// where the previous key left off.
+int column_btree_probe(struct column *col, const int *keys, const unsigned *ids,
+                       unsigned nkeys, struct column_ids *retidsL,
+                       struct column_ids *retidsR);
+
+// Sets *retids to the positions below nbits that hold a tuple, which
+// leaves out the ones deleted since they were taken
+int column_live_ids(struct column *col, unsigned nbits, struct column_ids **retids);
+
+// Copies out the current statistics of the column
+void column_get_stats(struct column *col, struct column_stats *retstats);
 
 #endif
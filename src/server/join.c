@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #include <db/common/operators.h>
 #include <db/common/results.h>
@@ -32,8 +33,8 @@ column_join_loop(struct storage *storage,
             for (unsigned l = iL; l < lmax; l++) {
                 for (unsigned r = iR; r < rmax; r++) {
                     if (inputL->cval_vals[l] == inputR->cval_vals[r]) {
-                        TRY(result, idarray_add(retidsL->cid_array, (void *) l, NULL), done);
-                        TRY(result, idarray_add(retidsR->cid_array, (void *) r, NULL), done);
+                        TRY(result, idarray_add(retidsL->cid_array, (void *) inputL->cval_ids[l], NULL), done);
+                        TRY(result, idarray_add(retidsR->cid_array, (void *) inputR->cval_ids[r], NULL), done);
                     }
                 }
             }
@@ -110,6 +111,9 @@ column_join_sort(struct storage *storage,
                  struct column_ids *retidsR)
 {
     int result;
+    if (inputL->cval_len == 0 || inputR->cval_len == 0) {
+        return 0;
+    }
     struct idval_tuple *tuplesL = NULL, *tuplesR = NULL;
     TRYNULL(result, DBENOMEM, tuplesL,
             malloc(sizeof(struct idval_tuple) * inputL->cval_len), done);
@@ -176,6 +180,11 @@ column_join_tree(struct storage *storage,
         DBLOG(result);
         goto cleanup_col;
     }
+    if (inputL->cval_len == 0) {
+        // nothing to probe with, and so nothing joins
+        result = 0;
+        goto cleanup_col;
+    }
 
     // sort our arrays
     struct idval_tuple *tuplesL = NULL;
@@ -187,42 +196,28 @@ column_join_tree(struct storage *storage,
     }
     qsort(tuplesL, inputL->cval_len, sizeof(struct idval_tuple), idval_tuple_compare);
 
-    // For each value in the left column, scan the btree for the value
-    // Maintain what we just searched for to avoid repeated accesses
-    // of the btree
-    struct column_ids *cids = NULL;
-    int prevval = 0;
+    // Probe the btree with all of the sorted values at once, which walks
+    // its leaves left to right like a merge
+    int *keys = NULL;
+    unsigned *ids = NULL;
+    TRYNULL(result, DBENOMEM, keys,
+            malloc(sizeof(int) * inputL->cval_len), cleanup_tuples);
+    TRYNULL(result, DBENOMEM, ids,
+            malloc(sizeof(unsigned) * inputL->cval_len), cleanup_keys);
     for (unsigned i = 0; i < inputL->cval_len; i++) {
-        int curval = tuplesL[i].idval_val;
-        if (cids == NULL || curval != prevval) {
-            if (cids != NULL) {
-                column_ids_destroy(cids);
-            }
-            struct op op;
-            bzero(&op, sizeof(struct op));
-            op.op_type = OP_SELECT_VALUE;
-            op.op_select.op_sel_value = curval;
-            strcpy(op.op_select.op_sel_col, inputR->cval_col);
-            TRYNULL(result, DBECOLSELECT, cids, column_select(col, &op), cleanup_cids);
-            prevval = curval;
-        }
-        unsigned leftid = tuplesL[i].idval_id;
-        struct cid_iterator iter;
-        cid_iter_init(&iter, cids);
-        while (cid_iter_has_next(&iter)) {
-            unsigned rightid = cid_iter_get(&iter);
-            TRY(result, idarray_add(retidsL->cid_array, (void *) leftid, NULL), cleanup_cids);
-            TRY(result, idarray_add(retidsR->cid_array, (void *) rightid, NULL), cleanup_cids);
-        }
-        cid_iter_cleanup(&iter);
+        keys[i] = tuplesL[i].idval_val;
+        ids[i] = tuplesL[i].idval_id;
     }
+    TRY(result, column_btree_probe(col, keys, ids, inputL->cval_len,
+                                   retidsL, retidsR), cleanup_ids);
 
     result = 0;
-    goto cleanup_cids;
-  cleanup_cids:
-    if (cids != NULL) {
-        column_ids_destroy(cids);
-    }
+    goto cleanup_ids;
+  cleanup_ids:
+    free(ids);
+  cleanup_keys:
+    free(keys);
+  cleanup_tuples:
     free(tuplesL);
   cleanup_col:
     column_close(col);
@@ -258,6 +253,9 @@ column_join_hash(struct storage *storage,
                  struct column_ids *retidsR)
 {
     int result;
+    if (inputL->cval_len == 0 || inputR->cval_len == 0) {
+        return 0;
+    }
 
     // Use static hashing.
     // First pass: compute counts for each bucket on right side
@@ -324,6 +322,76 @@ column_join_hash(struct storage *storage,
     return result;
 }
 
+// Rough costs, in units of comparing two values, used to pick a join
+// algorithm when the query does not name one.
+// Joins with at most this many pairs just compare every pair.
+#define JOIN_LOOP_MAX (1 << 14)
+// Looking up one value in a B+tree.
+#define JOIN_TREE_PROBE 256
+
+// Opens the column that the values were fetched from. Returns NULL if they
+// did not come straight from a column.
+static
+struct column *
+column_join_open(struct storage *storage, struct column_vals *cvals)
+{
+    struct column *col = NULL;
+    if (strcmp(cvals->cval_col, "") == 0
+        || column_open(storage, cvals->cval_col, &col) != 0) {
+        return NULL;
+    }
+    return col;
+}
+
+// PRECONDITION: inputL is at least as long as inputR
+// Picks the cheapest join algorithm for the inputs. The hash join builds
+// its table on inputR. A tree join is only picked when inputL holds every
+// value of a B+tree column, and it then probes that tree with inputR.
+static
+enum join_type
+column_join_plan(struct storage *storage,
+                 struct column_vals *inputL,
+                 struct column_vals *inputR)
+{
+    assert(inputL->cval_len >= inputR->cval_len);
+    uint64_t nl = inputL->cval_len;
+    uint64_t nr = inputR->cval_len;
+    if (nl * nr <= JOIN_LOOP_MAX) {
+        return JOIN_LOOP;
+    }
+
+    // The number of tree probes is the number of distinct values in inputR
+    uint64_t ndistinctR = nr;
+    struct column *colR = column_join_open(storage, inputR);
+    if (colR != NULL) {
+        struct column_stats stats;
+        column_get_stats(colR, &stats);
+        uint64_t ndistinct = column_stats_ndistinct(&stats);
+        if (ndistinct > 0 && ndistinct < ndistinctR) {
+            ndistinctR = ndistinct;
+        }
+        column_close(colR);
+    }
+
+    // Every probe of the hash table walks a whole bucket
+    double hashcost = nl + nr + ((double) nl * nr) / (1 << NHASHBITS);
+    double sortcost = nl * log2(nl) + nr * log2(nr);
+    double treecost = INFINITY;
+    struct column *colL = column_join_open(storage, inputL);
+    if (colL != NULL) {
+        if (colL->col_disk.cd_stype == STORAGE_BTREE
+            && nl == colL->col_disk.cd_ntuples) {
+            treecost = nr * log2(nr) + (double) ndistinctR * JOIN_TREE_PROBE;
+        }
+        column_close(colL);
+    }
+
+    if (treecost < hashcost && treecost < sortcost) {
+        return JOIN_TREE;
+    }
+    return (sortcost < hashcost) ? JOIN_SORT : JOIN_HASH;
+}
+
 int
 column_join(enum join_type jtype,
             struct storage *storage,
@@ -341,14 +409,25 @@ column_join(enum join_type jtype,
     if (jtype != JOIN_TREE && inputL->cval_len < inputR->cval_len) {
         return column_join(jtype, storage, inputR, inputL, retidsR, retidsL);
     }
+    if (jtype == JOIN_AUTO) {
+        jtype = column_join_plan(storage, inputL, inputR);
+        // the tree is on the left input, but treejoin probes its right one
+        if (jtype == JOIN_TREE) {
+            return column_join(JOIN_TREE, storage, inputR, inputL, retidsR, retidsL);
+        }
+    }
 
     int result;
     struct column_ids *idsL, *idsR;
     TRYNULL(result, DBENOMEM, idsL, malloc(sizeof(struct column_ids)), done);
     idsL->cid_type = CID_ARRAY;
+    idsL->cid_col[0] = '\0';
+    idsL->cid_index_col[0] = '\0';
     TRYNULL(result, DBENOMEM, idsL->cid_array, idarray_create(), cleanup_idsL);
     TRYNULL(result, DBENOMEM, idsR, malloc(sizeof(struct column_ids)), cleanup_idsLarray);
     idsR->cid_type = CID_ARRAY;
+    idsR->cid_col[0] = '\0';
+    idsR->cid_index_col[0] = '\0';
     TRYNULL(result, DBENOMEM, idsR->cid_array, idarray_create(), cleanup_idsR);
 
     switch (jtype) {
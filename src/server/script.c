@@ -0,0 +1,353 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <db/common/dberror.h>
+#include <db/common/try.h>
+#include <db/server/script.h>
+
+// Slots in the variable table to start with. It doubles when half full.
+#define SCRIPT_NSLOTS 64
+
+// What we know about a variable while we walk the script
+struct script_var {
+    const char *sv_name; // NULL for an empty slot
+    size_t sv_len;
+    int sv_writer; // last op that assigned it, or -1
+    unsigned *sv_readers; // ops that read it since then
+    unsigned sv_nreaders;
+    unsigned sv_maxreaders;
+};
+
+struct script_builder {
+    struct script *sb_script;
+    struct script_var *sb_vars;
+    unsigned sb_nslots;
+    unsigned sb_nvars;
+    int sb_barrier; // last barrier so far, or -1
+};
+
+// FNV-1a
+static
+uint32_t
+script_hash(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return h;
+}
+
+static
+struct script_var *
+script_slot(struct script_var *vars, unsigned nslots, const char *name, size_t len)
+{
+    unsigned i = script_hash(name, len) & (nslots - 1);
+    while (vars[i].sv_name != NULL
+           && (vars[i].sv_len != len || memcmp(vars[i].sv_name, name, len) != 0)) {
+        i = (i + 1) & (nslots - 1);
+    }
+    return &vars[i];
+}
+
+static
+int
+script_grow_vars(struct script_builder *sb)
+{
+    int result;
+    unsigned nslots = sb->sb_nslots * 2;
+    struct script_var *vars;
+    TRYNULL(result, DBENOMEM, vars, calloc(nslots, sizeof(struct script_var)), done);
+    for (unsigned i = 0; i < sb->sb_nslots; i++) {
+        struct script_var *old = &sb->sb_vars[i];
+        if (old->sv_name != NULL) {
+            *script_slot(vars, nslots, old->sv_name, old->sv_len) = *old;
+        }
+    }
+    free(sb->sb_vars);
+    sb->sb_vars = vars;
+    sb->sb_nslots = nslots;
+    result = 0;
+  done:
+    return result;
+}
+
+static
+int
+script_find_var(struct script_builder *sb, const char *name, size_t len,
+                struct script_var **retvar)
+{
+    int result;
+    if (2 * (sb->sb_nvars + 1) > sb->sb_nslots) {
+        TRY(result, script_grow_vars(sb), done);
+    }
+    struct script_var *var = script_slot(sb->sb_vars, sb->sb_nslots, name, len);
+    if (var->sv_name == NULL) {
+        var->sv_name = name;
+        var->sv_len = len;
+        var->sv_writer = -1;
+        sb->sb_nvars++;
+    }
+    *retvar = var;
+    result = 0;
+  done:
+    return result;
+}
+
+// Makes the op at index to wait for the op at index from. Anything before
+// the last barrier is done before the barrier is, so it needs no edge.
+static
+int
+script_edge(struct script_builder *sb, int from, unsigned to)
+{
+    if (from < 0 || from < sb->sb_barrier || (unsigned) from == to) {
+        return 0;
+    }
+    int result;
+    struct script_node *node = &sb->sb_script->sc_nodes[from];
+    // an op that uses several variables of the same earlier op adds its
+    // edges one after another
+    if (node->sn_nnext > 0 && node->sn_next[node->sn_nnext - 1] == to) {
+        result = 0;
+        goto done;
+    }
+    if (node->sn_nnext == node->sn_maxnext) {
+        unsigned max = (node->sn_maxnext == 0) ? 4 : 2 * node->sn_maxnext;
+        unsigned *next;
+        TRYNULL(result, DBENOMEM, next,
+                realloc(node->sn_next, max * sizeof(unsigned)), done);
+        node->sn_next = next;
+        node->sn_maxnext = max;
+    }
+    node->sn_next[node->sn_nnext++] = to;
+    sb->sb_script->sc_nodes[to].sn_ndeps++;
+    result = 0;
+  done:
+    return result;
+}
+
+static
+int
+script_read_len(struct script_builder *sb, unsigned op, const char *name, size_t len)
+{
+    int result;
+    struct script_var *var;
+    TRY(result, script_find_var(sb, name, len, &var), done);
+    TRY(result, script_edge(sb, var->sv_writer, op), done);
+    if (var->sv_nreaders == var->sv_maxreaders) {
+        unsigned max = (var->sv_maxreaders == 0) ? 4 : 2 * var->sv_maxreaders;
+        unsigned *readers;
+        TRYNULL(result, DBENOMEM, readers,
+                realloc(var->sv_readers, max * sizeof(unsigned)), done);
+        var->sv_readers = readers;
+        var->sv_maxreaders = max;
+    }
+    var->sv_readers[var->sv_nreaders++] = op;
+    result = 0;
+  done:
+    return result;
+}
+
+static
+int
+script_read(struct script_builder *sb, unsigned op, const char *name)
+{
+    return script_read_len(sb, op, name, strlen(name));
+}
+
+static
+int
+script_write(struct script_builder *sb, unsigned op, const char *name)
+{
+    int result;
+    struct script_var *var;
+    TRY(result, script_find_var(sb, name, strlen(name), &var), done);
+    TRY(result, script_edge(sb, var->sv_writer, op), done);
+    for (unsigned i = 0; i < var->sv_nreaders; i++) {
+        TRY(result, script_edge(sb, var->sv_readers[i], op), done);
+    }
+    var->sv_writer = op;
+    var->sv_nreaders = 0;
+    result = 0;
+  done:
+    return result;
+}
+
+// Reads every name in a comma separated list
+static
+int
+script_read_list(struct script_builder *sb, unsigned op, const char *names)
+{
+    int result = 0;
+    while (result == 0) {
+        size_t len = strcspn(names, ",");
+        result = script_read_len(sb, op, names, len);
+        if (names[len] == '\0') {
+            break;
+        }
+        names += len + 1;
+    }
+    return result;
+}
+
+static
+int
+script_add_op(struct script_builder *sb, unsigned i)
+{
+    int result;
+    struct script_node *node = &sb->sb_script->sc_nodes[i];
+    struct op *op = node->sn_op;
+    node->sn_kind = SCRIPT_PURE;
+    switch (op->op_type) {
+    case OP_SELECT_ALL:
+    case OP_SELECT_RANGE:
+    case OP_SELECT_VALUE:
+        node->sn_kind = SCRIPT_OUTPUT;
+        // fall through
+    case OP_SELECT_ALL_ASSIGN:
+    case OP_SELECT_RANGE_ASSIGN:
+    case OP_SELECT_VALUE_ASSIGN:
+        if (op->op_select.op_sel_pos[0] != '\0') {
+            TRY(result, script_read(sb, i, op->op_select.op_sel_pos), done);
+        }
+        if (node->sn_kind == SCRIPT_PURE) {
+            TRY(result, script_write(sb, i, op->op_select.op_sel_var), done);
+        }
+        break;
+    case OP_FETCH:
+        node->sn_kind = SCRIPT_OUTPUT;
+        TRY(result, script_read(sb, i, op->op_fetch.op_fetch_pos), done);
+        break;
+    case OP_FETCH_ASSIGN:
+        TRY(result, script_read(sb, i, op->op_fetch.op_fetch_pos), done);
+        TRY(result, script_write(sb, i, op->op_fetch.op_fetch_var), done);
+        break;
+    case OP_AGG:
+        TRY(result, script_read(sb, i, op->op_agg.op_agg_col), done);
+        if (op->op_agg.op_agg_math) {
+            TRY(result, script_read(sb, i, op->op_agg.op_agg_col2), done);
+        }
+        if (op->op_agg.op_agg_assign) {
+            TRY(result, script_write(sb, i, op->op_agg.op_agg_var), done);
+        } else {
+            node->sn_kind = SCRIPT_OUTPUT;
+        }
+        break;
+    case OP_MATH:
+        // constant operands are read like variables nobody assigns
+        TRY(result, script_read(sb, i, op->op_math.op_math_col1), done);
+        TRY(result, script_read(sb, i, op->op_math.op_math_col2), done);
+        if (op->op_math.op_math_assign) {
+            TRY(result, script_write(sb, i, op->op_math.op_math_var), done);
+        } else {
+            node->sn_kind = SCRIPT_OUTPUT;
+        }
+        break;
+    case OP_JOIN:
+        TRY(result, script_read(sb, i, op->op_join.op_join_inputL), done);
+        TRY(result, script_read(sb, i, op->op_join.op_join_inputR), done);
+        TRY(result, script_write(sb, i, op->op_join.op_join_varL), done);
+        TRY(result, script_write(sb, i, op->op_join.op_join_varR), done);
+        break;
+    case OP_SET:
+        TRY(result, script_read(sb, i, op->op_set.op_set_ids1), done);
+        if (op->op_set.op_set_stype != SET_NOT) {
+            TRY(result, script_read(sb, i, op->op_set.op_set_ids2), done);
+        }
+        if (op->op_set.op_set_assign) {
+            TRY(result, script_write(sb, i, op->op_set.op_set_var), done);
+        } else {
+            node->sn_kind = SCRIPT_OUTPUT;
+        }
+        break;
+    case OP_PRINT:
+        node->sn_kind = SCRIPT_OUTPUT;
+        TRY(result, script_read(sb, i, op->op_print.op_print_var), done);
+        break;
+    case OP_TUPLE:
+        node->sn_kind = SCRIPT_OUTPUT;
+        TRY(result, script_read_list(sb, i, op->op_tuple.op_tuple_vars), done);
+        break;
+    case OP_CREATE:
+    case OP_LOAD:
+    case OP_INSERT:
+    case OP_DELETE:
+    case OP_UPDATE:
+    case OP_BATCH_QUERIES:
+    case OP_BATCH_EXECUTE:
+        // waits for everything since the last barrier, which itself
+        // waited for everything before it
+        node->sn_kind = SCRIPT_BARRIER;
+        for (unsigned j = (sb->sb_barrier < 0) ? 0 : sb->sb_barrier; j < i; j++) {
+            TRY(result, script_edge(sb, j, i), done);
+        }
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    TRY(result, script_edge(sb, sb->sb_barrier, i), done);
+    if (node->sn_kind == SCRIPT_BARRIER) {
+        sb->sb_barrier = i;
+    }
+    result = 0;
+  done:
+    return result;
+}
+
+int
+script_create(struct oparray *ops, struct script **retscript)
+{
+    assert(ops != NULL);
+    assert(retscript != NULL);
+
+    int result;
+    struct script_builder sb;
+    sb.sb_nslots = SCRIPT_NSLOTS;
+    sb.sb_nvars = 0;
+    sb.sb_barrier = -1;
+    TRYNULL(result, DBENOMEM, sb.sb_script, malloc(sizeof(struct script)), done);
+    struct script *script = sb.sb_script;
+    script->sc_nnodes = oparray_num(ops);
+    // one spare node, so that an empty script is not mistaken for no memory
+    TRYNULL(result, DBENOMEM, script->sc_nodes,
+            calloc(script->sc_nnodes + 1, sizeof(struct script_node)), cleanup_script);
+    TRYNULL(result, DBENOMEM, sb.sb_vars,
+            calloc(sb.sb_nslots, sizeof(struct script_var)), cleanup_script);
+    for (unsigned i = 0; i < script->sc_nnodes; i++) {
+        script->sc_nodes[i].sn_op = oparray_get(ops, i);
+        TRY(result, script_add_op(&sb, i), cleanup_vars);
+    }
+
+    // success
+    result = 0;
+    *retscript = script;
+    goto cleanup_vars;
+  cleanup_vars:
+    for (unsigned i = 0; i < sb.sb_nslots; i++) {
+        free(sb.sb_vars[i].sv_readers);
+    }
+    free(sb.sb_vars);
+    if (result) {
+        script_destroy(script);
+    }
+    goto done;
+  cleanup_script:
+    script_destroy(script);
+  done:
+    return result;
+}
+
+void
+script_destroy(struct script *script)
+{
+    assert(script != NULL);
+    if (script->sc_nodes != NULL) {
+        for (unsigned i = 0; i < script->sc_nnodes; i++) {
+            free(script->sc_nodes[i].sn_next);
+        }
+        free(script->sc_nodes);
+    }
+    free(script);
+}
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <netdb.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -22,9 +23,12 @@
 #include <db/common/dberror.h>
 #include <db/common/try.h>
 #include <db/common/results.h>
+#include <db/common/synch.h>
+#include <db/server/file.h>
 #include <db/server/storage.h>
 #include <db/server/aggregate.h>
 #include <db/server/join.h>
+#include <db/server/script.h>
 #include <db/server/server.h>
 
 static
@@ -40,6 +44,7 @@ struct server {
     int s_listenfd;
     struct storage *s_storage;
     struct threadpool *s_threadpool;
+    char s_loaddir[PATH_MAX]; // sopt_loaddir with no links in it
 };
 
 enum vartuple_type {
@@ -58,10 +63,12 @@ struct vartuple {
     };
 };
 
-// (file name) -> file descriptor to CSV file
+// (file name) -> where to read the CSV file from
 struct filetuple {
     char ft_name[128];
     int ft_fd;
+    uint64_t ft_len; // bytes of the file still to be read from ft_fd
+    bool ft_local; // ft_fd is the file itself, opened by the server
 };
 
 DECLARRAY(vartuple);
@@ -73,23 +80,38 @@ struct session {
     int ses_fd;
     unsigned ses_jobid;
     struct storage *ses_storage;
+    struct threadpool *ses_tpool; // runs the pieces of its queries
+    const char *ses_loaddir; // where it may load files from, NULL for nowhere
     struct vartuplearray *ses_env;
+    struct lock *ses_envlock;
     struct filetuplearray *ses_files;
+    bool ses_batching; // between batch_queries() and batch_execute()
+    struct oparray *ses_batch; // selects waiting for batch_execute()
 };
 
 static
 struct session *
-session_create(int fd, unsigned jobid, struct storage *storage)
+session_create(int fd, unsigned jobid, struct storage *storage,
+               struct threadpool *tpool, const char *loaddir)
 {
     int result;
     struct session *session;
     TRYNULL(result, DBENOMEM, session, malloc(sizeof(struct session)), done);
     TRYNULL(result, DBENOMEM, session->ses_env, vartuplearray_create(), cleanup_malloc);
     TRYNULL(result, DBENOMEM, session->ses_files, filetuplearray_create(), cleanup_vartuple);
+    TRYNULL(result, DBENOMEM, session->ses_envlock, lock_create(), cleanup_filetuple);
+    TRYNULL(result, DBENOMEM, session->ses_batch, oparray_create(), cleanup_lock);
     session->ses_fd = fd;
     session->ses_jobid = jobid;
     session->ses_storage = storage;
+    session->ses_tpool = tpool;
+    session->ses_loaddir = loaddir;
+    session->ses_batching = false;
     goto done;
+  cleanup_lock:
+    lock_destroy(session->ses_envlock);
+  cleanup_filetuple:
+    filetuplearray_destroy(session->ses_files);
   cleanup_vartuple:
     vartuplearray_destroy(session->ses_env);
   cleanup_malloc:
@@ -123,14 +145,265 @@ session_destroy(struct session *session)
     vartuplearray_destroy(session->ses_env);
     while (filetuplearray_num(session->ses_files) > 0) {
         struct filetuple *f = filetuplearray_get(session->ses_files, 0);
-        // load file descriptor closed in load handler
+        // load file descriptor closed in load handler, unless the load
+        // never ran
+        if (f->ft_local) {
+            assert(close(f->ft_fd) == 0);
+        }
         free(f);
         filetuplearray_remove(session->ses_files, 0);
     }
     filetuplearray_destroy(session->ses_files);
+    parse_cleanup_ops(session->ses_batch);
+    lock_destroy(session->ses_envlock);
     free(session);
 }
 
+// Bytes of CSV we parse at a time during a load
+#define LOAD_BUFSIZE (4 << 20)
+
+// Skips whatever is left of a load file on the socket, so that the next
+// message can be read.
+static
+int
+server_skip_load(int fd, uint64_t len)
+{
+    int result = 0;
+    char buf[PAGESIZE];
+    while (len > 0) {
+        unsigned toread = (len < PAGESIZE) ? len : PAGESIZE;
+        TRY(result, io_read(fd, buf, toread), done);
+        len -= toread;
+    }
+  done:
+    return result;
+}
+
+// The columns of a load and their loaders
+struct server_load {
+    struct column **sl_cols;
+    struct column_loader **sl_loaders;
+    unsigned sl_ncols;
+    struct threadpool *sl_tpool;
+};
+
+// Most tasks we load columns on at once
+#define LOAD_MAX_TASKS 8
+
+// Columns shared between the tasks of a load. Column i belongs to node i
+// mod the number of nodes, so that every batch of it is worked on by the
+// same node and its pages stay where they were first touched. Every task
+// takes the next column of its node until they are all done, then helps
+// the other nodes, and either appends a batch to it or, with no table,
+// finishes it.
+struct server_load_work {
+    struct server_load *lw_load;
+    struct csv_table *lw_table;
+    unsigned lw_nnodes;
+    unsigned *lw_next; // columns taken so far, by node
+    int *lw_results;
+};
+
+struct server_load_task {
+    struct server_load_work *lt_work;
+    unsigned lt_node;
+};
+
+static
+void
+server_load_column(struct server_load_work *work, unsigned i)
+{
+    struct server_load *load = work->lw_load;
+    if (load->sl_loaders[i] == NULL) {
+        return;
+    }
+    if (work->lw_table != NULL) {
+        work->lw_results[i] = column_load_append(load->sl_loaders[i],
+                                                 work->lw_table->csv_cols[i].csv_vals,
+                                                 work->lw_table->csv_nrows);
+    } else {
+        work->lw_results[i] = column_load_finish(load->sl_loaders[i]);
+        load->sl_loaders[i] = NULL;
+    }
+}
+
+static
+void
+server_load_routine(void *arg, unsigned threadnum)
+{
+    (void) threadnum;
+    struct server_load_task *task = arg;
+    struct server_load_work *work = task->lt_work;
+    unsigned nnodes = work->lw_nnodes;
+    for (unsigned n = 0; n < nnodes; n++) {
+        unsigned node = (task->lt_node + n) % nnodes;
+        unsigned i;
+        while ((i = node + nnodes * __sync_fetch_and_add(&work->lw_next[node], 1))
+               < work->lw_load->sl_ncols) {
+            server_load_column(work, i);
+        }
+    }
+}
+
+// Works on every column of the load in parallel, and returns the first
+// error
+static
+int
+server_load_run(struct server_load *load, struct csv_table *table)
+{
+    int result;
+    struct server_load_work work = { load, table, threadpool_nnodes(load->sl_tpool),
+                                     NULL, NULL };
+    TRYNULL(result, DBENOMEM, work.lw_results, calloc(load->sl_ncols, sizeof(int)), done);
+    TRYNULL(result, DBENOMEM, work.lw_next, calloc(work.lw_nnodes, sizeof(unsigned)),
+            cleanup_results);
+    struct server_load_task tasks[LOAD_MAX_TASKS];
+    unsigned ntasks = (load->sl_ncols < LOAD_MAX_TASKS) ? load->sl_ncols : LOAD_MAX_TASKS;
+    struct task_group *group = task_group_create(load->sl_tpool);
+    // if we can't spawn a task, we do its share here
+    for (unsigned i = 0; i < ntasks; i++) {
+        tasks[i].lt_work = &work;
+        tasks[i].lt_node = i % work.lw_nnodes;
+        if (group == NULL
+            || task_group_spawn_node(group, tasks[i].lt_node, server_load_routine, &tasks[i])) {
+            server_load_routine(&tasks[i], 0);
+        }
+    }
+    if (group != NULL) {
+        task_group_wait(group);
+        task_group_destroy(group);
+    }
+    result = 0;
+    for (unsigned i = 0; i < load->sl_ncols && result == 0; i++) {
+        result = work.lw_results[i];
+    }
+    free(work.lw_next);
+  cleanup_results:
+    free(work.lw_results);
+  done:
+    return result;
+}
+
+// Appends the rows of table to the columns, opening them first if this is
+// the first batch
+static
+int
+server_load_batch(struct session *session, struct server_load *load,
+                  struct csv_table *table)
+{
+    int result;
+    if (load->sl_cols == NULL) {
+        TRYNULL(result, DBENOMEM, load->sl_cols,
+                calloc(table->csv_ncols, sizeof(struct column *)), done);
+        TRYNULL(result, DBENOMEM, load->sl_loaders,
+                calloc(table->csv_ncols, sizeof(struct column_loader *)), done);
+        for (; load->sl_ncols < table->csv_ncols; load->sl_ncols++) {
+            unsigned i = load->sl_ncols;
+            struct csv_column *csvcol = &table->csv_cols[i];
+            TRY(result, column_open(session->ses_storage, csvcol->csv_colname,
+                                    &load->sl_cols[i]), done);
+            result = column_load_begin(load->sl_cols[i], &load->sl_loaders[i]);
+            if (result) {
+                column_close(load->sl_cols[i]);
+                goto done;
+            }
+        }
+    }
+    TRY(result, server_load_run(load, table), done);
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Finishes the loads and closes the columns. Returns the first error.
+static
+int
+server_load_finish(struct server_load *load, int result)
+{
+    // finishing builds the sorted indexes, so it runs in parallel too
+    if (load->sl_ncols > 0) {
+        int finishresult = server_load_run(load, NULL);
+        result = result ? result : finishresult;
+    }
+    for (unsigned i = 0; i < load->sl_ncols; i++) {
+        // if we could not run the finish, do it here
+        if (load->sl_loaders[i] != NULL) {
+            int finishresult = column_load_finish(load->sl_loaders[i]);
+            result = result ? result : finishresult;
+        }
+        column_close(load->sl_cols[i]);
+    }
+    free(load->sl_loaders);
+    free(load->sl_cols);
+    return result;
+}
+
+// Parse the csv as it comes off the socket, and append every batch of rows
+// to the columns, so we never hold more than one batch in memory.
+static
+int
+server_load_stream(struct session *session, struct filetuple *ftuple)
+{
+    int result;
+    struct server_load load = { NULL, NULL, 0, session->ses_tpool };
+    struct csv_stream *stream;
+    TRYNULL(result, DBENOMEM, stream, csv_stream_create(LOAD_BUFSIZE), done);
+    bool eof = false;
+    while (!eof) {
+        size_t space;
+        char *buf;
+        TRYNULL(result, DBENOMEM, buf, csv_stream_buf(stream, &space), cleanup_load);
+        size_t toread = (space < ftuple->ft_len) ? space : ftuple->ft_len;
+        TRY(result, io_read(ftuple->ft_fd, buf, toread), cleanup_load);
+        ftuple->ft_len -= toread;
+        eof = (ftuple->ft_len == 0);
+        struct csv_table *table;
+        TRY(result, csv_stream_parse(stream, toread, eof, &table), cleanup_load);
+        if (table != NULL) {
+            TRY(result, server_load_batch(session, &load, table), cleanup_load);
+        }
+    }
+
+    // success
+    result = 0;
+    goto cleanup_load;
+  cleanup_load:
+    result = server_load_finish(&load, result);
+    csv_stream_destroy(stream);
+  done:
+    // leave the socket at the next message
+    if (result && server_skip_load(ftuple->ft_fd, ftuple->ft_len)) {
+        result = DBESOCKET;
+    }
+    return result;
+}
+
+// The server opened the file itself, so we can map it and parse it all at
+// once on several threads.
+static
+int
+server_load_local(struct session *session, struct filetuple *ftuple)
+{
+    int result;
+    struct server_load load = { NULL, NULL, 0, session->ses_tpool };
+    struct csv_table *table;
+    // csv_parse closes the file
+    TRYNULL(result, DBECSV, table, csv_parse(ftuple->ft_fd), done);
+    TRY(result, server_load_batch(session, &load, table), cleanup_load);
+
+    // success
+    result = 0;
+    goto cleanup_load;
+  cleanup_load:
+    result = server_load_finish(&load, result);
+    csv_destroy(table);
+  done:
+    return result;
+}
+
 static
 int
 server_eval_load(struct session *session, struct op *op)
@@ -139,51 +412,37 @@ server_eval_load(struct session *session, struct op *op)
     assert(op != NULL);
     assert(op->op_type == OP_LOAD);
 
-    // find the csv file descriptor for the load file name
-    int csvfd = -1;
+    // find the csv file for the load file name
+    struct filetuple *ftuple = NULL;
     unsigned ix = -1;
     for (unsigned i = 0; i < filetuplearray_num(session->ses_files); i++) {
-        struct filetuple *ftuple = filetuplearray_get(session->ses_files, i);
-        if (strcmp(ftuple->ft_name, op->op_load.op_load_file) == 0) {
+        struct filetuple *f = filetuplearray_get(session->ses_files, i);
+        if (strcmp(f->ft_name, op->op_load.op_load_file) == 0) {
             ix = i;
-            csvfd = ftuple->ft_fd;
+            ftuple = f;
             break;
         }
     }
-    assert(csvfd != -1);
+    assert(ftuple != NULL);
     assert(ix != -1);
     filetuplearray_remove(session->ses_files, ix);
-    int result;
-
-    // parse the csv
-    struct csv_resultarray *results = NULL;
-    TRYNULL(result, DBECSV, results, csv_parse(csvfd), done);
 
-    // for each column, load the data into that column
-    for (unsigned i = 0; i < csv_resultarray_num(results); i++) {
-        struct csv_result *csvheader = csv_resultarray_get(results, i);
-        struct column *col;
-        TRY(result, column_open(session->ses_storage, csvheader->csv_colname, &col),
-            cleanup_csv);
-        result = column_load(col, (int *) csvheader->csv_vals->arr.v,
-                             intarray_num(csvheader->csv_vals));
-        if (result) {
-            fprintf(stderr, "column load failed\n");
-            column_close(col);
-            goto cleanup_csv;
-        }
-        column_close(col);
+    int result;
+    if (ftuple->ft_local) {
+        result = server_load_local(session, ftuple);
+    } else {
+        result = server_load_stream(session, ftuple);
     }
-
-  cleanup_csv:
-    csv_destroy(results);
-  done:
+    if (result) {
+        fprintf(stderr, "column load failed\n");
+    }
+    free(ftuple);
     return result;
 }
 
 static
 struct vartuple *
-server_eval_get_var(struct vartuplearray *env, char *varname)
+server_find_var(struct vartuplearray *env, char *varname)
 {
     for (unsigned i = 0; i < vartuplearray_num(env); i++) {
         struct vartuple *v = vartuplearray_get(env, i);
@@ -194,14 +453,27 @@ server_eval_get_var(struct vartuplearray *env, char *varname)
     return NULL;
 }
 
+// The environment is locked while we look through it, because the ops of a
+// script may assign other variables at the same time. The script makes sure
+// that nothing assigns this variable while the caller uses it.
+static
+struct vartuple *
+server_eval_get_var(struct session *session, char *varname)
+{
+    lock_acquire(session->ses_envlock);
+    struct vartuple *v = server_find_var(session->ses_env, varname);
+    lock_release(session->ses_envlock);
+    return v;
+}
+
 static
 int
-server_add_var(struct vartuplearray *env, char *varname,
+server_add_var(struct session *session, char *varname,
                enum vartuple_type type,
                struct column_ids *ids,
                struct column_vals *vals)
 {
-    assert(env != NULL);
+    assert(session != NULL);
     assert(varname != NULL);
     switch (type) {
     case VAR_IDS:
@@ -219,7 +491,9 @@ server_add_var(struct vartuplearray *env, char *varname,
 
     int result;
     bool should_cleanup_vtuple_on_err = false;
-    struct vartuple *vtuple = server_eval_get_var(env, varname);
+    struct vartuplearray *env = session->ses_env;
+    lock_acquire(session->ses_envlock);
+    struct vartuple *vtuple = server_find_var(env, varname);
     if (vtuple == NULL) {
         // we couldn't find the variable in the environment, so we
         // need to create it
@@ -264,45 +538,70 @@ server_add_var(struct vartuplearray *env, char *varname,
         free(vtuple);
     }
   done:
+    lock_release(session->ses_envlock);
     return result;
 }
 
+// Assigns the ids found by a select, or sends them to the client. Takes
+// the ids, unless it fails.
 static
 int
-server_eval_select(struct session *session, struct op *op)
+server_select_result(struct session *session, struct op *op, struct column_ids *ids)
 {
-    assert(session != NULL);
-    assert(op != NULL);
-    assert(op->op_type >= OP_SELECT_ALL_ASSIGN
-           && op->op_type <= OP_SELECT_RANGE);
     int result;
-    struct column *col;
-    TRY(result, column_open(session->ses_storage, op->op_select.op_sel_col, &col), done);
-    struct column_ids *ids;
-    TRYNULL(result, DBECOLSELECT, ids, column_select(col, op), cleanup_col);
-
-    // If we have an assignment,
-    // find the variable in the vartuple array if it already exists
-    // otherwise create a new variable tuple
     switch (op->op_type) {
     case OP_SELECT_ALL_ASSIGN:
     case OP_SELECT_RANGE_ASSIGN:
     case OP_SELECT_VALUE_ASSIGN:
-        TRY(result, server_add_var(session->ses_env, op->op_select.op_sel_var,
-                                   VAR_IDS, ids, NULL), cleanup_ids);
-        result = 0;
-        goto cleanup_col; // don't destroy ids
+        TRY(result, server_add_var(session, op->op_select.op_sel_var,
+                                   VAR_IDS, ids, NULL), done);
+        break;
     case OP_SELECT_ALL:
     case OP_SELECT_RANGE:
     case OP_SELECT_VALUE:
-        TRY(result, rpc_write_select_result(session->ses_fd, ids), cleanup_ids);
-        result = 0;
-        goto cleanup_ids; // destroy the ids
+        TRY(result, rpc_write_select_result(session->ses_fd, ids), done);
+        column_ids_destroy(ids);
+        break;
     default:
         assert(0);
         break;
     }
+    result = 0;
+  done:
+    return result;
+}
 
+static
+int
+server_eval_select(struct session *session, struct op *op)
+{
+    assert(session != NULL);
+    assert(op != NULL);
+    assert(op->op_type >= OP_SELECT_ALL_ASSIGN
+           && op->op_type <= OP_SELECT_VALUE);
+    int result;
+    struct column *col;
+    TRY(result, column_open(session->ses_storage, op->op_select.op_sel_col, &col), done);
+    struct column_ids *ids;
+    if (op->op_select.op_sel_pos[0] != '\0') {
+        // only scan the positions of an earlier result
+        struct vartuple *v;
+        TRYNULL(result, DBENOVAR, v,
+                server_eval_get_var(session, op->op_select.op_sel_pos),
+                cleanup_col);
+        if (v->vt_type != VAR_IDS) {
+            result = DBEVARTYPE;
+            DBLOG(result);
+            goto cleanup_col;
+        }
+        TRYNULL(result, DBECOLSELECT, ids,
+                column_select_within(col, op, v->vt_column_ids), cleanup_col);
+    } else {
+        TRYNULL(result, DBECOLSELECT, ids, column_select(col, op), cleanup_col);
+    }
+    TRY(result, server_select_result(session, op, ids), cleanup_ids);
+    result = 0;
+    goto cleanup_col;
   cleanup_ids:
     column_ids_destroy(ids);
   cleanup_col:
@@ -311,6 +610,146 @@ server_eval_select(struct session *session, struct op *op)
     return result;
 }
 
+// True for the selects that scan the whole column rather than an
+// intermediate, which may be evaluated together with others on the column
+static
+bool
+server_select_batchable(struct op *op)
+{
+    return op->op_type >= OP_SELECT_ALL_ASSIGN && op->op_type <= OP_SELECT_VALUE
+           && op->op_select.op_sel_pos[0] == '\0';
+}
+
+// Evaluates selects that are batchable a column at a time, so that the
+// selects on each column share one scan of it. Sets retids[i] for ops[i],
+// or retresults[i] if it failed.
+static
+void
+server_select_many(struct session *session, struct op **ops, unsigned nops,
+                   struct column_ids **retids, int *retresults)
+{
+    int result;
+    struct op **group = NULL;
+    unsigned *groupix = NULL;
+    struct column_ids **groupids = NULL;
+    bzero(retids, nops * sizeof(struct column_ids *));
+    bzero(retresults, nops * sizeof(int));
+    TRYNULL(result, DBENOMEM, group, malloc(nops * sizeof(struct op *)), fail);
+    TRYNULL(result, DBENOMEM, groupix, malloc(nops * sizeof(unsigned)), fail);
+    TRYNULL(result, DBENOMEM, groupids, malloc(nops * sizeof(struct column_ids *)), fail);
+    for (unsigned i = 0; i < nops; i++) {
+        if (retids[i] != NULL || retresults[i] != 0) {
+            // in the group of an earlier select on the same column
+            continue;
+        }
+        char *colname = ops[i]->op_select.op_sel_col;
+        unsigned n = 0;
+        for (unsigned j = i; j < nops; j++) {
+            if (retids[j] == NULL && retresults[j] == 0
+                && strcmp(ops[j]->op_select.op_sel_col, colname) == 0) {
+                group[n] = ops[j];
+                groupix[n++] = j;
+            }
+        }
+        struct column *col;
+        result = column_open(session->ses_storage, colname, &col);
+        if (result == 0) {
+            if (column_select_batch(col, group, n, groupids)) {
+                result = DBECOLSELECT;
+            }
+            column_close(col);
+        }
+        for (unsigned k = 0; k < n; k++) {
+            if (result) {
+                retresults[groupix[k]] = result;
+            } else {
+                retids[groupix[k]] = groupids[k];
+            }
+        }
+    }
+    goto cleanup;
+  fail:
+    for (unsigned i = 0; i < nops; i++) {
+        retresults[i] = result;
+    }
+  cleanup:
+    free(groupids);
+    free(groupix);
+    free(group);
+}
+
+// Queues a select until batch_execute(). It is replied to right away, and
+// if it fails later, the op that runs the queue reports the error.
+static
+int
+server_batch_add(struct session *session, struct op *op)
+{
+    int result;
+    struct op *copy;
+    TRYNULL(result, DBENOMEM, copy, malloc(op_size(op)), done);
+    memcpy(copy, op, op_size(op));
+    TRY(result, oparray_add(session->ses_batch, copy, NULL), cleanup_copy);
+    result = 0;
+    goto done;
+  cleanup_copy:
+    free(copy);
+  done:
+    return result;
+}
+
+// Runs the queued selects, and assigns their results in the order they
+// were queued
+static
+int
+server_batch_execute(struct session *session)
+{
+    int result;
+    struct column_ids **ids = NULL;
+    int *results = NULL;
+    unsigned n = oparray_num(session->ses_batch);
+    if (n == 0) {
+        result = 0;
+        goto done;
+    }
+    struct op **ops = (struct op **) session->ses_batch->arr.v;
+    TRYNULL(result, DBENOMEM, ids, malloc(n * sizeof(struct column_ids *)), cleanup);
+    TRYNULL(result, DBENOMEM, results, malloc(n * sizeof(int)), cleanup);
+    server_select_many(session, ops, n, ids, results);
+    result = 0;
+    for (unsigned i = 0; i < n; i++) {
+        int opresult = results[i];
+        if (opresult == 0) {
+            opresult = server_add_var(session, ops[i]->op_select.op_sel_var,
+                                      VAR_IDS, ids[i], NULL);
+            if (opresult) {
+                column_ids_destroy(ids[i]);
+            }
+        }
+        if (result == 0) {
+            result = opresult;
+        }
+    }
+  cleanup:
+    free(results);
+    free(ids);
+    for (unsigned i = 0; i < n; i++) {
+        free(oparray_get(session->ses_batch, i));
+    }
+    oparray_setsize(session->ses_batch, 0);
+  done:
+    return result;
+}
+
+static
+int
+server_eval_batch(struct session *session, struct op *op)
+{
+    // the queue was run before this op
+    assert(oparray_num(session->ses_batch) == 0);
+    session->ses_batching = (op->op_type == OP_BATCH_QUERIES);
+    return 0;
+}
+
 static
 int
 server_eval_fetch(struct session *session, struct op *op)
@@ -324,7 +763,7 @@ server_eval_fetch(struct session *session, struct op *op)
     // find the variable representing the positions
     struct vartuple *v;
     TRYNULL(result, DBENOVAR, v,
-            server_eval_get_var(session->ses_env, op->op_fetch.op_fetch_pos),
+            server_eval_get_var(session, op->op_fetch.op_fetch_pos),
             cleanup_col);
     if (v->vt_type != VAR_IDS) {
         result = DBEVARTYPE;
@@ -342,7 +781,7 @@ server_eval_fetch(struct session *session, struct op *op)
         TRY(result, rpc_write_fetch_result(session->ses_fd, vals), cleanup_vals);
         break;
     case OP_FETCH_ASSIGN:
-        TRY(result, server_add_var(session->ses_env, op->op_fetch.op_fetch_var,
+        TRY(result, server_add_var(session, op->op_fetch.op_fetch_var,
                                    VAR_VALS, NULL, vals), cleanup_vals);
         result = 0;
         goto cleanup_col;  // don't destroy results
@@ -361,35 +800,85 @@ server_eval_fetch(struct session *session, struct op *op)
     return result;
 }
 
+// Resolves the name of a math input: either an integer constant,
+// or an intermediate in the environment.
 static
 int
-server_eval_agg(struct session *session, struct op *op) {
+server_eval_math_operand(struct session *session, char *name,
+                         struct math_operand *retoperand)
+{
     assert(session != NULL);
-    assert(op != NULL);
-    assert(op->op_type == OP_AGG);
+    assert(name != NULL);
+    assert(retoperand != NULL);
 
     int result;
-
-    // Try to find the column intermediate
+    char *end;
+    errno = 0;
+    long val = strtol(name, &end, 10);
+    if (name[0] != '\0' && *end == '\0' && errno == 0
+        && val >= INT_MIN && val <= INT_MAX) {
+        retoperand->mo_scalar = true;
+        retoperand->mo_scalar_val = (int) val;
+        result = 0;
+        goto done;
+    }
     struct vartuple *v;
-    TRYNULL(result, DBENOVAR, v,
-            server_eval_get_var(session->ses_env, op->op_agg.op_agg_col),
-            done);
+    TRYNULL(result, DBENOVAR, v, server_eval_get_var(session, name), done);
     if (v->vt_type != VAR_VALS) {
         result = DBEVARTYPE;
         DBLOG(result);
         goto done;
     }
+    retoperand->mo_scalar = false;
+    retoperand->mo_vals = v->vt_column_vals;
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+static
+int
+server_eval_agg(struct session *session, struct op *op) {
+    assert(session != NULL);
+    assert(op != NULL);
+    assert(op->op_type == OP_AGG);
 
-    // Perform the aggregation
-    agg_func_t aggf = agg_func(op->op_agg.op_agg_atype);
+    int result;
     struct column_vals *aggval;
-    TRY(result, column_agg(v->vt_column_vals, aggf, &aggval), done);
+    if (op->op_agg.op_agg_math) {
+        // Aggregate directly over the math result
+        struct math_operand left, right;
+        TRY(result, server_eval_math_operand(session,
+                                             op->op_agg.op_agg_col, &left), done);
+        TRY(result, server_eval_math_operand(session,
+                                             op->op_agg.op_agg_col2, &right), done);
+        TRY(result, column_math_agg(op->op_agg.op_agg_atype,
+                                    op->op_agg.op_agg_mtype,
+                                    &left, &right, &aggval), done);
+    } else {
+        // Try to find the column intermediate
+        struct vartuple *v;
+        TRYNULL(result, DBENOVAR, v,
+                server_eval_get_var(session, op->op_agg.op_agg_col),
+                done);
+        if (v->vt_type != VAR_VALS) {
+            result = DBEVARTYPE;
+            DBLOG(result);
+            goto done;
+        }
+
+        // Perform the aggregation
+        agg_func_t aggf = agg_func(op->op_agg.op_agg_atype);
+        TRY(result, column_agg(v->vt_column_vals, aggf, &aggval), done);
+    }
     assert(aggval != NULL);
 
     // If this is an assignment, add it to the environment
     if (op->op_agg.op_agg_assign) {
-        TRY(result, server_add_var(session->ses_env, op->op_agg.op_agg_var,
+        TRY(result, server_add_var(session, op->op_agg.op_agg_var,
                                    VAR_VALS, NULL, aggval), cleanup_aggval);
         result = 0;
         goto done; // don't destroy aggval
@@ -414,30 +903,36 @@ server_eval_math(struct session *session, struct op *op) {
 
     int result;
 
-    // Try to find the column intermediates
-    struct vartuple *vleft, *vright;
-    TRYNULL(result, DBENOVAR, vleft,
-            server_eval_get_var(session->ses_env, op->op_math.op_math_col1),
-            done);
-    TRYNULL(result, DBENOVAR, vright,
-            server_eval_get_var(session->ses_env, op->op_math.op_math_col2),
-            done);
-    if (vleft->vt_type != VAR_VALS || vright->vt_type != VAR_VALS) {
-        result = DBEVARTYPE;
-        DBLOG(result);
-        goto done;
+    // Try to find the column intermediates or constants
+    struct math_operand left, right;
+    TRY(result, server_eval_math_operand(session,
+                                         op->op_math.op_math_col1, &left), done);
+    TRY(result, server_eval_math_operand(session,
+                                         op->op_math.op_math_col2, &right), done);
+
+    // If we are assigning over an existing intermediate, reuse its buffer
+    struct column_vals *reuse = NULL;
+    if (op->op_math.op_math_assign) {
+        struct vartuple *v = server_eval_get_var(session,
+                                                 op->op_math.op_math_var);
+        if (v != NULL && v->vt_type == VAR_VALS) {
+            reuse = v->vt_column_vals;
+        }
     }
 
-    // Perform the aggregation
-    math_func_t mathf = math_func(op->op_math.op_math_mtype);
+    // Perform the math
     struct column_vals *mathvals;
-    TRY(result, column_math(vleft->vt_column_vals,
-                            vright->vt_column_vals, mathf, &mathvals), done);
+    TRY(result, column_math(op->op_math.op_math_mtype, &left, &right,
+                            reuse, &mathvals), done);
     assert(mathvals != NULL);
 
     // If this is an assignment, add it to the environment
     if (op->op_math.op_math_assign) {
-        TRY(result, server_add_var(session->ses_env, op->op_math.op_math_var,
+        if (mathvals == reuse) {
+            result = 0;
+            goto done; // already in the environment
+        }
+        TRY(result, server_add_var(session, op->op_math.op_math_var,
                                    VAR_VALS, NULL, mathvals), cleanup_mathval);
         result = 0;
         goto done; // don't destroy vals
@@ -464,7 +959,7 @@ server_eval_print(struct session *session, struct op *op)
     int result;
     struct vartuple *v;
     TRYNULL(result, DBENOVAR, v,
-            server_eval_get_var(session->ses_env, op->op_print.op_print_var),
+            server_eval_get_var(session, op->op_print.op_print_var),
             done);
     switch (v->vt_type) {
     case VAR_VALS:
@@ -569,7 +1064,7 @@ server_eval_delete(struct session *session, struct op *op)
     // try to find the variable in the environment, ensure it is ids
     struct vartuple *idvar;
     TRYNULL(result, DBENOVAR, idvar,
-            server_eval_get_var(session->ses_env, op->op_delete.op_delete_var),
+            server_eval_get_var(session, op->op_delete.op_delete_var),
             done);
     if (idvar->vt_type != VAR_IDS) {
         result = DBEVARTYPE;
@@ -618,7 +1113,7 @@ server_eval_update(struct session *session, struct op *op)
     // try to find the variable in the environment, ensure it is ids
     struct vartuple *idvar;
     TRYNULL(result, DBENOVAR, idvar,
-            server_eval_get_var(session->ses_env, op->op_update.op_update_var),
+            server_eval_get_var(session, op->op_update.op_update_var),
             cleanup_col);
     if (idvar->vt_type != VAR_IDS) {
         result = DBEVARTYPE;
@@ -676,7 +1171,7 @@ server_eval_tuple(struct session *session, struct op *op)
     while (pch != NULL) {
         struct vartuple *v;
         TRYNULL(result, DBENOVAR, v,
-                server_eval_get_var(session->ses_env, pch), cleanup_valsarray);
+                server_eval_get_var(session, pch), cleanup_valsarray);
         if (v->vt_type != VAR_VALS) {
             result = DBEVARTYPE;
             DBLOG(result);
@@ -713,10 +1208,10 @@ server_eval_join(struct session *session, struct op *op)
     // Try to find the column intermediates
     struct vartuple *inputL, *inputR;
     TRYNULL(result, DBENOVAR, inputL,
-            server_eval_get_var(session->ses_env, op->op_join.op_join_inputL),
+            server_eval_get_var(session, op->op_join.op_join_inputL),
             done);
     TRYNULL(result, DBENOVAR, inputR,
-            server_eval_get_var(session->ses_env, op->op_join.op_join_inputR),
+            server_eval_get_var(session, op->op_join.op_join_inputR),
             done);
     if (inputL->vt_type != VAR_VALS
         || inputR->vt_type != VAR_VALS
@@ -735,10 +1230,10 @@ server_eval_join(struct session *session, struct op *op)
                             &idsL, &idsR), done);
 
     // Don't allow these to fail
-    result = server_add_var(session->ses_env, op->op_join.op_join_varL,
+    result = server_add_var(session, op->op_join.op_join_varL,
                             VAR_IDS, idsL, NULL);
     assert(result == 0);
-    result = server_add_var(session->ses_env, op->op_join.op_join_varR,
+    result = server_add_var(session, op->op_join.op_join_varR,
                             VAR_IDS, idsR, NULL);
     assert(result == 0);
 
@@ -749,6 +1244,71 @@ server_eval_join(struct session *session, struct op *op)
     return result;
 }
 
+static
+int
+server_eval_set(struct session *session, struct op *op)
+{
+    assert(session != NULL);
+    assert(op != NULL);
+    assert(op->op_type == OP_SET);
+
+    int result;
+    struct vartuple *v1, *v2 = NULL;
+    TRYNULL(result, DBENOVAR, v1,
+            server_eval_get_var(session, op->op_set.op_set_ids1),
+            done);
+    if (op->op_set.op_set_stype != SET_NOT) {
+        TRYNULL(result, DBENOVAR, v2,
+                server_eval_get_var(session, op->op_set.op_set_ids2),
+                done);
+    }
+    if (v1->vt_type != VAR_IDS || (v2 != NULL && v2->vt_type != VAR_IDS)) {
+        result = DBEVARTYPE;
+        DBLOG(result);
+        goto done;
+    }
+
+    struct column_ids *ids;
+    if (op->op_set.op_set_stype == SET_NOT
+            && v1->vt_column_ids->cid_type != CID_ARRAY
+            && v1->vt_column_ids->cid_col[0] != '\0') {
+        // not() is taken within the positions the column still holds
+        struct column *col;
+        struct column_ids *live;
+        TRY(result, column_open(session->ses_storage,
+                                v1->vt_column_ids->cid_col, &col), done);
+        result = column_live_ids(col, column_ids_nbits(v1->vt_column_ids), &live);
+        column_close(col);
+        if (result) {
+            goto done;
+        }
+        result = column_ids_combine(SET_NOT, v1->vt_column_ids, live, &ids);
+        column_ids_destroy(live);
+        if (result) {
+            goto done;
+        }
+    } else {
+        TRY(result, column_ids_combine(op->op_set.op_set_stype, v1->vt_column_ids,
+                                       (v2 != NULL) ? v2->vt_column_ids : NULL,
+                                       &ids), done);
+    }
+    if (op->op_set.op_set_assign) {
+        TRY(result, server_add_var(session, op->op_set.op_set_var,
+                                   VAR_IDS, ids, NULL), cleanup_ids);
+        result = 0;
+        goto done; // don't destroy ids
+    }
+    TRY(result, rpc_write_select_result(session->ses_fd, ids), cleanup_ids);
+
+    // success
+    result = 0;
+    goto cleanup_ids;
+  cleanup_ids:
+    column_ids_destroy(ids);
+  done:
+    return result;
+}
+
 static
 int
 server_eval(struct session *session, struct op *op)
@@ -786,12 +1346,443 @@ server_eval(struct session *session, struct op *op)
         return server_eval_print(session, op);
     case OP_JOIN:
         return server_eval_join(session, op);
+    case OP_SET:
+        return server_eval_set(session, op);
+    case OP_BATCH_QUERIES:
+    case OP_BATCH_EXECUTE:
+        return server_eval_batch(session, op);
     default:
         assert(0);
         return -1;
     }
 }
 
+// Resolves the path a client sent into resolved, which has PATH_MAX bytes.
+// A relative path is taken from the load directory. Paths with a .. in
+// them, and ones that lead out of the load directory, are refused.
+static
+int
+server_resolve_load_path(const char *loaddir, const char *path, char *resolved)
+{
+    int result;
+    const char *c = path;
+    while (*c != '\0') {
+        const char *slash = strchr(c, '/');
+        size_t complen = (slash != NULL) ? (size_t) (slash - c) : strlen(c);
+        if (complen == 2 && c[0] == '.' && c[1] == '.') {
+            result = DBELOADPATH;
+            DBLOG(result);
+            goto done;
+        }
+        c += complen + (slash != NULL);
+    }
+    char joined[PATH_MAX];
+    int len = (path[0] == '/') ? snprintf(joined, PATH_MAX, "%s", path)
+            : snprintf(joined, PATH_MAX, "%s/%s", loaddir, path);
+    if (len >= PATH_MAX) {
+        result = DBELOADPATH;
+        DBLOG(result);
+        goto done;
+    }
+    // links are followed here, so they may not lead out either
+    if (realpath(joined, resolved) == NULL) {
+        result = DBEIONOFILE;
+        DBLOG(result);
+        goto done;
+    }
+    size_t dirlen = strlen(loaddir);
+    bool root = (dirlen == 1); // realpath leaves a / only on the root
+    if (strncmp(resolved, loaddir, dirlen) != 0
+        || (!root && resolved[dirlen] != '/')) {
+        result = DBELOADPATH;
+        DBLOG(result);
+        goto done;
+    }
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Opens resolved, which server_resolve_load_path found under loaddir, one
+// component at a time from loaddir without following links. realpath left
+// none in it, so a link found now was swapped in since the check, and
+// could lead out of loaddir. The file is opened without blocking, so that
+// a fifo swapped in cannot hold the open up.
+static
+int
+server_open_under(const char *loaddir, const char *resolved, int *retfd)
+{
+    int result;
+    int dirfd = open(loaddir, O_RDONLY | O_DIRECTORY);
+    if (dirfd == -1) {
+        result = DBEIONOFILE;
+        DBLOG(result);
+        goto done;
+    }
+    char rest[PATH_MAX];
+    strcpy(rest, resolved + strlen(loaddir));
+    char *save;
+    char *comp = strtok_r(rest, "/", &save);
+    while (comp != NULL) {
+        char *next = strtok_r(NULL, "/", &save);
+        int flags = O_RDONLY | O_NOFOLLOW | ((next != NULL) ? O_DIRECTORY : O_NONBLOCK);
+        int fd = openat(dirfd, comp, flags);
+        int openerrno = errno;
+        assert(close(dirfd) == 0);
+        if (fd == -1) {
+            result = (openerrno == ELOOP || openerrno == ENOTDIR)
+                    ? DBELOADPATH : DBEIONOFILE;
+            DBLOG(result);
+            goto done;
+        }
+        dirfd = fd;
+        comp = next;
+    }
+
+    // success
+    result = 0;
+    *retfd = dirfd;
+    goto done;
+  done:
+    return result;
+}
+
+// Reads the path of a server-local load and opens the file for ftuple. A
+// server only opens files for clients under the load directory it was
+// given, and none if it wasn't given one.
+static
+int
+server_open_load_path(struct session *session, int clientfd, struct rpc_header *msg,
+                      struct filetuple *ftuple)
+{
+    int result;
+    char *path;
+    TRY(result, rpc_read_file_path(clientfd, msg, &path), done);
+    if (session->ses_loaddir == NULL) {
+        result = DBELOADPATH;
+        DBLOG(result);
+        goto cleanup_path;
+    }
+    char resolved[PATH_MAX];
+    TRY(result, server_resolve_load_path(session->ses_loaddir, path, resolved),
+        cleanup_path);
+    int fd;
+    TRY(result, server_open_under(session->ses_loaddir, resolved, &fd), cleanup_path);
+    // not a fifo or a device, which the load could wait on forever
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        assert(close(fd) == 0);
+        result = DBELOADPATH;
+        DBLOG(result);
+        goto cleanup_path;
+    }
+    ftuple->ft_fd = fd;
+    ftuple->ft_len = 0;
+    ftuple->ft_local = true;
+
+    // success
+    result = 0;
+    goto cleanup_path;
+  cleanup_path:
+    free(path);
+  done:
+    return result;
+}
+
+// Reads the file that follows a load on the socket, or the path of a
+// server-local one, so that the load can find it
+static
+int
+server_add_load_file(struct session *session, int clientfd, struct op *op)
+{
+    int result;
+    struct rpc_header loadmsg;
+    TRY(result, rpc_read_header(clientfd, &loadmsg), done);
+    assert(loadmsg.rpc_type == RPC_FILE || loadmsg.rpc_type == RPC_FILE_PATH);
+    struct filetuple *ftuple;
+    TRYNULL(result, DBENOMEM, ftuple, malloc(sizeof(struct filetuple)), done);
+    // TODO: file names are larger than ftuple char buf
+    strcpy(ftuple->ft_name, op->op_load.op_load_file);
+    ftuple->ft_fd = clientfd;
+    ftuple->ft_len = loadmsg.rpc_len;
+    ftuple->ft_local = false;
+    if (loadmsg.rpc_type == RPC_FILE_PATH) {
+        // the client sent only a path on a filesystem we share
+        TRY(result, server_open_load_path(session, clientfd, &loadmsg, ftuple),
+            cleanup_ftuple);
+    }
+    TRY(result, filetuplearray_add(session->ses_files, ftuple, NULL), cleanup_fd);
+
+    // success
+    result = 0;
+    goto done;
+  cleanup_fd:
+    if (ftuple->ft_local) {
+        assert(close(ftuple->ft_fd) == 0);
+    }
+  cleanup_ftuple:
+    free(ftuple);
+  done:
+    return result;
+}
+
+// Runs an op and replies with OK or the error. Returns the error, so that
+// the caller can tell if the session has to end.
+static
+int
+server_run_op(struct session *session, int clientfd, struct op *op)
+{
+    int result;
+    if (op->op_type == OP_LOAD) {
+        // the file follows the op on the socket, and the load reads it
+        // from there
+        TRY(result, server_add_load_file(session, clientfd, op), error);
+    }
+    if (session->ses_batching && server_select_batchable(op)
+        && op->op_type <= OP_SELECT_VALUE_ASSIGN) {
+        // evaluated with the rest of the batch
+        TRY(result, server_batch_add(session, op), error);
+    } else {
+        // anything else may use what the queued selects assign
+        TRY(result, server_batch_execute(session), error);
+        TRY(result, server_eval(session, op), error);
+    }
+    TRY(result, rpc_write_ok(clientfd), error);
+    result = 0;
+    goto done;
+  error:
+    (void) rpc_write_error(clientfd, (char *) dberror_string(result));
+  done:
+    return result;
+}
+
+// How many ops from i on are selects that may be evaluated together, all on
+// the same column
+static
+unsigned
+server_select_run(struct oparray *ops, unsigned i)
+{
+    struct op *first = oparray_get(ops, i);
+    if (!server_select_batchable(first)) {
+        return 0;
+    }
+    unsigned n = 1;
+    while (i + n < oparray_num(ops)) {
+        struct op *op = oparray_get(ops, i + n);
+        if (!server_select_batchable(op)
+            || strcmp(op->op_select.op_sel_col, first->op_select.op_sel_col) != 0) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+// Runs consecutive selects on one column in a single scan, and replies to
+// each of them in order like server_run_op would. Returns the error that
+// ended the session, if any.
+static
+int
+server_run_selects(struct session *session, int clientfd, struct op **ops, unsigned nops)
+{
+    int result;
+    struct column_ids **ids = NULL;
+    int *results = NULL;
+    TRYNULL(result, DBENOMEM, ids, malloc(nops * sizeof(struct column_ids *)), error);
+    TRYNULL(result, DBENOMEM, results, malloc(nops * sizeof(int)), error);
+    server_select_many(session, ops, nops, ids, results);
+    unsigned i;
+    for (i = 0; i < nops; i++) {
+        result = results[i];
+        if (result == 0) {
+            result = server_select_result(session, ops[i], ids[i]);
+            if (result) {
+                column_ids_destroy(ids[i]);
+            }
+        }
+        if (result == 0) {
+            result = rpc_write_ok(clientfd);
+        } else {
+            (void) rpc_write_error(clientfd, (char *) dberror_string(result));
+        }
+        if (result && dberror_server_is_fatal(result)) {
+            break;
+        }
+    }
+    // the ones we never got to
+    for (i++; i < nops; i++) {
+        if (results[i] == 0) {
+            column_ids_destroy(ids[i]);
+        }
+    }
+    goto cleanup;
+  error:
+    // the client still waits for a reply to every op
+    for (unsigned i = 0; i < nops; i++) {
+        (void) rpc_write_error(clientfd, (char *) dberror_string(result));
+    }
+  cleanup:
+    free(results);
+    free(ids);
+    return result;
+}
+
+// A script being run. Pure ops are spawned as tasks once the ops they
+// depend on are done, by whichever thread finished the last of those. The
+// rest run on the session's thread in script order, which also sends every
+// reply in order, and runs tasks while it waits for a pure op.
+struct server_script {
+    struct session *ss_session;
+    struct script *ss_script;
+    struct task_group *ss_group;
+    struct server_script_op *ss_ops;
+    unsigned *ss_ndeps; // ops each op still waits for
+    int *ss_results;
+    bool *ss_done;
+    bool ss_stop; // start no more ops
+};
+
+// An op of a script, for a task to run or the session's thread to wait for
+struct server_script_op {
+    struct server_script *so_script;
+    unsigned so_op;
+};
+
+static
+void
+server_script_routine(void *arg, unsigned threadnum);
+
+// If we can't spawn the op, we run it here
+static
+void
+server_script_start(struct server_script *ss, unsigned i)
+{
+    if (task_group_spawn(ss->ss_group, server_script_routine, &ss->ss_ops[i])) {
+        server_script_routine(&ss->ss_ops[i], 0);
+    }
+}
+
+// Records the result of an op, and starts the pure ops that only waited
+// for it
+static
+void
+server_script_finish(struct server_script *ss, unsigned i, int result)
+{
+    struct script_node *node = &ss->ss_script->sc_nodes[i];
+    ss->ss_results[i] = result;
+    for (unsigned j = 0; j < node->sn_nnext; j++) {
+        unsigned next = node->sn_next[j];
+        if (__atomic_sub_fetch(&ss->ss_ndeps[next], 1, __ATOMIC_ACQ_REL) == 0
+            && ss->ss_script->sc_nodes[next].sn_kind == SCRIPT_PURE) {
+            server_script_start(ss, next);
+        }
+    }
+    __atomic_store_n(&ss->ss_done[i], true, __ATOMIC_RELEASE);
+    threadpool_notify(ss->ss_session->ses_tpool);
+}
+
+static
+void
+server_script_routine(void *arg, unsigned threadnum)
+{
+    (void) threadnum;
+    struct server_script_op *so = (struct server_script_op *) arg;
+    struct server_script *ss = so->so_script;
+    if (__atomic_load_n(&ss->ss_stop, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    int result = server_eval(ss->ss_session, ss->ss_script->sc_nodes[so->so_op].sn_op);
+    server_script_finish(ss, so->so_op, result);
+}
+
+static
+bool
+server_script_done(void *arg)
+{
+    struct server_script_op *so = (struct server_script_op *) arg;
+    return __atomic_load_n(&so->so_script->ss_done[so->so_op], __ATOMIC_ACQUIRE);
+}
+
+// Runs the ops of a script and replies to each of them in order, like
+// server_run_op would. Returns the error that ended the session, if any.
+static
+int
+server_run_script(struct session *session, int clientfd, struct oparray *ops)
+{
+    int result;
+    bool ran = false;
+    struct server_script ss;
+    bzero(&ss, sizeof(struct server_script));
+    ss.ss_session = session;
+    TRY(result, script_create(ops, &ss.ss_script), done);
+    unsigned n = ss.ss_script->sc_nnodes;
+    TRYNULL(result, DBENOMEM, ss.ss_group, task_group_create(session->ses_tpool), cleanup_ss);
+    TRYNULL(result, DBENOMEM, ss.ss_ops,
+            calloc(n + 1, sizeof(struct server_script_op)), cleanup_ss);
+    TRYNULL(result, DBENOMEM, ss.ss_ndeps, calloc(n + 1, sizeof(unsigned)), cleanup_ss);
+    TRYNULL(result, DBENOMEM, ss.ss_results, calloc(n + 1, sizeof(int)), cleanup_ss);
+    TRYNULL(result, DBENOMEM, ss.ss_done, calloc(n + 1, sizeof(bool)), cleanup_ss);
+    for (unsigned i = 0; i < n; i++) {
+        ss.ss_ops[i].so_script = &ss;
+        ss.ss_ops[i].so_op = i;
+        ss.ss_ndeps[i] = ss.ss_script->sc_nodes[i].sn_ndeps;
+    }
+
+    result = 0;
+    ran = true;
+    for (unsigned i = 0; i < n; i++) {
+        struct script_node *node = &ss.ss_script->sc_nodes[i];
+        if (node->sn_kind == SCRIPT_PURE && node->sn_ndeps == 0) {
+            server_script_start(&ss, i);
+        }
+    }
+    for (unsigned i = 0; i < n; i++) {
+        struct script_node *node = &ss.ss_script->sc_nodes[i];
+        if (node->sn_kind != SCRIPT_PURE) {
+            // everything before it is done and replied to
+            assert(__atomic_load_n(&ss.ss_ndeps[i], __ATOMIC_ACQUIRE) == 0);
+            result = server_run_op(session, clientfd, node->sn_op);
+            server_script_finish(&ss, i, result);
+        } else {
+            task_group_wait_until(ss.ss_group, server_script_done, &ss.ss_ops[i]);
+            result = ss.ss_results[i];
+            if (result == 0) {
+                result = rpc_write_ok(clientfd);
+            } else {
+                (void) rpc_write_error(clientfd, (char *) dberror_string(result));
+            }
+        }
+        if (result && dberror_server_is_fatal(result)) {
+            break;
+        }
+    }
+
+    // the tasks finish the op they are running, if we stopped early
+    __atomic_store_n(&ss.ss_stop, true, __ATOMIC_RELEASE);
+    task_group_wait(ss.ss_group);
+    goto cleanup_ss;
+  cleanup_ss:
+    free(ss.ss_done);
+    free(ss.ss_results);
+    free(ss.ss_ndeps);
+    free(ss.ss_ops);
+    if (ss.ss_group != NULL) {
+        task_group_destroy(ss.ss_group);
+    }
+    script_destroy(ss.ss_script);
+  done:
+    if (!ran) {
+        // the client still waits for a reply to every op
+        for (unsigned i = 0; i < oparray_num(ops); i++) {
+            (void) rpc_write_error(clientfd, (char *) dberror_string(result));
+        }
+    }
+    return result;
+}
+
 static
 void
 server_routine(void *arg, unsigned threadnum)
@@ -799,14 +1790,12 @@ server_routine(void *arg, unsigned threadnum)
     assert(arg != NULL);
     struct session *sarg = (struct session *) arg;
     int clientfd = sarg->ses_fd;
-    unsigned jobid = sarg->ses_jobid;
-    unsigned loadid = 0;
     int result;
 
     while (1) {
         struct op *op;
+        struct oparray *ops;
         struct rpc_header msg;
-        struct rpc_header loadmsg;
         TRY(result, rpc_read_header(clientfd, &msg), recover);
         switch (msg.rpc_type) {
         case RPC_TERMINATE:
@@ -815,44 +1804,52 @@ server_routine(void *arg, unsigned threadnum)
             result = DBECLIENTTERM;
             goto recover;
         case RPC_QUERY:
-            // handle RPC_FILE here as well
             TRY(result, rpc_read_query(clientfd, &msg, &op), recover);
-            if (op->op_type == OP_LOAD) {
-                int copyfd;
-                char filenamebuf[128];
-                sprintf(filenamebuf, "%s/jobid-%d.loadid-%d.tmp",
-                        sarg->ses_storage->st_dbdir, jobid, loadid);
-                loadid++;
-                TRY(result, rpc_read_header(clientfd, &loadmsg), cleanup_op);
-                assert(loadmsg.rpc_type = RPC_FILE);
-                TRY(result, rpc_read_file(clientfd, &loadmsg, filenamebuf, &copyfd), cleanup_op);
-                struct filetuple *ftuple;
-                TRYNULL(result, DBENOMEM, ftuple, malloc(sizeof(struct filetuple)), cleanup_op);
-                // TODO: file names are larger than ftuple char buf
-                strcpy(ftuple->ft_name, op->op_load.op_load_file);
-                ftuple->ft_fd = copyfd;
-                result = filetuplearray_add(sarg->ses_files, ftuple, NULL);
-                if (result) {
-                    free(ftuple);
-                    goto cleanup_op;
+            result = server_run_op(sarg, clientfd, op);
+            free(op);
+            break;
+        case RPC_OPS:
+            // several ops, each of which gets its own reply. The replies
+            // are held back until the last op is done and go out together,
+            // rather than a small packet per op.
+            TRY(result, rpc_read_ops(clientfd, &msg, &ops), recover);
+            // Consecutive selects on the same column are evaluated
+            // together, unless a batch is being queued anyway.
+            io_cork(clientfd, true);
+            for (unsigned i = 0, n; i < oparray_num(ops); i += n) {
+                n = sarg->ses_batching ? 0 : server_select_run(ops, i);
+                if (n > 1) {
+                    result = server_run_selects(sarg, clientfd,
+                                                (struct op **) ops->arr.v + i, n);
+                } else {
+                    n = 1;
+                    result = server_run_op(sarg, clientfd, oparray_get(ops, i));
+                }
+                if (result && dberror_server_is_fatal(result)) {
+                    break;
                 }
             }
-            TRY(result, server_eval(sarg, op), cleanup_op);
+            io_cork(clientfd, false);
+            parse_cleanup_ops(ops);
+            break;
+        case RPC_SCRIPT:
+            // ops that may run out of order, but are replied to in order
+            TRY(result, rpc_read_ops(clientfd, &msg, &ops), recover);
+            io_cork(clientfd, true);
+            result = server_run_script(sarg, clientfd, ops);
+            io_cork(clientfd, false);
+            parse_cleanup_ops(ops);
             break;
         default:
             assert(0);
             break;
         }
-        assert(result == 0);
-        result = rpc_write_ok(clientfd);
-        if (result) {
-            goto cleanup_op;
+        // the reply has been sent
+        if (result && dberror_server_is_fatal(result)) {
+            goto done;
         }
-        free(op);
         continue;
 
-      cleanup_op:
-        free(op);
       recover:
         if (result != DBECLIENTTERM) {
             (void) rpc_write_error(clientfd, (char *) dberror_string(result));
@@ -878,6 +1875,13 @@ server_create(struct server_options *options)
     struct server *s = NULL;
     TRYNULL(result, DBENOMEM, s, malloc(sizeof(struct server)), done);
     memcpy(&s->s_opt, options, sizeof(struct server_options));
+    s->s_loaddir[0] = '\0';
+    if (s->s_opt.sopt_loaddir[0] != '\0'
+        && realpath(s->s_opt.sopt_loaddir, s->s_loaddir) == NULL) {
+        result = DBEIONOFILE;
+        DBLOG(result);
+        goto cleanup_malloc;
+    }
 
     int listenfd;
     struct addrinfo hints, *servinfo;
@@ -943,11 +1947,15 @@ server_create(struct server_options *options)
         goto done;
     }
 
-    // init the storage directory
+    // init the storage directory, reading and writing through io_uring
+    // where we can
+    file_set_queue_depth(s->s_opt.sopt_iodepth < 0 ? 0 : s->s_opt.sopt_iodepth);
     TRYNULL(result, DBENOMEM, s->s_storage, storage_init(s->s_opt.sopt_dbdir),
             cleanup_listenfd);
 
-    // create a threadpool to handle the connections
+    // create a threadpool to handle the connections, with the workers
+    // placed on the CPUs we were asked to
+    threadpool_set_affinity(s->s_opt.sopt_affinity);
     TRYNULL(result, DBENOMEM, s->s_threadpool,
             threadpool_create(s->s_opt.sopt_nthreads), cleanup_storage);
     result = 0;
@@ -987,7 +1995,8 @@ server_start(struct server *s)
         // cleaning up the file descriptor
         struct session *sjob;
         TRYNULL(result, DBENOMEM, sjob,
-                session_create(acceptfd, jobid++, s->s_storage),
+                session_create(acceptfd, jobid++, s->s_storage, s->s_threadpool,
+                               s->s_loaddir[0] ? s->s_loaddir : NULL),
                 cleanup_acceptfd);
 
         struct job job;
@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <db/common/search.h>
+#include <db/common/dberror.h>
+#include <db/common/try.h>
+#include <db/server/stats.h>
+
+// Number of values we sort to pick the histogram bounds
+#define COLSTATS_SAMPLE 16384
+
+// log2(COLSTATS_NSKETCH)
+#define SKETCH_BITS 6
+
+/*
+ * Hash function taken from here:
+ * http://stackoverflow.com/questions/664014/what-integer-hash-function-are-good-that-accepts-an-integer-hash-key
+ */
+static
+uint32_t
+stats_hash(uint32_t x)
+{
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = ((x >> 16) ^ x);
+    return x;
+}
+
+static
+void
+column_stats_sketch_add(struct column_stats *stats, int val)
+{
+    // The top bits pick the register, the rest give the rank, which is the
+    // position of the first set bit.
+    uint32_t h = stats_hash((uint32_t) val);
+    unsigned reg = h >> (32 - SKETCH_BITS);
+    uint32_t rest = h << SKETCH_BITS;
+    uint8_t rank = (rest == 0) ? (32 - SKETCH_BITS + 1)
+                               : (uint8_t) (__builtin_clz(rest) + 1);
+    if (rank > stats->cs_sketch[reg]) {
+        stats->cs_sketch[reg] = rank;
+    }
+}
+
+// Returns the bucket that val falls into. Values below the first bound are
+// counted in the first bucket.
+static
+unsigned
+column_stats_bucket(struct column_stats *stats, int val)
+{
+    assert(stats->cs_nbuckets > 0);
+    unsigned lo = 0;
+    unsigned hi = stats->cs_nbuckets;
+    // find the last bound <= val
+    while (hi - lo > 1) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (stats->cs_bounds[mid] <= val) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int
+column_stats_build(struct column_stats *stats, int *vals, uint64_t num)
+{
+    assert(stats != NULL);
+    assert(vals != NULL || num == 0);
+
+    int result;
+    bzero(stats, sizeof(struct column_stats));
+    if (num == 0) {
+        result = 0;
+        goto done;
+    }
+
+    // Sort an evenly spaced sample and use its quantiles as the bounds
+    unsigned nsample = (num < COLSTATS_SAMPLE) ? num : COLSTATS_SAMPLE;
+    int *sample;
+    TRYNULL(result, DBENOMEM, sample, malloc(sizeof(int) * nsample), done);
+    for (unsigned i = 0; i < nsample; i++) {
+        sample[i] = vals[(i * num) / nsample];
+    }
+    qsort(sample, nsample, sizeof(int), int_compare);
+    unsigned nbuckets = 0;
+    for (unsigned b = 0; b < COLSTATS_NBUCKETS; b++) {
+        int bound = sample[(b * nsample) / COLSTATS_NBUCKETS];
+        // runs of a repeated value stay within one bucket
+        if (nbuckets == 0 || bound > stats->cs_bounds[nbuckets - 1]) {
+            stats->cs_bounds[nbuckets++] = bound;
+        }
+    }
+    free(sample);
+    stats->cs_nbuckets = nbuckets;
+
+    // Then count every value exactly
+    int min = vals[0];
+    int max = vals[0];
+    for (uint64_t i = 0; i < num; i++) {
+        int val = vals[i];
+        min = (val < min) ? val : min;
+        max = (val > max) ? val : max;
+        stats->cs_counts[column_stats_bucket(stats, val)]++;
+        column_stats_sketch_add(stats, val);
+    }
+    stats->cs_bounds[0] = min;
+    stats->cs_max = max;
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+void
+column_stats_add(struct column_stats *stats, int val)
+{
+    assert(stats != NULL);
+    if (stats->cs_nbuckets == 0) {
+        stats->cs_nbuckets = 1;
+        stats->cs_bounds[0] = val;
+        stats->cs_max = val;
+    }
+    if (val < stats->cs_bounds[0]) {
+        stats->cs_bounds[0] = val;
+    }
+    if (val > stats->cs_max) {
+        stats->cs_max = val;
+    }
+    stats->cs_counts[column_stats_bucket(stats, val)]++;
+    column_stats_sketch_add(stats, val);
+}
+
+void
+column_stats_remove(struct column_stats *stats, int val)
+{
+    assert(stats != NULL);
+    if (stats->cs_nbuckets == 0) {
+        return;
+    }
+    unsigned bucket = column_stats_bucket(stats, val);
+    if (stats->cs_counts[bucket] > 0) {
+        stats->cs_counts[bucket]--;
+    }
+}
+
+uint64_t
+column_stats_rows(struct column_stats *stats)
+{
+    assert(stats != NULL);
+    uint64_t rows = 0;
+    for (unsigned i = 0; i < stats->cs_nbuckets; i++) {
+        rows += stats->cs_counts[i];
+    }
+    return rows;
+}
+
+uint64_t
+column_stats_ndistinct(struct column_stats *stats)
+{
+    assert(stats != NULL);
+    uint64_t rows = column_stats_rows(stats);
+    if (rows == 0) {
+        return 0;
+    }
+    double m = COLSTATS_NSKETCH;
+    double sum = 0;
+    unsigned zeros = 0;
+    for (unsigned i = 0; i < COLSTATS_NSKETCH; i++) {
+        sum += ldexp(1.0, -stats->cs_sketch[i]);
+        zeros += (stats->cs_sketch[i] == 0);
+    }
+    // 0.709 is the bias correction for 64 registers. Small cardinalities
+    // are better estimated by counting the empty registers.
+    double estimate = 0.709 * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+    uint64_t ndistinct = (uint64_t) (estimate + 0.5);
+    if (ndistinct < 1) {
+        ndistinct = 1;
+    }
+    return (ndistinct > rows) ? rows : ndistinct;
+}
+
+uint64_t
+column_stats_estimate(struct column_stats *stats, int low, int high)
+{
+    assert(stats != NULL);
+    if (stats->cs_nbuckets == 0 || low > high
+        || high < stats->cs_bounds[0] || low > stats->cs_max) {
+        return 0;
+    }
+    // A single value gets the average frequency of a value in the column
+    if (low == high) {
+        uint64_t ndistinct = column_stats_ndistinct(stats);
+        return (ndistinct == 0) ? 0 : column_stats_rows(stats) / ndistinct;
+    }
+    // Otherwise assume values are spread evenly within each bucket
+    double estimate = 0;
+    for (unsigned i = 0; i < stats->cs_nbuckets; i++) {
+        int64_t blow = stats->cs_bounds[i];
+        int64_t bhigh = (i + 1 < stats->cs_nbuckets)
+                ? (int64_t) stats->cs_bounds[i + 1] - 1 : stats->cs_max;
+        int64_t olow = (low > blow) ? low : blow;
+        int64_t ohigh = (high < bhigh) ? high : bhigh;
+        if (olow > ohigh) {
+            continue;
+        }
+        estimate += (double) stats->cs_counts[i] * (ohigh - olow + 1)
+                    / (bhigh - blow + 1);
+    }
+    return (uint64_t) (estimate + 0.5);
+}
@@ -5,10 +5,12 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <db/common/operators.h>
 #include <db/common/array.h>
 #include <db/common/synch.h>
@@ -25,9 +27,168 @@
 
 DEFARRAY(column, /* no inline */);
 
+// Pages of the base file that a shared scan reads at once
+#define SCAN_CHUNK_PAGES 64
+
+// Pages of the base file that a fetch reads at once, and how far apart the
+// pages it hints to the kernel may be to be hinted together
+#define FETCH_RUN_PAGES 32
+#define FETCH_PREFETCH_GAP 4
+
+// Pages of the base file that a load writes back at once
+#define LOAD_WRITE_PAGES 32
+
+// A select on an unsorted column waiting for the shared scan. Its
+// predicate is that the value, as unsigned, is within sr_span of sr_low,
+// which covers select all, range and value with one comparison.
+struct scan_request {
+    unsigned sr_low;
+    unsigned sr_span;
+    bool sr_none; // the range is empty
+    struct column_ids *sr_cids;
+    uint64_t sr_maxtuples;
+    uint64_t sr_pagesleft; // pages it has not been evaluated against yet
+    int sr_result;
+    bool sr_done; // detached from the scan, protected by cs_lock
+    struct scan_request *sr_next;
+};
+
+// Selects that scan the base file of the same column at the same time
+// share one pass over it. The scan goes round the file a chunk at a time
+// from wherever it is when a select attaches, each chunk is evaluated for
+// every attached select, and a select detaches once it has seen every page.
+// One of the waiting threads drives the scan for all of them.
+struct column_scan {
+    struct lock *cs_lock;
+    struct cv *cs_cv;
+    struct scan_request *cs_requests; // attached selects
+    page_t cs_cursor; // next page to read, counted from FILE_FIRST_PAGE
+    bool cs_driving; // a thread is reading chunks
+};
+
+static
+struct column_scan *
+column_scan_create(void)
+{
+    struct column_scan *scan = malloc(sizeof(struct column_scan));
+    if (scan == NULL) {
+        goto done;
+    }
+    scan->cs_lock = lock_create();
+    if (scan->cs_lock == NULL) {
+        goto cleanup_malloc;
+    }
+    scan->cs_cv = cv_create();
+    if (scan->cs_cv == NULL) {
+        goto cleanup_lock;
+    }
+    scan->cs_requests = NULL;
+    scan->cs_cursor = 0;
+    scan->cs_driving = false;
+    goto done;
+  cleanup_lock:
+    lock_destroy(scan->cs_lock);
+  cleanup_malloc:
+    free(scan);
+    scan = NULL;
+  done:
+    return scan;
+}
+
+static
+void
+column_scan_destroy(struct column_scan *scan)
+{
+    assert(scan->cs_requests == NULL);
+    assert(!scan->cs_driving);
+    cv_destroy(scan->cs_cv);
+    lock_destroy(scan->cs_lock);
+    free(scan);
+}
+
 DECLARRAY_BYTYPE(valarray, int);
 DEFARRAY_BYTYPE(valarray, int, /* no inline */);
 
+// A column record from before cd_stats
+struct column_on_disk_v1 {
+    char cd_col_name[120];
+    uint64_t cd_ntuples;
+    uint64_t cd_nexttupleid;
+    uint32_t cd_stype;
+    uint32_t cd_magic;
+    page_t cd_btree_root;
+    char cd_base_file[52];
+    char cd_index_file[52];
+};
+
+CASSERT(PAGESIZE % sizeof(struct column_on_disk_v1) == 0, storage);
+
+#define COLUMNS_PER_PAGE_V1 (PAGESIZE / sizeof(struct column_on_disk_v1))
+
+// Rewrites a metadata file of records from before cd_stats with the
+// records of now. Their statistics are left empty, and are rebuilt when
+// the column is opened. Called before anything else uses storage.
+static
+int
+storage_upgrade(struct storage *storage)
+{
+    int result;
+    page_t npages = file_num_pages(storage->st_file);
+    struct column_on_disk colbuf[COLUMNS_PER_PAGE];
+    if (npages <= FILE_FIRST_PAGE) {
+        result = 0;
+        goto done;
+    }
+    // columns fill the file from the front, so an old one is first
+    TRY(result, file_read(storage->st_file, FILE_FIRST_PAGE, colbuf), done);
+    if (colbuf[0].cd_magic != COLUMN_TAKEN_V1) {
+        result = 0;
+        goto done;
+    }
+
+    page_t noldpages = npages - FILE_FIRST_PAGE;
+    struct column_on_disk_v1 *old;
+    TRYNULL(result, DBENOMEM, old,
+            malloc(noldpages * COLUMNS_PER_PAGE_V1 * sizeof(struct column_on_disk_v1)),
+            done);
+    for (page_t i = 0; i < noldpages; i++) {
+        TRY(result, file_read(storage->st_file, FILE_FIRST_PAGE + i,
+                              &old[i * COLUMNS_PER_PAGE_V1]), cleanup_old);
+    }
+    unsigned nold = noldpages * COLUMNS_PER_PAGE_V1;
+    for (unsigned first = 0; first < nold; first += COLUMNS_PER_PAGE) {
+        page_t page = FILE_FIRST_PAGE + first / COLUMNS_PER_PAGE;
+        if (page >= npages) {
+            TRY(result, file_alloc_page(storage->st_file, &page), cleanup_old);
+        }
+        bzero(colbuf, sizeof(colbuf));
+        for (unsigned i = 0; i < COLUMNS_PER_PAGE && first + i < nold; i++) {
+            struct column_on_disk_v1 *oldcol = &old[first + i];
+            if (oldcol->cd_magic != COLUMN_TAKEN_V1) {
+                continue;
+            }
+            struct column_on_disk *col = &colbuf[i];
+            memcpy(col->cd_col_name, oldcol->cd_col_name, sizeof(col->cd_col_name));
+            col->cd_ntuples = oldcol->cd_ntuples;
+            col->cd_nexttupleid = oldcol->cd_nexttupleid;
+            col->cd_stype = oldcol->cd_stype;
+            col->cd_magic = COLUMN_TAKEN;
+            col->cd_btree_root = oldcol->cd_btree_root;
+            memcpy(col->cd_base_file, oldcol->cd_base_file, sizeof(col->cd_base_file));
+            memcpy(col->cd_index_file, oldcol->cd_index_file, sizeof(col->cd_index_file));
+        }
+        TRY(result, file_write(storage->st_file, page, colbuf), cleanup_old);
+    }
+
+    // success
+    result = 0;
+    goto cleanup_old;
+  cleanup_old:
+    free(old);
+  done:
+    return result;
+}
+
 // create the directory if it doesn't exist, and init metadata file
 struct storage *
 storage_init(char *dbdir)
@@ -48,10 +209,15 @@ storage_init(char *dbdir)
     char buf[128];
     sprintf(buf, "%s/%s", dbdir, METADATA_FILENAME);
     TRYNULL(result, DBEIONOFILE, storage->st_file, file_open(buf), cleanup_mkdir);
+    TRY(result, storage_upgrade(storage), cleanup_file);
 
     result = 0;
     goto done;
 
+  cleanup_file:
+    // the directory holds a database, leave it be
+    file_close(storage->st_file);
+    goto cleanup_colarray;
   cleanup_mkdir:
     assert(rmdir(dbdir) == 0);
   cleanup_colarray:
@@ -145,15 +311,14 @@ storage_find_column_open(struct storage *storage, char *colname,
     assert(colname != NULL);
     assert(retcol != NULL);
 
+    // The name of an open column never changes, so we can read it without
+    // the column lock, which a long load may be holding.
     for (unsigned i = 0; i < columnarray_num(storage->st_open_cols); i++) {
         struct column *col = columnarray_get(storage->st_open_cols, i);
-        rwlock_acquire_read(col->col_rwlock);
         if (strcmp(col->col_disk.cd_col_name, colname) == 0) {
             *retcol = col;
-            rwlock_release(col->col_rwlock);
             return true;
         }
-        rwlock_release(col->col_rwlock);
     }
     return false;
 }
@@ -188,9 +353,212 @@ btree_node_synch(struct file *f, struct btree_node *node)
     assert(f != NULL);
     assert(node != NULL);
     assert(node->bt_header.bth_page != BTREE_PAGE_NULL);
+    node->bt_header.bth_version = BTREE_VERSION;
     return file_write(f, node->bt_header.bth_page, node);
 }
 
+static
+struct vlatch *
+btree_page_latch(struct column *col, page_t page)
+{
+    return &col->col_btree_latches[page % BTREE_NLATCHES];
+}
+
+// PRECONDITION: must be holding col_writer_lock
+// Writes node like btree_node_synch, holding the latch of its page so that
+// searches reading the page at the same time read it again
+static
+int
+btree_node_write(struct column *col, struct btree_node *node)
+{
+    struct vlatch *vl = btree_page_latch(col, node->bt_header.bth_page);
+    vlatch_write_acquire(vl);
+    int result = btree_node_synch(col->col_index_file, node);
+    vlatch_write_release(vl);
+    return result;
+}
+
+// PRECONDITION: must be holding lock on column
+// Reads a whole version of the page, even while an insert writes it
+static
+int
+btree_read_page(struct column *col, page_t page, struct btree_node *nodebuf)
+{
+    int result;
+    struct vlatch *vl = btree_page_latch(col, page);
+    while (1) {
+        unsigned version = vlatch_read_begin(vl);
+        TRY(result, file_read(col->col_index_file, page, nodebuf), done);
+        if (vlatch_read_validate(vl, version)) {
+            break;
+        }
+    }
+    result = 0;
+  done:
+    return result;
+}
+
+// PRECONDITION: must be holding lock on column
+static
+page_t
+btree_root(struct column *col)
+{
+    page_t root;
+    unsigned version;
+    do {
+        version = vlatch_read_begin(&col->col_btree_rootlatch);
+        root = col->col_disk.cd_btree_root;
+    } while (!vlatch_read_validate(&col->col_btree_rootlatch, version));
+    return root;
+}
+
+static
+void
+btree_inner_destroy(struct btree_inner *node)
+{
+    if (node == NULL) {
+        return;
+    }
+    if (!node->bi_leaves && node->bi_children != NULL) {
+        for (unsigned i = 0; i <= node->bi_nkeys; i++) {
+            btree_inner_destroy(node->bi_children[i]);
+        }
+    }
+    free(node->bi_children);
+    free(node->bi_keys);
+    free(node);
+}
+
+// Reads the internal node on page and everything under it into memory.
+// height is the number of internal levels from this one down.
+static
+int
+btree_inner_read(struct file *f, page_t page, unsigned height,
+                 struct btree_inner **retnode)
+{
+    int result;
+    struct btree_node nodebuf;
+    struct btree_inner *node = NULL;
+    TRY(result, file_read(f, page, &nodebuf), done);
+    assert(nodebuf.bt_header.bth_type == BTREE_NODE_INTERNAL);
+    unsigned nkeys = nodebuf.bt_header.bth_nentries;
+    TRYNULL(result, DBENOMEM, node, calloc(1, sizeof(struct btree_inner)), done);
+    node->bi_nkeys = nkeys;
+    node->bi_leaves = (height == 1);
+    if (posix_memalign((void **) &node->bi_keys, BTREE_CACHELINE,
+                       (nkeys + 1) * sizeof(int))) {
+        node->bi_keys = NULL;
+        result = DBENOMEM;
+        DBLOG(result);
+        goto cleanup_node;
+    }
+    // pages and pointers may differ in size, e.g. in a 32 bit build
+    size_t childsize = node->bi_leaves ? sizeof(page_t) : sizeof(struct btree_inner *);
+    TRYNULL(result, DBENOMEM, node->bi_children, calloc(nkeys + 1, childsize), cleanup_node);
+    for (unsigned i = 0; i < nkeys; i++) {
+        node->bi_keys[i] = nodebuf.bt_entries[i].bte_key;
+    }
+    for (unsigned i = 0; i <= nkeys; i++) {
+        page_t child = (i == 0) ? nodebuf.bt_header.bth_left
+                                : nodebuf.bt_entries[i - 1].bte_page;
+        if (node->bi_leaves) {
+            node->bi_pages[i] = child;
+        } else {
+            TRY(result, btree_inner_read(f, child, height - 1,
+                                         &node->bi_children[i]), cleanup_node);
+        }
+    }
+    result = 0;
+    goto done;
+  cleanup_node:
+    btree_inner_destroy(node);
+    node = NULL;
+  done:
+    *retnode = (result == 0) ? node : NULL;
+    return result;
+}
+
+// PRECONDITION: MUST BE HOLDING COLUMN WRITE LOCK
+// Frees the internal levels that were replaced, which no search can be
+// going through anymore
+static
+void
+btree_inner_reclaim(struct column *col)
+{
+    while (col->col_btree_retired != NULL) {
+        struct btree_inner *node = col->col_btree_retired;
+        col->col_btree_retired = node->bi_retired;
+        btree_inner_destroy(node);
+    }
+}
+
+// PRECONDITION: must be holding lock on column
+static
+struct btree_inner *
+btree_inner_get(struct column *col)
+{
+    // pairs with the release in btree_inner_load
+    return __atomic_load_n(&col->col_btree_inner, __ATOMIC_ACQUIRE);
+}
+
+// PRECONDITION: MUST BE HOLDING col_writer_lock, OR BE OPENING THE COLUMN
+// Reads the internal levels of the btree into memory, in place of the ones
+// searches use now, which are freed by the next writer to hold the column
+// write lock. If that fails, searches keep using the old ones, or read
+// them from disk, until the next try.
+static
+void
+btree_inner_load(struct column *col)
+{
+    int result;
+    col->col_btree_stale = true;
+
+    // every path from the root is as long, so follow the left pointers to
+    // find how many internal levels there are
+    struct btree_node nodebuf;
+    page_t root = col->col_disk.cd_btree_root;
+    page_t page = root;
+    unsigned height = 0;
+    while (1) {
+        TRY(result, file_read(col->col_index_file, page, &nodebuf), done);
+        if (nodebuf.bt_header.bth_type == BTREE_NODE_LEAF) {
+            break;
+        }
+        page = nodebuf.bt_header.bth_left;
+        height++;
+    }
+    struct btree_inner *inner = NULL;
+    if (height > 0) {
+        TRY(result, btree_inner_read(col->col_index_file, root, height, &inner), done);
+    }
+    struct btree_inner *old = col->col_btree_inner;
+    // a search that sees the new levels sees all of them
+    __atomic_store_n(&col->col_btree_inner, inner, __ATOMIC_RELEASE);
+    if (old != NULL) {
+        old->bi_retired = col->col_btree_retired;
+        col->col_btree_retired = old;
+    }
+    col->col_btree_stale = false;
+  done:
+    return;
+}
+
+// Finds the leaf a search for val ends at, ordering keys by their
+// difference like the nodes on disk
+static
+page_t
+btree_inner_find(struct btree_inner *node, int val)
+{
+    while (1) {
+        unsigned l = int_lower_bound(val, node->bi_keys, node->bi_nkeys,
+                                     sizeof(int));
+        if (node->bi_leaves) {
+            return node->bi_pages[l];
+        }
+        node = node->bi_children[l];
+    }
+}
+
 int
 storage_add_column(struct storage *storage, char *colname,
                    enum storage_type stype)
@@ -303,6 +671,112 @@ storage_add_column(struct storage *storage, char *colname,
     return result;
 }
 
+// Builds the statistics of a column from its base file, for a column
+// from a metadata file that had none
+static
+int
+column_stats_rebuild(struct column *col)
+{
+    int result;
+    int *vals;
+    TRYNULL(result, DBENOMEM, vals, malloc(sizeof(int) * col->col_disk.cd_ntuples), done);
+    uint64_t nvals = 0;
+    struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
+    for (uint64_t id = 0; id < col->col_disk.cd_nexttupleid; id++) {
+        uint64_t ix = id % COLENTRY_UNSORTED_PER_PAGE;
+        if (ix == 0) {
+            TRY(result, file_read(col->col_base_file,
+                                  FILE_FIRST_PAGE + id / COLENTRY_UNSORTED_PER_PAGE,
+                                  colentrybuf), cleanup_vals);
+        }
+        if (colentrybuf[ix].ce_taken && nvals < col->col_disk.cd_ntuples) {
+            vals[nvals++] = colentrybuf[ix].ce_val;
+        }
+    }
+    TRY(result, column_stats_build(&col->col_disk.cd_stats, vals, nvals), cleanup_vals);
+    col->col_dirty = true;
+
+    // success
+    result = 0;
+    goto cleanup_vals;
+  cleanup_vals:
+    free(vals);
+  done:
+    return result;
+}
+
+static
+int
+btree_insert(struct column *col, struct btree_entry *entry);
+
+// Builds the btree of a column again from its base file, for an index
+// file written in an older layout. The new tree is written to another
+// file, which replaces the old one once it is whole.
+static
+int
+column_btree_rebuild(struct column *col)
+{
+    int result;
+    char filenamebuf[56];
+    char newnamebuf[60];
+    sprintf(filenamebuf, "%s/%s", col->col_storage->st_dbdir,
+            col->col_disk.cd_index_file);
+    sprintf(newnamebuf, "%s.new", filenamebuf);
+    (void) remove(newnamebuf);
+    struct file *oldfile = col->col_index_file;
+    page_t oldroot = col->col_disk.cd_btree_root;
+    TRYNULL(result, DBEFILE, col->col_index_file, file_open(newnamebuf), cleanup_old);
+
+    page_t rootpage;
+    TRY(result, file_alloc_page(col->col_index_file, &rootpage), cleanup_new);
+    struct btree_node root;
+    bzero(&root, sizeof(struct btree_node));
+    root.bt_header.bth_type = BTREE_NODE_LEAF;
+    root.bt_header.bth_next = BTREE_PAGE_NULL;
+    root.bt_header.bth_page = rootpage;
+    root.bt_header.bth_nentries = 0;
+    TRY(result, btree_node_synch(col->col_index_file, &root), cleanup_new);
+    col->col_disk.cd_btree_root = rootpage;
+
+    // the id of a tuple is its position in the base file
+    struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
+    for (uint64_t id = 0; id < col->col_disk.cd_nexttupleid; id++) {
+        uint64_t ix = id % COLENTRY_UNSORTED_PER_PAGE;
+        if (ix == 0) {
+            TRY(result, file_read(col->col_base_file,
+                                  FILE_FIRST_PAGE + id / COLENTRY_UNSORTED_PER_PAGE,
+                                  colentrybuf), cleanup_new);
+        }
+        if (colentrybuf[ix].ce_taken) {
+            struct btree_entry entry;
+            bzero(&entry, sizeof(struct btree_entry));
+            entry.bte_key = colentrybuf[ix].ce_val;
+            entry.bte_index = id;
+            TRY(result, btree_insert(col, &entry), cleanup_new);
+        }
+    }
+    if (rename(newnamebuf, filenamebuf) != 0) {
+        result = DBEFILE;
+        DBLOG(result);
+        goto cleanup_new;
+    }
+    file_close(oldfile);
+    TRY(result, storage_synch_column(col->col_storage, &col->col_disk,
+                                     col->col_page, col->col_index), done);
+
+    // success
+    result = 0;
+    goto done;
+  cleanup_new:
+    file_close(col->col_index_file);
+    (void) remove(newnamebuf);
+  cleanup_old:
+    col->col_index_file = oldfile;
+    col->col_disk.cd_btree_root = oldroot;
+  done:
+    return result;
+}
+
 // if not in array, add it and inc ref count
 int
 column_open(struct storage *storage, char *colname, struct column **retcol)
@@ -319,9 +793,7 @@ column_open(struct storage *storage, char *colname, struct column **retcol)
     // if it is, increment the ref count and return it
     bool openfound = storage_find_column_open(storage, colname, &col);
     if (openfound) {
-        rwlock_acquire_write(col->col_rwlock);
         col->col_opencount++;
-        rwlock_release(col->col_rwlock);
         goto done;
     }
 
@@ -343,6 +815,11 @@ column_open(struct storage *storage, char *colname, struct column **retcol)
     // allocate space for the in-memory representation of the column
     TRYNULL(result, DBENOMEM, col, malloc(sizeof(struct column)), done);
     memcpy(&col->col_disk, &colbuf[colindex], sizeof(struct column_on_disk));
+    col->col_page = colpage;
+    col->col_index = colindex;
+    col->col_opencount = 1;
+    col->col_storage = storage;
+    col->col_dirty = false;
 
     // open the base file for the column
     char filenamebuf[56];
@@ -362,18 +839,40 @@ column_open(struct storage *storage, char *colname, struct column **retcol)
 
     // allocate the lock to protect the column
     TRYNULL(result, DBENOMEM, col->col_rwlock, rwlock_create(), cleanup_file);
-    col->col_page = colpage;
-    col->col_index = colindex;
-    col->col_opencount = 1;
-    col->col_storage = storage;
-    col->col_dirty = false;
+    TRYNULL(result, DBENOMEM, col->col_writer_lock, lock_create(), cleanup_rwlock);
+    TRYNULL(result, DBENOMEM, col->col_scan, column_scan_create(), cleanup_lock);
+    col->col_btree_inner = NULL;
+    col->col_btree_retired = NULL;
+    col->col_btree_stale = false;
+    vlatch_init(&col->col_btree_rootlatch);
+    col->col_btree_latches = NULL;
+    if (col->col_disk.cd_stype == STORAGE_BTREE) {
+        TRYNULL(result, DBENOMEM, col->col_btree_latches,
+                calloc(BTREE_NLATCHES, sizeof(struct vlatch)), cleanup_scan);
+        struct btree_node rootbuf;
+        TRY(result, file_read(col->col_index_file, col->col_disk.cd_btree_root, &rootbuf),
+            cleanup_scan);
+        if (rootbuf.bt_header.bth_version != BTREE_VERSION) {
+            TRY(result, column_btree_rebuild(col), cleanup_scan);
+        }
+        btree_inner_load(col);
+    }
+    if (col->col_disk.cd_ntuples > 0 && col->col_disk.cd_stats.cs_nbuckets == 0) {
+        TRY(result, column_stats_rebuild(col), cleanup_scan);
+    }
 
     // finally, add this column to the array of open columns
-    TRY(result, columnarray_add(storage->st_open_cols, col, NULL), cleanup_lock);
+    TRY(result, columnarray_add(storage->st_open_cols, col, NULL), cleanup_scan);
     result = 0;
     goto done;
 
+  cleanup_scan:
+    btree_inner_destroy(col->col_btree_inner);
+    free(col->col_btree_latches);
+    column_scan_destroy(col->col_scan);
   cleanup_lock:
+    lock_destroy(col->col_writer_lock);
+  cleanup_rwlock:
     rwlock_destroy(col->col_rwlock);
   cleanup_file:
     if (col->col_index_file != NULL) {
@@ -396,25 +895,16 @@ column_close(struct column *col)
     assert(col != NULL);
     int result;
     // to prevent an open and close happening at the same time for this
-    // column, we grab the lock on storage first
-    // to avoid deadlock, we grab the storage lock first
-    rwlock_acquire_read(col->col_rwlock);
+    // column, we grab the lock on storage, which protects the ref count
     struct storage *storage = col->col_storage;
-    rwlock_release(col->col_rwlock);
     assert(storage != NULL);
     lock_acquire(storage->st_lock);
 
     // decrement the refcnt. if it reaches 0, destroy the column
     // since we are the last thread to close it, then it is safe to
     // read the contents of the struct without the lock
-    bool should_destroy = false;
-    rwlock_acquire_write(col->col_rwlock);
     col->col_opencount--;
-    if (col->col_opencount == 0) {
-        should_destroy = true;
-    }
-    rwlock_release(col->col_rwlock);
-    if (!should_destroy) {
+    if (col->col_opencount > 0) {
         goto done;
     }
 
@@ -436,6 +926,11 @@ column_close(struct column *col)
         }
     }
     assert(columnarray_num(storage->st_open_cols) == listlen - 1);
+    btree_inner_reclaim(col);
+    btree_inner_destroy(col->col_btree_inner);
+    free(col->col_btree_latches);
+    column_scan_destroy(col->col_scan);
+    lock_destroy(col->col_writer_lock);
     rwlock_destroy(col->col_rwlock);
     file_close(col->col_base_file);
     if (col->col_disk.cd_stype == STORAGE_BTREE || col->col_disk.cd_stype == STORAGE_SORTED) {
@@ -447,61 +942,41 @@ column_close(struct column *col)
     lock_release(storage->st_lock);
 }
 
-static
-int
-btree_entry_compare(const void *a, const void *b)
-{
-    struct btree_entry *aent = (struct btree_entry *) a;
-    struct btree_entry *bent = (struct btree_entry *) b;
-    return (aent->bte_key - bent->bte_key);
-}
-
 // PRECONDITION: must be holding lock on column
-// Finds all ids on [left, right)
+// Adds the ids of the entries from position ix of the leaf in nodebuf on,
+// up to the first one greater than high
 static
 int
-btree_select_range(struct column *col,
-                   int low, int high,
-                   page_t pleft, unsigned ixleft,
-                   page_t pright, unsigned ixright,
+btree_select_range(struct column *col, int low, int high,
+                   struct btree_node *nodebuf, unsigned ix,
                    struct column_ids *cids)
 {
     assert(col != NULL);
+    assert(nodebuf != NULL);
     assert(cids != NULL);
-    assert(cids->cid_type == CID_BITMAP);
-    assert(pleft != BTREE_PAGE_NULL);
-    assert(pright != BTREE_PAGE_NULL);
-    assert(ixleft <= BTENTRY_PER_PAGE);
-    assert(ixright <= BTENTRY_PER_PAGE);
+    assert(cids->cid_type != CID_ARRAY);
+    assert(ix <= BTLEAF_PER_PAGE);
 
     int result;
-    struct btree_node nodebuf;
-
-    page_t curpage = pleft;
-    unsigned curix = ixleft;
     while (1) {
-        assert(curpage != BTREE_PAGE_NULL);
-        TRY(result, file_read(col->col_index_file, curpage, &nodebuf), done);
-
-        assert(nodebuf.bt_header.bth_type == BTREE_NODE_LEAF);
-        assert(nodebuf.bt_header.bth_page == curpage);
-
-        unsigned rightbound = (curpage == pright) ? ixright
-                : nodebuf.bt_header.bth_nentries;
-        for (/* none */; curix < rightbound; curix++) {
-            struct btree_entry *entry = &nodebuf.bt_entries[curix];
-            assert(low <= entry->bte_key);
-            assert(entry->bte_key <= high);
-            bitmap_mark(cids->cid_bitmap, entry->bte_index);
+        assert(nodebuf->bt_header.bth_type == BTREE_NODE_LEAF);
+        unsigned nentries = nodebuf->bt_header.bth_nentries;
+        for (/* none */; ix < nentries; ix++) {
+            if (nodebuf->bt_keys[ix] > high) {
+                goto success;
+            }
+            assert(low <= nodebuf->bt_keys[ix]);
+            TRY(result, column_ids_add(cids, nodebuf->bt_ids[ix]), done);
         }
-        if ((curpage == pright) && (curix == ixright)) {
+        page_t next = nodebuf->bt_header.bth_next;
+        if (next == BTREE_PAGE_NULL) {
             break;
         }
-        curpage = nodebuf.bt_header.bth_next;
-        curix = 0;
+        TRY(result, btree_read_page(col, next, nodebuf), done);
+        ix = 0;
     }
 
-    // success
+  success:
     result = 0;
     goto done;
   done:
@@ -509,92 +984,111 @@ btree_select_range(struct column *col,
 }
 
 // PRECONDITION: must be holding lock on column
+// Reads the leaf with the lower bound of val into nodebuf, and returns its
+// page and the index of the lower bound in it. An insert may have split
+// the leaf we go down to since the levels above were read, moving the
+// lower bound to a leaf on the right, so we move right until the lower
+// bound is within a leaf, or we are on the last one.
 static
 int
-btree_search(struct column *col, int val,
+btree_search(struct column *col, int val, struct btree_node *nodebuf,
              page_t *retpage, unsigned *retindex)
 {
     int result;
-    page_t targetpage = BTREE_PAGE_NULL;
-    unsigned targetindex = 0;
-    struct btree_entry target;
-    bzero(&target, sizeof(struct btree_entry));
-    target.bte_key = val;
-
-    struct btree_node nodebuf;
-    page_t curpage = col->col_disk.cd_btree_root;
-    while (targetpage == BTREE_PAGE_NULL) {
+    struct btree_inner *inner = btree_inner_get(col);
+    page_t curpage;
+    if (inner != NULL) {
+        // the internal levels are in memory, so only the leaf is read
+        curpage = btree_inner_find(inner, val);
+    } else {
+        curpage = btree_root(col);
+    }
+    unsigned ix;
+    while (1) {
         assert(curpage != BTREE_PAGE_NULL);
-        TRY(result, file_read(col->col_index_file, curpage, &nodebuf), done);
-        unsigned ix = binary_search(&target, &nodebuf.bt_entries,
-                                    nodebuf.bt_header.bth_nentries,
-                                    sizeof(struct btree_entry),
-                                    btree_entry_compare);
-        switch (nodebuf.bt_header.bth_type) {
+        TRY(result, btree_read_page(col, curpage, nodebuf), done);
+        unsigned nentries = nodebuf->bt_header.bth_nentries;
+        switch (nodebuf->bt_header.bth_type) {
         case BTREE_NODE_INTERNAL:
+            ix = int_lower_bound(val, nodebuf->bt_entries, nentries,
+                                 sizeof(struct btree_entry));
             if (ix == 0) { // chase left pointer
-                curpage = nodebuf.bt_header.bth_left;
+                curpage = nodebuf->bt_header.bth_left;
             } else { // chase ix - 1
-                curpage = nodebuf.bt_entries[ix - 1].bte_page;
+                curpage = nodebuf->bt_entries[ix - 1].bte_page;
             }
             break;
         case BTREE_NODE_LEAF:
-            targetpage = curpage;
-            targetindex = ix;
-            goto success;
+            ix = int_lower_bound(val, nodebuf->bt_keys, nentries, sizeof(int));
+            if (ix < nentries || nodebuf->bt_header.bth_next == BTREE_PAGE_NULL) {
+                goto success;
+            }
+            curpage = nodebuf->bt_header.bth_next;
+            break;
         default:
             assert(0);
             break;
         }
     }
 
-    // success
   success:
     result = 0;
-    assert(targetpage != BTREE_PAGE_NULL);
-    *retpage = targetpage;
-    *retindex = targetindex;
+    *retpage = curpage;
+    *retindex = ix;
     goto done;
   done:
     return result;
 }
 
+// Adds entry to the leaf in memory
+static
+void
+btree_leaf_add_entry(struct btree_node *node, struct btree_entry *entry)
+{
+    assert(node->bt_header.bth_type == BTREE_NODE_LEAF);
+    unsigned nentries = node->bt_header.bth_nentries;
+    assert(nentries < BTLEAF_PER_PAGE);
+    assert(entry->bte_index <= UINT32_MAX);
+
+    unsigned ix = int_lower_bound(entry->bte_key, node->bt_keys, nentries,
+                                  sizeof(int));
+    if (ix < nentries) {
+        // memmove allows overlapping regions
+        memmove(&node->bt_keys[ix + 1], &node->bt_keys[ix],
+                sizeof(int) * (nentries - ix));
+        memmove(&node->bt_ids[ix + 1], &node->bt_ids[ix],
+                sizeof(uint32_t) * (nentries - ix));
+    }
+    node->bt_keys[ix] = entry->bte_key;
+    node->bt_ids[ix] = entry->bte_index;
+    node->bt_header.bth_nentries++;
+}
+
 static
 int
-btree_insert_entry(struct file *f,
+btree_insert_entry(struct column *col,
                    struct btree_node *current,
                    struct btree_entry *entry)
 {
     assert(current != NULL);
-    unsigned nentries = current->bt_header.bth_nentries;
-    assert(nentries < BTENTRY_PER_PAGE);
-
-    unsigned ix = binary_search(entry, current->bt_entries, nentries,
-                                sizeof(struct btree_entry),
-                                btree_entry_compare);
-    if (ix < nentries) {
-        // memmove allows overlapping regions
-        memmove(&current->bt_entries[ix + 1], &current->bt_entries[ix],
-                sizeof(struct btree_entry) * (nentries - ix));
-    }
-    current->bt_entries[ix] = *entry;
-    current->bt_header.bth_nentries++;
-    return btree_node_synch(f, current);
+    btree_leaf_add_entry(current, entry);
+    return btree_node_write(col, current);
 }
 
 // Inserts the entry into current
 // If a split occurred, returns a new entry and a pointer to the node
-// that needs to be fixed
+// that needs to be fixed, and sets *retsplit
 static
 int
-btree_insert_helper(struct file *f,
+btree_insert_helper(struct column *col,
                     struct btree_node *current,
                     struct btree_entry *entry,
-                    struct btree_entry *retentry)
+                    struct btree_entry *retentry,
+                    bool *retsplit)
 {
     (void) btree_select_range;
     (void) btree_search;
-    assert(f != NULL);
+    assert(col != NULL);
     assert(current != NULL);
     assert(entry != NULL);
     assert(retentry != NULL);
@@ -611,11 +1105,10 @@ btree_insert_helper(struct file *f,
     // entry to insert into the current node.
     if (current->bt_header.bth_type == BTREE_NODE_INTERNAL) {
         assert(current->bt_header.bth_nentries != 0);
-        ix = binary_search(entry,
-                           current->bt_entries,
-                           current->bt_header.bth_nentries,
-                           sizeof(struct btree_entry),
-                           btree_entry_compare);
+        ix = int_lower_bound(entry->bte_key,
+                             current->bt_entries,
+                             current->bt_header.bth_nentries,
+                             sizeof(struct btree_entry));
         page_t pchild;
         if (ix == 0) { // chase left pointer
             pchild = current->bt_header.bth_left;
@@ -623,10 +1116,10 @@ btree_insert_helper(struct file *f,
             pchild = current->bt_entries[ix - 1].bte_page;
         }
         assert(pchild != BTREE_PAGE_NULL);
-        result = file_read(f, pchild, &nodebuf);
+        result = file_read(col->col_index_file, pchild, &nodebuf);
         assert(result == 0);
         bzero(&entrybuf, sizeof(struct btree_entry));
-        result = btree_insert_helper(f, &nodebuf, entry, &entrybuf);
+        result = btree_insert_helper(col, &nodebuf, entry, &entrybuf, retsplit);
         assert(result == 0);
 
         // If we get a new entry, it must be an entry pointing to
@@ -647,14 +1140,14 @@ btree_insert_helper(struct file *f,
             }
             current->bt_entries[ix] = entrybuf;
             current->bt_header.bth_nentries++;
-            result = btree_node_synch(f, current);
+            result = btree_node_write(col, current);
             assert(result == 0);
             bzero(&entrybuf, sizeof(struct btree_entry));
             goto success;
         }
     } else {
-        if (current->bt_header.bth_nentries < BTENTRY_PER_PAGE) {
-            result = btree_insert_entry(f, current, entry);
+        if (current->bt_header.bth_nentries < BTLEAF_PER_PAGE) {
+            result = btree_insert_entry(col, current, entry);
             assert(result == 0);
             bzero(&entrybuf, sizeof(struct btree_entry));
             goto success;
@@ -662,22 +1155,29 @@ btree_insert_helper(struct file *f,
     }
 
     // Otherwise, we need to split and copy half the entries to the new node.
+    *retsplit = true;
     unsigned nentries = current->bt_header.bth_nentries;
     bzero(&nodebuf, sizeof(struct btree_node));
     page_t newpage;
-    result = file_alloc_page(f, &newpage);
+    result = file_alloc_page(col->col_index_file, &newpage);
     assert(result == 0);
     unsigned halfix = nentries / 2;
     nodebuf.bt_header.bth_type = current->bt_header.bth_type;
     nodebuf.bt_header.bth_page = newpage;
     struct btree_entry *base;
+    size_t bytes_tocopy;
     switch (current->bt_header.bth_type) {
     case BTREE_NODE_LEAF:
         current->bt_header.bth_nentries = halfix;
         nodebuf.bt_header.bth_nentries = nentries - halfix;
         nodebuf.bt_header.bth_next = current->bt_header.bth_next;
         current->bt_header.bth_next = newpage;
-        base = &current->bt_entries[halfix];
+        memcpy(nodebuf.bt_keys, &current->bt_keys[halfix],
+               sizeof(int) * (nentries - halfix));
+        memcpy(nodebuf.bt_ids, &current->bt_ids[halfix],
+               sizeof(uint32_t) * (nentries - halfix));
+        bzero(&current->bt_keys[halfix], sizeof(int) * (nentries - halfix));
+        bzero(&current->bt_ids[halfix], sizeof(uint32_t) * (nentries - halfix));
         break;
     case BTREE_NODE_INTERNAL:
         // one of the entries from current becomes the left pointer
@@ -688,15 +1188,14 @@ btree_insert_helper(struct file *f,
         nodebuf.bt_header.bth_nentries = (nentries - halfix) - 1;
         nodebuf.bt_header.bth_left = current->bt_entries[halfix].bte_page;
         base = &current->bt_entries[halfix + 1];
+        bytes_tocopy = sizeof(struct btree_entry) * nodebuf.bt_header.bth_nentries;
+        memcpy(&nodebuf.bt_entries, base, bytes_tocopy);
+        bzero(base, bytes_tocopy);
         break;
     default:
         assert(0);
         break;
     }
-    size_t bytes_tocopy =
-            sizeof(struct btree_entry) * nodebuf.bt_header.bth_nentries;
-    memcpy(&nodebuf.bt_entries, base, bytes_tocopy);
-    bzero(base, bytes_tocopy);
 
     // Now insert the entry into the appropriate position in this node
     if (current->bt_header.bth_type == BTREE_NODE_INTERNAL) {
@@ -721,12 +1220,10 @@ btree_insert_helper(struct file *f,
     } else {
         // If the entry to be inserted is geq than the smallest key
         // in the new right node, the entry should be inserted into that node.
-        if (btree_entry_compare(entry, &nodebuf.bt_entries[0]) >= 0) {
-            result = btree_insert_entry(f, &nodebuf, entry);
-            assert(result == 0);
+        if (entry->bte_key >= nodebuf.bt_keys[0]) {
+            btree_leaf_add_entry(&nodebuf, entry);
         } else {
-            result = btree_insert_entry(f, current, entry);
-            assert(result == 0);
+            btree_leaf_add_entry(current, entry);
         }
     }
 
@@ -737,7 +1234,7 @@ btree_insert_helper(struct file *f,
     case BTREE_NODE_LEAF:
         // if we are a leaf node, we must propagate a copy of the
         // key up and maintain another copy at this level
-        entrybuf.bte_key = nodebuf.bt_entries[0].bte_key;
+        entrybuf.bte_key = nodebuf.bt_keys[0];
         entrybuf.bte_page = newpage;
         break;
     case BTREE_NODE_INTERNAL:
@@ -754,10 +1251,12 @@ btree_insert_helper(struct file *f,
         assert(0);
         break;
     }
-    // Now we need to synch all the changes in the current and new nodes
-    result = btree_node_synch(f, &nodebuf);
+    // Now we need to synch all the changes in the current and new nodes.
+    // The new node goes first, so that a search that reads the current
+    // node finds all of its entries there or on the right.
+    result = btree_node_write(col, &nodebuf);
     assert(result == 0);
-    result = btree_node_synch(f, current);
+    result = btree_node_write(col, current);
     assert(result == 0);
 
     goto success;
@@ -787,9 +1286,14 @@ btree_insert(struct column *col, struct btree_entry *entry)
                        col->col_disk.cd_btree_root, &rootbuf);
     assert(result == 0);
 
-    result = btree_insert_helper(col->col_index_file, &rootbuf, entry,
-                                 &entrybuf);
+    bool split = false;
+    result = btree_insert_helper(col, &rootbuf, entry, &entrybuf, &split);
     assert(result == 0);
+    if (split) {
+        // an internal node changed, so the copy in memory is out of date
+        // until the caller is done inserting
+        col->col_btree_stale = true;
+    }
 
     // If after insertion, our current does not have a sibling, we're done
     if (entrybuf.bte_page == BTREE_PAGE_NULL) {
@@ -811,45 +1315,63 @@ btree_insert(struct column *col, struct btree_entry *entry)
     nodebuf.bt_header.bth_page = newpage;
     nodebuf.bt_header.bth_left = rootbuf.bt_header.bth_page;
     nodebuf.bt_entries[0] = entrybuf;
-    result = btree_node_synch(col->col_index_file, &nodebuf);
+    result = btree_node_write(col, &nodebuf);
     assert(result == 0);
     newrootpage = newpage;
     goto success;
 
   success:
     result = 0;
+    vlatch_write_acquire(&col->col_btree_rootlatch);
     col->col_disk.cd_btree_root = newrootpage;
-    col->col_disk.cd_ntuples++;
-    col->col_disk.cd_nexttupleid++;
-    col->col_dirty = true;
+    vlatch_write_release(&col->col_btree_rootlatch);
     goto done;
   done:
     return result;
 }
 
+#define SELECT_EXPECTED_UNKNOWN UINT64_MAX
+
+// Picks the representation for the result of a select. An idset costs
+// about two bytes per id while sparse and never much more than a bitmap
+// when dense, so it is the default. When we know up front that the
+// selection is dense, a plain bitmap is as small and cheaper to fill.
+static
+struct column_ids *
+column_select_create_ids(struct column *col, uint64_t expected)
+{
+    unsigned nbits = col->col_disk.cd_nexttupleid;
+    enum column_ids_type type = CID_IDSET;
+    if (expected != SELECT_EXPECTED_UNKNOWN && expected * 16 >= nbits) {
+        type = CID_BITMAP;
+    }
+    return column_ids_create(type, nbits);
+}
+
 // PRECONDITION: MUST BE HOLDING COLUMN LOCK
-// This will mark the entries in the bitmap for the tuples that satisfy
-// the select predicate.
+// This will select the ids of the tuples that satisfy the select
+// predicate into *retcids.
 static
 int
-column_select_btree(struct column *col, struct op *op,
-                    struct column_ids *cids)
+column_select_btree(struct column *col, struct op *op, uint64_t expected,
+                    struct column_ids **retcids)
 {
     assert(col != NULL);
     assert(op != NULL);
-    assert(cids != NULL);
-    assert(cids->cid_type == CID_BITMAP);
+    assert(retcids != NULL);
 
     int result;
-    page_t pleft, pright;
+    struct column_ids *cids = NULL;
+    struct btree_node nodebuf;
+    page_t page;
+    unsigned ix;
     int low, high;
-    unsigned ixleft, ixright;
     switch (op->op_type) {
     case OP_SELECT_ALL:
     case OP_SELECT_ALL_ASSIGN:
-        for (unsigned i = 0; i < col->col_disk.cd_ntuples; i++) {
-            bitmap_mark(cids->cid_bitmap, i);
-        }
+        TRYNULL(result, DBENOMEM, cids,
+                column_select_create_ids(col, col->col_disk.cd_ntuples), done);
+        TRY(result, column_ids_add_range(cids, 0, col->col_disk.cd_ntuples), done);
         result = 0;
         goto done;
     case OP_SELECT_RANGE:
@@ -866,28 +1388,131 @@ column_select_btree(struct column *col, struct op *op,
         assert(0);
         break;
     }
-    TRY(result, btree_search(col, low, &pleft, &ixleft), done);
-    TRY(result, btree_search(col, high + 1, &pright, &ixright), done);
-    TRY(result, btree_select_range(col, low, high, pleft, ixleft, pright, ixright, cids), done);
+    TRY(result, btree_search(col, low, &nodebuf, &page, &ix), done);
+    TRYNULL(result, DBENOMEM, cids, column_select_create_ids(col, expected), done);
+    TRY(result, btree_select_range(col, low, high, &nodebuf, ix, cids), done);
 
     // success
     result = 0;
     goto done;
   done:
+    *retcids = cids;
     return result;
 }
 
 static
 int
-column_entry_sorted_compare(const void *a, const void *b)
+uint64_compare(const void *a, const void *b)
 {
-    struct column_entry_sorted *aent = (struct column_entry_sorted *) a;
-    struct column_entry_sorted *bent = (struct column_entry_sorted *) b;
-    return aent->ce_val - bent->ce_val;
+    uint64_t x = *(uint64_t *) a;
+    uint64_t y = *(uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// PRECONDITION: must be holding lock on column
+// Moves (*curpage, *curix), with the leaf *curpage in nodebuf, to the lower
+// bound of key. Everything before the current position must be less than
+// key, so when the lower bound is still within the leaf it is found
+// without reading anything.
+static
+int
+btree_probe_seek(struct column *col, int key, struct btree_node *nodebuf,
+                 page_t *curpage, unsigned *curix)
+{
+    unsigned n = nodebuf->bt_header.bth_nentries;
+    if (*curpage == BTREE_PAGE_NULL || *curix == n
+        || nodebuf->bt_keys[n - 1] - key < 0) {
+        return btree_search(col, key, nodebuf, curpage, curix);
+    }
+    *curix += int_lower_bound(key, &nodebuf->bt_keys[*curix], n - *curix,
+                              sizeof(int));
+    return 0;
+}
+
+int
+column_btree_probe(struct column *col, const int *keys, const unsigned *ids,
+                   unsigned nkeys, struct column_ids *retidsL,
+                   struct column_ids *retidsR)
+{
+    assert(col != NULL);
+    assert(col->col_disk.cd_stype == STORAGE_BTREE);
+    assert(keys != NULL || nkeys == 0);
+    assert(ids != NULL || nkeys == 0);
+    assert(retidsL != NULL && retidsL->cid_type == CID_ARRAY);
+    assert(retidsR != NULL && retidsR->cid_type == CID_ARRAY);
+    rwlock_acquire_read(col->col_rwlock);
+
+    int result;
+    struct btree_node nodebuf;
+    bzero(&nodebuf.bt_header, sizeof(struct btree_header));
+    page_t curpage = BTREE_PAGE_NULL;
+    unsigned curix = 0;
+    // the right ids of the current key
+    uint64_t *matches = NULL;
+    unsigned maxmatches = 0;
+    unsigned i = 0;
+    while (i < nkeys) {
+        int key = keys[i];
+        assert(i == 0 || keys[i - 1] <= key);
+        TRY(result, btree_probe_seek(col, key, &nodebuf, &curpage, &curix), done);
+
+        // the tuples equal to key may run on into the following leaves
+        unsigned nmatches = 0;
+        while (1) {
+            if (curix == nodebuf.bt_header.bth_nentries) {
+                page_t next = nodebuf.bt_header.bth_next;
+                if (next == BTREE_PAGE_NULL) {
+                    break;
+                }
+                TRY(result, btree_read_page(col, next, &nodebuf), done);
+                curpage = next;
+                curix = 0;
+                continue;
+            }
+            if (nodebuf.bt_keys[curix] != key) {
+                break;
+            }
+            if (nmatches == maxmatches) {
+                unsigned max = (maxmatches == 0) ? 64 : 2 * maxmatches;
+                uint64_t *grown;
+                TRYNULL(result, DBENOMEM, grown,
+                        realloc(matches, max * sizeof(uint64_t)), done);
+                matches = grown;
+                maxmatches = max;
+            }
+            matches[nmatches++] = nodebuf.bt_ids[curix++];
+        }
+        qsort(matches, nmatches, sizeof(uint64_t), uint64_compare);
+
+        // every left id with this key pairs with every match
+        for (/* none */; i < nkeys && keys[i] == key; i++) {
+            for (unsigned m = 0; m < nmatches; m++) {
+                TRY(result, idarray_add(retidsL->cid_array, (void *) (uintptr_t) ids[i], NULL), done);
+                TRY(result, idarray_add(retidsR->cid_array, (void *) (uintptr_t) matches[m], NULL), done);
+            }
+        }
+    }
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    free(matches);
+    rwlock_release(col->col_rwlock);
+    return result;
 }
 
-// MUST BE HOLDING LOCK ON COLUMN
-// Returns all the indices in the sorted entries at positions [left, right)
+static
+int
+column_entry_sorted_compare(const void *a, const void *b)
+{
+    struct column_entry_sorted *aent = (struct column_entry_sorted *) a;
+    struct column_entry_sorted *bent = (struct column_entry_sorted *) b;
+    return (aent->ce_val > bent->ce_val) - (aent->ce_val < bent->ce_val);
+}
+
+// MUST BE HOLDING LOCK ON COLUMN
+// Returns all the indices in the sorted entries at positions [left, right)
 static
 int
 column_select_sorted_range(struct column *col, uint64_t left, uint64_t right,
@@ -895,7 +1520,7 @@ column_select_sorted_range(struct column *col, uint64_t left, uint64_t right,
 {
     assert(col != NULL);
     assert(cids != NULL);
-    assert(cids->cid_type == CID_BITMAP);
+    assert(cids->cid_type != CID_ARRAY);
     assert(left <= right);
     assert(right <= col->col_disk.cd_ntuples);
     assert(PAGESIZE % sizeof(struct column_entry_sorted) == 0);
@@ -913,7 +1538,7 @@ column_select_sorted_range(struct column *col, uint64_t left, uint64_t right,
         }
         // mark the bit for this id
         unsigned curindex = curtuple % COLENTRY_SORTED_PER_PAGE;
-        bitmap_mark(cids->cid_bitmap, colentrybuf[curindex].ce_index);
+        TRY(result, column_ids_add(cids, colentrybuf[curindex].ce_index), done);
     }
     result = 0;
     goto done;
@@ -932,8 +1557,6 @@ column_search_sorted(struct column *col, int val, uint64_t *retindex)
     assert(retindex != NULL);
 
     int result;
-    struct column_entry_sorted target;
-    target.ce_val = val;
     struct column_entry_sorted colentrybuf[COLENTRY_SORTED_PER_PAGE];
     uint64_t ntuples = col->col_disk.cd_ntuples;
 
@@ -958,14 +1581,11 @@ column_search_sorted(struct column *col, int val, uint64_t *retindex)
         uint64_t ntuples_in_page = (pm == plast - 1) ?
                 ntuples % COLENTRY_SORTED_PER_PAGE : COLENTRY_SORTED_PER_PAGE;
 
-        // Attempt to find the tuple on this page
-        // this will return a lower bound index where we *should* insert
-        // the value if we were to insert. The tuple index is not necessarily
-        // equal to our target value
-        index = binary_search(&target, colentrybuf, ntuples_in_page,
-                                       sizeof(struct column_entry_sorted),
-                                       column_entry_sorted_compare);
-        if (index == COLENTRY_SORTED_PER_PAGE) {
+        // The lower bound is past this page only if the page is full and
+        // its last tuple is still less than our target value, so there is
+        // no need to search the rest of the page yet
+        struct column_entry_sorted *last = &colentrybuf[COLENTRY_SORTED_PER_PAGE - 1];
+        if (ntuples_in_page == COLENTRY_SORTED_PER_PAGE && last->ce_val < val) {
             pl = pm + 1; // the tuple lives on the right page
         } else {
             pr = pm; // the tuple *might* live on this page or left
@@ -987,9 +1607,8 @@ column_search_sorted(struct column *col, int val, uint64_t *retindex)
     // our lower bound MUST be in this page.
     uint64_t ntuples_in_page = (pl == plast - 1) ?
             ntuples % COLENTRY_SORTED_PER_PAGE : COLENTRY_SORTED_PER_PAGE;
-    index = binary_search(&target, colentrybuf, ntuples_in_page,
-                          sizeof(struct column_entry_sorted),
-                          column_entry_sorted_compare);
+    index = int_lower_bound(val, colentrybuf, ntuples_in_page,
+                            sizeof(struct column_entry_sorted));
     assert(index != COLENTRY_SORTED_PER_PAGE);
     goto success;
 
@@ -1002,19 +1621,19 @@ column_search_sorted(struct column *col, int val, uint64_t *retindex)
 }
 
 // PRECONDITION: MUST BE HOLDING COLUMN LOCK
-// This will mark the entries in the bitmap for the tuples that satisfy
-// the select predicate.
+// This will select the ids of the tuples that satisfy the select
+// predicate into *retcids.
 static
 int
 column_select_sorted(struct column *col, struct op *op,
-                     struct column_ids *cids)
+                     struct column_ids **retcids)
 {
     assert(col != NULL);
     assert(op != NULL);
-    assert(cids != NULL);
-    assert(cids->cid_type == CID_BITMAP);
+    assert(retcids != NULL);
 
     int result;
+    struct column_ids *cids = NULL;
     uint64_t left;
     uint64_t right;
     switch (op->op_type) {
@@ -1039,12 +1658,14 @@ column_select_sorted(struct column *col, struct op *op,
         assert(0);
         break;
     }
+    TRYNULL(result, DBENOMEM, cids, column_select_create_ids(col, right - left), done);
     TRY(result, column_select_sorted_range(col, left, right, cids), done);
 
     // success
     result = 0;
     goto done;
   done:
+    *retcids = cids;
     return result;
 }
 
@@ -1071,42 +1692,386 @@ column_select_predicate(int candidateval, struct op *op)
 }
 
 // PRECONDITION: MUST BE HOLDING COLUMN LOCK
-// This will mark the entries in the bitmap for the tuples that satisfy
-// the select predicate.
+static
+void
+column_scan_request_init(struct scan_request *req, struct column *col, struct op *op,
+                         struct column_ids *cids)
+{
+    req->sr_none = false;
+    switch (op->op_type) {
+    case OP_SELECT_ALL:
+    case OP_SELECT_ALL_ASSIGN:
+        req->sr_low = 0;
+        req->sr_span = UINT_MAX;
+        break;
+    case OP_SELECT_RANGE:
+    case OP_SELECT_RANGE_ASSIGN:
+        req->sr_low = op->op_select.op_sel_low;
+        req->sr_span = op->op_select.op_sel_high - op->op_select.op_sel_low;
+        req->sr_none = (op->op_select.op_sel_low > op->op_select.op_sel_high);
+        break;
+    case OP_SELECT_VALUE:
+    case OP_SELECT_VALUE_ASSIGN:
+        req->sr_low = op->op_select.op_sel_value;
+        req->sr_span = 0;
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    req->sr_cids = cids;
+    req->sr_maxtuples = col->col_disk.cd_nexttupleid;
+    req->sr_pagesleft = (req->sr_maxtuples + COLENTRY_UNSORTED_PER_PAGE - 1)
+                        / COLENTRY_UNSORTED_PER_PAGE;
+    req->sr_result = 0;
+    req->sr_done = false;
+    req->sr_next = NULL;
+}
+
+// Evaluates a select against one page of the base file, page counted from
+// FILE_FIRST_PAGE. The matches are gathered without branching on the
+// values, so the loop stays cheap however selective the predicate is.
+static
+void
+column_scan_evaluate(struct scan_request *req, struct column_entry_unsorted *entries,
+                     page_t page)
+{
+    int result;
+    uint64_t firstid = (uint64_t) page * COLENTRY_UNSORTED_PER_PAGE;
+    if (req->sr_none || firstid >= req->sr_maxtuples) {
+        return;
+    }
+    unsigned n = MIN(COLENTRY_UNSORTED_PER_PAGE, req->sr_maxtuples - firstid);
+    unsigned matches[COLENTRY_UNSORTED_PER_PAGE];
+    unsigned nmatches = 0;
+    for (unsigned i = 0; i < n; i++) {
+        matches[nmatches] = firstid + i;
+        nmatches += entries[i].ce_taken
+                    & ((unsigned) entries[i].ce_val - req->sr_low <= req->sr_span);
+    }
+    for (unsigned i = 0; i < nmatches; i++) {
+        TRY(result, column_ids_add(req->sr_cids, matches[i]), fail);
+    }
+    return;
+  fail:
+    req->sr_result = result;
+    req->sr_pagesleft = 0;
+}
+
+// Called with cs_lock held
+static
+bool
+column_scan_pending(struct scan_request *reqs, unsigned nreqs)
+{
+    for (unsigned i = 0; i < nreqs; i++) {
+        if (!reqs[i].sr_done) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// PRECONDITION: MUST BE HOLDING cs_lock AND DRIVING THE SCAN
+// Reads chunks of the base file and evaluates every attached select against
+// them until the caller's own selects have seen the whole file. Each page
+// is evaluated against all the selects while it is in cache. Selects that
+// attach meanwhile join in at the current chunk. The lock is dropped while
+// reading and evaluating; only this thread removes requests from the list,
+// and new ones are only pushed on its head, so the part of the list it
+// walks is stable. While a chunk is evaluated in one of bufs, the next one
+// is read into the other.
+static
+void
+column_scan_drive(struct column *col, struct scan_request *reqs, unsigned nreqs,
+                  page_t npages, struct column_entry_unsorted **bufs)
+{
+    struct column_scan *scan = col->col_scan;
+    struct file_io io;
+    page_t ahead = npages; // first page of the chunk being read, if any
+    unsigned cur = 0;
+    while (column_scan_pending(reqs, nreqs)) {
+        page_t first = (scan->cs_cursor < npages) ? scan->cs_cursor : 0;
+        page_t n = MIN(SCAN_CHUNK_PAGES, npages - first);
+        struct scan_request *requests = scan->cs_requests;
+        lock_release(scan->cs_lock);
+
+        int result;
+        if (ahead == first) {
+            cur = !cur;
+            result = file_io_wait(&io);
+        } else {
+            if (ahead != npages) {
+                file_io_wait(&io);
+            }
+            result = file_read_pages(col->col_base_file, FILE_FIRST_PAGE + first,
+                                     n, bufs[cur]);
+        }
+        ahead = npages;
+        bool more = false;
+        for (struct scan_request *req = requests; req != NULL; req = req->sr_next) {
+            more |= (req->sr_pagesleft > n);
+        }
+        if (result == 0 && more) {
+            ahead = (first + n == npages) ? 0 : first + n;
+            file_read_start(col->col_base_file, FILE_FIRST_PAGE + ahead,
+                            MIN(SCAN_CHUNK_PAGES, npages - ahead), bufs[!cur], &io);
+        }
+
+        struct column_entry_unsorted *buf = bufs[cur];
+        for (page_t i = 0; i < n; i++) {
+            struct column_entry_unsorted *entries = &buf[i * COLENTRY_UNSORTED_PER_PAGE];
+            for (struct scan_request *req = requests; req != NULL; req = req->sr_next) {
+                if (result) {
+                    req->sr_result = result;
+                    req->sr_pagesleft = 0;
+                } else if (i < req->sr_pagesleft) {
+                    column_scan_evaluate(req, entries, first + i);
+                }
+            }
+        }
+        for (struct scan_request *req = requests; req != NULL; req = req->sr_next) {
+            req->sr_pagesleft -= MIN(n, req->sr_pagesleft);
+        }
+
+        lock_acquire(scan->cs_lock);
+        scan->cs_cursor = (first + n == npages) ? 0 : first + n;
+        struct scan_request **prev = &scan->cs_requests;
+        while (*prev != NULL) {
+            struct scan_request *req = *prev;
+            if (req->sr_pagesleft == 0) {
+                req->sr_done = true;
+                *prev = req->sr_next;
+            } else {
+                prev = &req->sr_next;
+            }
+        }
+        cv_broadcast(scan->cs_cv);
+    }
+    if (ahead != npages) {
+        file_io_wait(&io);
+    }
+}
+
+// PRECONDITION: MUST BE HOLDING COLUMN LOCK
+// Attaches the requests to the shared scan of the column and waits until
+// each of them has seen the whole base file, driving the scan whenever
+// nobody else is. Returns the first error any of them hit.
 static
 int
-column_select_unsorted(struct column *col, struct op *op,
-                       struct column_ids *cids)
+column_scan_run(struct column *col, struct scan_request *reqs, unsigned nreqs)
+{
+    int result;
+    page_t npages = reqs[0].sr_pagesleft;
+    if (npages == 0) {
+        result = 0;
+        goto done;
+    }
+    struct column_entry_unsorted *bufs[2];
+    TRYNULL(result, DBENOMEM, bufs[0], file_buf_alloc(2 * SCAN_CHUNK_PAGES), done);
+    bufs[1] = &bufs[0][SCAN_CHUNK_PAGES * COLENTRY_UNSORTED_PER_PAGE];
+
+    struct column_scan *scan = col->col_scan;
+    lock_acquire(scan->cs_lock);
+    for (unsigned i = 0; i < nreqs; i++) {
+        assert(reqs[i].sr_pagesleft == npages);
+        reqs[i].sr_next = scan->cs_requests;
+        scan->cs_requests = &reqs[i];
+    }
+    while (column_scan_pending(reqs, nreqs)) {
+        if (scan->cs_driving) {
+            cv_wait(scan->cs_cv, scan->cs_lock);
+            continue;
+        }
+        scan->cs_driving = true;
+        column_scan_drive(col, reqs, nreqs, npages, bufs);
+        scan->cs_driving = false;
+        // let a waiting select take over
+        cv_broadcast(scan->cs_cv);
+    }
+    lock_release(scan->cs_lock);
+    free(bufs[0]);
+
+    result = 0;
+    for (unsigned i = 0; i < nreqs && result == 0; i++) {
+        result = reqs[i].sr_result;
+    }
+  done:
+    return result;
+}
+
+// PRECONDITION: MUST BE HOLDING COLUMN LOCK
+// This will select the ids of the tuples that satisfy the select
+// predicate into *retcids. Concurrent selects on the column share one
+// scan of the base file, see struct column_scan.
+static
+int
+column_select_unsorted(struct column *col, struct op *op, uint64_t expected,
+                       struct column_ids **retcids)
 {
     assert(col != NULL);
     assert(op != NULL);
-    assert(cids != NULL);
-    assert(cids->cid_type == CID_BITMAP);
+    assert(retcids != NULL);
     assert(PAGESIZE % sizeof(struct column_entry_unsorted) == 0);
 
     int result;
-    struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
-    uint64_t scanned = 0;
-    uint64_t maxtuples = col->col_disk.cd_nexttupleid;
-    page_t page = FILE_FIRST_PAGE;
-    while (scanned < maxtuples) {
-        TRY(result, file_read(col->col_base_file, page, colentrybuf), done);
-        uint64_t toscan = MIN(maxtuples - scanned, COLENTRY_UNSORTED_PER_PAGE);
-        for (unsigned i = 0; i < toscan; i++, scanned++) {
-            struct column_entry_unsorted entry = colentrybuf[i];
-            if (entry.ce_taken && column_select_predicate(entry.ce_val, op)) {
-                bitmap_mark(cids->cid_bitmap, scanned);
-            }
-        }
-        page++;
-    }
-    assert(scanned == maxtuples);
+    struct column_ids *cids = NULL;
+    TRYNULL(result, DBENOMEM, cids, column_select_create_ids(col, expected), done);
+    struct scan_request req;
+    column_scan_request_init(&req, col, op, cids);
+    TRY(result, column_scan_run(col, &req, 1), done);
     result = 0;
     goto done;
   done:
+    *retcids = cids;
     return result;
 }
 
+// PRECONDITION: MUST BE HOLDING COLUMN LOCK
+// Estimates how many tuples the select will return
+static
+uint64_t
+column_select_expected(struct column *col, struct op *op)
+{
+    struct column_stats *stats = &col->col_disk.cd_stats;
+    switch (op->op_type) {
+    case OP_SELECT_ALL:
+    case OP_SELECT_ALL_ASSIGN:
+        return col->col_disk.cd_ntuples;
+    case OP_SELECT_RANGE:
+    case OP_SELECT_RANGE_ASSIGN:
+        if (stats->cs_nbuckets == 0) {
+            return SELECT_EXPECTED_UNKNOWN;
+        }
+        return column_stats_estimate(stats, op->op_select.op_sel_low,
+                                     op->op_select.op_sel_high);
+    case OP_SELECT_VALUE:
+    case OP_SELECT_VALUE_ASSIGN:
+        if (stats->cs_nbuckets == 0) {
+            return SELECT_EXPECTED_UNKNOWN;
+        }
+        return column_stats_estimate(stats, op->op_select.op_sel_value,
+                                     op->op_select.op_sel_value);
+    default:
+        assert(0);
+        return SELECT_EXPECTED_UNKNOWN;
+    }
+}
+
+// Costs for choosing between an index and a scan of the base file, in
+// units of one page read sequentially. The pages near the top of a search
+// are shared by every search and stay cached, so they are counted as
+// cheap pages. Ids come out of an index in value order, so each one is a
+// random insert into the result instead of an append; COST_INDEX_IDS of
+// them cost about as much as reading a page.
+#define COST_RANDOM_PAGE 4
+#define COST_INDEX_IDS 64
+
+// PRECONDITION: MUST BE HOLDING COLUMN LOCK
+// Decides whether it is cheaper to answer the select from the index of
+// the column rather than scanning the base file.
+static
+bool
+column_select_use_index(struct column *col, struct op *op, uint64_t expected)
+{
+    assert(col->col_disk.cd_stype != STORAGE_UNSORTED);
+
+    // Without statistics, trust the index
+    if (expected == SELECT_EXPECTED_UNKNOWN) {
+        return true;
+    }
+    uint64_t ntuples = col->col_disk.cd_ntuples;
+    uint64_t scancost = (col->col_disk.cd_nexttupleid
+                         + COLENTRY_UNSORTED_PER_PAGE - 1) / COLENTRY_UNSORTED_PER_PAGE;
+    uint64_t indexcost = expected / COST_INDEX_IDS;
+    uint64_t depth = 1;
+    switch (col->col_disk.cd_stype) {
+    case STORAGE_SORTED:
+        // two binary searches over the pages, then a sequential read
+        for (uint64_t n = 1; n < (ntuples / COLENTRY_SORTED_PER_PAGE) + 1; n *= 2) {
+            depth++;
+        }
+        indexcost += 2 * depth + expected / COLENTRY_SORTED_PER_PAGE;
+        break;
+    case STORAGE_BTREE:
+        // A select all never reads the tree
+        if (op->op_type == OP_SELECT_ALL || op->op_type == OP_SELECT_ALL_ASSIGN) {
+            return true;
+        }
+        // a descent, then a walk over leaves that are at least half full
+        // and scattered over the index file. The descent only reads a leaf
+        // while the internal levels are in memory.
+        for (uint64_t n = BTLEAF_PER_PAGE;
+             n < ntuples && btree_inner_get(col) == NULL;
+             n *= BTENTRY_PER_PAGE / 2) {
+            depth++;
+        }
+        indexcost += depth
+                     + (expected / (BTLEAF_PER_PAGE / 2) + 1) * COST_RANDOM_PAGE;
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    return indexcost < scancost;
+}
+
+// PRECONDITION: MUST BE HOLDING COLUMN LOCK
+// Use the index of the column unless the predicate selects so much of it
+// that scanning the base file is cheaper
+static
+enum storage_type
+column_select_path(struct column *col, struct op *op, uint64_t expected)
+{
+    enum storage_type path = col->col_disk.cd_stype;
+    if (path != STORAGE_UNSORTED && !column_select_use_index(col, op, expected)) {
+        path = STORAGE_UNSORTED;
+    }
+    return path;
+}
+
+// Now that the set is built, settle on the smallest container for each
+// chunk of ids
+static
+int
+column_select_optimize(struct column_ids *cids)
+{
+    if (cids->cid_type == CID_IDSET) {
+        return idset_optimize(cids->cid_idset);
+    }
+    return 0;
+}
+
+// Records the column on the ids a select returns, so that not() can leave
+// out its deleted positions, and the range of the index the select covers,
+// so that a fetch of the same column can read the values from there
+static
+void
+column_select_note_index(struct column *col, struct op *op,
+                         struct column_ids *cids)
+{
+    strcpy(cids->cid_col, col->col_disk.cd_col_name);
+    if (col->col_disk.cd_stype == STORAGE_UNSORTED) {
+        return;
+    }
+    switch (op->op_type) {
+    case OP_SELECT_RANGE:
+    case OP_SELECT_RANGE_ASSIGN:
+        cids->cid_index_low = op->op_select.op_sel_low;
+        cids->cid_index_high = op->op_select.op_sel_high;
+        break;
+    case OP_SELECT_VALUE:
+    case OP_SELECT_VALUE_ASSIGN:
+        cids->cid_index_low = op->op_select.op_sel_value;
+        cids->cid_index_high = op->op_select.op_sel_value;
+        break;
+    default:
+        // a select all reads every value, which the base file holds in
+        // order
+        return;
+    }
+    strcpy(cids->cid_index_col, col->col_disk.cd_col_name);
+}
+
 struct column_ids *
 column_select(struct column *col, struct op *op)
 {
@@ -1115,37 +2080,166 @@ column_select(struct column *col, struct op *op)
     rwlock_acquire_read(col->col_rwlock);
 
     int result;
-    struct column_ids *cids;
-    TRYNULL(result, DBENOMEM, cids, malloc(sizeof(struct column_ids)), done);
-    TRYNULL(result, DBENOMEM,
-            cids->cid_bitmap, bitmap_create(col->col_disk.cd_nexttupleid), cleanup_malloc);
-    cids->cid_type = CID_BITMAP;
-    // select based on the storage type of the column
-    switch (col->col_disk.cd_stype) {
+    struct column_ids *cids = NULL;
+    uint64_t expected = column_select_expected(col, op);
+    switch (column_select_path(col, op, expected)) {
     case STORAGE_UNSORTED:
-        result = column_select_unsorted(col, op, cids);
+        result = column_select_unsorted(col, op, expected, &cids);
         break;
     case STORAGE_SORTED:
-        result = column_select_sorted(col, op, cids);
+        result = column_select_sorted(col, op, &cids);
         break;
     case STORAGE_BTREE:
-        result = column_select_btree(col, op, cids);
+        result = column_select_btree(col, op, expected, &cids);
         break;
     default:
         assert(0);
         break;
     }
     if (result) {
-        goto cleanup_bitmap;
+        goto cleanup_ids;
     }
+    TRY(result, column_select_optimize(cids), cleanup_ids);
+    column_select_note_index(col, op, cids);
     // success
     result = 0;
     goto done;
 
-  cleanup_bitmap:
-    bitmap_destroy(cids->cid_bitmap);
-  cleanup_malloc:
-    free(cids);
+  cleanup_ids:
+    if (cids != NULL) {
+        column_ids_destroy(cids);
+        cids = NULL;
+    }
+  done:
+    rwlock_release(col->col_rwlock);
+    return cids;
+}
+
+int
+column_select_batch(struct column *col, struct op **ops, unsigned nops,
+                    struct column_ids **retids)
+{
+    assert(col != NULL);
+    assert(ops != NULL);
+    assert(retids != NULL);
+    rwlock_acquire_read(col->col_rwlock);
+
+    int result;
+    bzero(retids, nops * sizeof(struct column_ids *));
+    struct scan_request *reqs;
+    TRYNULL(result, DBENOMEM, reqs, malloc(nops * sizeof(struct scan_request)), done);
+    unsigned nreqs = 0;
+    for (unsigned i = 0; i < nops; i++) {
+        struct op *op = ops[i];
+        assert(op->op_select.op_sel_pos[0] == '\0');
+        uint64_t expected = column_select_expected(col, op);
+        switch (column_select_path(col, op, expected)) {
+        case STORAGE_UNSORTED:
+            // evaluated together below
+            TRYNULL(result, DBENOMEM, retids[i],
+                    column_select_create_ids(col, expected), cleanup_ids);
+            column_scan_request_init(&reqs[nreqs++], col, op, retids[i]);
+            break;
+        case STORAGE_SORTED:
+            TRY(result, column_select_sorted(col, op, &retids[i]), cleanup_ids);
+            break;
+        case STORAGE_BTREE:
+            TRY(result, column_select_btree(col, op, expected, &retids[i]), cleanup_ids);
+            break;
+        default:
+            assert(0);
+            break;
+        }
+    }
+    if (nreqs > 0) {
+        TRY(result, column_scan_run(col, reqs, nreqs), cleanup_ids);
+    }
+    for (unsigned i = 0; i < nops; i++) {
+        TRY(result, column_select_optimize(retids[i]), cleanup_ids);
+        column_select_note_index(col, ops[i], retids[i]);
+    }
+    // success
+    result = 0;
+    goto cleanup_reqs;
+
+  cleanup_ids:
+    for (unsigned i = 0; i < nops; i++) {
+        if (retids[i] != NULL) {
+            column_ids_destroy(retids[i]);
+            retids[i] = NULL;
+        }
+    }
+  cleanup_reqs:
+    free(reqs);
+  done:
+    rwlock_release(col->col_rwlock);
+    return result;
+}
+
+struct column_ids *
+column_select_within(struct column *col, struct op *op,
+                     struct column_ids *within)
+{
+    assert(col != NULL);
+    assert(op != NULL);
+    assert(within != NULL);
+    rwlock_acquire_read(col->col_rwlock);
+
+    int result;
+    struct column_ids *cids = NULL;
+    uint64_t maxtuples = col->col_disk.cd_nexttupleid;
+    if (within->cid_type != CID_ARRAY && column_ids_nbits(within) != maxtuples) {
+        result = DBECOLDIFFLEN;
+        DBLOG(result);
+        goto done;
+    }
+    // The result is a subset of within. Arrays from joins may repeat ids,
+    // which only an idset tolerates.
+    TRYNULL(result, DBENOMEM, cids,
+            column_select_create_ids(col, (within->cid_type == CID_ARRAY)
+                                     ? SELECT_EXPECTED_UNKNOWN
+                                     : column_ids_count(within)), done);
+
+    // Only visit the base pages that hold a position in within
+    struct cid_iterator iter;
+    cid_iter_init(&iter, within);
+    page_t curpage = 0;
+    struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
+    unsigned idbuf[CID_BATCH];
+    unsigned nids;
+    while ((nids = cid_iter_next_batch(&iter, idbuf, CID_BATCH)) > 0) {
+        for (unsigned j = 0; j < nids; j++) {
+            unsigned id = idbuf[j];
+            if (id >= maxtuples) {
+                result = DBECOLDIFFLEN;
+                DBLOG(result);
+                goto cleanup_iter;
+            }
+            page_t requestedpage = FILE_FIRST_PAGE + (id / COLENTRY_UNSORTED_PER_PAGE);
+            if (requestedpage != curpage) {
+                TRY(result, file_read(col->col_base_file, requestedpage, colentrybuf), cleanup_iter);
+                curpage = requestedpage;
+            }
+            struct column_entry_unsorted entry =
+                    colentrybuf[id % COLENTRY_UNSORTED_PER_PAGE];
+            if (entry.ce_taken && column_select_predicate(entry.ce_val, op)) {
+                TRY(result, column_ids_add(cids, id), cleanup_iter);
+            }
+        }
+    }
+    cid_iter_cleanup(&iter);
+    if (cids->cid_type == CID_IDSET) {
+        TRY(result, idset_optimize(cids->cid_idset), cleanup_ids);
+    }
+    column_select_note_index(col, op, cids);
+
+    // success
+    result = 0;
+    goto done;
+  cleanup_iter:
+    cid_iter_cleanup(&iter);
+  cleanup_ids:
+    column_ids_destroy(cids);
     cids = NULL;
   done:
     rwlock_release(col->col_rwlock);
@@ -1249,255 +2343,378 @@ column_ids_cleanup(struct fetch_tuple *ftuples)
     }
 }
 
+// Hints the pages of the base file that the nids sorted ids are on, so
+// that the kernel reads them in while earlier ones are gathered. Pages
+// less than FETCH_PREFETCH_GAP apart are hinted as one range, since a
+// larger read costs about as much as a small one. When the first of the
+// pages is already cached, the file most likely is too, and the hints
+// would only cost a system call each.
+static
+void
+column_fetch_prefetch(struct column *col, unsigned *ids, unsigned nids)
+{
+    if (nids == 0 || file_page_cached(col->col_base_file,
+                                      FILE_FIRST_PAGE + (ids[0] / COLENTRY_UNSORTED_PER_PAGE))) {
+        return;
+    }
+    page_t first = 0;
+    page_t last = 0;
+    for (unsigned j = 0; j < nids; j++) {
+        page_t page = FILE_FIRST_PAGE + (ids[j] / COLENTRY_UNSORTED_PER_PAGE);
+        if (first != 0 && page < last + FETCH_PREFETCH_GAP) {
+            last = page;
+            continue;
+        }
+        if (first != 0) {
+            file_prefetch(col->col_base_file, first, last - first + 1);
+        }
+        first = page;
+        last = page;
+    }
+    if (first != 0) {
+        file_prefetch(col->col_base_file, first, last - first + 1);
+    }
+}
+
+// The ids at [fr_from, fr_to) of a batch, which are on the pages
+// [fr_first, fr_end) of the base file
+struct fetch_run {
+    page_t fr_first;
+    page_t fr_end;
+    unsigned fr_from;
+    unsigned fr_to;
+};
+
+// Finds the run from the id at from on, which takes the pages the ids
+// after it need one after the other, up to FETCH_RUN_PAGES of them
+static
+void
+column_fetch_next_run(unsigned *ids, unsigned nids, unsigned from,
+                      struct fetch_run *run)
+{
+    assert(from < nids);
+    run->fr_first = FILE_FIRST_PAGE + (ids[from] / COLENTRY_UNSORTED_PER_PAGE);
+    run->fr_end = run->fr_first + 1;
+    run->fr_from = from;
+    unsigned k;
+    for (k = from + 1; k < nids; k++) {
+        page_t page = FILE_FIRST_PAGE + (ids[k] / COLENTRY_UNSORTED_PER_PAGE);
+        if (page >= run->fr_end) {
+            if (page > run->fr_end || page >= run->fr_first + FETCH_RUN_PAGES) {
+                break;
+            }
+            run->fr_end = page + 1;
+        }
+    }
+    run->fr_to = k;
+}
+
 // PRECONDITION: MUST BE HOLDING LOCK ON COLUMN
+// For a bitmap or idset, the values and ids are written to vals and
+// fetchids, which must have room for column_ids_count(ids) entries. For an
+// array, the values are written into the sorted ftuples.
+// The pages of each batch of ids are prefetched while the batch before it
+// is gathered. Within a batch, the ids are gathered a run of pages at a
+// time, and the next run is read while one is gathered.
 static
 int
 column_fetch_base_data(struct column *col, struct column_ids *ids,
-                       struct valarray *vals, struct idarray *fetchids,
+                       int *vals, unsigned *fetchids,
                        struct fetch_tuple *ftuples)
 {
     int result;
+    struct column_entry_unsorted *runbufs[2];
+    TRYNULL(result, DBENOMEM, runbufs[0], file_buf_alloc(2 * FETCH_RUN_PAGES), done);
+    runbufs[1] = &runbufs[0][FETCH_RUN_PAGES * COLENTRY_UNSORTED_PER_PAGE];
     struct cid_iterator iter;
     cid_iter_init(&iter, ids);
 
-    page_t curpage = 0;
-    struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
+    unsigned idbufs[2][CID_BATCH];
+    unsigned curbatch = 0;
+    unsigned nids = cid_iter_next_batch(&iter, idbufs[curbatch], CID_BATCH);
+    column_fetch_prefetch(col, idbufs[curbatch], nids);
+    struct fetch_run runs[2];
+    struct file_io ios[2];
+    bool reading = false; // into the other run buffer
+    unsigned cur = 0;
     unsigned ni = 0;
-    while (cid_iter_has_next(&iter)) {
-        uint64_t i = cid_iter_get(&iter);
-        assert(i < col->col_disk.cd_nexttupleid);
-        page_t requestedpage =
-                FILE_FIRST_PAGE + (i / COLENTRY_UNSORTED_PER_PAGE);
-        assert(requestedpage != 0);
-        // if the requested page is not the current page in the buffer,
-        // read in that page and update the curpage
-        if (requestedpage != curpage) {
-            TRY(result, file_read(col->col_base_file, requestedpage, colentrybuf), done);
-            curpage = requestedpage;
-        }
-        unsigned requestedindex = i % COLENTRY_UNSORTED_PER_PAGE;
-        assert(colentrybuf[requestedindex].ce_taken);
-        int val = colentrybuf[requestedindex].ce_val;
-        if (ids->cid_type == CID_BITMAP) {
-            TRY(result, valarray_add(vals, (void *) val, NULL), done);
-            TRY(result, idarray_add(fetchids, (void *) (unsigned) i, NULL), done);
-        } else {
-            assert(ftuples[ni].fetch_id == i);
-            ftuples[ni].fetch_val = val;
-            ni++;
+    while (nids > 0) {
+        unsigned *idbuf = idbufs[curbatch];
+        unsigned nnext = cid_iter_next_batch(&iter, idbufs[!curbatch], CID_BATCH);
+        column_fetch_prefetch(col, idbufs[!curbatch], nnext);
+        column_fetch_next_run(idbuf, nids, 0, &runs[cur]);
+        file_read_start(col->col_base_file, runs[cur].fr_first,
+                        runs[cur].fr_end - runs[cur].fr_first, runbufs[cur], &ios[cur]);
+        while (1) {
+            struct fetch_run *run = &runs[cur];
+            if (run->fr_to < nids) {
+                column_fetch_next_run(idbuf, nids, run->fr_to, &runs[!cur]);
+                file_read_start(col->col_base_file, runs[!cur].fr_first,
+                                runs[!cur].fr_end - runs[!cur].fr_first,
+                                runbufs[!cur], &ios[!cur]);
+                reading = true;
+            }
+            TRY(result, file_io_wait(&ios[cur]), cleanup_iter);
+            uint64_t firstid = (run->fr_first - FILE_FIRST_PAGE) * COLENTRY_UNSORTED_PER_PAGE;
+            for (unsigned j = run->fr_from; j < run->fr_to; j++) {
+                unsigned i = idbuf[j];
+                assert(i < col->col_disk.cd_nexttupleid);
+                struct column_entry_unsorted *entry = &runbufs[cur][i - firstid];
+                // positions from a stale intermediate may have been
+                // deleted since
+                if (!entry->ce_taken) {
+                    result = DBEDELETED;
+                    DBLOG(result);
+                    goto cleanup_iter;
+                }
+                if (ids->cid_type == CID_ARRAY) {
+                    assert(ftuples[ni].fetch_id == i);
+                    ftuples[ni].fetch_val = entry->ce_val;
+                } else {
+                    vals[ni] = entry->ce_val;
+                    fetchids[ni] = i;
+                }
+                ni++;
+            }
+            if (!reading) {
+                break;
+            }
+            cur = !cur;
+            reading = false;
         }
+        curbatch = !curbatch;
+        nids = nnext;
     }
     // success
     result = 0;
-    goto done;
-  done:
+    goto cleanup_iter;
+  cleanup_iter:
+    if (reading) {
+        file_io_wait(&ios[!cur]);
+    }
     cid_iter_cleanup(&iter);
+    free(runbufs[0]);
+  done:
     return result;
 }
 
-struct column_vals *
-column_fetch(struct column *col, struct column_ids *ids)
+// Bits of the id that each pass of column_fetch_sort_pairs sorts on
+#define FETCH_RADIX_BITS 11
+
+// Sorts the n pairs by the ids below nbits in their high half, with a least
+// significant digit radix sort into tmp and back, and returns whichever of
+// the two holds the result
+static
+uint64_t *
+column_fetch_sort_pairs(uint64_t *pairs, uint64_t *tmp, unsigned n, unsigned nbits)
+{
+    unsigned counts[1 << FETCH_RADIX_BITS];
+    for (unsigned shift = 32; shift < 64 && (nbits - 1) >> (shift - 32) != 0;
+         shift += FETCH_RADIX_BITS) {
+        bzero(counts, sizeof(counts));
+        for (unsigned i = 0; i < n; i++) {
+            counts[(pairs[i] >> shift) & ((1 << FETCH_RADIX_BITS) - 1)]++;
+        }
+        unsigned sum = 0;
+        for (unsigned d = 0; d < (1 << FETCH_RADIX_BITS); d++) {
+            unsigned count = counts[d];
+            counts[d] = sum;
+            sum += count;
+        }
+        for (unsigned i = 0; i < n; i++) {
+            tmp[counts[(pairs[i] >> shift) & ((1 << FETCH_RADIX_BITS) - 1)]++] = pairs[i];
+        }
+        uint64_t *sorted = tmp;
+        tmp = pairs;
+        pairs = sorted;
+    }
+    return pairs;
+}
+
+// Adds the tuple id with value val to the pairs of a covering fetch if it
+// is one of the ids being fetched
+static inline
+void
+column_fetch_index_add(struct column_ids *ids, unsigned nbits, unsigned len,
+                       uint64_t *pairs, unsigned *npairs, uint64_t id, int val)
+{
+    if (id < nbits && column_ids_contains(ids, id)) {
+        assert(*npairs < len);
+        pairs[(*npairs)++] = (id << 32) | (uint32_t) val;
+    }
+}
+
+// PRECONDITION: MUST BE HOLDING LOCK ON COLUMN
+// Reads the values of ids from the range of the index that the select
+// which made them covers, instead of from the base file. The values and
+// ids are written to vals and fetchids in the order of the ids, like
+// column_fetch_base_data does. If updates or deletes have since moved some
+// of the ids out of the range, *retcovered is false and nothing is written.
+static
+int
+column_fetch_index(struct column *col, struct column_ids *ids,
+                   int *vals, unsigned *fetchids, bool *retcovered)
 {
     assert(col != NULL);
     assert(ids != NULL);
+    assert(ids->cid_type != CID_ARRAY);
+    assert(strcmp(ids->cid_index_col, col->col_disk.cd_col_name) == 0);
+
     int result;
-    struct column_vals *cvals = NULL;
-    struct fetch_tuple *ftuples = NULL;
-    struct valarray *vals = NULL;
-    struct idarray *fetchids = NULL;
+    unsigned len = column_ids_count(ids);
+    unsigned nbits = column_ids_nbits(ids);
+    // the id of each value in the high half, so that sorting them puts
+    // the values in the order of the ids, and as much again to sort them
+    // into. One spare, so that an empty fetch is not mistaken for no memory.
+    uint64_t *pairs;
+    TRYNULL(result, DBENOMEM, pairs, malloc(sizeof(uint64_t) * (2 * len + 1)), done);
+    unsigned npairs = 0;
 
-    rwlock_acquire_read(col->col_rwlock);
-    uint64_t maxtuples = col->col_disk.cd_nexttupleid;
-    switch (ids->cid_type) {
-    case CID_BITMAP:
-        if (maxtuples != bitmap_nbits(ids->cid_bitmap)) {
-            result = DBECOLDIFFLEN;
-            DBLOG(result);
-            goto done;
+    switch (col->col_disk.cd_stype) {
+    case STORAGE_SORTED: {
+        uint64_t left, right;
+        TRY(result, column_search_sorted(col, ids->cid_index_low, &left), cleanup_pairs);
+        TRY(result, column_search_sorted(col, ids->cid_index_high + 1, &right), cleanup_pairs);
+        struct column_entry_sorted colentrybuf[COLENTRY_SORTED_PER_PAGE];
+        page_t bufpage = 0;
+        for (uint64_t curtuple = left; curtuple < right; curtuple++) {
+            page_t curpage = FILE_FIRST_PAGE + (curtuple / COLENTRY_SORTED_PER_PAGE);
+            if (curpage != bufpage) {
+                TRY(result, file_read(col->col_index_file, curpage, colentrybuf), cleanup_pairs);
+                bufpage = curpage;
+            }
+            struct column_entry_sorted *entry =
+                    &colentrybuf[curtuple % COLENTRY_SORTED_PER_PAGE];
+            column_fetch_index_add(ids, nbits, len, pairs, &npairs,
+                                   entry->ce_index, entry->ce_val);
         }
         break;
-    case CID_ARRAY:
-        break;
-    default: assert(0); break;
     }
-
-    // sort the ids to make fetching faster
-    TRY(result, column_ids_sort(ids, &ftuples), done);
-    if (ids->cid_type == CID_BITMAP) {
-        TRYNULL(result, DBENOMEM, vals, valarray_create(), cleanup_temps);
-        TRYNULL(result, DBENOMEM, fetchids, idarray_create(), cleanup_temps);
-    }
-
-    switch (col->col_disk.cd_stype) {
-    case STORAGE_UNSORTED:
-    case STORAGE_SORTED:
-    case STORAGE_BTREE:
-        // we always use the base data to fetch the values
-        TRY(result, column_fetch_base_data(col, ids, vals, fetchids, ftuples), cleanup_temps);
+    case STORAGE_BTREE: {
+        int low = ids->cid_index_low;
+        int high = ids->cid_index_high;
+        struct btree_node nodebuf;
+        page_t page;
+        unsigned ix;
+        TRY(result, btree_search(col, low, &nodebuf, &page, &ix), cleanup_pairs);
+        while (1) {
+            unsigned nentries = nodebuf.bt_header.bth_nentries;
+            for (/* none */; ix < nentries && nodebuf.bt_keys[ix] <= high; ix++) {
+                column_fetch_index_add(ids, nbits, len, pairs, &npairs,
+                                       nodebuf.bt_ids[ix], nodebuf.bt_keys[ix]);
+            }
+            page_t next = nodebuf.bt_header.bth_next;
+            if (ix < nentries || next == BTREE_PAGE_NULL) {
+                break;
+            }
+            TRY(result, btree_read_page(col, next, &nodebuf), cleanup_pairs);
+            ix = 0;
+        }
         break;
+    }
     default:
         assert(0);
         break;
     }
 
-    // Copy the ids and values into the cval struct
-    TRYNULL(result, DBENOMEM, cvals, malloc(sizeof(struct column_vals)), cleanup_temps);
-    bzero(cvals, sizeof(struct column_vals));
-    strcpy(cvals->cval_col, col->col_disk.cd_col_name);
-    cvals->cval_len = (ids->cid_type == CID_ARRAY) ? idarray_num(ids->cid_array)
-            : idarray_num(fetchids);
-    TRYNULL(result, DBENOMEM, cvals->cval_vals,
-            malloc(sizeof(int) * cvals->cval_len), cleanup_malloc);
-    TRYNULL(result, DBENOMEM, cvals->cval_ids,
-            malloc(sizeof(unsigned) * cvals->cval_len), cleanup_malloc);
-
-    // fix the ids to make row alignment
-    column_ids_fix(ids, ftuples);
-    if (ids->cid_type == CID_ARRAY) {
-        unsigned len = idarray_num(ids->cid_array);
+    *retcovered = (npairs == len);
+    if (*retcovered) {
+        uint64_t *sorted = column_fetch_sort_pairs(pairs, &pairs[len], len, nbits);
         for (unsigned i = 0; i < len; i++) {
-            cvals->cval_ids[i] = ftuples[i].fetch_id;
-            cvals->cval_vals[i] = ftuples[i].fetch_val;
+            fetchids[i] = sorted[i] >> 32;
+            vals[i] = (int) (uint32_t) sorted[i];
         }
-    } else {
-        assert(valarray_num(vals) == idarray_num(fetchids));
-        memcpy(cvals->cval_vals, vals->arr.v, sizeof(int) * cvals->cval_len);
-        memcpy(cvals->cval_ids, fetchids->arr.v, sizeof(unsigned) * cvals->cval_len);
     }
-
+    // success
     result = 0;
-    goto cleanup_temps;
-
-  cleanup_malloc:
-    free(cvals);
-    cvals = NULL;
-  cleanup_temps:
-    if (vals != NULL) {
-        vals->arr.num = 0;
-        valarray_destroy(vals);
-    }
-    if (fetchids != NULL) {
-        fetchids->arr.num = 0;
-        idarray_destroy(fetchids);
-    }
-    column_ids_cleanup(ftuples);
-  done:
-    rwlock_release(col->col_rwlock);
-    return cvals;
-}
-
-static
-int
-column_load_unsorted(struct file *f, int *vals, uint64_t num)
-{
-    int result = 0;
-    struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
-    uint64_t curtuple = 0;
-    while (curtuple < num) {
-        uint64_t tuples_tocopy =
-                MIN(COLENTRY_UNSORTED_PER_PAGE, num - curtuple);
-        bzero(colentrybuf, PAGESIZE);
-        for (unsigned i = 0; i < tuples_tocopy; i++) {
-            colentrybuf[i].ce_taken = true;
-            colentrybuf[i].ce_val = vals[curtuple + i];
-        }
-        page_t page;
-        TRY(result, file_alloc_page(f, &page), done);
-        result = file_write(f, page, colentrybuf);
-        if (result) {
-            file_free_page(f, page);
-            goto done;
-        }
-        curtuple += tuples_tocopy;
-    }
+    goto cleanup_pairs;
+  cleanup_pairs:
+    free(pairs);
   done:
     return result;
 }
 
-static
-int
-column_load_index_sorted(struct file *f, int *vals, uint64_t num)
+struct column_vals *
+column_fetch(struct column *col, struct column_ids *ids)
 {
-    assert(f != NULL);
-    assert(vals != NULL);
-
+    assert(col != NULL);
+    assert(ids != NULL);
     int result;
-    // create the entries in memory and sort them
-    struct column_entry_sorted *entries;
-    TRYNULL(result, DBENOMEM, entries,
-            malloc(num * sizeof(struct column_entry_sorted)), done);
-    for (uint64_t i = 0; i < num; i++) {
-        entries[i].ce_val = vals[i];
-        entries[i].ce_index = i;
-    }
-    qsort(entries, num, sizeof(struct column_entry_sorted),
-          column_entry_sorted_compare);
+    struct column_vals *cvals = NULL;
+    struct fetch_tuple *ftuples = NULL;
 
-    // write the entries out to disk, one page at a time
-    struct column_entry_sorted colentrybuf[COLENTRY_SORTED_PER_PAGE];
-    uint64_t curtuple = 0;
-    while (curtuple < num) {
-        uint64_t tuples_tocopy = MIN(COLENTRY_SORTED_PER_PAGE, num - curtuple);
-        // avoid overflow
-        size_t bytes_tocopy = sizeof(struct column_entry_sorted)
-                * tuples_tocopy;
-        bzero(colentrybuf, PAGESIZE);
-        memcpy(colentrybuf, entries + curtuple, bytes_tocopy);
-        page_t page;
-        TRY(result, file_alloc_page(f, &page), cleanup_malloc);
-        result = file_write(f, page, colentrybuf);
-        if (result) {
-            file_free_page(f, page);
-            goto cleanup_malloc;
+    rwlock_acquire_read(col->col_rwlock);
+    uint64_t maxtuples = col->col_disk.cd_nexttupleid;
+    switch (ids->cid_type) {
+    case CID_BITMAP:
+    case CID_IDSET:
+        if (maxtuples != column_ids_nbits(ids)) {
+            result = DBECOLDIFFLEN;
+            DBLOG(result);
+            goto done;
         }
-        curtuple += tuples_tocopy;
+        break;
+    case CID_ARRAY:
+        break;
+    default: assert(0); break;
     }
-    result = 0;
-    goto cleanup_malloc;
-  cleanup_malloc:
-    free(entries);
-  done:
-    return result;
-}
 
-static
-int
-column_load_index_btree(struct column *col, int *vals, uint64_t num)
-{
-    assert(col->col_index_file != NULL);
-    assert(vals != NULL);
-    assert(col->col_disk.cd_ntuples == 0);
-    int result;
+    // sort the ids to make fetching faster
+    TRY(result, column_ids_sort(ids, &ftuples), done);
 
-    // the root page should have been created in storage_add_column
-    assert(col->col_disk.cd_btree_root != BTREE_PAGE_NULL);
+    // Size the result up front so the fetch can write straight into it
+    TRYNULL(result, DBENOMEM, cvals, malloc(sizeof(struct column_vals)), cleanup_temps);
+    bzero(cvals, sizeof(struct column_vals));
+    strcpy(cvals->cval_col, col->col_disk.cd_col_name);
+    cvals->cval_len = column_ids_count(ids);
+    TRYNULL(result, DBENOMEM, cvals->cval_vals,
+            malloc(sizeof(int) * cvals->cval_len), cleanup_malloc);
+    TRYNULL(result, DBENOMEM, cvals->cval_ids,
+            malloc(sizeof(unsigned) * cvals->cval_len), cleanup_malloc);
 
-    // Now insert all the tuples one by one
-    for (uint64_t i = 0; i < num; i++) {
-        struct btree_entry entry;
-        bzero(&entry, sizeof(struct btree_entry));
-        entry.bte_key = vals[i];
-        entry.bte_index = i;
-        result = btree_insert(col, &entry);
-        assert(result == 0);
+    // The ids of a select on this column are a range of its index, which
+    // holds their values too
+    bool covered = false;
+    if (ids->cid_type != CID_ARRAY
+        && strcmp(ids->cid_index_col, col->col_disk.cd_col_name) == 0) {
+        TRY(result, column_fetch_index(col, ids, cvals->cval_vals,
+                                       cvals->cval_ids, &covered), cleanup_malloc);
+    }
+    if (!covered) {
+        TRY(result, column_fetch_base_data(col, ids, cvals->cval_vals,
+                                           cvals->cval_ids, ftuples), cleanup_malloc);
+    }
+
+    // fix the ids to make row alignment
+    column_ids_fix(ids, ftuples);
+    if (ids->cid_type == CID_ARRAY) {
+        for (unsigned i = 0; i < cvals->cval_len; i++) {
+            cvals->cval_ids[i] = ftuples[i].fetch_id;
+            cvals->cval_vals[i] = ftuples[i].fetch_val;
+        }
     }
 
-    // success
     result = 0;
-    goto done;
+    goto cleanup_temps;
+
+  cleanup_malloc:
+    column_vals_destroy(cvals);
+    cvals = NULL;
+  cleanup_temps:
+    column_ids_cleanup(ftuples);
   done:
-    return result;
+    rwlock_release(col->col_rwlock);
+    return cvals;
 }
 
 // PRECONDITION: MUST BE HOLDING LOCK
 static
 int
-column_insert_btree(struct column *col, int val)
+column_insert_btree(struct column *col, int val, uint64_t index)
 {
     assert(col != NULL);
     assert(col->col_disk.cd_stype == STORAGE_BTREE);
 
-    uint64_t index = col->col_disk.cd_ntuples;
     struct btree_entry entry;
     bzero(&entry, sizeof(struct btree_entry));
     entry.bte_key = val;
@@ -1619,14 +2836,22 @@ column_insert(struct column *col, int val)
 {
     assert(col != NULL);
     int result;
+    lock_acquire(col->col_writer_lock);
     rwlock_acquire_write(col->col_rwlock);
+    // no select can still be searching internal levels that earlier
+    // inserts replaced
+    btree_inner_reclaim(col);
 
     // we always insert into the unsorted projection as well
     // because we use this for fetching
     TRY(result, column_insert_unsorted(col, val), done);
+    uint64_t index = col->col_disk.cd_ntuples;
     switch (col->col_disk.cd_stype) {
     case STORAGE_BTREE:
-        result = column_insert_btree(col, val);
+        // counted now, and added to the tree below
+        col->col_disk.cd_ntuples++;
+        col->col_disk.cd_nexttupleid++;
+        col->col_dirty = true;
         break;
     case STORAGE_SORTED:
         result = column_insert_sorted(col, val);
@@ -1643,12 +2868,26 @@ column_insert(struct column *col, int val)
     if (result) {
         goto done;
     }
+    column_stats_add(&col->col_disk.cd_stats, val);
+
+    if (col->col_disk.cd_stype == STORAGE_BTREE) {
+        // Selects on the column go on while we add to the tree, and go
+        // through the pages we change optimistically. col_writer_lock
+        // keeps every other change out until we are done.
+        rwlock_release(col->col_rwlock);
+        rwlock_acquire_read(col->col_rwlock);
+        TRY(result, column_insert_btree(col, val, index), done);
+        if (col->col_btree_stale) {
+            btree_inner_load(col);
+        }
+    }
 
     // success
     result = 0;
     goto done;
   done:
     rwlock_release(col->col_rwlock);
+    lock_release(col->col_writer_lock);
     return result;
 }
 
@@ -1667,25 +2906,33 @@ column_update_unsorted(struct column *col, struct column_ids *ids, int val)
     page_t curpage = 0;
     bool dirty = false;
     struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
-    while (cid_iter_has_next(&iter)) {
-        uint64_t id = cid_iter_get(&iter);
-        assert(id < col->col_disk.cd_nexttupleid);
-        page_t requestedpage = FILE_FIRST_PAGE + (id / COLENTRY_UNSORTED_PER_PAGE);
-        assert(requestedpage != 0);
-        // if the requested page is not the current page in the buffer
-        // write out the current page if it is dirty
-        // then read in the requested page and update the curpage
-        if (requestedpage != curpage) {
-            if (dirty) {
-                TRY(result, file_write(col->col_base_file, curpage, colentrybuf), done);
+    unsigned idbuf[CID_BATCH];
+    unsigned nids;
+    while ((nids = cid_iter_next_batch(&iter, idbuf, CID_BATCH)) > 0) {
+        for (unsigned j = 0; j < nids; j++) {
+            unsigned id = idbuf[j];
+            assert(id < col->col_disk.cd_nexttupleid);
+            page_t requestedpage = FILE_FIRST_PAGE + (id / COLENTRY_UNSORTED_PER_PAGE);
+            assert(requestedpage != 0);
+            // if the requested page is not the current page in the buffer
+            // write out the current page if it is dirty
+            // then read in the requested page and update the curpage
+            if (requestedpage != curpage) {
+                if (dirty) {
+                    TRY(result, file_write(col->col_base_file, curpage, colentrybuf), done);
+                }
+                TRY(result, file_read(col->col_base_file, requestedpage, colentrybuf), done);
+                curpage = requestedpage;
             }
-            TRY(result, file_read(col->col_base_file, requestedpage, colentrybuf), done);
-            curpage = requestedpage;
+            unsigned requestedindex = id % COLENTRY_UNSORTED_PER_PAGE;
+            assert(colentrybuf[requestedindex].ce_taken);
+            column_stats_remove(&col->col_disk.cd_stats,
+                                colentrybuf[requestedindex].ce_val);
+            column_stats_add(&col->col_disk.cd_stats, val);
+            colentrybuf[requestedindex].ce_val = val;
+            col->col_dirty = true;
+            dirty = true;
         }
-        unsigned requestedindex = id % COLENTRY_UNSORTED_PER_PAGE;
-        assert(colentrybuf[requestedindex].ce_taken);
-        colentrybuf[requestedindex].ce_val = val;
-        dirty = true;
     }
     if (dirty) {
         TRY(result, file_write(col->col_base_file, curpage, colentrybuf), done);
@@ -1707,12 +2954,14 @@ column_update(struct column *col, struct column_ids *ids, int val)
 
     int result = 0;
     struct fetch_tuple *ftuples = NULL;
+    lock_acquire(col->col_writer_lock);
     rwlock_acquire_write(col->col_rwlock);
 
     // Make sure the number of bits does not exceed the number of ids in the col
     switch (ids->cid_type) {
     case CID_BITMAP:
-        if (col->col_disk.cd_nexttupleid < bitmap_nbits(ids->cid_bitmap)) {
+    case CID_IDSET:
+        if (col->col_disk.cd_nexttupleid < column_ids_nbits(ids)) {
             result = DBECOLDIFFLEN;
             DBLOG(result);
             goto done;
@@ -1747,6 +2996,7 @@ column_update(struct column *col, struct column_ids *ids, int val)
   done:
     column_ids_cleanup(ftuples);
     rwlock_release(col->col_rwlock);
+    lock_release(col->col_writer_lock);
     return result;
 }
 
@@ -1765,30 +3015,39 @@ column_delete_unsorted(struct column *col, struct column_ids *ids)
     page_t curpage = 0;
     bool dirty = false;
     struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
-    while (cid_iter_has_next(&iter)) {
-        uint64_t id = cid_iter_get(&iter);
-        assert(id < col->col_disk.cd_nexttupleid);
-        page_t requestedpage = FILE_FIRST_PAGE + (id / COLENTRY_UNSORTED_PER_PAGE);
-        assert(requestedpage != 0);
-        // if the requested page is not the current page in the buffer
-        // write out the current page if it is dirty
-        // then read in the requested page and update the curpage
-        if (requestedpage != curpage) {
-            if (dirty) {
-                TRY(result, file_write(col->col_base_file, curpage, colentrybuf), done);
+    unsigned idbuf[CID_BATCH];
+    unsigned nids;
+    while ((nids = cid_iter_next_batch(&iter, idbuf, CID_BATCH)) > 0) {
+        for (unsigned j = 0; j < nids; j++) {
+            unsigned id = idbuf[j];
+            assert(id < col->col_disk.cd_nexttupleid);
+            page_t requestedpage = FILE_FIRST_PAGE + (id / COLENTRY_UNSORTED_PER_PAGE);
+            assert(requestedpage != 0);
+            // if the requested page is not the current page in the buffer
+            // write out the current page if it is dirty
+            // then read in the requested page and update the curpage
+            if (requestedpage != curpage) {
+                if (dirty) {
+                    TRY(result, file_write(col->col_base_file, curpage, colentrybuf), done);
+                }
+                TRY(result, file_read(col->col_base_file, requestedpage, colentrybuf), done);
+                curpage = requestedpage;
             }
-            TRY(result, file_read(col->col_base_file, requestedpage, colentrybuf), done);
-            curpage = requestedpage;
-        }
-        unsigned requestedindex = id % COLENTRY_UNSORTED_PER_PAGE;
-        // If we delete after a join, we might get repeated IDs.
-        // That's ok, a delete is idempotent. But we can't have this assertion.
-        //assert(colentrybuf[requestedindex].ce_taken);
-        colentrybuf[requestedindex].ce_val = 0xDEADBEEF;
-        colentrybuf[requestedindex].ce_taken = false;
-        col->col_disk.cd_ntuples--;
-        col->col_dirty = true;
-        dirty = true;
+            unsigned requestedindex = id % COLENTRY_UNSORTED_PER_PAGE;
+            // If we delete after a join, we might get repeated IDs.
+            // That's ok, a delete is idempotent, but only the first one
+            // removes a tuple.
+            if (!colentrybuf[requestedindex].ce_taken) {
+                continue;
+            }
+            column_stats_remove(&col->col_disk.cd_stats,
+                                colentrybuf[requestedindex].ce_val);
+            colentrybuf[requestedindex].ce_val = 0xDEADBEEF;
+            colentrybuf[requestedindex].ce_taken = false;
+            col->col_disk.cd_ntuples--;
+            col->col_dirty = true;
+            dirty = true;
+        }
     }
     if (dirty) {
         TRY(result, file_write(col->col_base_file, curpage, colentrybuf), done);
@@ -1810,12 +3069,14 @@ column_delete(struct column *col, struct column_ids *ids)
 
     int result = 0;
     struct fetch_tuple *ftuples = NULL;
+    lock_acquire(col->col_writer_lock);
     rwlock_acquire_write(col->col_rwlock);
 
     // Make sure the number of bits does not exceed the number of ids in the col
     switch (ids->cid_type) {
     case CID_BITMAP:
-        if (col->col_disk.cd_nexttupleid < bitmap_nbits(ids->cid_bitmap)) {
+    case CID_IDSET:
+        if (col->col_disk.cd_nexttupleid < column_ids_nbits(ids)) {
             result = DBECOLDIFFLEN;
             DBLOG(result);
             goto done;
@@ -1850,46 +3111,585 @@ column_delete(struct column *col, struct column_ids *ids)
   done:
     column_ids_cleanup(ftuples);
     rwlock_release(col->col_rwlock);
+    lock_release(col->col_writer_lock);
     return result;
 }
 
+// A sorted run of entries written by one batch of a load
+struct load_run {
+    page_t lr_first; // first page of the run in the run file
+    uint64_t lr_nentries;
+};
+
+struct column_loader {
+    struct column *cl_col;
+    // Sorted columns write every batch as a sorted run into a scratch
+    // file, and merge the runs into the index when the load finishes.
+    char cl_run_name[256];
+    struct file *cl_run_file;
+    struct load_run *cl_runs;
+    unsigned cl_nruns;
+    unsigned cl_maxruns;
+    uint64_t cl_nexttupleid; // of the column when the load began
+    int cl_result; // of the first append that failed
+    bool cl_widened; // a later batch went past the histogram of the first
+};
+
 int
-column_load(struct column *col, int *vals, uint64_t num)
+column_load_begin(struct column *col, struct column_loader **retloader)
 {
     assert(col != NULL);
-    assert(vals != NULL);
+    assert(retloader != NULL);
     int result;
+    struct column_loader *loader = NULL;
+    lock_acquire(col->col_writer_lock);
     rwlock_acquire_write(col->col_rwlock);
     // if we've already loaded this column, prevent a double load
     if (col->col_disk.cd_ntuples > 0) {
         result = 0;
+        goto cleanup_lock;
+    }
+    TRYNULL(result, DBENOMEM, loader, calloc(1, sizeof(struct column_loader)),
+            cleanup_lock);
+    loader->cl_col = col;
+    loader->cl_nexttupleid = col->col_disk.cd_nexttupleid;
+    if (col->col_disk.cd_stype == STORAGE_SORTED) {
+        sprintf(loader->cl_run_name, "%s/%s.runs",
+                col->col_storage->st_dbdir, col->col_disk.cd_col_name);
+        // throw away the runs of a load that never finished
+        (void) remove(loader->cl_run_name);
+        TRYNULL(result, DBEFILE, loader->cl_run_file,
+                file_open(loader->cl_run_name), cleanup_loader);
+    }
+    bzero(&col->col_disk.cd_stats, sizeof(struct column_stats));
+    col->col_dirty = true;
+
+    // success, keep holding the lock until the load finishes
+    result = 0;
+    goto done;
+  cleanup_loader:
+    free(loader);
+    loader = NULL;
+  cleanup_lock:
+    rwlock_release(col->col_rwlock);
+    lock_release(col->col_writer_lock);
+  done:
+    *retloader = loader;
+    return result;
+}
+
+// Writes vals to the base file, starting at position first. The pages are
+// written back a chunk at a time, while the next chunk is filled.
+static
+int
+column_load_base(struct column *col, uint64_t first, int *vals, uint64_t num)
+{
+    int result;
+    struct column_entry_unsorted *bufs[2];
+    TRYNULL(result, DBENOMEM, bufs[0], malloc(2 * LOAD_WRITE_PAGES * PAGESIZE), done);
+    bufs[1] = &bufs[0][LOAD_WRITE_PAGES * COLENTRY_UNSORTED_PER_PAGE];
+    struct file_io ios[2];
+    bool writing[2] = {false, false};
+    unsigned cur = 0;
+    uint64_t index = first;
+    uint64_t curtuple = 0;
+    while (curtuple < num) {
+        // the buffer is free again once its last chunk is written
+        if (writing[cur]) {
+            writing[cur] = false;
+            TRY(result, file_io_wait(&ios[cur]), cleanup_writes);
+        }
+        page_t firstpage = FILE_FIRST_PAGE + index / COLENTRY_UNSORTED_PER_PAGE;
+        page_t npages = 0;
+        while (curtuple < num && npages < LOAD_WRITE_PAGES) {
+            page_t page = firstpage + npages;
+            struct column_entry_unsorted *colentrybuf =
+                    &bufs[cur][npages * COLENTRY_UNSORTED_PER_PAGE];
+            unsigned ix = index % COLENTRY_UNSORTED_PER_PAGE;
+            // the previous batch may have left the last page partly filled
+            if (file_page_isalloc(col->col_base_file, page)) {
+                TRY(result, file_read(col->col_base_file, page, colentrybuf), cleanup_writes);
+            } else {
+                page_t newpage;
+                TRY(result, file_alloc_page(col->col_base_file, &newpage), cleanup_writes);
+                assert(newpage == page);
+                bzero(colentrybuf, PAGESIZE);
+            }
+            uint64_t tuples_tocopy =
+                    MIN(COLENTRY_UNSORTED_PER_PAGE - ix, num - curtuple);
+            for (unsigned i = 0; i < tuples_tocopy; i++) {
+                colentrybuf[ix + i].ce_taken = true;
+                colentrybuf[ix + i].ce_val = vals[curtuple + i];
+            }
+            curtuple += tuples_tocopy;
+            index += tuples_tocopy;
+            npages++;
+        }
+        file_write_start(col->col_base_file, firstpage, npages, bufs[cur], &ios[cur]);
+        writing[cur] = true;
+        cur = !cur;
+    }
+    result = 0;
+    goto cleanup_writes;
+  cleanup_writes:
+    for (unsigned i = 0; i < 2; i++) {
+        if (writing[i]) {
+            int writeresult = file_io_wait(&ios[i]);
+            if (result == 0) {
+                result = writeresult;
+            }
+        }
+    }
+    free(bufs[0]);
+  done:
+    return result;
+}
+
+// Sorts one batch of a sorted column and writes it to the run file
+static
+int
+column_load_run(struct column_loader *loader, uint64_t first,
+                int *vals, uint64_t num)
+{
+    int result;
+    if (loader->cl_nruns == loader->cl_maxruns) {
+        unsigned maxruns = (loader->cl_maxruns == 0) ? 8 : loader->cl_maxruns * 2;
+        struct load_run *runs;
+        TRYNULL(result, DBENOMEM, runs,
+                realloc(loader->cl_runs, maxruns * sizeof(struct load_run)), done);
+        loader->cl_runs = runs;
+        loader->cl_maxruns = maxruns;
+    }
+    struct column_entry_sorted *entries;
+    TRYNULL(result, DBENOMEM, entries,
+            malloc(num * sizeof(struct column_entry_sorted)), done);
+    for (uint64_t i = 0; i < num; i++) {
+        entries[i].ce_val = vals[i];
+        entries[i].ce_padding = 0;
+        entries[i].ce_index = first + i;
+    }
+    qsort(entries, num, sizeof(struct column_entry_sorted),
+          column_entry_sorted_compare);
+
+    // write the entries out to disk, one page at a time
+    struct load_run *run = &loader->cl_runs[loader->cl_nruns];
+    run->lr_first = file_num_pages(loader->cl_run_file);
+    run->lr_nentries = num;
+    struct column_entry_sorted colentrybuf[COLENTRY_SORTED_PER_PAGE];
+    for (uint64_t curtuple = 0; curtuple < num; curtuple += COLENTRY_SORTED_PER_PAGE) {
+        uint64_t tuples_tocopy = MIN(COLENTRY_SORTED_PER_PAGE, num - curtuple);
+        bzero(colentrybuf, PAGESIZE);
+        memcpy(colentrybuf, entries + curtuple,
+               sizeof(struct column_entry_sorted) * tuples_tocopy);
+        page_t page;
+        TRY(result, file_alloc_page(loader->cl_run_file, &page), cleanup_malloc);
+        assert(page == run->lr_first + curtuple / COLENTRY_SORTED_PER_PAGE);
+        TRY(result, file_write(loader->cl_run_file, page, colentrybuf), cleanup_malloc);
+    }
+    loader->cl_nruns++;
+
+    result = 0;
+    goto cleanup_malloc;
+  cleanup_malloc:
+    free(entries);
+  done:
+    return result;
+}
+
+// A batch for the base file, written on its own thread while the caller
+// builds the index from the same values
+struct load_base_job {
+    struct column *lb_col;
+    uint64_t lb_first;
+    int *lb_vals;
+    uint64_t lb_num;
+    int lb_result;
+};
+
+static
+void *
+column_load_base_routine(void *arg)
+{
+    struct load_base_job *job = arg;
+    job->lb_result = column_load_base(job->lb_col, job->lb_first,
+                                      job->lb_vals, job->lb_num);
+    return NULL;
+}
+
+int
+column_load_append(struct column_loader *loader, int *vals, uint64_t num)
+{
+    assert(loader != NULL);
+    assert(vals != NULL || num == 0);
+    int result;
+    struct column *col = loader->cl_col;
+    uint64_t first = col->col_disk.cd_nexttupleid;
+    if (loader->cl_result != 0 || num == 0) {
+        result = loader->cl_result;
         goto done;
     }
 
-    // TODO: also create index file
-    result = column_load_unsorted(col->col_base_file, vals, num);
+    // we always write the unsorted projection as well
+    // because we use this for fetching. The index only needs the values, so
+    // for an indexed column the base file is written on another thread
+    // while we build the index here.
+    struct load_base_job basejob = { col, first, vals, num, 0 };
+    pthread_t basethread;
+    bool basestarted = false;
+    if (col->col_disk.cd_stype == STORAGE_UNSORTED) {
+        column_load_base_routine(&basejob);
+    } else {
+        basestarted = (pthread_create(&basethread, NULL,
+                                      column_load_base_routine, &basejob) == 0);
+        if (!basestarted) {
+            column_load_base_routine(&basejob);
+        }
+    }
     switch (col->col_disk.cd_stype) {
     case STORAGE_BTREE:
-        result = column_load_index_btree(col, vals, num);
+        // the root page should have been created in storage_add_column
+        assert(col->col_disk.cd_btree_root != BTREE_PAGE_NULL);
+        for (uint64_t i = 0; i < num; i++) {
+            struct btree_entry entry;
+            bzero(&entry, sizeof(struct btree_entry));
+            entry.bte_key = vals[i];
+            entry.bte_index = first + i;
+            TRY(result, btree_insert(col, &entry), join_base);
+        }
+        col->col_disk.cd_ntuples += num;
+        col->col_disk.cd_nexttupleid += num;
         break;
     case STORAGE_SORTED:
-        result = column_load_index_sorted(col->col_index_file, vals, num);
+        TRY(result, column_load_run(loader, first, vals, num), join_base);
         col->col_disk.cd_ntuples += num;
         col->col_disk.cd_nexttupleid += num;
-        col->col_dirty = true;
         break;
     case STORAGE_UNSORTED:
         col->col_disk.cd_ntuples += num;
         col->col_disk.cd_nexttupleid += num;
-        col->col_dirty = true;
         break;
     default:
         assert(0);
         break;
     }
+    result = 0;
+  join_base:
+    if (basestarted) {
+        assert(pthread_join(basethread, NULL) == 0);
+    }
+    result = result ? result : basejob.lb_result;
+    if (result) {
+        loader->cl_result = result;
+        goto done;
+    }
+    col->col_dirty = true;
+
+    // The first batch picks the histogram bounds, later ones only count.
+    // A later one with values past them piles into the outer buckets, and
+    // the histogram is built again when the load finishes.
+    struct column_stats *stats = &col->col_disk.cd_stats;
+    if (stats->cs_nbuckets == 0) {
+        TRY(result, column_stats_build(stats, vals, num), done);
+    } else {
+        int low = stats->cs_bounds[0];
+        int high = stats->cs_max;
+        for (uint64_t i = 0; i < num; i++) {
+            column_stats_add(stats, vals[i]);
+        }
+        if (stats->cs_bounds[0] != low || stats->cs_max != high) {
+            loader->cl_widened = true;
+        }
+    }
+
+    // success
+    result = 0;
+    goto done;
+  done:
+    return result;
+}
+
+// Where a merge is in one run
+struct merge_cursor {
+    struct load_run *mc_run;
+    uint64_t mc_next; // next entry of the run
+    struct column_entry_sorted mc_page[COLENTRY_SORTED_PER_PAGE];
+};
+
+static
+bool
+merge_cursor_less(struct merge_cursor *cursors, unsigned a, unsigned b)
+{
+    struct column_entry_sorted *ea =
+            &cursors[a].mc_page[cursors[a].mc_next % COLENTRY_SORTED_PER_PAGE];
+    struct column_entry_sorted *eb =
+            &cursors[b].mc_page[cursors[b].mc_next % COLENTRY_SORTED_PER_PAGE];
+    // earlier runs hold smaller ids
+    return (ea->ce_val < eb->ce_val) || (ea->ce_val == eb->ce_val && a < b);
+}
+
+// Sifts heap[i] down to its place in the min-heap
+static
+void
+merge_heap_down(struct merge_cursor *cursors, unsigned *heap, unsigned nheap,
+                unsigned i)
+{
+    while (1) {
+        unsigned smallest = i;
+        unsigned l = 2 * i + 1;
+        unsigned r = 2 * i + 2;
+        if (l < nheap && merge_cursor_less(cursors, heap[l], heap[smallest])) {
+            smallest = l;
+        }
+        if (r < nheap && merge_cursor_less(cursors, heap[r], heap[smallest])) {
+            smallest = r;
+        }
+        if (smallest == i) {
+            break;
+        }
+        unsigned tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Merges the sorted runs of the load into the index file
+static
+int
+column_load_merge(struct column_loader *loader)
+{
+    int result;
+    struct column *col = loader->cl_col;
+    unsigned nruns = loader->cl_nruns;
+    struct merge_cursor *cursors;
+    unsigned *heap;
+    if (nruns == 0) {
+        result = 0;
+        goto done;
+    }
+    TRYNULL(result, DBENOMEM, cursors,
+            malloc(nruns * sizeof(struct merge_cursor)), done);
+    TRYNULL(result, DBENOMEM, heap, malloc(nruns * sizeof(unsigned)),
+            cleanup_cursors);
+
+    // every run has at least one entry, so start the heap with all of them
+    for (unsigned i = 0; i < nruns; i++) {
+        cursors[i].mc_run = &loader->cl_runs[i];
+        cursors[i].mc_next = 0;
+        TRY(result, file_read(loader->cl_run_file, cursors[i].mc_run->lr_first,
+                              cursors[i].mc_page), cleanup_heap);
+        heap[i] = i;
+    }
+    unsigned nheap = nruns;
+    for (unsigned i = nheap / 2; i-- > 0; ) {
+        merge_heap_down(cursors, heap, nheap, i);
+    }
+
+    struct column_entry_sorted colentrybuf[COLENTRY_SORTED_PER_PAGE];
+    unsigned nbuf = 0;
+    while (nheap > 0) {
+        struct merge_cursor *c = &cursors[heap[0]];
+        colentrybuf[nbuf++] = c->mc_page[c->mc_next % COLENTRY_SORTED_PER_PAGE];
+        c->mc_next++;
+        if (c->mc_next == c->mc_run->lr_nentries) {
+            heap[0] = heap[--nheap];
+        } else if (c->mc_next % COLENTRY_SORTED_PER_PAGE == 0) {
+            TRY(result, file_read(loader->cl_run_file,
+                                  c->mc_run->lr_first + c->mc_next / COLENTRY_SORTED_PER_PAGE,
+                                  c->mc_page), cleanup_heap);
+        }
+        merge_heap_down(cursors, heap, nheap, 0);
+
+        if (nbuf == COLENTRY_SORTED_PER_PAGE || nheap == 0) {
+            bzero(colentrybuf + nbuf,
+                  sizeof(struct column_entry_sorted) * (COLENTRY_SORTED_PER_PAGE - nbuf));
+            page_t page;
+            TRY(result, file_alloc_page(col->col_index_file, &page), cleanup_heap);
+            TRY(result, file_write(col->col_index_file, page, colentrybuf), cleanup_heap);
+            nbuf = 0;
+        }
+    }
+
+    result = 0;
+    goto cleanup_heap;
+  cleanup_heap:
+    free(heap);
+  cleanup_cursors:
+    free(cursors);
+  done:
+    return result;
+}
+
+// Puts the column back the way column_load_begin found it after a load
+// fails, so that it may be loaded again. The base file is written over by
+// the next load, but the index may hold part of this one, so it starts
+// over in a new file, which replaces the old one once it is ready.
+static
+int
+column_load_rollback(struct column_loader *loader)
+{
+    int result;
+    struct column *col = loader->cl_col;
+    col->col_disk.cd_ntuples = 0;
+    col->col_disk.cd_nexttupleid = loader->cl_nexttupleid;
+    bzero(&col->col_disk.cd_stats, sizeof(struct column_stats));
+    col->col_dirty = true;
+    if (col->col_index_file == NULL) {
+        result = 0;
+        goto done;
+    }
+
+    char filenamebuf[56];
+    char newnamebuf[60];
+    sprintf(filenamebuf, "%s/%s", col->col_storage->st_dbdir,
+            col->col_disk.cd_index_file);
+    sprintf(newnamebuf, "%s.new", filenamebuf);
+    (void) remove(newnamebuf);
+    struct file *newfile;
+    TRYNULL(result, DBEFILE, newfile, file_open(newnamebuf), done);
+    page_t rootpage = BTREE_PAGE_NULL;
+    if (col->col_disk.cd_stype == STORAGE_BTREE) {
+        TRY(result, file_alloc_page(newfile, &rootpage), cleanup_new);
+        struct btree_node root;
+        bzero(&root, sizeof(struct btree_node));
+        root.bt_header.bth_type = BTREE_NODE_LEAF;
+        root.bt_header.bth_next = BTREE_PAGE_NULL;
+        root.bt_header.bth_page = rootpage;
+        root.bt_header.bth_nentries = 0;
+        TRY(result, btree_node_synch(newfile, &root), cleanup_new);
+    }
+    if (rename(newnamebuf, filenamebuf) != 0) {
+        result = DBEFILE;
+        DBLOG(result);
+        goto cleanup_new;
+    }
+    file_close(col->col_index_file);
+    col->col_index_file = newfile;
+    if (col->col_disk.cd_stype == STORAGE_BTREE) {
+        vlatch_write_acquire(&col->col_btree_rootlatch);
+        col->col_disk.cd_btree_root = rootpage;
+        vlatch_write_release(&col->col_btree_rootlatch);
+        col->col_btree_stale = true;
+    }
+
+    // success
+    result = 0;
+    goto done;
+  cleanup_new:
+    file_close(newfile);
+    (void) remove(newnamebuf);
+  done:
+    return result;
+}
+
+int
+column_load_finish(struct column_loader *loader)
+{
+    assert(loader != NULL);
+    int result = loader->cl_result;
+    struct column *col = loader->cl_col;
+    if (loader->cl_run_file != NULL) {
+        // the runs of a failed load are thrown away unmerged
+        if (result == 0) {
+            result = column_load_merge(loader);
+        }
+        file_close(loader->cl_run_file);
+        (void) remove(loader->cl_run_name);
+    }
+    if (result == 0 && loader->cl_widened) {
+        result = column_stats_rebuild(col);
+    }
+    if (result) {
+        int rollbackresult = column_load_rollback(loader);
+        if (rollbackresult) {
+            DBLOG(rollbackresult);
+        }
+    }
+    if (col->col_btree_stale) {
+        btree_inner_load(col);
+    }
+    btree_inner_reclaim(col);
+    free(loader->cl_runs);
+    free(loader);
+    rwlock_release(col->col_rwlock);
+    lock_release(col->col_writer_lock);
+    return result;
+}
+
+int
+column_load(struct column *col, int *vals, uint64_t num)
+{
+    assert(col != NULL);
+    int result;
+    struct column_loader *loader;
+    TRY(result, column_load_begin(col, &loader), done);
+    if (loader == NULL) {
+        goto done;
+    }
+    result = column_load_append(loader, vals, num);
+    int finishresult = column_load_finish(loader);
+    result = result ? result : finishresult;
     goto done;
+  done:
+    return result;
+}
+
+int
+column_live_ids(struct column *col, unsigned nbits, struct column_ids **retids)
+{
+    assert(col != NULL);
+    assert(retids != NULL);
+
+    int result;
+    struct column_ids *cids = NULL;
+    rwlock_acquire_read(col->col_rwlock);
+    if (nbits > col->col_disk.cd_nexttupleid) {
+        result = DBECOLDIFFLEN;
+        DBLOG(result);
+        goto done;
+    }
+    // the live positions are dense unless most tuples were deleted
+    enum column_ids_type type = CID_IDSET;
+    if (col->col_disk.cd_ntuples * 16 >= nbits) {
+        type = CID_BITMAP;
+    }
+    TRYNULL(result, DBENOMEM, cids, column_ids_create(type, nbits), done);
+    // only unsorted columns delete, and without a delete every position
+    // is live
+    if (col->col_disk.cd_stype != STORAGE_UNSORTED
+            || col->col_disk.cd_ntuples == col->col_disk.cd_nexttupleid) {
+        TRY(result, column_ids_add_range(cids, 0, nbits), cleanup_ids);
+        goto success;
+    }
+    struct column_entry_unsorted colentrybuf[COLENTRY_UNSORTED_PER_PAGE];
+    for (unsigned first = 0; first < nbits; first += COLENTRY_UNSORTED_PER_PAGE) {
+        page_t page = FILE_FIRST_PAGE + (first / COLENTRY_UNSORTED_PER_PAGE);
+        TRY(result, file_read(col->col_base_file, page, colentrybuf), cleanup_ids);
+        for (unsigned i = 0; i < COLENTRY_UNSORTED_PER_PAGE && first + i < nbits; i++) {
+            if (colentrybuf[i].ce_taken) {
+                TRY(result, column_ids_add(cids, first + i), cleanup_ids);
+            }
+        }
+    }
+    goto success;
 
+  success:
+    result = 0;
+    *retids = cids;
+    goto done;
+  cleanup_ids:
+    column_ids_destroy(cids);
   done:
     rwlock_release(col->col_rwlock);
     return result;
 }
+
+void
+column_get_stats(struct column *col, struct column_stats *retstats)
+{
+    assert(col != NULL);
+    assert(retstats != NULL);
+    rwlock_acquire_read(col->col_rwlock);
+    *retstats = col->col_disk.cd_stats;
+    rwlock_release(col->col_rwlock);
+}
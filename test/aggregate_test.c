@@ -0,0 +1,163 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <db/common/dberror.h>
+#include <db/server/aggregate.h>
+
+// more than one block of the fused kernels
+#define NVALS 3000
+
+static
+struct column_vals *
+vals_create(unsigned len)
+{
+    struct column_vals *vals = calloc(1, sizeof(struct column_vals));
+    assert(vals != NULL);
+    vals->cval_vals = malloc(sizeof(int) * (len ? len : 1));
+    assert(vals->cval_vals != NULL);
+    vals->cval_len = len;
+    return vals;
+}
+
+static
+void
+vals_destroy(struct column_vals *vals)
+{
+    free(vals->cval_vals);
+    free(vals->cval_ids);
+    free(vals);
+}
+
+static
+int
+aggregate(enum agg_type atype, struct column_vals *vals)
+{
+    struct column_vals *agg;
+    assert(column_agg(vals, agg_func(atype), &agg) == 0);
+    assert(agg->cval_len == 1);
+    int result = agg->cval_vals[0];
+    vals_destroy(agg);
+    return result;
+}
+
+static
+int
+math_aggregate(enum agg_type atype, enum math_type mtype,
+               struct math_operand *left, struct math_operand *right)
+{
+    struct column_vals *agg;
+    assert(column_math_agg(atype, mtype, left, right, &agg) == 0);
+    assert(agg->cval_len == 1);
+    int result = agg->cval_vals[0];
+    vals_destroy(agg);
+    return result;
+}
+
+void testmath(void) {
+    struct column_vals *a = vals_create(NVALS);
+    struct column_vals *b = vals_create(NVALS);
+    for (unsigned i = 0; i < NVALS; i++) {
+        a->cval_vals[i] = i;
+        b->cval_vals[i] = (i % 7) + 1;
+    }
+    struct math_operand left = { .mo_scalar = false, .mo_vals = a };
+    struct math_operand right = { .mo_scalar = false, .mo_vals = b };
+    struct math_operand five = { .mo_scalar = true, .mo_scalar_val = 5 };
+    struct math_operand zero = { .mo_scalar = true, .mo_scalar_val = 0 };
+
+    struct column_vals *out;
+    assert(column_math(MATH_ADD, &left, &right, NULL, &out) == 0);
+    assert(out->cval_len == NVALS);
+    for (unsigned i = 0; i < NVALS; i++) {
+        assert(out->cval_vals[i] == a->cval_vals[i] + b->cval_vals[i]);
+    }
+    // written over the reused intermediate
+    struct column_vals *reused;
+    assert(column_math(MATH_SUB, &five, &left, out, &reused) == 0);
+    assert(reused == out);
+    for (unsigned i = 0; i < NVALS; i++) {
+        assert(out->cval_vals[i] == 5 - a->cval_vals[i]);
+    }
+    assert(column_math(MATH_DIV, &left, &five, out, &reused) == 0);
+    for (unsigned i = 0; i < NVALS; i++) {
+        assert(out->cval_vals[i] == a->cval_vals[i] / 5);
+    }
+    vals_destroy(out);
+
+    // a zero divisor anywhere, and two scalars, are rejected
+    assert(column_math(MATH_DIV, &left, &zero, NULL, &out) == DBEDIVZERO);
+    assert(column_math(MATH_DIV, &right, &left, NULL, &out) == DBEDIVZERO);
+    assert(column_math(MATH_ADD, &five, &zero, NULL, &out) == DBEVARTYPE);
+    struct column_vals *shorter = vals_create(NVALS - 1);
+    struct math_operand other = { .mo_scalar = false, .mo_vals = shorter };
+    assert(column_math(MATH_ADD, &left, &other, NULL, &out) == DBEINTERMDIFFLEN);
+    vals_destroy(shorter);
+
+    // the fused aggregates match aggregating the materialized math
+    enum agg_type atypes[] = { AGG_MIN, AGG_MAX, AGG_SUM, AGG_AVG, AGG_COUNT };
+    enum math_type mtypes[] = { MATH_ADD, MATH_SUB, MATH_MUL, MATH_DIV };
+    for (unsigned m = 0; m < sizeof(mtypes) / sizeof(mtypes[0]); m++) {
+        assert(column_math(mtypes[m], &left, &right, NULL, &out) == 0);
+        for (unsigned t = 0; t < sizeof(atypes) / sizeof(atypes[0]); t++) {
+            assert(math_aggregate(atypes[t], mtypes[m], &left, &right)
+                   == aggregate(atypes[t], out));
+        }
+        vals_destroy(out);
+    }
+    vals_destroy(a);
+    vals_destroy(b);
+}
+
+void testempty(void) {
+    struct column_vals *empty = vals_create(0);
+    assert(aggregate(AGG_MIN, empty) == INT_MAX);
+    assert(aggregate(AGG_MAX, empty) == INT_MIN);
+    assert(aggregate(AGG_SUM, empty) == 0);
+    assert(aggregate(AGG_COUNT, empty) == 0);
+    struct column_vals *agg;
+    assert(column_agg(empty, agg_avg, &agg) == DBEDIVZERO);
+
+    struct math_operand left = { .mo_scalar = false, .mo_vals = empty };
+    struct math_operand one = { .mo_scalar = true, .mo_scalar_val = 1 };
+    assert(math_aggregate(AGG_SUM, MATH_ADD, &left, &one) == 0);
+    assert(math_aggregate(AGG_COUNT, MATH_ADD, &left, &one) == 0);
+    assert(math_aggregate(AGG_MIN, MATH_ADD, &left, &one) == INT_MAX);
+    assert(column_math_agg(AGG_AVG, MATH_ADD, &left, &one, &agg) == DBEDIVZERO);
+
+    struct column_vals *out;
+    assert(column_math(MATH_MUL, &left, &one, NULL, &out) == 0);
+    assert(out->cval_len == 0);
+    vals_destroy(out);
+    vals_destroy(empty);
+}
+
+void testoverflow(void) {
+    // the sums go past an int on the way, and are summed in 64 bits
+    struct column_vals *vals = vals_create(NVALS);
+    for (unsigned i = 0; i < NVALS; i++) {
+        vals->cval_vals[i] = INT_MAX - (i % 2);
+    }
+    assert(aggregate(AGG_AVG, vals) == INT_MAX - 1);
+    for (unsigned i = 0; i < NVALS; i++) {
+        vals->cval_vals[i] = (i < NVALS / 2) ? INT_MAX : -INT_MAX;
+    }
+    assert(aggregate(AGG_SUM, vals) == 0);
+    assert(aggregate(AGG_AVG, vals) == 0);
+
+    struct math_operand left = { .mo_scalar = false, .mo_vals = vals };
+    struct math_operand zero = { .mo_scalar = true, .mo_scalar_val = 0 };
+    assert(math_aggregate(AGG_SUM, MATH_ADD, &left, &zero) == 0);
+    for (unsigned i = 0; i < NVALS; i++) {
+        vals->cval_vals[i] = INT_MAX;
+    }
+    assert(math_aggregate(AGG_AVG, MATH_ADD, &left, &zero) == INT_MAX);
+    assert(math_aggregate(AGG_AVG, MATH_SUB, &zero, &left) == -INT_MAX);
+    assert(aggregate(AGG_AVG, vals) == INT_MAX);
+    vals_destroy(vals);
+}
+
+int main(void) {
+    testmath();
+    testempty();
+    testoverflow();
+}
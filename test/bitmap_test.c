@@ -0,0 +1,125 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <db/common/bitmap.h>
+
+// a few 64-bit chunks and a partial byte
+#define NBITS (3 * 64 + 13)
+
+// the first set bit at or after start, by bitmap_isset
+static
+unsigned
+next_set(struct bitmap *b, unsigned start)
+{
+    while (start < bitmap_nbits(b) && !bitmap_isset(b, start)) {
+        start++;
+    }
+    return start;
+}
+
+void testpadding(void) {
+    // the unused bits of the last byte are marked in use, and must not
+    // be counted or found
+    struct bitmap *b = bitmap_create(NBITS);
+    assert(b != NULL);
+    assert(bitmap_count(b) == 0);
+    unsigned index;
+    assert(!bitmap_next_set(b, 0, &index));
+    assert(index == NBITS);
+    bitmap_mark(b, NBITS - 1);
+    assert(bitmap_count(b) == 1);
+    assert(bitmap_next_set(b, 0, &index) && index == NBITS - 1);
+    assert(bitmap_next_set(b, NBITS - 1, &index) && index == NBITS - 1);
+    unsigned buf[8];
+    unsigned start = 0;
+    assert(bitmap_extract(b, &start, buf, 8) == 1);
+    assert(buf[0] == NBITS - 1);
+    assert(start == NBITS);
+    assert(bitmap_extract(b, &start, buf, 8) == 0);
+
+    // all of them set, and then none again
+    bitmap_invert(b);
+    assert(bitmap_count(b) == NBITS - 1);
+    bitmap_unmark(b, 0);
+    bitmap_mark(b, NBITS - 1);
+    assert(bitmap_count(b) == NBITS - 1);
+    assert(bitmap_next_set(b, 0, &index) && index == 1);
+    start = 0;
+    unsigned total = 0;
+    unsigned n;
+    while ((n = bitmap_extract(b, &start, buf, 8)) > 0) {
+        assert(buf[n - 1] < NBITS);
+        total += n;
+    }
+    assert(total == NBITS - 1);
+    bitmap_invert(b);
+    assert(bitmap_count(b) == 1);
+    assert(bitmap_next_set(b, 0, &index) && index == 0);
+    assert(!bitmap_next_set(b, 1, &index));
+    bitmap_destroy(b);
+}
+
+void testempty(void) {
+    struct bitmap *b = bitmap_create(0);
+    assert(b != NULL);
+    assert(bitmap_count(b) == 0);
+    unsigned index;
+    assert(!bitmap_next_set(b, 0, &index));
+    assert(index == 0);
+    unsigned buf[1];
+    unsigned start = 0;
+    assert(bitmap_extract(b, &start, buf, 1) == 0);
+    assert(start == 0);
+    bitmap_destroy(b);
+}
+
+void testresume(void) {
+    // a bit set every third, extracted in batches that end inside a
+    // chunk, on a chunk boundary, and past the last bit
+    struct bitmap *b = bitmap_create(NBITS);
+    assert(b != NULL);
+    for (unsigned i = 0; i < NBITS; i += 3) {
+        bitmap_mark(b, i);
+    }
+    for (unsigned i = 0; i <= NBITS; i++) {
+        unsigned index;
+        bool found = bitmap_next_set(b, i, &index);
+        assert(index == next_set(b, i));
+        assert(found == (index < NBITS));
+    }
+    unsigned batches[] = { 1, 5, 21, 22, 64, NBITS };
+    for (unsigned k = 0; k < sizeof(batches) / sizeof(batches[0]); k++) {
+        unsigned *buf = malloc(sizeof(unsigned) * batches[k]);
+        assert(buf != NULL);
+        unsigned start = 0;
+        unsigned expect = 0;
+        unsigned n;
+        while ((n = bitmap_extract(b, &start, buf, batches[k])) > 0) {
+            assert(n <= batches[k]);
+            for (unsigned i = 0; i < n; i++) {
+                assert(buf[i] == expect);
+                expect += 3;
+            }
+            // start is left past the last one, and not past the next
+            assert(start > buf[n - 1]);
+            assert(start <= next_set(b, buf[n - 1] + 1));
+        }
+        assert(expect >= NBITS);
+        assert(start == NBITS);
+        free(buf);
+    }
+
+    // starting part way through a chunk
+    unsigned buf[4];
+    unsigned start = 65;
+    assert(bitmap_extract(b, &start, buf, 4) == 4);
+    assert(buf[0] == 66 && buf[3] == 75);
+    assert(start == 78);
+    bitmap_destroy(b);
+}
+
+int main(void) {
+    testpadding();
+    testempty();
+    testresume();
+}
@@ -0,0 +1,152 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <db/common/csv.h>
+
+#define NROWS 300000
+
+static
+int
+writefile(char *path, char *contents)
+{
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, S_IRWXU);
+    assert(fd != -1);
+    assert(write(fd, contents, strlen(contents)) == (ssize_t) strlen(contents));
+    return fd;
+}
+
+void testformat(void) {
+    char path[] = "csv_test.format.tmp";
+    int fd = writefile(path,
+            "a,b,c\r\n"
+            "1,-2,3\r\n"
+            "\n"
+            " 42, +7,1234567890\n"
+            "5\n"
+            "-2147483648,2147483647,9,10\n"
+            "123456789,12345678,x1");
+    struct csv_table *table = csv_parse(fd);
+    assert(table != NULL);
+    assert(table->csv_ncols == 3);
+    assert(strcmp(table->csv_cols[0].csv_colname, "a") == 0);
+    assert(strcmp(table->csv_cols[1].csv_colname, "b") == 0);
+    assert(strcmp(table->csv_cols[2].csv_colname, "c") == 0);
+    assert(table->csv_nrows == 5);
+
+    int a[] = {1, 42, 5, -2147483647 - 1, 123456789};
+    int b[] = {-2, 7, 0, 2147483647, 12345678};
+    int c[] = {3, 1234567890, 0, 9, 0};
+    for (unsigned i = 0; i < 5; i++) {
+        assert(table->csv_cols[0].csv_vals[i] == a[i]);
+        assert(table->csv_cols[1].csv_vals[i] == b[i]);
+        assert(table->csv_cols[2].csv_vals[i] == c[i]);
+    }
+    csv_destroy(table);
+    unlink(path);
+}
+
+void testparallel(void) {
+    // large enough to be split between threads
+    char path[] = "csv_test.parallel.tmp";
+    FILE *file = fopen(path, "w");
+    assert(file != NULL);
+    fprintf(file, "x,y\n");
+    for (int i = 0; i < NROWS; i++) {
+        fprintf(file, "%d,%d\n", i, -7 * i);
+    }
+    assert(fclose(file) == 0);
+
+    int fd = open(path, O_RDONLY);
+    assert(fd != -1);
+    struct csv_table *table = csv_parse(fd);
+    assert(table != NULL);
+    assert(table->csv_ncols == 2);
+    assert(table->csv_nrows == NROWS);
+    for (int i = 0; i < NROWS; i++) {
+        assert(table->csv_cols[0].csv_vals[i] == i);
+        assert(table->csv_cols[1].csv_vals[i] == -7 * i);
+    }
+    csv_destroy(table);
+    unlink(path);
+}
+
+void testnoheader(void) {
+    char path[] = "csv_test.noheader.tmp";
+    int fd = writefile(path, "a,b");
+    assert(csv_parse(fd) == NULL);
+    unlink(path);
+}
+
+// Feeds contents to a stream at most step bytes at a time, and checks that
+// column x counts up from 0 and y is -x.
+static
+void
+streamfile(char *contents, size_t bufsize, size_t step, uint64_t nrows)
+{
+    struct csv_stream *stream = csv_stream_create(bufsize);
+    assert(stream != NULL);
+    size_t total = strlen(contents);
+    size_t off = 0;
+    uint64_t seen = 0;
+    while (true) {
+        size_t len;
+        char *buf = csv_stream_buf(stream, &len);
+        assert(buf != NULL);
+        len = (len < step) ? len : step;
+        len = (len < total - off) ? len : total - off;
+        memcpy(buf, contents + off, len);
+        off += len;
+        struct csv_table *table;
+        assert(csv_stream_parse(stream, len, off == total, &table) == 0);
+        if (table != NULL) {
+            assert(table->csv_ncols == 2);
+            assert(strcmp(table->csv_cols[0].csv_colname, "x") == 0);
+            for (uint64_t i = 0; i < table->csv_nrows; i++) {
+                assert(table->csv_cols[0].csv_vals[i] == (int) (seen + i));
+                assert(table->csv_cols[1].csv_vals[i] == -(int) (seen + i));
+            }
+            seen += table->csv_nrows;
+        }
+        if (off == total) {
+            break;
+        }
+    }
+    assert(seen == nrows);
+    csv_stream_destroy(stream);
+}
+
+void teststream(void) {
+    char contents[64 + 32 * 1000];
+    char *p = contents;
+    p += sprintf(p, "x,y\n");
+    for (int i = 0; i < 1000; i++) {
+        p += sprintf(p, "%d,%d\n", i, -i);
+    }
+    // lines split between pieces, and a last line without a newline
+    streamfile(contents, 4096, 7, 1000);
+    streamfile(contents, 4096, 4096, 1000);
+    p[-1] = '\0';
+    streamfile(contents, 64, 13, 1000);
+    // a buffer smaller than one line has to grow
+    streamfile(contents, 2, 2, 1000);
+
+    // the header never arrives
+    struct csv_stream *stream = csv_stream_create(16);
+    size_t len;
+    char *buf = csv_stream_buf(stream, &len);
+    memcpy(buf, "a,b", 3);
+    struct csv_table *table;
+    assert(csv_stream_parse(stream, 3, true, &table) != 0);
+    assert(table == NULL);
+    csv_stream_destroy(stream);
+}
+
+int main(void) {
+    testformat();
+    testparallel();
+    testnoheader();
+    teststream();
+}
@@ -0,0 +1,82 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <db/server/file.h>
+
+#define TESTFILE "file_test.tmp"
+#define NPAGES 64
+#define NIOS 16
+
+static char pages[NPAGES][PAGESIZE];
+
+// Writes and reads the pages back with more ios in flight than the queue
+// depth, so that starting one has to wait for another to finish
+static
+void
+checkio(unsigned depth)
+{
+    file_set_queue_depth(depth);
+    unlink(TESTFILE);
+    struct file *f = file_open(TESTFILE);
+    assert(f != NULL);
+    for (unsigned i = 0; i < NPAGES; i++) {
+        page_t page;
+        assert(file_alloc_page(f, &page) == 0);
+        assert(page == FILE_FIRST_PAGE + i);
+        memset(pages[i], 'a' + (i + depth) % 26, PAGESIZE);
+    }
+
+    struct file_io ios[NIOS];
+    unsigned per = NPAGES / NIOS;
+    for (unsigned i = 0; i < NIOS; i++) {
+        file_write_start(f, FILE_FIRST_PAGE + i * per, per, pages[i * per], &ios[i]);
+    }
+    for (unsigned i = 0; i < NIOS; i++) {
+        assert(file_io_wait(&ios[i]) == 0);
+    }
+
+    char (*buf)[PAGESIZE] = malloc(NPAGES * PAGESIZE);
+    assert(buf != NULL);
+    bzero(buf, NPAGES * PAGESIZE);
+    // waited for out of order
+    for (unsigned i = 0; i < NIOS; i++) {
+        file_read_start(f, FILE_FIRST_PAGE + i * per, per, buf[i * per], &ios[i]);
+    }
+    for (unsigned i = NIOS; i > 0; i--) {
+        assert(file_io_wait(&ios[i - 1]) == 0);
+    }
+    assert(memcmp(buf, pages, NPAGES * PAGESIZE) == 0);
+
+    // and matches what a plain read sees
+    char page[PAGESIZE];
+    assert(file_read(f, FILE_FIRST_PAGE + NPAGES - 1, page) == 0);
+    assert(memcmp(page, pages[NPAGES - 1], PAGESIZE) == 0);
+#ifdef RWF_NOWAIT
+    // just written, so in the page cache, and nothing past the end is
+    assert(file_page_cached(f, FILE_FIRST_PAGE));
+    assert(file_page_cached(f, FILE_FIRST_PAGE + NPAGES - 1));
+#endif
+    assert(!file_page_cached(f, FILE_FIRST_PAGE + NPAGES));
+
+    free(buf);
+    file_close(f);
+    unlink(TESTFILE);
+}
+
+void testsync(void) {
+    checkio(0);
+}
+
+void testring(void) {
+    checkio(4);
+    checkio(64);
+}
+
+int main(void) {
+    testsync();
+    testring();
+    file_set_queue_depth(0);
+}
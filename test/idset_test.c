@@ -0,0 +1,130 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <db/common/idset.h>
+
+#define NBITS (5 * 65536 + 123)
+
+// builds an idset and a plain bool array holding the same ids
+static
+struct idset *
+build(bool *ref, unsigned seed, unsigned sparse, unsigned dense, unsigned run)
+{
+    struct idset *set = idset_create(NBITS);
+    assert(set != NULL);
+    srand(seed);
+    for (unsigned i = 0; i < NBITS; i++) {
+        ref[i] = false;
+    }
+    // chunk 0 is sparse, chunk 1 is dense, chunk 2 holds a run and the
+    // last chunk is partial
+    for (unsigned i = 0; i < sparse; i++) {
+        unsigned id = rand() % 65536;
+        assert(idset_add(set, id) == 0);
+        ref[id] = true;
+    }
+    for (unsigned i = 0; i < dense; i++) {
+        unsigned id = 65536 + rand() % 65536;
+        assert(idset_add(set, id) == 0);
+        ref[id] = true;
+    }
+    assert(idset_add_range(set, 2 * 65536 + run, 3 * 65536 + run) == 0);
+    for (unsigned i = 2 * 65536 + run; i < 3 * 65536 + run; i++) {
+        ref[i] = true;
+    }
+    assert(idset_add(set, NBITS - 1) == 0);
+    ref[NBITS - 1] = true;
+    return set;
+}
+
+static
+void
+check(struct idset *set, bool *ref)
+{
+    unsigned count = 0;
+    for (unsigned i = 0; i < NBITS; i++) {
+        assert(idset_contains(set, i) == ref[i]);
+        count += ref[i];
+    }
+    assert(idset_count(set) == count);
+
+    // extract in odd sized batches to cross container boundaries
+    unsigned buf[1000];
+    unsigned start = 0;
+    unsigned n;
+    unsigned expected = 0;
+    unsigned seen = 0;
+    while ((n = idset_extract(set, &start, buf, 1000)) > 0) {
+        for (unsigned i = 0; i < n; i++) {
+            while (!ref[expected]) {
+                expected++;
+            }
+            assert(buf[i] == expected);
+            expected++;
+            seen++;
+        }
+    }
+    assert(seen == count);
+    assert(start == NBITS);
+}
+
+void testaddextract(void) {
+    bool *ref = malloc(NBITS);
+    struct idset *set = build(ref, 1, 1000, 30000, 7);
+    check(set, ref);
+    // adding again does not change anything
+    assert(idset_add(set, NBITS - 1) == 0);
+    check(set, ref);
+    assert(idset_optimize(set) == 0);
+    check(set, ref);
+
+    unsigned index;
+    assert(idset_next_set(set, 3 * 65536 + 7, &index));
+    assert(index == NBITS - 1);
+    assert(!idset_next_set(set, NBITS, &index));
+    idset_destroy(set);
+    free(ref);
+}
+
+void testsetops(void) {
+    bool *refa = malloc(NBITS);
+    bool *refb = malloc(NBITS);
+    bool *ref = malloc(NBITS);
+    struct idset *a = build(refa, 2, 3000, 40000, 100);
+    struct idset *b = build(refb, 3, 3000, 2000, 40000);
+    assert(idset_optimize(a) == 0);
+
+    struct idset *c;
+    assert(idset_and(a, b, &c) == 0);
+    for (unsigned i = 0; i < NBITS; i++) {
+        ref[i] = refa[i] && refb[i];
+    }
+    check(c, ref);
+    idset_destroy(c);
+
+    assert(idset_or(a, b, &c) == 0);
+    for (unsigned i = 0; i < NBITS; i++) {
+        ref[i] = refa[i] || refb[i];
+    }
+    check(c, ref);
+    idset_destroy(c);
+
+    assert(idset_andnot(a, b, &c) == 0);
+    for (unsigned i = 0; i < NBITS; i++) {
+        ref[i] = refa[i] && !refb[i];
+    }
+    check(c, ref);
+    idset_destroy(c);
+
+    idset_destroy(a);
+    idset_destroy(b);
+    free(refa);
+    free(refb);
+    free(ref);
+}
+
+int main(void) {
+    testaddextract();
+    testsetops();
+}
@@ -87,8 +87,32 @@ void test_iter(void) {
     numlist_destroy(lst);
 }
 
+void test_remove(void) {
+    struct numlist *lst = numlist_create();
+    assert(lst != NULL);
+    struct num nums[4] = { { .n = 5 }, { .n = 6 }, { .n = 7 }, { .n = 8 } };
+    for (unsigned i = 0; i < 4; i++) {
+        assert(numlist_addtail(lst, &nums[i]) == 0);
+    }
+    // from the middle, then each end
+    struct numlistnode *node = numlist_next(numlist_iterhead(lst));
+    assert(numlist_remove(lst, node) == &nums[1]);
+    assert(numlist_size(lst) == 3);
+    assert(numlist_remove(lst, numlist_itertail(lst)) == &nums[3]);
+    assert(numlist_remove(lst, numlist_iterhead(lst)) == &nums[0]);
+    assert(numlist_size(lst) == 1);
+    assert(numlist_gethead(lst) == &nums[2] && numlist_gettail(lst) == &nums[2]);
+    assert(numlist_remove(lst, numlist_iterhead(lst)) == &nums[2]);
+    assert(numlist_iterhead(lst) == NULL);
+    // and the list still works
+    assert(numlist_addhead(lst, &nums[0]) == 0);
+    assert(numlist_remtail(lst) == &nums[0]);
+    numlist_destroy(lst);
+}
+
 int main(void) {
     test_head();
     test_tail();
     test_iter();
+    test_remove();
 }
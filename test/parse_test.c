@@ -614,6 +614,76 @@ void testhashjoin(void) {
     parse_cleanup_ops(ops);
 }
 
+void testautojoin(void) {
+    char *query = "r,s=join(a,b)";
+    struct oparray *ops = parse_query(query);
+    assert(oparray_num(ops) == 1);
+    struct op *op = oparray_get(ops, 0);
+    assert(op->op_type == OP_JOIN);
+    assert(op->op_join.op_join_jtype == JOIN_AUTO);
+    assert(strcmp(op->op_join.op_join_varL,"r") == 0);
+    assert(strcmp(op->op_join.op_join_varR,"s") == 0);
+    assert(strcmp(op->op_join.op_join_inputL,"a") == 0);
+    assert(strcmp(op->op_join.op_join_inputR,"b") == 0);
+    char *s = op_string(op);
+    assert(strcmp(query, s) == 0);
+    free(s);
+    parse_cleanup_ops(ops);
+}
+
+void testaddscalar(void) {
+    char *query = "x=add(aout,-5)";
+    struct oparray *ops = parse_query(query);
+    assert(oparray_num(ops) == 1);
+    struct op *op = oparray_get(ops, 0);
+    assert(op->op_type == OP_MATH);
+    assert(op->op_math.op_math_mtype == MATH_ADD);
+    assert(strcmp(op->op_math.op_math_col1,"aout") == 0);
+    assert(strcmp(op->op_math.op_math_col2,"-5") == 0);
+    assert(op->op_math.op_math_assign == true);
+    char *s = op_string(op);
+    assert(strcmp(query, s) == 0);
+    free(s);
+    parse_cleanup_ops(ops);
+}
+
+void testsummulassign(void) {
+    char *query = "x=sum(mul(aout,bout))";
+    struct oparray *ops = parse_query(query);
+    assert(oparray_num(ops) == 1);
+    struct op *op = oparray_get(ops, 0);
+    assert(op->op_type == OP_AGG);
+    assert(op->op_agg.op_agg_atype == AGG_SUM);
+    assert(op->op_agg.op_agg_math == true);
+    assert(op->op_agg.op_agg_mtype == MATH_MUL);
+    assert(strcmp(op->op_agg.op_agg_col,"aout") == 0);
+    assert(strcmp(op->op_agg.op_agg_col2,"bout") == 0);
+    assert(op->op_agg.op_agg_assign == true);
+    assert(strcmp(op->op_agg.op_agg_var,"x") == 0);
+    char *s = op_string(op);
+    assert(strcmp(query, s) == 0);
+    free(s);
+    parse_cleanup_ops(ops);
+}
+
+void testmaxsub(void) {
+    char *query = "max(sub(aout,3))";
+    struct oparray *ops = parse_query(query);
+    assert(oparray_num(ops) == 1);
+    struct op *op = oparray_get(ops, 0);
+    assert(op->op_type == OP_AGG);
+    assert(op->op_agg.op_agg_atype == AGG_MAX);
+    assert(op->op_agg.op_agg_math == true);
+    assert(op->op_agg.op_agg_mtype == MATH_SUB);
+    assert(strcmp(op->op_agg.op_agg_col,"aout") == 0);
+    assert(strcmp(op->op_agg.op_agg_col2,"3") == 0);
+    assert(op->op_agg.op_agg_assign == false);
+    char *s = op_string(op);
+    assert(strcmp(query, s) == 0);
+    free(s);
+    parse_cleanup_ops(ops);
+}
+
 void testbad(void) {
     char *query = "";
     struct oparray *ops = parse_query(query);
@@ -621,6 +691,51 @@ void testbad(void) {
     parse_cleanup_ops(ops);
 }
 
+static
+void
+checkerror(char *line, unsigned pos)
+{
+    struct parse_error err;
+    assert(parse_line_err(line, &err) == NULL);
+    assert(err.pe_pos == pos);
+    assert(err.pe_msg != NULL);
+}
+
+void testerrors(void) {
+    checkerror("foo(a)", 0);
+    checkerror("x=select(C,a,5)", 11);
+    checkerror("select(C,1,2,3,4)", 15);
+    checkerror("select(C,-1)", 9);
+    checkerror("select(C,4294967296)", 9);
+    checkerror("print(a))", 8);
+    checkerror("x=print(a)", 2);
+    checkerror("x=join(a,b)", 2);
+    checkerror("create(a,\"foo\")", 10);
+    checkerror("load(x.csv)", 5);
+    checkerror("x=sum(foo(a,b))", 6);
+    checkerror("x=add(a)", 7);
+    checkerror("insert()", 7);
+
+    // the failing line of a query is reported as well
+    struct parse_error err;
+    assert(parse_query_err("s=select(C)\nfetch(D)", &err) == NULL);
+    assert(err.pe_line == 1);
+    assert(err.pe_pos == 7);
+}
+
+void testlongname(void) {
+    char line[2 * COLUMNLEN];
+    memset(line, 'a', sizeof(line));
+    memcpy(line, "print(", 6);
+    strcpy(line + COLUMNLEN + 6, ")");
+    checkerror(line, 6);
+    strcpy(line + COLUMNLEN - 1 + 6, ")");
+    struct op *op = parse_line(line);
+    assert(op != NULL);
+    assert(strlen(op->op_print.op_print_var) == COLUMNLEN - 1);
+    free(op);
+}
+
 void testmultiple(void) {
     char *s;
     struct op *op;
@@ -649,6 +764,69 @@ void testmultiple(void) {
     parse_cleanup_ops(ops);
 }
 
+void testselectwithin(void) {
+    char *query = "s2=select(s1,C,14,20)";
+    struct oparray *ops = parse_query(query);
+    assert(oparray_num(ops) == 1);
+    struct op *op = oparray_get(ops, 0);
+    assert(op->op_type == OP_SELECT_RANGE_ASSIGN);
+    assert(strcmp(op->op_select.op_sel_var,"s2") == 0);
+    assert(strcmp(op->op_select.op_sel_pos,"s1") == 0);
+    assert(strcmp(op->op_select.op_sel_col,"C") == 0);
+    assert(op->op_select.op_sel_low == 14);
+    assert(op->op_select.op_sel_high == 20);
+    char *s = op_string(op);
+    assert(strcmp(query, s) == 0);
+    free(s);
+    parse_cleanup_ops(ops);
+}
+
+void testandassign(void) {
+    char *query = "s3=and(s1,s2)";
+    struct oparray *ops = parse_query(query);
+    assert(oparray_num(ops) == 1);
+    struct op *op = oparray_get(ops, 0);
+    assert(op->op_type == OP_SET);
+    assert(op->op_set.op_set_stype == SET_AND);
+    assert(op->op_set.op_set_assign);
+    assert(strcmp(op->op_set.op_set_var,"s3") == 0);
+    assert(strcmp(op->op_set.op_set_ids1,"s1") == 0);
+    assert(strcmp(op->op_set.op_set_ids2,"s2") == 0);
+    char *s = op_string(op);
+    assert(strcmp(query, s) == 0);
+    free(s);
+    parse_cleanup_ops(ops);
+}
+
+void testnot(void) {
+    char *query = "not(s1)";
+    struct oparray *ops = parse_query(query);
+    assert(oparray_num(ops) == 1);
+    struct op *op = oparray_get(ops, 0);
+    assert(op->op_type == OP_SET);
+    assert(op->op_set.op_set_stype == SET_NOT);
+    assert(!op->op_set.op_set_assign);
+    assert(strcmp(op->op_set.op_set_ids1,"s1") == 0);
+    char *s = op_string(op);
+    assert(strcmp(query, s) == 0);
+    free(s);
+    parse_cleanup_ops(ops);
+}
+
+void testbatch(void) {
+    char *query = "batch_queries()\ns1=select(a,1,5)\nbatch_execute()";
+    struct oparray *ops = parse_query(query);
+    assert(oparray_num(ops) == 3);
+    assert(oparray_get(ops, 0)->op_type == OP_BATCH_QUERIES);
+    assert(oparray_get(ops, 2)->op_type == OP_BATCH_EXECUTE);
+    char *s = op_string(oparray_get(ops, 2));
+    assert(strcmp(s, "batch_execute()") == 0);
+    free(s);
+    parse_cleanup_ops(ops);
+    assert(parse_query("batch_queries(a)") == NULL);
+    assert(parse_query("b=batch_execute()") == NULL);
+}
+
 int main(void) {
     testbad();
     testselectall();
@@ -687,9 +865,19 @@ int main(void) {
     testmulassign();
     testdiv();
     testdivassign();
+    testaddscalar();
+    testsummulassign();
+    testmaxsub();
     testprint();
     testloopjoin();
     testsortjoin();
     testtreejoin();
     testhashjoin();
+    testautojoin();
+    testselectwithin();
+    testandassign();
+    testnot();
+    testerrors();
+    testlongname();
+    testbatch();
 }
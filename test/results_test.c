@@ -0,0 +1,239 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <db/common/dberror.h>
+#include <db/common/results.h>
+
+// more than one idset chunk, and a partial last byte
+#define NBITS (65536 + 1000 + 5)
+
+static
+struct column_ids *
+cids_array_create(void)
+{
+    struct column_ids *cids = malloc(sizeof(struct column_ids));
+    assert(cids != NULL);
+    cids->cid_type = CID_ARRAY;
+    cids->cid_col[0] = '\0';
+    cids->cid_index_col[0] = '\0';
+    cids->cid_array = idarray_create();
+    assert(cids->cid_array != NULL);
+    return cids;
+}
+
+static
+void
+cids_array_add(struct column_ids *cids, unsigned id)
+{
+    assert(idarray_add(cids->cid_array, (void *) (uintptr_t) id, NULL) == 0);
+}
+
+// Drains the iterator in batches of n, and checks it returns expect
+static
+void
+checkbatches(struct column_ids *cids, unsigned *expect, unsigned nexpect, unsigned n)
+{
+    unsigned *buf = malloc(sizeof(unsigned) * n);
+    assert(buf != NULL);
+    struct cid_iterator iter;
+    cid_iter_init(&iter, cids);
+    unsigned got = 0;
+    unsigned count;
+    while ((count = cid_iter_next_batch(&iter, buf, n)) > 0) {
+        assert(count <= n);
+        for (unsigned i = 0; i < count; i++) {
+            assert(got < nexpect);
+            assert(buf[i] == expect[got++]);
+        }
+    }
+    assert(got == nexpect);
+    assert(cid_iter_next_batch(&iter, buf, n) == 0);
+    cid_iter_cleanup(&iter);
+    free(buf);
+}
+
+void testbatch(void) {
+    unsigned nexpect = 0;
+    unsigned *expect = malloc(sizeof(unsigned) * NBITS);
+    assert(expect != NULL);
+    for (unsigned i = 0; i < NBITS; i += (i < 2000) ? 1 : 97) {
+        expect[nexpect++] = i;
+    }
+    expect[nexpect++] = NBITS - 1;
+
+    struct column_ids *bitmap = column_ids_create(CID_BITMAP, NBITS);
+    struct column_ids *idset = column_ids_create(CID_IDSET, NBITS);
+    struct column_ids *array = cids_array_create();
+    assert(bitmap != NULL && idset != NULL);
+    for (unsigned i = 0; i < nexpect; i++) {
+        assert(column_ids_add(bitmap, expect[i]) == 0);
+        assert(column_ids_add(idset, expect[i]) == 0);
+        cids_array_add(array, expect[i]);
+    }
+    unsigned batches[] = { 1, 7, 64, CID_BATCH, NBITS };
+    for (unsigned k = 0; k < sizeof(batches) / sizeof(batches[0]); k++) {
+        checkbatches(bitmap, expect, nexpect, batches[k]);
+        checkbatches(idset, expect, nexpect, batches[k]);
+        checkbatches(array, expect, nexpect, batches[k]);
+    }
+    // an array keeps its order and duplicates
+    struct column_ids *unordered = cids_array_create();
+    unsigned ids[] = { 9, 3, 3, NBITS + 7, 0 };
+    for (unsigned i = 0; i < 5; i++) {
+        cids_array_add(unordered, ids[i]);
+    }
+    checkbatches(unordered, ids, 5, 2);
+    column_ids_destroy(unordered);
+
+    // and nothing from empty ones
+    column_ids_destroy(bitmap);
+    column_ids_destroy(idset);
+    column_ids_destroy(array);
+    bitmap = column_ids_create(CID_BITMAP, NBITS);
+    idset = column_ids_create(CID_IDSET, NBITS);
+    array = cids_array_create();
+    checkbatches(bitmap, NULL, 0, CID_BATCH);
+    checkbatches(idset, NULL, 0, CID_BATCH);
+    checkbatches(array, NULL, 0, CID_BATCH);
+    column_ids_destroy(bitmap);
+    column_ids_destroy(idset);
+    column_ids_destroy(array);
+    free(expect);
+}
+
+// The ids of ref as each type of column_ids
+static
+void
+build(bool *ref, struct column_ids **cids)
+{
+    cids[CID_BITMAP] = column_ids_create(CID_BITMAP, NBITS);
+    cids[CID_IDSET] = column_ids_create(CID_IDSET, NBITS);
+    cids[CID_ARRAY] = cids_array_create();
+    assert(cids[CID_BITMAP] != NULL && cids[CID_IDSET] != NULL);
+    for (unsigned i = 0; i < NBITS; i++) {
+        if (ref[i]) {
+            assert(column_ids_add(cids[CID_BITMAP], i) == 0);
+            assert(column_ids_add(cids[CID_IDSET], i) == 0);
+            // arrays are unordered and may repeat ids
+            cids_array_add(cids[CID_ARRAY], i);
+            if (i % 5 == 0) {
+                cids_array_add(cids[CID_ARRAY], i);
+            }
+        }
+    }
+}
+
+static
+void
+checkset(struct column_ids *cids, bool *ref)
+{
+    unsigned count = 0;
+    for (unsigned i = 0; i < NBITS; i++) {
+        count += ref[i];
+    }
+    assert(cids->cid_type != CID_ARRAY);
+    assert(column_ids_nbits(cids) >= NBITS);
+    assert(column_ids_count(cids) == count);
+    for (unsigned i = 0; i < NBITS; i++) {
+        assert(column_ids_contains(cids, i) == ref[i]);
+    }
+}
+
+void testcombine(void) {
+    bool *refa = malloc(sizeof(bool) * NBITS);
+    bool *refb = malloc(sizeof(bool) * NBITS);
+    bool *expect = malloc(sizeof(bool) * NBITS);
+    assert(refa != NULL && refb != NULL && expect != NULL);
+    // a is dense at the start and sparse after, b the other way around,
+    // and both hold the last id
+    srand(7);
+    for (unsigned i = 0; i < NBITS; i++) {
+        bool first = (i < NBITS / 2);
+        refa[i] = (rand() % (first ? 2 : 50)) == 0;
+        refb[i] = (rand() % (first ? 50 : 2)) == 0;
+    }
+    refa[NBITS - 1] = refb[NBITS - 1] = true;
+    struct column_ids *a[3], *b[3];
+    build(refa, a);
+    build(refb, b);
+
+    enum column_ids_type types[] = { CID_BITMAP, CID_ARRAY, CID_IDSET };
+    for (unsigned i = 0; i < 3; i++) {
+        for (unsigned j = 0; j < 3; j++) {
+            struct column_ids *ids;
+            assert(column_ids_combine(SET_AND, a[types[i]], b[types[j]], &ids) == 0);
+            for (unsigned k = 0; k < NBITS; k++) {
+                expect[k] = refa[k] && refb[k];
+            }
+            checkset(ids, expect);
+            column_ids_destroy(ids);
+            assert(column_ids_combine(SET_OR, a[types[i]], b[types[j]], &ids) == 0);
+            for (unsigned k = 0; k < NBITS; k++) {
+                expect[k] = refa[k] || refb[k];
+            }
+            checkset(ids, expect);
+            column_ids_destroy(ids);
+        }
+        struct column_ids *ids;
+        if (types[i] == CID_ARRAY) {
+            // an array doesn't know the range of ids
+            assert(column_ids_combine(SET_NOT, a[types[i]], NULL, &ids) == DBEVARTYPE);
+            continue;
+        }
+        assert(column_ids_combine(SET_NOT, a[types[i]], NULL, &ids) == 0);
+        assert(column_ids_nbits(ids) == NBITS);
+        for (unsigned k = 0; k < NBITS; k++) {
+            expect[k] = !refa[k];
+        }
+        checkset(ids, expect);
+        // and back again
+        struct column_ids *notnot;
+        assert(column_ids_combine(SET_NOT, ids, NULL, &notnot) == 0);
+        checkset(notnot, refa);
+        column_ids_destroy(notnot);
+        column_ids_destroy(ids);
+        // within the live positions b
+        for (unsigned j = 0; j < 3; j++) {
+            if (types[j] == CID_ARRAY) {
+                continue;
+            }
+            assert(column_ids_combine(SET_NOT, a[types[i]], b[types[j]], &ids) == 0);
+            for (unsigned k = 0; k < NBITS; k++) {
+                expect[k] = !refa[k] && refb[k];
+            }
+            checkset(ids, expect);
+            column_ids_destroy(ids);
+        }
+        assert(column_ids_combine(SET_NOT, a[types[i]], b[CID_ARRAY], &ids) == DBECOLDIFFLEN);
+    }
+
+    // bitmaps over different ranges are combined as idsets
+    struct column_ids *shorter = column_ids_create(CID_BITMAP, NBITS - 100);
+    assert(shorter != NULL);
+    assert(column_ids_add(shorter, 3) == 0);
+    struct column_ids *ids;
+    assert(column_ids_combine(SET_OR, a[CID_BITMAP], shorter, &ids) == 0);
+    assert(ids->cid_type == CID_IDSET);
+    for (unsigned k = 0; k < NBITS; k++) {
+        expect[k] = refa[k] || k == 3;
+    }
+    checkset(ids, expect);
+    column_ids_destroy(ids);
+    // the live positions of not() must cover the same range
+    assert(column_ids_combine(SET_NOT, a[CID_BITMAP], shorter, &ids) == DBECOLDIFFLEN);
+    column_ids_destroy(shorter);
+
+    for (unsigned i = 0; i < 3; i++) {
+        column_ids_destroy(a[i]);
+        column_ids_destroy(b[i]);
+    }
+    free(refa);
+    free(refb);
+    free(expect);
+}
+
+int main(void) {
+    testbatch();
+    testcombine();
+}
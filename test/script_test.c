@@ -0,0 +1,105 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <db/common/parser.h>
+#include <db/server/script.h>
+
+// true if op to waits for op from
+static
+bool
+waits(struct script *script, unsigned to, unsigned from)
+{
+    struct script_node *node = &script->sc_nodes[from];
+    for (unsigned i = 0; i < node->sn_nnext; i++) {
+        if (node->sn_next[i] == to) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static
+struct script *
+build(char *query, struct oparray **retops)
+{
+    char *copy = strdup(query);
+    struct oparray *ops = parse_query(copy);
+    assert(ops != NULL);
+    free(copy);
+    struct script *script;
+    assert(script_create(ops, &script) == 0);
+    assert(script->sc_nnodes == oparray_num(ops));
+    *retops = ops;
+    return script;
+}
+
+void testdeps(void) {
+    struct oparray *ops;
+    struct script *script = build(
+            "s1=select(a,1,5)\n"     // 0
+            "s2=select(b,1,5)\n"     // 1
+            "f1=fetch(c,s1)\n"       // 2 reads 0
+            "print(f1)\n"            // 3 reads 2
+            "s1=select(a,2,3)\n"     // 4 after 0 and its reader 2
+            "f2=add(f1,f1)\n"        // 5 reads 2
+            "f1=sum(f2)\n"           // 6 reads 5, after 2 and its readers 3, 5
+            "tuple(f1,f2)\n",        // 7 reads 6 and 5
+            &ops);
+    struct script_node *n = script->sc_nodes;
+    assert(n[0].sn_kind == SCRIPT_PURE && n[0].sn_ndeps == 0);
+    assert(n[1].sn_kind == SCRIPT_PURE && n[1].sn_ndeps == 0);
+    assert(n[2].sn_ndeps == 1 && waits(script, 2, 0));
+    assert(n[3].sn_kind == SCRIPT_OUTPUT && n[3].sn_ndeps == 1 && waits(script, 3, 2));
+    assert(n[4].sn_ndeps == 2 && waits(script, 4, 0) && waits(script, 4, 2));
+    assert(n[5].sn_ndeps == 1 && waits(script, 5, 2));
+    assert(n[6].sn_ndeps == 3);
+    assert(waits(script, 6, 2) && waits(script, 6, 3) && waits(script, 6, 5));
+    assert(n[7].sn_kind == SCRIPT_OUTPUT && n[7].sn_ndeps == 2);
+    assert(waits(script, 7, 5) && waits(script, 7, 6));
+    script_destroy(script);
+    parse_cleanup_ops(ops);
+}
+
+void testbarrier(void) {
+    struct oparray *ops;
+    struct script *script = build(
+            "s1=select(a,1,5)\n"         // 0
+            "s2=select(b,1,5)\n"         // 1
+            "insert(a,1,b,2)\n"          // 2 after 0 and 1
+            "f1=fetch(a,s1)\n"           // 3 only needs the barrier
+            "s3=select(c,1,5)\n"         // 4 also waits for it
+            "update(s3,a,7)\n"           // 5 after 2, 3, 4
+            "f2=fetch(b,s2)\n",          // 6 after 5 only
+            &ops);
+    struct script_node *n = script->sc_nodes;
+    assert(n[2].sn_kind == SCRIPT_BARRIER && n[2].sn_ndeps == 2);
+    assert(n[3].sn_ndeps == 1 && waits(script, 3, 2));
+    assert(n[4].sn_ndeps == 1 && waits(script, 4, 2));
+    assert(n[5].sn_kind == SCRIPT_BARRIER && n[5].sn_ndeps == 3);
+    assert(n[6].sn_ndeps == 1 && waits(script, 6, 5));
+    script_destroy(script);
+    parse_cleanup_ops(ops);
+}
+
+void testmany(void) {
+    // lots of variables, to grow the table
+    char query[64 * 1000];
+    char *p = query;
+    for (unsigned i = 0; i < 1000; i++) {
+        p += sprintf(p, "s%u=select(a,%u,%u)\n", i, i, i + 1);
+    }
+    struct oparray *ops;
+    struct script *script = build(query, &ops);
+    for (unsigned i = 0; i < 1000; i++) {
+        assert(script->sc_nodes[i].sn_ndeps == 0);
+    }
+    script_destroy(script);
+    parse_cleanup_ops(ops);
+}
+
+int main(void) {
+    testdeps();
+    testbarrier();
+    testmany();
+}
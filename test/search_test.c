@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <db/common/search.h>
@@ -39,8 +40,69 @@ void testduplicates(void) {
     assert(binary_search(&val, arr, 7, sizeof(int), int_compare) == 7);
 }
 
+struct entry {
+    int e_key;
+    int e_other;
+    long long e_value;
+};
+
+static
+int
+entry_compare(const void *a, const void *b)
+{
+    return ((struct entry *) a)->e_key - ((struct entry *) b)->e_key;
+}
+
+void testlowerbound(void) {
+    int arr[7] = {2, 3, 4, 5, 5, 6, 7};
+    assert(int_lower_bound(5, arr, 0, sizeof(int)) == 0);
+    assert(int_lower_bound(1, arr, 7, sizeof(int)) == 0);
+    assert(int_lower_bound(5, arr, 7, sizeof(int)) == 3);
+    assert(int_lower_bound(10, arr, 7, sizeof(int)) == 7);
+
+    // keys far enough apart that their difference overflows
+    int wide[5] = {INT_MIN, -5, 0, 7, INT_MAX};
+    assert(int_lower_bound(INT_MIN, wide, 5, sizeof(int)) == 0);
+    assert(int_lower_bound(INT_MIN + 1, wide, 5, sizeof(int)) == 1);
+    assert(int_lower_bound(-5, wide, 5, sizeof(int)) == 1);
+    assert(int_lower_bound(1, wide, 5, sizeof(int)) == 3);
+    assert(int_lower_bound(8, wide, 5, sizeof(int)) == 4);
+    assert(int_lower_bound(INT_MAX, wide, 5, sizeof(int)) == 4);
+    assert(int_lower_bound(INT_MAX, wide, 4, sizeof(int)) == 4);
+    assert(int_lower_bound(INT_MIN, wide + 1, 4, sizeof(int)) == 0);
+    for (unsigned n = 0; n <= 5; n++) {
+        int xs[] = {INT_MIN, INT_MIN + 1, -6, -5, 0, 7, 8, INT_MAX - 1, INT_MAX};
+        for (unsigned i = 0; i < sizeof(xs) / sizeof(xs[0]); i++) {
+            assert(int_lower_bound(xs[i], wide, n, sizeof(int))
+                   == binary_search(&xs[i], wide, n, sizeof(int), int_compare));
+        }
+    }
+
+    // agrees with binary_search on every size, dense and strided
+    struct entry entries[300];
+    int keys[300];
+    srand(11);
+    int key = 0;
+    for (unsigned i = 0; i < 300; i++) {
+        key += rand() % 3;
+        keys[i] = key;
+        entries[i].e_key = key;
+    }
+    for (unsigned n = 0; n <= 300; n++) {
+        for (int x = -1; x <= key + 1; x++) {
+            struct entry target = {x, 0, 0};
+            assert(int_lower_bound(x, keys, n, sizeof(int))
+                   == binary_search(&x, keys, n, sizeof(int), int_compare));
+            assert(int_lower_bound(x, entries, n, sizeof(struct entry))
+                   == binary_search(&target, entries, n, sizeof(struct entry),
+                                    entry_compare));
+        }
+    }
+}
+
 int main(void) {
     testempty();
     testsingle();
     testduplicates();
+    testlowerbound();
 }
@@ -0,0 +1,85 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <db/server/stats.h>
+
+#define NVALS 100000
+
+// counts the values in [low, high]
+static
+uint64_t
+count(int *vals, unsigned num, int low, int high)
+{
+    uint64_t n = 0;
+    for (unsigned i = 0; i < num; i++) {
+        n += (vals[i] >= low && vals[i] <= high);
+    }
+    return n;
+}
+
+static
+void
+checkclose(uint64_t estimate, uint64_t actual, uint64_t slack)
+{
+    uint64_t diff = (estimate > actual) ? estimate - actual : actual - estimate;
+    assert(diff <= slack);
+}
+
+void testbuild(void) {
+    int *vals = malloc(sizeof(int) * NVALS);
+    srand(1);
+    // a skewed column: half of the values are in [0, 100), the rest
+    // are spread over [0, 1000000)
+    for (unsigned i = 0; i < NVALS; i++) {
+        vals[i] = (i % 2) ? rand() % 100 : rand() % 1000000;
+    }
+    struct column_stats stats;
+    assert(column_stats_build(&stats, vals, NVALS) == 0);
+    assert(stats.cs_nbuckets > 1);
+    assert(column_stats_rows(&stats) == NVALS);
+
+    checkclose(column_stats_estimate(&stats, 0, 99), count(vals, NVALS, 0, 99), NVALS / 50);
+    checkclose(column_stats_estimate(&stats, 100, 999999),
+               count(vals, NVALS, 100, 999999), NVALS / 50);
+    checkclose(column_stats_estimate(&stats, 500000, 600000),
+               count(vals, NVALS, 500000, 600000), NVALS / 50);
+    assert(column_stats_estimate(&stats, 1000000, 2000000) == 0);
+    assert(column_stats_estimate(&stats, 10, 5) == 0);
+
+    // about 100 + 50000 distinct values, within the error of the sketch
+    uint64_t ndistinct = column_stats_ndistinct(&stats);
+    assert(ndistinct > 30000 && ndistinct < 70000);
+    free(vals);
+}
+
+void testincremental(void) {
+    struct column_stats stats;
+    assert(column_stats_build(&stats, NULL, 0) == 0);
+    assert(stats.cs_nbuckets == 0);
+    assert(column_stats_rows(&stats) == 0);
+    assert(column_stats_ndistinct(&stats) == 0);
+    assert(column_stats_estimate(&stats, 0, 100) == 0);
+
+    for (int i = 0; i < 1000; i++) {
+        column_stats_add(&stats, i % 10);
+    }
+    assert(column_stats_rows(&stats) == 1000);
+    checkclose(column_stats_ndistinct(&stats), 10, 2);
+    assert(column_stats_estimate(&stats, 0, 9) == 1000);
+    checkclose(column_stats_estimate(&stats, 3, 3), 100, 25);
+
+    // values outside the bounds widen them
+    column_stats_add(&stats, -5);
+    column_stats_add(&stats, 50);
+    assert(column_stats_estimate(&stats, -5, 50) == 1002);
+
+    for (int i = 0; i < 500; i++) {
+        column_stats_remove(&stats, i % 10);
+    }
+    assert(column_stats_rows(&stats) == 502);
+}
+
+int main(void) {
+    testbuild();
+    testincremental();
+}
@@ -0,0 +1,1081 @@
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <string.h>
+#include <db/common/dberror.h>
+#include <db/common/parser.h>
+#include <db/common/results.h>
+#include <db/common/synch.h>
+#include <db/common/threadpool.h>
+#include <db/server/join.h>
+#include <db/server/storage.h>
+
+#define DBDIR "storage_test.tmp"
+#define NVALS 300007
+#define NTHREADS 8
+#define NSELECTS 10
+
+static int vals[NVALS];
+
+struct selector {
+    struct column *s_col;
+    unsigned s_seed;
+};
+
+// Runs selects with a range per iteration and checks every result
+static
+void *
+selector_routine(void *arg)
+{
+    struct selector *s = arg;
+    for (unsigned i = 0; i < NSELECTS; i++) {
+        unsigned low = (s->s_seed * 7919 + i * 104729) % 1000;
+        unsigned high = low + 50 + i;
+        char query[64];
+        sprintf(query, "select(a,%u,%u)", low, high);
+        struct oparray *ops = parse_query(query);
+        assert(ops != NULL && oparray_num(ops) == 1);
+        struct column_ids *ids = column_select(s->s_col, oparray_get(ops, 0));
+        assert(ids != NULL);
+
+        unsigned count = 0;
+        for (unsigned id = 0; id < NVALS; id++) {
+            count += (vals[id] >= (int) low && vals[id] <= (int) high);
+        }
+        assert(column_ids_count(ids) == count);
+        struct cid_iterator iter;
+        cid_iter_init(&iter, ids);
+        while (cid_iter_has_next(&iter)) {
+            uint64_t id = cid_iter_get(&iter);
+            assert(vals[id] >= (int) low && vals[id] <= (int) high);
+        }
+        cid_iter_cleanup(&iter);
+        column_ids_destroy(ids);
+        parse_cleanup_ops(ops);
+    }
+    return NULL;
+}
+
+// Opens a new unsorted column a, loaded with vals
+static
+struct column *
+setup(struct storage **retstorage)
+{
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(storage_add_column(storage, "a", STORAGE_UNSORTED) == 0);
+    struct column *col;
+    assert(column_open(storage, "a", &col) == 0);
+    srand(42);
+    for (unsigned i = 0; i < NVALS; i++) {
+        vals[i] = rand() % 1100;
+    }
+    assert(column_load(col, vals, NVALS) == 0);
+    *retstorage = storage;
+    return col;
+}
+
+static
+void
+teardown(struct storage *storage, struct column *col)
+{
+    column_close(col);
+    storage_close(storage);
+    assert(system("rm -rf " DBDIR) == 0);
+}
+
+void testsharedscan(void) {
+    struct storage *storage;
+    struct column *col = setup(&storage);
+
+    // the selects attach to each other's scans at whatever page it is on
+    pthread_t threads[NTHREADS];
+    struct selector selectors[NTHREADS];
+    for (unsigned i = 0; i < NTHREADS; i++) {
+        selectors[i].s_col = col;
+        selectors[i].s_seed = i;
+        assert(pthread_create(&threads[i], NULL, selector_routine, &selectors[i]) == 0);
+    }
+    for (unsigned i = 0; i < NTHREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    teardown(storage, col);
+}
+
+void testbatch(void) {
+    struct storage *storage;
+    struct column *col = setup(&storage);
+    char *query = "s0=select(a,100,200)\n"
+                  "select(a,7)\n"
+                  "s2=select(a)\n"
+                  "s3=select(a,500,400)\n"
+                  "s4=select(a,1050,4294967295)\n";
+    struct oparray *ops = parse_query(query);
+    assert(ops != NULL);
+    unsigned nops = oparray_num(ops);
+    struct op *batch[5];
+    struct column_ids *ids[5];
+    for (unsigned i = 0; i < nops; i++) {
+        batch[i] = oparray_get(ops, i);
+    }
+    assert(column_select_batch(col, batch, nops, ids) == 0);
+
+    unsigned low[] = {100, 7, 0, 500, 1050};
+    unsigned high[] = {200, 7, 1100, 400, 4294967295u};
+    for (unsigned i = 0; i < nops; i++) {
+        unsigned count = 0;
+        for (unsigned id = 0; id < NVALS; id++) {
+            count += ((unsigned) vals[id] >= low[i] && (unsigned) vals[id] <= high[i]);
+        }
+        assert(column_ids_count(ids[i]) == count);
+        // the fetch reads runs of the pages these are on
+        struct column_vals *cvals = column_fetch(col, ids[i]);
+        assert(cvals != NULL && cvals->cval_len == count);
+        for (unsigned j = 0; j < count; j++) {
+            assert(cvals->cval_vals[j] == vals[cvals->cval_ids[j]]);
+        }
+        column_vals_destroy(cvals);
+        column_ids_destroy(ids[i]);
+    }
+    parse_cleanup_ops(ops);
+    teardown(storage, col);
+}
+
+// Checks selects on the btree column b against the first n of tvals
+// Checks that select(b,low,high) finds as many as the first n of tvals
+static
+void
+checkselect(struct column *col, int *tvals, unsigned n, unsigned low, unsigned high)
+{
+    char query[64];
+    sprintf(query, "select(b,%u,%u)", low, high);
+    struct oparray *ops = parse_query(query);
+    assert(ops != NULL);
+    struct column_ids *ids = column_select(col, oparray_get(ops, 0));
+    assert(ids != NULL);
+    unsigned count = 0;
+    for (unsigned id = 0; id < n; id++) {
+        count += ((unsigned) tvals[id] >= low && (unsigned) tvals[id] <= high);
+    }
+    assert(column_ids_count(ids) == count);
+    column_ids_destroy(ids);
+    parse_cleanup_ops(ops);
+}
+
+static
+void
+checktree(struct column *col, int *tvals, unsigned n)
+{
+    for (unsigned i = 0; i < 200; i++) {
+        unsigned low = tvals[(i * 7919) % n] - (i % 3) * 50;
+        unsigned high = low + (i % 4) * 100;
+        checkselect(col, tvals, n, low, high);
+    }
+}
+
+// Walks the leaves from the left, checking each holds the ids of its
+// keys in order, and selects the keys at the ends of each leaf and
+// between one leaf and the next
+static
+void
+checkleaves(struct column *col, int *tvals, unsigned n)
+{
+    page_t page = col->col_disk.cd_btree_root;
+    for (struct btree_inner *inner = col->col_btree_inner; inner != NULL;
+         inner = inner->bi_children[0]) {
+        if (inner->bi_leaves) {
+            page = inner->bi_pages[0];
+            break;
+        }
+    }
+    unsigned total = 0;
+    unsigned nleaves = 0;
+    int last = 0;
+    while (page != BTREE_PAGE_NULL) {
+        struct btree_node node;
+        assert(file_read(col->col_index_file, page, &node) == 0);
+        assert(node.bt_header.bth_type == BTREE_NODE_LEAF);
+        assert(node.bt_header.bth_version == BTREE_VERSION);
+        unsigned nentries = node.bt_header.bth_nentries;
+        assert(nentries <= BTLEAF_PER_PAGE);
+        for (unsigned i = 0; i < nentries; i++) {
+            assert(node.bt_ids[i] < n);
+            assert(tvals[node.bt_ids[i]] == node.bt_keys[i]);
+            assert(i == 0 || node.bt_keys[i - 1] <= node.bt_keys[i]);
+        }
+        if (nentries > 0) {
+            int first = node.bt_keys[0];
+            checkselect(col, tvals, n, first, first);
+            checkselect(col, tvals, n, node.bt_keys[nentries - 1], node.bt_keys[nentries - 1]);
+            if (nleaves > 0) {
+                assert(last <= first);
+                checkselect(col, tvals, n, last, first);
+            }
+            last = node.bt_keys[nentries - 1];
+        }
+        total += nentries;
+        nleaves++;
+        page = node.bt_header.bth_next;
+    }
+    assert(total == n);
+}
+
+void testbtree(void) {
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(storage_add_column(storage, "b", STORAGE_BTREE) == 0);
+    struct column *col;
+    assert(column_open(storage, "b", &col) == 0);
+    // a root leaf has no internal levels to keep
+    assert(col->col_btree_inner == NULL && !col->col_btree_stale);
+
+    // enough values for two internal levels
+    unsigned nload = 100000;
+    unsigned ninsert = 2000;
+    srand(7);
+    for (unsigned i = 0; i < nload + ninsert; i++) {
+        vals[i] = 100 + rand() % 1000000;
+    }
+    assert(column_load(col, vals, nload) == 0);
+    struct btree_inner *root = col->col_btree_inner;
+    assert(root != NULL && !root->bi_leaves && !col->col_btree_stale);
+    checktree(col, vals, nload);
+
+    // inserts split leaves, and the internal levels follow
+    for (unsigned i = nload; i < nload + ninsert; i++) {
+        assert(column_insert(col, vals[i]) == 0);
+    }
+    assert(col->col_btree_inner != NULL && !col->col_btree_stale);
+    checktree(col, vals, nload + ninsert);
+
+    // reopening reads them back from disk
+    column_close(col);
+    assert(column_open(storage, "b", &col) == 0);
+    assert(col->col_btree_inner != NULL);
+    checktree(col, vals, nload + ninsert);
+
+    teardown(storage, col);
+}
+
+void testdenseleaves(void) {
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(storage_add_column(storage, "b", STORAGE_BTREE) == 0);
+    struct column *col;
+    assert(column_open(storage, "b", &col) == 0);
+    unsigned n = 6 * BTLEAF_PER_PAGE + 5;
+    srand(9);
+    for (unsigned i = 0; i < n; i++) {
+        vals[i] = rand() % (4 * n);
+    }
+
+    // a full root leaf, which the next insert splits
+    assert(column_load(col, vals, BTLEAF_PER_PAGE) == 0);
+    assert(col->col_btree_inner == NULL);
+    checkleaves(col, vals, BTLEAF_PER_PAGE);
+    assert(column_insert(col, vals[BTLEAF_PER_PAGE]) == 0);
+    struct btree_inner *root = col->col_btree_inner;
+    assert(root != NULL && root->bi_leaves && root->bi_nkeys == 1);
+    checkleaves(col, vals, BTLEAF_PER_PAGE + 1);
+    for (unsigned i = BTLEAF_PER_PAGE + 1; i < n; i++) {
+        assert(column_insert(col, vals[i]) == 0);
+    }
+    assert(col->col_btree_inner->bi_nkeys > 2);
+    checkleaves(col, vals, n);
+    checktree(col, vals, n);
+
+    // reopening reads the same leaves back from disk
+    page_t rootpage = col->col_disk.cd_btree_root;
+    column_close(col);
+    assert(column_open(storage, "b", &col) == 0);
+    assert(col->col_disk.cd_btree_root == rootpage);
+    checkleaves(col, vals, n);
+    column_close(col);
+    storage_close(storage);
+
+    // a file from before the version is built again from the base file
+    struct file *f = file_open(DBDIR "/b.btree");
+    assert(f != NULL);
+    struct btree_node node;
+    assert(file_read(f, rootpage, &node) == 0);
+    node.bt_header.bth_version = 0;
+    assert(file_write(f, rootpage, &node) == 0);
+    file_close(f);
+    storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(column_open(storage, "b", &col) == 0);
+    assert(col->col_btree_inner != NULL);
+    assert(file_read(col->col_index_file, col->col_disk.cd_btree_root, &node) == 0);
+    assert(node.bt_header.bth_version == BTREE_VERSION);
+    checkleaves(col, vals, n);
+    checktree(col, vals, n);
+    // and stays built
+    rootpage = col->col_disk.cd_btree_root;
+    column_close(col);
+    storage_close(storage);
+    storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(column_open(storage, "b", &col) == 0);
+    assert(col->col_disk.cd_btree_root == rootpage);
+    checkleaves(col, vals, n);
+    teardown(storage, col);
+}
+
+struct tree_reader {
+    struct column *tr_col;
+    unsigned tr_nload;
+    bool *tr_stop;
+};
+
+// Selects on the tree while it grows. The loaded tuples are always found,
+// and whatever else comes back was inserted.
+static
+void *
+tree_reader_routine(void *arg)
+{
+    struct tree_reader *r = arg;
+    unsigned i = 0;
+    while (!__atomic_load_n(r->tr_stop, __ATOMIC_RELAXED)) {
+        unsigned low = 100 + (i * 7919) % 1000000;
+        unsigned high = low + 2000;
+        char query[64];
+        sprintf(query, "select(b,%u,%u)", low, high);
+        struct oparray *ops = parse_query(query);
+        assert(ops != NULL);
+        struct column_ids *ids = column_select(r->tr_col, oparray_get(ops, 0));
+        assert(ids != NULL);
+        unsigned nloaded = 0;
+        for (unsigned id = 0; id < r->tr_nload; id++) {
+            nloaded += ((unsigned) vals[id] >= low && (unsigned) vals[id] <= high);
+        }
+        unsigned nfound = 0;
+        struct cid_iterator iter;
+        cid_iter_init(&iter, ids);
+        while (cid_iter_has_next(&iter)) {
+            uint64_t id = cid_iter_get(&iter);
+            assert((unsigned) vals[id] >= low && (unsigned) vals[id] <= high);
+            nfound += (id < r->tr_nload);
+        }
+        cid_iter_cleanup(&iter);
+        assert(nfound == nloaded);
+        column_ids_destroy(ids);
+        parse_cleanup_ops(ops);
+        i++;
+    }
+    return NULL;
+}
+
+void testconcurrentinsert(void) {
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(storage_add_column(storage, "b", STORAGE_BTREE) == 0);
+    struct column *col;
+    assert(column_open(storage, "b", &col) == 0);
+    unsigned nload = 50000;
+    unsigned ninsert = 3000;
+    srand(5);
+    for (unsigned i = 0; i < nload + ninsert; i++) {
+        vals[i] = 100 + rand() % 1000000;
+    }
+    assert(column_load(col, vals, nload) == 0);
+
+    // the inserts split leaves and replace the internal levels under the
+    // selects
+    bool stop = false;
+    pthread_t threads[NTHREADS / 2];
+    struct tree_reader readers[NTHREADS / 2];
+    for (unsigned i = 0; i < NTHREADS / 2; i++) {
+        readers[i].tr_col = col;
+        readers[i].tr_nload = nload;
+        readers[i].tr_stop = &stop;
+        assert(pthread_create(&threads[i], NULL, tree_reader_routine, &readers[i]) == 0);
+    }
+    for (unsigned i = nload; i < nload + ninsert; i++) {
+        assert(column_insert(col, vals[i]) == 0);
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < NTHREADS / 2; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    checktree(col, vals, nload + ninsert);
+    teardown(storage, col);
+}
+
+void testprobe(void) {
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(storage_add_column(storage, "b", STORAGE_BTREE) == 0);
+    struct column *col;
+    assert(column_open(storage, "b", &col) == 0);
+    // few distinct values, so the runs of each span several leaves
+    unsigned n = 100000;
+    srand(3);
+    for (unsigned i = 0; i < n; i++) {
+        vals[i] = 2 * (rand() % 300);
+    }
+    assert(column_load(col, vals, n) == 0);
+
+    // sorted keys with repeats and keys that are not in the tree
+    unsigned nkeys = 0;
+    int keys[1000];
+    unsigned ids[1000];
+    for (int key = -3; key < 700; key += 1 + nkeys % 3) {
+        for (unsigned r = 0; r <= nkeys % 2; r++) {
+            ids[nkeys] = nkeys;
+            keys[nkeys++] = key;
+        }
+    }
+    struct column_ids idsL = {.cid_type = CID_ARRAY};
+    struct column_ids idsR = {.cid_type = CID_ARRAY};
+    assert((idsL.cid_array = idarray_create()) != NULL);
+    assert((idsR.cid_array = idarray_create()) != NULL);
+    assert(column_btree_probe(col, keys, ids, nkeys, &idsL, &idsR) == 0);
+
+    // every pair matches, in key order and then in right id order
+    unsigned npairs = idarray_num(idsL.cid_array);
+    assert(npairs == idarray_num(idsR.cid_array));
+    unsigned expected = 0;
+    for (unsigned k = 0; k < nkeys; k++) {
+        for (unsigned id = 0; id < n; id++) {
+            expected += (vals[id] == keys[k]);
+        }
+    }
+    assert(npairs == expected && npairs > 0);
+    for (unsigned p = 0; p < npairs; p++) {
+        unsigned l = (unsigned) (uintptr_t) idarray_get(idsL.cid_array, p);
+        unsigned r = (unsigned) (uintptr_t) idarray_get(idsR.cid_array, p);
+        assert(vals[r] == keys[l]);
+        if (p > 0) {
+            unsigned pl = (unsigned) (uintptr_t) idarray_get(idsL.cid_array, p - 1);
+            unsigned pr = (unsigned) (uintptr_t) idarray_get(idsR.cid_array, p - 1);
+            assert(pl < l || (pl == l && pr < r));
+        }
+    }
+    idsL.cid_array->arr.num = 0;
+    idsR.cid_array->arr.num = 0;
+    idarray_destroy(idsL.cid_array);
+    idarray_destroy(idsR.cid_array);
+
+    // an empty input joins to nothing, whichever side and join it is
+    int some[3] = { 0, 2, 4 };
+    unsigned someids[3] = { 0, 1, 2 };
+    struct column_vals empty = { NULL, NULL, 0, "b" };
+    struct column_vals other = { some, someids, 3, "b" };
+    enum join_type jtypes[] = { JOIN_LOOP, JOIN_SORT, JOIN_TREE, JOIN_HASH };
+    for (unsigned j = 0; j < sizeof(jtypes) / sizeof(jtypes[0]); j++) {
+        struct column_ids *retL, *retR;
+        assert(column_join(jtypes[j], storage, &empty, &other, &retL, &retR) == 0);
+        assert(idarray_num(retL->cid_array) == 0);
+        column_ids_destroy(retL);
+        column_ids_destroy(retR);
+        if (jtypes[j] == JOIN_TREE) {
+            // which probes the whole column, not the right input
+            continue;
+        }
+        assert(column_join(jtypes[j], storage, &other, &empty, &retL, &retR) == 0);
+        assert(idarray_num(retR->cid_array) == 0);
+        column_ids_destroy(retL);
+        column_ids_destroy(retR);
+    }
+    teardown(storage, col);
+}
+
+// Fetches the ids of select(c,low,high) and checks each value against the
+// first n of fvals
+static
+void
+checkfetch(struct column *col, char *query, int *fvals, unsigned n,
+           struct column_ids **retids)
+{
+    struct oparray *ops = parse_query(query);
+    assert(ops != NULL);
+    struct column_ids *ids = column_select(col, oparray_get(ops, 0));
+    assert(ids != NULL);
+    struct column_vals *cvals = column_fetch(col, ids);
+    assert(cvals != NULL && cvals->cval_len == column_ids_count(ids));
+    // in the order of the ids, like a fetch from the base file
+    for (unsigned i = 0; i < cvals->cval_len; i++) {
+        assert(cvals->cval_ids[i] < n);
+        assert(cvals->cval_vals[i] == fvals[cvals->cval_ids[i]]);
+        assert(i == 0 || cvals->cval_ids[i - 1] < cvals->cval_ids[i]);
+    }
+    column_vals_destroy(cvals);
+    parse_cleanup_ops(ops);
+    *retids = ids;
+}
+
+void testcoveringfetch(void) {
+    enum storage_type types[] = {STORAGE_SORTED, STORAGE_BTREE};
+    for (unsigned t = 0; t < 2; t++) {
+        assert(system("rm -rf " DBDIR) == 0);
+        struct storage *storage = storage_init(DBDIR);
+        assert(storage != NULL);
+        assert(storage_add_column(storage, "c", types[t]) == 0);
+        struct column *col;
+        assert(column_open(storage, "c", &col) == 0);
+        unsigned n = 20000;
+        srand(11);
+        for (unsigned i = 0; i < n; i++) {
+            vals[i] = rand() % 5000;
+        }
+        assert(column_load(col, vals, n) == 0);
+
+        // the values come from the range of the index
+        struct column_ids *ids;
+        checkfetch(col, "select(c,77)", vals, n, &ids);
+        column_ids_destroy(ids);
+        checkfetch(col, "select(c,1000,1999)", vals, n, &ids);
+        assert(strcmp(ids->cid_index_col, "c") == 0);
+
+        // a range that does not hold every id sends the fetch to the base
+        // file
+        ids->cid_index_low = 1500;
+        struct column_vals *cvals = column_fetch(col, ids);
+        assert(cvals != NULL && cvals->cval_len == column_ids_count(ids));
+        for (unsigned i = 0; i < cvals->cval_len; i++) {
+            assert(cvals->cval_vals[i] == vals[cvals->cval_ids[i]]);
+            assert(cvals->cval_vals[i] >= 1000 && cvals->cval_vals[i] <= 1999);
+        }
+        column_vals_destroy(cvals);
+        column_ids_destroy(ids);
+        teardown(storage, col);
+    }
+}
+
+// Values at both ends of the int range are further apart than an int can
+// hold, so they only sort and search right when compared, not subtracted
+void testsortedextremes(void) {
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(storage_add_column(storage, "c", STORAGE_SORTED) == 0);
+    struct column *col;
+    assert(column_open(storage, "c", &col) == 0);
+    unsigned n = 20000;
+    srand(13);
+    for (unsigned i = 0; i < n; i++) {
+        switch (rand() % 3) {
+        case 0: vals[i] = INT_MIN + rand() % 1000; break;
+        case 1: vals[i] = INT_MAX - 1000 + rand() % 999; break;
+        default: vals[i] = rand() % 1000 - 500; break;
+        }
+    }
+    assert(column_load(col, vals, n) == 0);
+
+    for (unsigned i = 0; i < 300; i++) {
+        int val = vals[(i * 7919) % n];
+        char query[64];
+        sprintf(query, "select(c,%u)", (unsigned) val);
+        struct column_ids *ids;
+        checkfetch(col, query, vals, n, &ids);
+        unsigned count = 0;
+        for (unsigned id = 0; id < n; id++) {
+            count += (vals[id] == val);
+        }
+        assert(column_ids_count(ids) == count);
+        column_ids_destroy(ids);
+    }
+    struct column_ids *ids;
+    checkfetch(col, "select(c,2147482647,2147483000)", vals, n, &ids);
+    unsigned count = 0;
+    for (unsigned id = 0; id < n; id++) {
+        count += (vals[id] >= 2147482647 && vals[id] <= 2147483000);
+    }
+    assert(column_ids_count(ids) == count);
+    column_ids_destroy(ids);
+    teardown(storage, col);
+}
+
+// A full root leaf holds keys from both ends of the int range, which are
+// further apart than an int can hold, and an insert of the smallest key
+// splits it between them
+void testbtreeextremes(void) {
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(storage_add_column(storage, "b", STORAGE_BTREE) == 0);
+    struct column *col;
+    assert(column_open(storage, "b", &col) == 0);
+    unsigned n = BTLEAF_PER_PAGE + 1;
+    for (unsigned i = 0; i < BTLEAF_PER_PAGE; i++) {
+        vals[i] = (i < BTLEAF_PER_PAGE / 2) ? INT_MIN + 1 + (int) i : INT_MAX - (int) i;
+    }
+    vals[BTLEAF_PER_PAGE] = INT_MIN;
+    assert(column_load(col, vals, BTLEAF_PER_PAGE) == 0);
+    assert(column_insert(col, vals[BTLEAF_PER_PAGE]) == 0);
+    assert(col->col_btree_inner != NULL);
+
+    // the leaves stay in key order
+    page_t page = col->col_btree_inner->bi_pages[0];
+    bool first = true;
+    int last = 0;
+    while (page != BTREE_PAGE_NULL) {
+        struct btree_node node;
+        assert(file_read(col->col_index_file, page, &node) == 0);
+        for (unsigned i = 0; i < node.bt_header.bth_nentries; i++) {
+            assert(first || last <= node.bt_keys[i]);
+            first = false;
+            last = node.bt_keys[i];
+        }
+        page = node.bt_header.bth_next;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        char query[64];
+        sprintf(query, "select(b,%u)", (unsigned) vals[i]);
+        struct column_ids *ids;
+        checkfetch(col, query, vals, n, &ids);
+        assert(column_ids_count(ids) == 1 && column_ids_contains(ids, i));
+        column_ids_destroy(ids);
+    }
+    teardown(storage, col);
+}
+
+// Runs query on col, within the ids of within if there are any
+static
+struct column_ids *
+selectquery(struct column *col, char *query, struct column_ids *within)
+{
+    struct oparray *ops = parse_query(query);
+    assert(ops != NULL && oparray_num(ops) == 1);
+    struct column_ids *ids = (within == NULL)
+            ? column_select(col, oparray_get(ops, 0))
+            : column_select_within(col, oparray_get(ops, 0), within);
+    parse_cleanup_ops(ops);
+    return ids;
+}
+
+void testwithin(void) {
+    struct storage *storage;
+    struct column *col = setup(&storage);
+    // a dense and a sparse selection to select within
+    char *queries[] = { "select(a,100,600)", "select(a,7)" };
+    unsigned low[] = { 100, 7 };
+    unsigned high[] = { 600, 7 };
+    for (unsigned q = 0; q < 2; q++) {
+        struct column_ids *within = selectquery(col, queries[q], NULL);
+        assert(within != NULL);
+        struct column_ids *ids = selectquery(col, "select(a,5,400)", within);
+        assert(ids != NULL);
+        unsigned count = 0;
+        for (unsigned id = 0; id < NVALS; id++) {
+            bool in = vals[id] >= (int) low[q] && vals[id] <= (int) high[q]
+                    && vals[id] >= 5 && vals[id] <= 400;
+            count += in;
+            assert(column_ids_contains(ids, id) == in);
+        }
+        assert(column_ids_count(ids) == count);
+        column_ids_destroy(ids);
+        column_ids_destroy(within);
+    }
+
+    // an array, which may repeat ids
+    struct column_ids arr;
+    arr.cid_type = CID_ARRAY;
+    arr.cid_col[0] = '\0';
+    arr.cid_index_col[0] = '\0';
+    arr.cid_array = idarray_create();
+    assert(arr.cid_array != NULL);
+    for (unsigned id = 0; id < NVALS; id += 1000) {
+        assert(idarray_add(arr.cid_array, (void *) (uintptr_t) id, NULL) == 0);
+        assert(idarray_add(arr.cid_array, (void *) (uintptr_t) id, NULL) == 0);
+    }
+    struct column_ids *ids = selectquery(col, "select(a,0,549)", &arr);
+    assert(ids != NULL);
+    for (unsigned id = 0; id < NVALS; id++) {
+        assert(column_ids_contains(ids, id) == (id % 1000 == 0 && vals[id] < 550));
+    }
+    column_ids_destroy(ids);
+    // a position past the end of the column
+    assert(idarray_add(arr.cid_array, (void *) (uintptr_t) NVALS, NULL) == 0);
+    assert(selectquery(col, "select(a,0,549)", &arr) == NULL);
+    arr.cid_array->arr.num = 0;
+    idarray_destroy(arr.cid_array);
+
+    // a set over a different number of positions
+    struct column_ids *other = column_ids_create(CID_BITMAP, NVALS - 1);
+    assert(other != NULL);
+    assert(selectquery(col, "select(a,0,549)", other) == NULL);
+    column_ids_destroy(other);
+    teardown(storage, col);
+}
+
+void testnotdeleted(void) {
+    struct storage *storage;
+    struct column *col = setup(&storage);
+    struct column_ids *deleted = selectquery(col, "select(a,0,99)", NULL);
+    assert(deleted != NULL);
+    assert(column_delete(col, deleted) == 0);
+
+    // not() of a dense and a sparse selection, taken within the live
+    // positions, leaves out the deleted ones
+    char *queries[] = { "select(a,500,1099)", "select(a,7)" };
+    unsigned low[] = { 500, 7 };
+    unsigned high[] = { 1099, 7 };
+    for (unsigned q = 0; q < 2; q++) {
+        struct column_ids *s = selectquery(col, queries[q], NULL);
+        assert(s != NULL);
+        assert(strcmp(s->cid_col, "a") == 0);
+        struct column_ids *all;
+        assert(column_ids_combine(SET_NOT, s, NULL, &all) == 0);
+        assert(column_fetch(col, all) == NULL);
+        column_ids_destroy(all);
+        struct column_ids *live, *ids;
+        assert(column_live_ids(col, column_ids_nbits(s), &live) == 0);
+        assert(column_ids_count(live) == NVALS - column_ids_count(deleted));
+        assert(column_ids_combine(SET_NOT, s, live, &ids) == 0);
+        assert(strcmp(ids->cid_col, "a") == 0);
+        unsigned count = 0;
+        for (unsigned id = 0; id < NVALS; id++) {
+            count += vals[id] >= 100 && (vals[id] < (int) low[q] || vals[id] > (int) high[q]);
+        }
+        assert(column_ids_count(ids) == count);
+        struct column_vals *cvals = column_fetch(col, ids);
+        assert(cvals != NULL);
+        assert(cvals->cval_len == count);
+        for (unsigned i = 0; i < cvals->cval_len; i++) {
+            assert(cvals->cval_vals[i] == vals[cvals->cval_ids[i]]);
+            assert(cvals->cval_vals[i] >= 100);
+        }
+        column_vals_destroy(cvals);
+        column_ids_destroy(ids);
+        column_ids_destroy(live);
+        column_ids_destroy(s);
+    }
+
+    struct column_ids *s = selectquery(col, "select(a,100,1099)", NULL);
+    struct column_ids *live, *ids;
+    assert(s != NULL);
+    assert(column_live_ids(col, column_ids_nbits(s), &live) == 0);
+    assert(column_ids_combine(SET_NOT, s, live, &ids) == 0);
+    assert(column_ids_count(ids) == 0);
+    assert(column_update(col, ids, 5) == 0);
+    column_ids_destroy(ids);
+    column_ids_destroy(live);
+    column_ids_destroy(s);
+    s = selectquery(col, "select(a,0,99)", NULL);
+    assert(s != NULL && column_ids_count(s) == 0);
+    column_ids_destroy(s);
+    // a range past the end of the column
+    assert(column_live_ids(col, NVALS + 1, &live) == DBECOLDIFFLEN);
+    column_ids_destroy(deleted);
+    teardown(storage, col);
+}
+
+// A column record from before cd_stats
+struct old_column {
+    char oc_col_name[120];
+    uint64_t oc_ntuples;
+    uint64_t oc_nexttupleid;
+    uint32_t oc_stype;
+    uint32_t oc_magic;
+    page_t oc_btree_root;
+    char oc_base_file[52];
+    char oc_index_file[52];
+};
+
+#define NOLDCOLS 11
+
+void testupgrade(void) {
+    // more columns than fit in a page now, and fewer than fit in an old one
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    srand(5);
+    for (unsigned i = 0; i < NVALS; i++) {
+        vals[i] = rand() % 1000;
+    }
+    for (unsigned c = 0; c < NOLDCOLS; c++) {
+        char name[8];
+        sprintf(name, "o%u", c);
+        assert(storage_add_column(storage, name, STORAGE_UNSORTED) == 0);
+        struct column *col;
+        assert(column_open(storage, name, &col) == 0);
+        assert(column_load(col, &vals[c], 1000 + c) == 0);
+        column_close(col);
+    }
+    storage_close(storage);
+
+    // write the records back the way they were before cd_stats
+    struct file *f = file_open(DBDIR "/metadata");
+    assert(f != NULL);
+    page_t npages = file_num_pages(f);
+    assert(npages - FILE_FIRST_PAGE == 2);
+    struct column_on_disk cols[2 * COLUMNS_PER_PAGE];
+    assert(file_read(f, FILE_FIRST_PAGE, cols) == 0);
+    assert(file_read(f, FILE_FIRST_PAGE + 1, &cols[COLUMNS_PER_PAGE]) == 0);
+    struct old_column oldcols[PAGESIZE / sizeof(struct old_column)];
+    assert(NOLDCOLS <= sizeof(oldcols) / sizeof(oldcols[0]));
+    memset(oldcols, 0, sizeof(oldcols));
+    for (unsigned c = 0; c < NOLDCOLS; c++) {
+        assert(cols[c].cd_magic == COLUMN_TAKEN);
+        strcpy(oldcols[c].oc_col_name, cols[c].cd_col_name);
+        oldcols[c].oc_ntuples = cols[c].cd_ntuples;
+        oldcols[c].oc_nexttupleid = cols[c].cd_nexttupleid;
+        oldcols[c].oc_stype = cols[c].cd_stype;
+        oldcols[c].oc_magic = COLUMN_TAKEN_V1;
+        oldcols[c].oc_btree_root = cols[c].cd_btree_root;
+        strcpy(oldcols[c].oc_base_file, cols[c].cd_base_file);
+        strcpy(oldcols[c].oc_index_file, cols[c].cd_index_file);
+    }
+    assert(file_write(f, FILE_FIRST_PAGE, oldcols) == 0);
+    memset(cols, 0, sizeof(cols));
+    assert(file_write(f, FILE_FIRST_PAGE + 1, cols) == 0);
+    file_close(f);
+
+    // every column is found again, and its statistics are rebuilt
+    storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    for (unsigned c = 0; c < NOLDCOLS; c++) {
+        char name[8];
+        sprintf(name, "o%u", c);
+        struct column *col;
+        assert(column_open(storage, name, &col) == 0);
+        struct column_stats stats;
+        column_get_stats(col, &stats);
+        assert(column_stats_rows(&stats) == 1000 + c);
+        struct oparray *ops = parse_query("select(o0,0,499)");
+        assert(ops != NULL);
+        struct column_ids *ids = column_select(col, oparray_get(ops, 0));
+        assert(ids != NULL);
+        unsigned count = 0;
+        for (unsigned i = 0; i < 1000 + c; i++) {
+            count += vals[c + i] < 500;
+        }
+        assert(column_ids_count(ids) == count);
+        column_ids_destroy(ids);
+        parse_cleanup_ops(ops);
+        column_close(col);
+    }
+    // adding one more goes on as before
+    assert(storage_add_column(storage, "new", STORAGE_UNSORTED) == 0);
+    struct column *col;
+    assert(column_open(storage, "new", &col) == 0);
+    teardown(storage, col);
+}
+
+void testloadbatches(void) {
+    // the second batch is far past the values of the first, which the
+    // histogram is built again for
+    enum storage_type types[] = {STORAGE_UNSORTED, STORAGE_SORTED, STORAGE_BTREE};
+    unsigned n = 20000;
+    for (unsigned t = 0; t < 3; t++) {
+        assert(system("rm -rf " DBDIR) == 0);
+        struct storage *storage = storage_init(DBDIR);
+        assert(storage != NULL);
+        assert(storage_add_column(storage, "l", types[t]) == 0);
+        struct column *col;
+        assert(column_open(storage, "l", &col) == 0);
+        for (unsigned i = 0; i < 2 * n; i++) {
+            vals[i] = (i < n) ? (int) (i % 100) : (int) (1000 + i % 1000);
+        }
+        struct column_loader *loader;
+        assert(column_load_begin(col, &loader) == 0 && loader != NULL);
+        assert(column_load_append(loader, vals, n) == 0);
+        assert(column_load_append(loader, &vals[n], n) == 0);
+        assert(column_load_finish(loader) == 0);
+
+        struct column_stats stats;
+        column_get_stats(col, &stats);
+        assert(column_stats_rows(&stats) == 2 * n);
+        uint64_t estimate = column_stats_estimate(&stats, 1000, 1499);
+        assert(estimate > n / 2 - n / 20 && estimate < n / 2 + n / 20);
+        estimate = column_stats_estimate(&stats, 0, 49);
+        assert(estimate > n / 2 - n / 20 && estimate < n / 2 + n / 20);
+
+        // and the index holds both batches
+        struct column_ids *ids = selectquery(col, "select(l,50,1049)", NULL);
+        assert(ids != NULL && column_ids_count(ids) == n / 2 + n / 20);
+        column_ids_destroy(ids);
+        teardown(storage, col);
+    }
+}
+
+// A load of a column, run as a job of the pool like a session's, with its
+// one append in a task that the other worker takes
+struct pool_load {
+    struct threadpool *pl_tpool;
+    struct column *pl_col;
+    struct column_loader *pl_loader;
+    struct semaphore *pl_started; // the append is running
+    struct semaphore *pl_waiting; // the job waits for it
+    struct semaphore *pl_release; // the append may finish
+    struct semaphore *pl_done;
+};
+
+static
+void
+pool_load_append(void *arg, unsigned threadnum)
+{
+    (void) threadnum;
+    struct pool_load *pl = arg;
+    assert(column_load_append(pl->pl_loader, vals, NVALS) == 0);
+    V(pl->pl_started);
+    P(pl->pl_release);
+}
+
+static
+void
+pool_load_job(void *arg, unsigned threadnum)
+{
+    (void) threadnum;
+    struct pool_load *pl = arg;
+    assert(column_load_begin(pl->pl_col, &pl->pl_loader) == 0);
+    struct task_group *group = task_group_create(pl->pl_tpool);
+    assert(group != NULL);
+    assert(task_group_spawn(group, pool_load_append, pl) == 0);
+    P(pl->pl_started);
+    V(pl->pl_waiting);
+    // the select spawned meanwhile is of another group, and needs the
+    // column we hold
+    task_group_wait(group);
+    task_group_destroy(group);
+    assert(column_load_finish(pl->pl_loader) == 0);
+    V(pl->pl_done);
+}
+
+struct pool_select {
+    struct column *ps_col;
+    unsigned ps_count;
+};
+
+static
+void
+pool_select(void *arg, unsigned threadnum)
+{
+    (void) threadnum;
+    struct pool_select *ps = arg;
+    struct oparray *ops = parse_query("select(a,100,199)");
+    assert(ops != NULL);
+    struct column_ids *ids = column_select(ps->ps_col, oparray_get(ops, 0));
+    assert(ids != NULL);
+    ps->ps_count = column_ids_count(ids);
+    column_ids_destroy(ids);
+    parse_cleanup_ops(ops);
+}
+
+// A load that fails partway, here on the size limit of the base file,
+// leaves the column empty, and it can be loaded again
+void testloadfailed(void) {
+    enum storage_type types[] = {STORAGE_UNSORTED, STORAGE_SORTED};
+    srand(19);
+    for (unsigned i = 0; i < NVALS; i++) {
+        vals[i] = rand() % 1000;
+    }
+    signal(SIGXFSZ, SIG_IGN);
+    for (unsigned t = 0; t < 2; t++) {
+        assert(system("rm -rf " DBDIR) == 0);
+        struct storage *storage = storage_init(DBDIR);
+        assert(storage != NULL);
+        assert(storage_add_column(storage, "l", types[t]) == 0);
+        struct column *col;
+        assert(column_open(storage, "l", &col) == 0);
+
+        struct rlimit limit;
+        assert(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+        struct rlimit small = { 512 * 1024, limit.rlim_max };
+        assert(setrlimit(RLIMIT_FSIZE, &small) == 0);
+        assert(column_load(col, vals, NVALS) != 0);
+        assert(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        assert(col->col_disk.cd_ntuples == 0 && col->col_disk.cd_nexttupleid == 0);
+        struct column_stats stats;
+        column_get_stats(col, &stats);
+        assert(column_stats_rows(&stats) == 0);
+
+        assert(column_load(col, vals, NVALS) == 0);
+        assert(col->col_disk.cd_ntuples == NVALS);
+        struct column_ids *ids = selectquery(col, "select(l,100,199)", NULL);
+        assert(ids != NULL);
+        unsigned count = 0;
+        for (unsigned id = 0; id < NVALS; id++) {
+            count += (vals[id] >= 100 && vals[id] <= 199);
+        }
+        assert(column_ids_count(ids) == count);
+        struct column_vals *cvals = column_fetch(col, ids);
+        assert(cvals != NULL && cvals->cval_len == count);
+        for (unsigned i = 0; i < count; i++) {
+            assert(cvals->cval_vals[i] == vals[cvals->cval_ids[i]]);
+        }
+        column_vals_destroy(cvals);
+        column_ids_destroy(ids);
+        teardown(storage, col);
+    }
+    signal(SIGXFSZ, SIG_DFL);
+}
+
+void testloadwhileselect(void) {
+    assert(system("rm -rf " DBDIR) == 0);
+    struct storage *storage = storage_init(DBDIR);
+    assert(storage != NULL);
+    assert(storage_add_column(storage, "a", STORAGE_UNSORTED) == 0);
+    struct column *col;
+    assert(column_open(storage, "a", &col) == 0);
+    srand(13);
+    unsigned count = 0;
+    for (unsigned i = 0; i < NVALS; i++) {
+        vals[i] = rand() % 1000;
+        count += (vals[i] >= 100 && vals[i] <= 199);
+    }
+    struct threadpool *tpool = threadpool_create(2);
+    assert(tpool != NULL);
+    struct pool_load pl = { tpool, col, NULL, semaphore_create(0), semaphore_create(0),
+                            semaphore_create(0), semaphore_create(0) };
+    assert(pl.pl_started != NULL && pl.pl_waiting != NULL);
+    assert(pl.pl_release != NULL && pl.pl_done != NULL);
+    struct job job = { &pl, pool_load_job };
+    assert(threadpool_add_job(tpool, &job) == 0);
+    P(pl.pl_waiting);
+
+    // The loading worker waits for its append, and must leave the select
+    // alone while it does. It would deadlock on the column's lock.
+    struct pool_select ps = { col, 0 };
+    struct task_group *group = task_group_create(tpool);
+    assert(group != NULL);
+    assert(task_group_spawn(group, pool_select, &ps) == 0);
+    usleep(100000);
+    V(pl.pl_release);
+    task_group_wait(group);
+    task_group_destroy(group);
+    P(pl.pl_done);
+    // and it runs after the load
+    assert(ps.ps_count == count);
+
+    threadpool_destroy(tpool);
+    semaphore_destroy(pl.pl_started);
+    semaphore_destroy(pl.pl_waiting);
+    semaphore_destroy(pl.pl_release);
+    semaphore_destroy(pl.pl_done);
+    teardown(storage, col);
+}
+
+int main(void) {
+    // scans, fetches and loads go through io_uring where there is one
+    file_set_queue_depth(32);
+    testsharedscan();
+    testbatch();
+    testbtree();
+    testdenseleaves();
+    testprobe();
+    testconcurrentinsert();
+    testcoveringfetch();
+    testsortedextremes();
+    testbtreeextremes();
+    testwithin();
+    testnotdeleted();
+    testupgrade();
+    testloadbatches();
+    testloadfailed();
+    testloadwhileselect();
+}
@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <db/common/synch.h>
+#include <db/common/threadpool.h>
+
+#define NTASKS 10000
+#define SUMLEN 10000
+// smaller ranges are summed without spawning
+#define SUMGRAIN 64
+#define AFFINITY_THREADS 4
+
+static unsigned counted;
+
+static
+void
+count(void *arg, unsigned threadnum)
+{
+    (void) arg;
+    (void) threadnum;
+    __atomic_fetch_add(&counted, 1, __ATOMIC_RELAXED);
+}
+
+void testjobs(void) {
+    struct threadpool *tpool = threadpool_create(4);
+    assert(tpool != NULL);
+    counted = 0;
+    struct job job = { NULL, count };
+    for (unsigned i = 0; i < 100; i++) {
+        assert(threadpool_add_job(tpool, &job) == 0);
+    }
+    while (__atomic_load_n(&counted, __ATOMIC_RELAXED) < 100) {
+        usleep(1000);
+    }
+    threadpool_destroy(tpool);
+}
+
+static
+void
+mark(void *arg, unsigned threadnum)
+{
+    (void) threadnum;
+    (*(unsigned *) arg)++;
+}
+
+void testgroup(void) {
+    // spawned from outside the pool
+    struct threadpool *tpool = threadpool_create(4);
+    assert(tpool != NULL);
+    unsigned *marks = calloc(NTASKS, sizeof(unsigned));
+    assert(marks != NULL);
+    struct task_group *group = task_group_create(tpool);
+    assert(group != NULL);
+    for (unsigned i = 0; i < NTASKS; i++) {
+        assert(task_group_spawn(group, mark, &marks[i]) == 0);
+    }
+    task_group_wait(group);
+    for (unsigned i = 0; i < NTASKS; i++) {
+        assert(marks[i] == 1);
+    }
+    // the group can be used again
+    assert(task_group_spawn(group, mark, &marks[0]) == 0);
+    task_group_wait(group);
+    assert(marks[0] == 2);
+    task_group_destroy(group);
+    free(marks);
+    threadpool_destroy(tpool);
+}
+
+struct sum {
+    struct threadpool *s_tpool;
+    unsigned s_low;
+    unsigned s_high;
+    unsigned long s_sum;
+};
+
+// Splits the range in two, and sums one half in a subtask
+static
+void
+sum(void *arg, unsigned threadnum)
+{
+    struct sum *s = (struct sum *) arg;
+    if (s->s_high - s->s_low <= SUMGRAIN) {
+        s->s_sum = 0;
+        for (unsigned i = s->s_low; i < s->s_high; i++) {
+            s->s_sum += i;
+        }
+        return;
+    }
+    unsigned mid = s->s_low + (s->s_high - s->s_low) / 2;
+    struct sum left = { s->s_tpool, s->s_low, mid, 0 };
+    struct sum right = { s->s_tpool, mid, s->s_high, 0 };
+    struct task_group *group = task_group_create(s->s_tpool);
+    assert(group != NULL);
+    assert(task_group_spawn(group, sum, &left) == 0);
+    sum(&right, threadnum);
+    task_group_wait(group);
+    task_group_destroy(group);
+    s->s_sum = left.s_sum + right.s_sum;
+}
+
+static
+void
+checksum(unsigned nthreads)
+{
+    struct threadpool *tpool = threadpool_create(nthreads);
+    assert(tpool != NULL);
+    struct sum s = { tpool, 0, SUMLEN, 0 };
+    struct task_group *group = task_group_create(tpool);
+    assert(group != NULL);
+    assert(task_group_spawn(group, sum, &s) == 0);
+    task_group_wait(group);
+    task_group_destroy(group);
+    assert(s.s_sum == (unsigned long) SUMLEN * (SUMLEN - 1) / 2);
+    threadpool_destroy(tpool);
+}
+
+void testnested(void) {
+    checksum(1);
+    checksum(4);
+}
+
+struct spawner {
+    struct task_group *sp_group;
+    unsigned *sp_marks;
+};
+
+// Spawns more tasks into its own group than a deque starts out with
+static
+void
+spawn(void *arg, unsigned threadnum)
+{
+    (void) threadnum;
+    struct spawner *sp = (struct spawner *) arg;
+    for (unsigned i = 0; i < NTASKS; i++) {
+        assert(task_group_spawn(sp->sp_group, mark, &sp->sp_marks[i]) == 0);
+    }
+}
+
+void testgrow(void) {
+    struct threadpool *tpool = threadpool_create(2);
+    assert(tpool != NULL);
+    struct spawner sp;
+    sp.sp_marks = calloc(NTASKS, sizeof(unsigned));
+    assert(sp.sp_marks != NULL);
+    sp.sp_group = task_group_create(tpool);
+    assert(sp.sp_group != NULL);
+    assert(task_group_spawn(sp.sp_group, spawn, &sp) == 0);
+    task_group_wait(sp.sp_group);
+    for (unsigned i = 0; i < NTASKS; i++) {
+        assert(sp.sp_marks[i] == 1);
+    }
+    task_group_destroy(sp.sp_group);
+    free(sp.sp_marks);
+    threadpool_destroy(tpool);
+}
+
+struct busy {
+    struct threadpool *b_tpool;
+    struct semaphore *b_started;
+    struct semaphore *b_release;
+    unsigned long b_sum;
+};
+
+static
+void
+block(void *arg, unsigned threadnum)
+{
+    (void) threadnum;
+    struct busy *b = (struct busy *) arg;
+    V(b->b_started);
+    P(b->b_release);
+}
+
+static
+void
+sumjob(void *arg, unsigned threadnum)
+{
+    struct busy *b = (struct busy *) arg;
+    struct sum s = { b->b_tpool, 0, SUMLEN, 0 };
+    sum(&s, threadnum);
+    __atomic_store_n(&b->b_sum, s.s_sum, __ATOMIC_RELEASE);
+    V(b->b_release);
+}
+
+void testbusy(void) {
+    // With the other worker stuck in a job, the job that spawns the tasks
+    // has to run them all itself
+    struct threadpool *tpool = threadpool_create(2);
+    assert(tpool != NULL);
+    struct busy b = { tpool, semaphore_create(0), semaphore_create(0), 0 };
+    assert(b.b_started != NULL && b.b_release != NULL);
+    struct job job = { &b, block };
+    assert(threadpool_add_job(tpool, &job) == 0);
+    P(b.b_started);
+    job.j_routine = sumjob;
+    assert(threadpool_add_job(tpool, &job) == 0);
+    while (__atomic_load_n(&b.b_sum, __ATOMIC_ACQUIRE) == 0) {
+        usleep(1000);
+    }
+    assert(b.b_sum == (unsigned long) SUMLEN * (SUMLEN - 1) / 2);
+    threadpool_destroy(tpool);
+    semaphore_destroy(b.b_started);
+    semaphore_destroy(b.b_release);
+}
+
+void testowngroup(void) {
+    // With the only worker stuck in a job, a thread that waits on a group
+    // runs the tasks of that group, and leaves the ones of another
+    struct threadpool *tpool = threadpool_create(1);
+    assert(tpool != NULL);
+    struct busy b = { tpool, semaphore_create(0), semaphore_create(0), 0 };
+    assert(b.b_started != NULL && b.b_release != NULL);
+    struct job job = { &b, block };
+    assert(threadpool_add_job(tpool, &job) == 0);
+    P(b.b_started);
+    unsigned marks[2] = { 0, 0 };
+    struct task_group *other = task_group_create(tpool);
+    struct task_group *group = task_group_create(tpool);
+    assert(other != NULL && group != NULL);
+    assert(task_group_spawn(other, mark, &marks[0]) == 0);
+    assert(task_group_spawn(group, mark, &marks[1]) == 0);
+    task_group_wait(group);
+    assert(marks[0] == 0 && marks[1] == 1);
+    task_group_wait(other);
+    assert(marks[0] == 1);
+    V(b.b_release);
+    task_group_destroy(other);
+    task_group_destroy(group);
+    threadpool_destroy(tpool);
+    semaphore_destroy(b.b_started);
+    semaphore_destroy(b.b_release);
+}
+
+// Checks that a worker may only run on one CPU
+static
+void
+pinned(void *arg, unsigned threadnum)
+{
+    cpu_set_t cpus;
+    assert(sched_getaffinity(0, sizeof(cpu_set_t), &cpus) == 0);
+    // the waiting thread may run it too
+    if (threadnum < AFFINITY_THREADS) {
+        assert(CPU_COUNT(&cpus) == 1);
+    }
+    (*(unsigned *) arg)++;
+}
+
+void testaffinity(void) {
+    threadpool_set_affinity(TP_AFFINITY_CORE);
+    struct threadpool *tpool = threadpool_create(AFFINITY_THREADS);
+    assert(tpool != NULL);
+    unsigned nnodes = threadpool_nnodes(tpool);
+    assert(nnodes >= 1);
+    unsigned marks[4 * AFFINITY_THREADS] = { 0 };
+    struct task_group *group = task_group_create(tpool);
+    assert(group != NULL);
+    // nodes past the last wrap around
+    for (unsigned i = 0; i < 4 * AFFINITY_THREADS; i++) {
+        assert(task_group_spawn_node(group, i, pinned, &marks[i]) == 0);
+    }
+    task_group_wait(group);
+    for (unsigned i = 0; i < 4 * AFFINITY_THREADS; i++) {
+        assert(marks[i] == 1);
+    }
+    task_group_destroy(group);
+    threadpool_destroy(tpool);
+
+    threadpool_set_affinity(TP_AFFINITY_NODE);
+    checksum(AFFINITY_THREADS);
+    threadpool_set_affinity(TP_AFFINITY_NONE);
+    tpool = threadpool_create(AFFINITY_THREADS);
+    assert(tpool != NULL);
+    assert(threadpool_nnodes(tpool) == 1);
+    threadpool_destroy(tpool);
+}
+
+int main(void) {
+    testjobs();
+    testgroup();
+    testnested();
+    testgrow();
+    testbusy();
+    testowngroup();
+    testaffinity();
+}
@@ -0,0 +1,190 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <db/common/parser.h>
+#include <db/common/wire.h>
+#include <db/common/dberror.h>
+#include <db/common/rpc.h>
+
+static char *queries[] = {
+    "select(C)",
+    "s=select(C,14,20)",
+    "s=select(C,14)",
+    "s2=select(s1,C,0,4294967295)",
+    "fetch(D,inter)",
+    "f=fetch(D,inter)",
+    "create(a,\"sorted\")",
+    "create(a,\"b+tree\")",
+    "load(\"data.csv\")",
+    "insert(a,1,b,-2,c,3)",
+    "delete(t1,a,b,c)",
+    "update(t1,a,-2147483648)",
+    "tuple(aout,bout)",
+    "x=max(aout)",
+    "count(aout)",
+    "x=sum(mul(aout,bout))",
+    "avg(sub(a,b))",
+    "x=add(aout,-5)",
+    "div(a,b)",
+    "print(x)",
+    "r,s=loopjoin(a,b)",
+    "r,s=join(a,b)",
+    "s3=and(s1,s2)",
+    "or(s1,s2)",
+    "s2=not(s1)",
+    "batch_queries()",
+    "batch_execute()",
+};
+
+#define NQUERIES (sizeof(queries) / sizeof(queries[0]))
+
+void testroundtrip(void) {
+    for (unsigned i = 0; i < NQUERIES; i++) {
+        struct op *op = parse_line(queries[i]);
+        assert(op != NULL);
+        size_t len = wire_op_size(op);
+        char *buf = malloc(len);
+        assert(wire_op_encode(op, buf) == len);
+        // much smaller than the op itself
+        assert(len < 64);
+
+        struct op *decoded;
+        assert(wire_op_decode(buf, len, &decoded) == 0);
+        assert(decoded->op_type == op->op_type);
+        char *s = op_string(decoded);
+        assert(strcmp(s, queries[i]) == 0);
+        free(s);
+
+        // every prefix is too short, and a longer buffer has extra bytes
+        for (size_t n = 0; n < len; n++) {
+            assert(wire_op_decode(buf, n, &decoded) == DBEWIRE);
+        }
+        char *longer = malloc(len + 1);
+        memcpy(longer, buf, len);
+        longer[len] = 0;
+        assert(wire_op_decode(longer, len + 1, &decoded) == DBEWIRE);
+        free(longer);
+        free(buf);
+        free(op);
+    }
+}
+
+void testbad(void) {
+    char buf[8];
+    // not an op type
+    buf[0] = 100;
+    struct op *op;
+    assert(wire_op_decode(buf, 1, &op) == DBEWIRE);
+    // a create with an unknown storage type
+    struct op *create = parse_line("create(a,\"sorted\")");
+    size_t len = wire_op_size(create);
+    assert(len <= sizeof(buf));
+    wire_op_encode(create, buf);
+    buf[len - 1] = 7;
+    assert(wire_op_decode(buf, len, &op) == DBEWIRE);
+    free(create);
+}
+
+void testvarint(void) {
+    uint64_t vals[] = { 0, 1, 127, 128, 300, 16384, 1ULL << 40, UINT64_MAX };
+    for (unsigned i = 0; i < sizeof(vals) / sizeof(vals[0]); i++) {
+        char buf[10];
+        size_t n = wire_varint_encode(vals[i], buf);
+        assert(n == wire_varint_size(vals[i]));
+        uint64_t val;
+        assert(wire_varint_decode(buf, n, &val) == n);
+        assert(val == vals[i]);
+        assert(wire_varint_decode(buf, n - 1, &val) == 0);
+    }
+}
+
+void testmessage(void) {
+    // all of the queries but the first in one message
+    char query[4096] = "";
+    for (unsigned i = 0; i < NQUERIES; i++) {
+        strcat(query, queries[i]);
+        strcat(query, "\n");
+    }
+    struct oparray *ops = parse_query(query);
+    assert(ops != NULL);
+    assert(oparray_num(ops) == NQUERIES);
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    assert(rpc_write_ops(fds[0], ops, 1, NQUERIES - 1) == 0);
+
+    struct rpc_header msg;
+    assert(rpc_read_header(fds[1], &msg) == 0);
+    assert(msg.rpc_type == RPC_OPS);
+    struct oparray *readops;
+    assert(rpc_read_ops(fds[1], &msg, &readops) == 0);
+    assert(oparray_num(readops) == NQUERIES - 1);
+    for (unsigned i = 0; i < NQUERIES - 1; i++) {
+        char *s = op_string(oparray_get(readops, i));
+        assert(strcmp(s, queries[i + 1]) == 0);
+        free(s);
+    }
+    parse_cleanup_ops(readops);
+    parse_cleanup_ops(ops);
+    assert(close(fds[0]) == 0);
+    assert(close(fds[1]) == 0);
+}
+
+// Results are written in batches, so use more values than fit in one
+#define NRESULTS 5000
+#define NTUPLES 700
+
+void testresults(void) {
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    int vals[3][NRESULTS];
+    struct column_vals cols[3];
+    struct column_vals *tuples[3];
+    for (unsigned c = 0; c < 3; c++) {
+        for (unsigned i = 0; i < NRESULTS; i++) {
+            vals[c][i] = (int) (i * 7919 + c) - NRESULTS;
+        }
+        cols[c].cval_vals = vals[c];
+        cols[c].cval_len = NTUPLES;
+        tuples[c] = &cols[c];
+    }
+
+    assert(rpc_write_tuple_result(fds[0], tuples, 3) == 0);
+    for (unsigned i = 0; i < NTUPLES; i++) {
+        struct rpc_header msg;
+        assert(rpc_read_header(fds[1], &msg) == 0);
+        assert(msg.rpc_type == RPC_TUPLE_RESULT);
+        int *tuple;
+        unsigned len;
+        assert(rpc_read_tuple_result(fds[1], &msg, &tuple, &len) == 0);
+        assert(len == 3);
+        for (unsigned c = 0; c < 3; c++) {
+            assert(tuple[c] == vals[c][i]);
+        }
+        free(tuple);
+    }
+
+    cols[0].cval_len = NRESULTS;
+    assert(rpc_write_fetch_result(fds[0], &cols[0]) == 0);
+    struct rpc_header msg;
+    assert(rpc_read_header(fds[1], &msg) == 0);
+    assert(msg.rpc_type == RPC_FETCH_RESULT);
+    int *fetched;
+    unsigned nfetched;
+    assert(rpc_read_fetch_result(fds[1], &msg, &fetched, &nfetched) == 0);
+    assert(nfetched == NRESULTS);
+    assert(memcmp(fetched, vals[0], sizeof(vals[0])) == 0);
+    free(fetched);
+    assert(close(fds[0]) == 0);
+    assert(close(fds[1]) == 0);
+}
+
+int main(void) {
+    testroundtrip();
+    testbad();
+    testvarint();
+    testmessage();
+    testresults();
+}